@@ -0,0 +1,63 @@
+#ifndef BENCH_HPP
+# define BENCH_HPP
+
+# include <iostream>
+# include <iomanip>
+# include <string>
+# include <vector>
+# include <chrono>
+# include <cstdlib>
+# include <algorithm>
+
+# include "../core/ascii_format.hpp"
+
+# define BENCH_DEFAULT_ITEMS	100000	// Number of secrets used by default
+# define BENCH_FILE_ITEMS	1000	// Most iterations of the file benchmarks
+# define BENCH_PNG_ITEMS	100		// Most iterations of the PNG benchmark
+# define BENCH_NO_COUNT		((size_t)-1)
+
+typedef std::chrono::steady_clock	BenchClock;
+
+// Heap allocations (malloc family, so operator new too) made by the calling thread
+size_t		allocationCount(void);
+
+// Start of a single-threaded measure: allocations and time of the calling thread
+struct BenchStart
+{
+	size_t					allocations;
+	BenchClock::time_point	time;
+
+	BenchStart(): allocations(allocationCount()), time(BenchClock::now()) {}
+};
+
+// Helpers
+double		elapsedSeconds(BenchClock::time_point start);
+// Without a BenchStart, allocations aren't known (e.g. the work ran on other threads)
+void		printResult(const std::string &name, size_t operations, double seconds,
+				size_t allocations = BENCH_NO_COUNT);
+void		printResult(const std::string &name, size_t operations, const BenchStart &start);
+// Write every result printed so far as CSV, to compare two releases
+bool		writeResults(const char *path);
+std::string	randomHexKey(size_t length);
+std::string	randomBase32Key(size_t length);
+
+// Benchmarks
+void		benchBatch(size_t count);
+void		benchFormat(size_t count);
+// Each stage of the CLI on its own, from the key check to the QR code
+void		benchStages(size_t count);
+// Time step from the system, coarse and fake clocks (Clock.hpp)
+void		benchClock(size_t count);
+// Codes read from a CodeSchedule against the HMAC per request
+void		benchSchedule(size_t count);
+// One-shot HMAC and AES with each crypto backend (CryptoBackend.hpp)
+void		benchCrypto(size_t count);
+// Same outputs from every crypto backend, and the known answers
+bool		checkCryptoBackends(void);
+// 'maxThreads' 0: one per hardware thread
+void		benchParallel(size_t count, unsigned maxThreads, bool pin);
+void		benchThrottle(unsigned maxThreads);
+// Group commit of the HOTP counter log, from 1 to 'maxThreads' threads
+void		benchCounterLog(size_t count, unsigned maxThreads);
+
+#endif
@@ -0,0 +1,88 @@
+#include "bench.hpp"
+#include <errno.h>
+#include <new>
+
+/*
+ * Allocation counter
+ *
+ * Crypto++ blocks, libpng and libqrencode allocate with malloc(), not only
+ * with operator new, so the malloc family itself is replaced: defined in
+ * the executable, these functions are also the ones called by the shared
+ * libraries. They count, then forward to the glibc allocator. A realloc()
+ * counts as one allocation, free() is left alone.
+ *
+ * The counter is per thread, so counting costs no synchronization and the
+ * scaling benchmarks aren't slowed down, but only single-threaded measures
+ * (BenchStart) can report it.
+ */
+
+static thread_local size_t	g_allocations __attribute__((tls_model("initial-exec"))) = 0;
+
+size_t allocationCount(void) { return g_allocations; }
+
+#ifdef __GLIBC__
+
+extern "C"
+{
+	void	*__libc_malloc(size_t size);
+	void	*__libc_calloc(size_t count, size_t size);
+	void	*__libc_realloc(void *pointer, size_t size);
+	void	*__libc_memalign(size_t alignment, size_t size);
+
+	void *malloc(size_t size)
+	{
+		++g_allocations;
+		return __libc_malloc(size);
+	}
+
+	void *calloc(size_t count, size_t size)
+	{
+		++g_allocations;
+		return __libc_calloc(count, size);
+	}
+
+	void *realloc(void *pointer, size_t size)
+	{
+		++g_allocations;
+		return __libc_realloc(pointer, size);
+	}
+
+	void *memalign(size_t alignment, size_t size)
+	{
+		++g_allocations;
+		return __libc_memalign(alignment, size);
+	}
+
+	void *aligned_alloc(size_t alignment, size_t size)
+	{
+		++g_allocations;
+		return __libc_memalign(alignment, size);
+	}
+
+	int posix_memalign(void **pointer, size_t alignment, size_t size)
+	{
+		void	*block;
+
+		++g_allocations;
+		block = __libc_memalign(alignment, size);
+		if (!block)
+			return ENOMEM;
+		*pointer = block;
+		return 0;
+	}
+}
+
+#else
+
+// Elsewhere, only the C++ allocations are counted
+void *operator new(size_t size)
+{
+	++g_allocations;
+	if (void *block = std::malloc(size ? size : 1))
+		return block;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept { std::free(block); }
+
+#endif
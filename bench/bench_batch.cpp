@@ -0,0 +1,92 @@
+#include "bench.hpp"
+#include "../core/TOTPBatch.hpp"
+#include "../core/sha1_multibuffer.hpp"
+
+// Number of digests checked against Crypto++ for each SHA-1 backend
+#define BENCH_CHECKED_ITEMS	4096
+
+/*
+ * Make sure a SHA-1 backend is bit-exact with CryptoPP::HMAC<SHA1>,
+ * which is used by the string API.
+ */
+static bool checkBackend(
+	const std::vector<PreparedKey> &keys, const std::vector<std::string> &hexKeys,
+	const std::vector<uint64_t> &counters)
+{
+	TOTPGenerator	generator(false);
+	size_t	count = std::min<size_t>(keys.size(), BENCH_CHECKED_ITEMS);
+	uint8_t	digests[BENCH_CHECKED_ITEMS][OTP_SHA1_DIGEST_SIZE];
+	uint8_t	expected[OTP_SHA1_DIGEST_SIZE];
+	uint8_t	counterBytes[8];
+
+	hmacSha1Batch(keys.data(), counters.data(), count, digests);
+	for (size_t i = 0; i < count; ++i)
+	{
+		for (int j = 0; j < 8; ++j)
+			counterBytes[j] = static_cast<uint8_t>(counters[i] >> (56 - 8 * j));
+
+		const CryptoPP::SecByteBlock	secret = generator.DecodeKey(hexKeys[i]);
+		CryptoPP::HMAC<CryptoPP::SHA1>	hmac(secret, secret.size());
+		hmac.CalculateDigest(expected, counterBytes, sizeof(counterBytes));
+		if (memcmp(expected, digests[i], OTP_SHA1_DIGEST_SIZE) != 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Compare the per-call string API (decode + HMAC setup + formatting for
+ * every code) with the batch engine working on prepared keys.
+ */
+void benchBatch(size_t count)
+{
+	std::vector<std::string>	hexKeys(count);
+	std::vector<PreparedKey>	keys;
+	std::vector<uint64_t>		counters(count);
+	std::vector<char>			codes(count * OTP_TOTP_CODE_DIGIT);
+	std::vector<uint8_t>		results(count);
+	TOTPGenerator				generator(false);
+	uint64_t					counter = generator.getTimeCounter(OTP_TOTP_TIME);
+
+	keys.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		hexKeys[i] = randomHexKey(OTP_MIN_KEY_STRENGTH);
+		keys.push_back(PreparedKey(hexKeys[i]));
+		counters[i] = counter;
+	}
+
+	// Per-call path: one key string per call
+	BenchStart	start;
+	size_t		generated = 0;
+	for (size_t i = 0; i < count; ++i)
+		generated += generator.generateTOTPHmacSha1(hexKeys[i]).size() / OTP_TOTP_CODE_DIGIT;
+	printResult("generateTOTPHmacSha1 (string)", generated, start);
+
+	// Batch path: prepared keys, caller-owned output buffer, for each SHA-1 backend
+	Sha1Backend	defaultBackend = sha1GetBackend();
+	for (int backend = 0; backend < OTP_SHA1_BACKEND_COUNT; ++backend)
+	{
+		if (!sha1SetBackend(static_cast<Sha1Backend>(backend)))
+			continue;
+		std::string	name = sha1BackendName(static_cast<Sha1Backend>(backend));
+
+		if (!checkBackend(keys, hexKeys, counters))
+			std::cerr << FMT_ERROR " The " << name
+				<< " backend doesn't match CryptoPP::HMAC<SHA1>." << std::endl;
+
+		start = BenchStart();
+		generated = generateTOTPBatch(keys.data(), counters.data(), count, codes.data());
+		printResult("generateTOTPBatch (" + name + ")", generated, start);
+
+		start = BenchStart();
+		size_t matches = verifyTOTPBatch(
+			keys.data(), counters.data(), codes.data(), count, results.data());
+		printResult("verifyTOTPBatch (" + name + ")", count, start);
+
+		if (matches != count)
+			std::cerr << FMT_ERROR " Batch verification rejected "
+				<< count - matches << " valid codes." << std::endl;
+	}
+	sha1SetBackend(defaultBackend);
+}
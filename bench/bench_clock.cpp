@@ -0,0 +1,72 @@
+#include "bench.hpp"
+#include "../core/TOTPGenerator.hpp"
+
+/*
+ * Reading the time step: the counter of the system and of the coarse
+ * clock, through the cache of the thread, then the cache alone with a
+ * fake clock moving by one second per call, which must only compute a
+ * new step every 30 calls.
+ *
+ * Then the verification of a token running one time step ahead, without
+ * and with the drift estimate of its account: the whole window is
+ * computed in the first case (T, T-1, T+1), one HMAC in the second.
+ */
+void benchClock(size_t count)
+{
+	TOTPGenerator	generator(false);
+	FakeClock		fakeClock(0);
+	uint64_t		counters = 0;
+
+	BenchStart	start;
+	for (size_t i = 0; i < count; ++i)
+		counters += generator.getTimeCounter(OTP_TOTP_TIME);
+	printResult("getTimeCounter (system clock)", count, start);
+
+	generator.setClock(coarseClock());
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		counters += generator.getTimeCounter(OTP_TOTP_TIME);
+	printResult("getTimeCounter (coarse clock)", count, start);
+
+	CounterCache	&cache = CounterCache::local();
+	size_t			refreshes = cache.refreshes();
+
+	generator.setClock(fakeClock);
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+	{
+		counters += generator.currentTimeStep(OTP_TOTP_TIME).bytes[7];
+		fakeClock.advance(1);
+	}
+	printResult("currentTimeStep (fake clock)", count, start);
+
+	refreshes = cache.refreshes() - refreshes;
+	if (refreshes != (count + OTP_TOTP_TIME - 1) / OTP_TOTP_TIME)
+		std::cerr << FMT_WARNING " The time step was computed " << refreshes
+			<< " times for " << count << " seconds." << std::endl;
+	if (counters == 0)
+		std::cerr << FMT_WARNING " No counter was read." << std::endl;
+
+	PreparedKey		key(randomHexKey(OTP_MIN_KEY_STRENGTH));
+	DriftEstimate	drift;
+	int				offset = 0;
+	size_t			matches = 0;
+
+	fakeClock.set(OTP_TOTP_TIME * 1000 + OTP_TOTP_TIME);
+	std::string		code = generator.generateTOTPHmacSha1(key);
+	fakeClock.set(OTP_TOTP_TIME * 1000);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		matches += generator.verifyTOTP(key, code, OTP_TOTP_WINDOW, offset);
+	printResult("verifyTOTP (token at +1)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		matches += generator.verifyTOTP(key, code, OTP_TOTP_WINDOW, offset, drift);
+	printResult("verifyTOTP (token at +1, drift)", count, start);
+
+	if (matches != 2 * count || drift.predicted() != 1)
+		std::cerr << FMT_WARNING " The drifted code was matched " << matches << " times out of "
+			<< 2 * count << ", predicted offset " << drift.predicted() << "." << std::endl;
+}
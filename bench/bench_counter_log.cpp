@@ -0,0 +1,63 @@
+#include "bench.hpp"
+#include "../core/CounterLog.hpp"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+// Log written by the benchmark in the current folder, removed at the end
+#define BENCH_COUNTER_LOG	"bench_counters.log"
+#define BENCH_COUNTER_ACCOUNTS	64
+
+/*
+ * Durable HOTP counters: 'count' commits (one per verification) from 1
+ * to N threads. Each commit waits for its record to be synced, so the
+ * time is the one of fdatasync: the group commit shows in the number of
+ * syncs per commit, which drops as threads are added.
+ */
+void benchCounterLog(size_t count, unsigned maxThreads)
+{
+	if (maxThreads == 0)
+		maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+
+	for (size_t t = 0; t < threadCounts.size(); ++t)
+	{
+		unsigned					threads = threadCounts[t];
+		std::vector<std::thread>	workers;
+		std::atomic<size_t>			committed(0);
+
+		std::remove(BENCH_COUNTER_LOG);
+		try
+		{
+			CounterLog	log(BENCH_COUNTER_LOG);
+
+			// The commits run on the workers, so only the time is measured
+			BenchClock::time_point	start = BenchClock::now();
+			for (unsigned w = 0; w < threads; ++w)
+				// Each thread has its own accounts, whose counters only move forward
+				workers.push_back(std::thread([&log, &committed, count, threads, w]() {
+					for (size_t i = 0; w + i * threads < count; ++i)
+						committed += log.commit(std::to_string(w) + "-" + std::to_string(i % BENCH_COUNTER_ACCOUNTS),
+							i / BENCH_COUNTER_ACCOUNTS + 1);
+				}));
+			for (size_t w = 0; w < workers.size(); ++w)
+				workers[w].join();
+			printResult("CounterLog commit (" + std::to_string(threads) + " threads)", count,
+				elapsedSeconds(start));
+			std::cout << "  syncs per commit: " << std::setprecision(2)
+				<< static_cast<double>(log.syncs()) / count << std::endl;
+		}
+		catch (std::exception &e)
+		{
+			std::cerr << FMT_ERROR " " << e.what() << std::endl;
+			break;
+		}
+		if (committed != count)
+			std::cerr << FMT_WARNING " " << count - committed << " counters didn't move." << std::endl;
+	}
+	std::remove(BENCH_COUNTER_LOG);
+}
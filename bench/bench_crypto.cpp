@@ -0,0 +1,215 @@
+#include "bench.hpp"
+#include "../core/CryptoBackend.hpp"
+#include "../core/TOTPGenerator.hpp"
+#include <algorithm>
+#include <cstring>
+
+#define BENCH_CONFORMANCE_ITEMS	1000	// Random inputs compared between the backends
+
+struct HmacVector
+{
+	HashAlgorithm	algorithm;
+	const char		*key;
+	const char		*message;
+	const char		*digest;	// Hex
+};
+
+/*
+ * Known answers: RFC 2202 and RFC 4231 (test case 2), and the first block
+ * of NIST SP 800-38A F.2.5 (CBC-AES256), whatever the padding after it.
+ */
+static const HmacVector	g_hmacVectors[] = {
+	{ OTP_HASH_SHA1, "Jefe", "what do ya want for nothing?",
+		"effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+	{ OTP_HASH_SHA256, "Jefe", "what do ya want for nothing?",
+		"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+	{ OTP_HASH_SHA512, "Jefe", "what do ya want for nothing?",
+		"164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+		"9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737" }
+};
+static const char	*g_aesKey = "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4";
+static const char	*g_aesIV = "000102030405060708090a0b0c0d0e0f";
+static const char	*g_aesPlain = "6bc1bee22e409f96e93d7e117393172a";
+static const char	*g_aesCipher = "f58c4c04d6e5f1ba779eabfb5f7bfbd6";
+
+static std::vector<uint8_t> fromHex(const char *hex)
+{
+	std::vector<uint8_t>	bytes(strlen(hex) / 2);
+
+	for (size_t i = 0; i < bytes.size(); ++i)
+		bytes[i] = static_cast<uint8_t>(std::stoul(std::string(hex + 2 * i, 2), nullptr, 16));
+	return bytes;
+}
+
+static std::vector<uint8_t> randomBytes(size_t size)
+{
+	std::vector<uint8_t>	bytes(size);
+
+	for (size_t i = 0; i < size; ++i)
+		bytes[i] = static_cast<uint8_t>(std::rand());
+	return bytes;
+}
+
+// Known answers of the current backend
+static bool checkVectors(void)
+{
+	const char	*name = cryptoBackendName(cryptoGetBackend());
+	bool		valid = true;
+
+	for (size_t i = 0; i < sizeof(g_hmacVectors) / sizeof(g_hmacVectors[0]); ++i)
+	{
+		const HmacVector	&vector = g_hmacVectors[i];
+		uint8_t				digest[OTP_HMAC_MAX_DIGEST];
+
+		cryptoHmac(vector.algorithm, reinterpret_cast<const uint8_t *>(vector.key), strlen(vector.key),
+			reinterpret_cast<const uint8_t *>(vector.message), strlen(vector.message), digest);
+		if (memcmp(digest, fromHex(vector.digest).data(), cryptoHmacSize(vector.algorithm)) != 0)
+		{
+			std::cerr << FMT_ERROR " " << name << ": wrong HMAC-"
+				<< hashAlgorithmName(vector.algorithm) << " of the RFC test vector." << std::endl;
+			valid = false;
+		}
+	}
+
+	std::vector<uint8_t>	key = fromHex(g_aesKey);
+	std::vector<uint8_t>	iv = fromHex(g_aesIV);
+	std::vector<uint8_t>	plain = fromHex(g_aesPlain);
+	std::vector<uint8_t>	cipher(cryptoAesCipherSize(plain.size()));
+
+	if (!cryptoAesEncrypt(key.data(), iv.data(), plain.data(), plain.size(), cipher.data())
+		|| memcmp(cipher.data(), fromHex(g_aesCipher).data(), OTP_AES_BLOCK_SIZE) != 0)
+	{
+		std::cerr << FMT_ERROR " " << name << ": wrong AES-256-CBC of the NIST test vector." << std::endl;
+		valid = false;
+	}
+	return valid;
+}
+
+// Outputs of the current backend for random inputs, in the order of the inputs
+static std::vector<uint8_t> randomOutputs(unsigned seed, bool &valid)
+{
+	std::srand(seed);
+
+	std::vector<uint8_t>	outputs;
+	std::vector<uint8_t>	key = randomBytes(OTP_AES_KEY_SIZE);
+	std::vector<uint8_t>	iv = randomBytes(OTP_AES_BLOCK_SIZE);
+
+	for (size_t i = 0; i < BENCH_CONFORMANCE_ITEMS; ++i)
+	{
+		HashAlgorithm			algorithm = static_cast<HashAlgorithm>(i % 3);
+		std::vector<uint8_t>	hmacKey = randomBytes(std::rand() % 200 + 1);
+		std::vector<uint8_t>	message = randomBytes(std::rand() % 300);
+		uint8_t					digest[OTP_HMAC_MAX_DIGEST];
+
+		cryptoHmac(algorithm, hmacKey.data(), hmacKey.size(), message.data(), message.size(), digest);
+		outputs.insert(outputs.end(), digest, digest + cryptoHmacSize(algorithm));
+
+		std::vector<uint8_t>	plain = randomBytes(std::rand() % 100);
+		std::vector<uint8_t>	cipher(cryptoAesCipherSize(plain.size()));
+		std::vector<uint8_t>	recovered(cipher.size());
+		size_t					recoveredSize;
+
+		valid = cryptoAesEncrypt(key.data(), iv.data(), plain.data(), plain.size(), cipher.data()) && valid;
+		outputs.insert(outputs.end(), cipher.begin(), cipher.end());
+		// An empty plain text is only padding, which must decrypt to nothing
+		valid = cryptoAesDecrypt(key.data(), iv.data(), cipher.data(), cipher.size(),
+			recovered.data(), recoveredSize)
+			&& recoveredSize == plain.size()
+			&& std::equal(plain.begin(), plain.end(), recovered.begin()) && valid;
+	}
+	return outputs;
+}
+
+/*
+ * Conformance of the crypto backends: each one must give the known answers,
+ * decrypt what it encrypts, and all of them must give byte-identical
+ * outputs for the same random inputs.
+ *
+ * @return
+ *  true if every built-in backend conforms.
+ */
+bool checkCryptoBackends(void)
+{
+	CryptoBackend			defaultBackend = cryptoGetBackend();
+	std::vector<uint8_t>	reference;
+	bool					conforms = true;
+
+	for (int backend = 0; backend < OTP_CRYPTO_BACKEND_COUNT; ++backend)
+	{
+		if (!cryptoSetBackend(static_cast<CryptoBackend>(backend)))
+			continue;
+		const char	*name = cryptoBackendName(static_cast<CryptoBackend>(backend));
+		bool		valid = checkVectors();
+		bool		roundTrips = true;
+
+		std::vector<uint8_t>	outputs = randomOutputs(42, roundTrips);
+		if (!roundTrips)
+		{
+			std::cerr << FMT_ERROR " " << name << ": an AES round trip failed." << std::endl;
+			valid = false;
+		}
+		if (reference.empty())
+			reference = outputs;
+		else if (outputs != reference)
+		{
+			std::cerr << FMT_ERROR " " << name << " and "
+				<< cryptoBackendName(OTP_CRYPTO_CRYPTOPP) << " gave different outputs." << std::endl;
+			valid = false;
+		}
+		std::cout << (valid ? FMT_DONE " " : FMT_ERROR " ") << name << std::endl;
+		conforms = conforms && valid;
+	}
+	cryptoSetBackend(defaultBackend);
+	return conforms;
+}
+
+// One-shot HMAC and key file AES, with each built-in backend
+void benchCrypto(size_t count)
+{
+	std::vector<uint8_t>		secret = randomBytes(20);
+	std::string					key = randomHexKey(OTP_MIN_KEY_STRENGTH);
+	std::vector<std::string>	ciphers(count);
+	CryptoBackend				defaultBackend = cryptoGetBackend();
+	TOTPGenerator				generator(false);
+
+	for (int backend = 0; backend < OTP_CRYPTO_BACKEND_COUNT; ++backend)
+	{
+		if (!cryptoSetBackend(static_cast<CryptoBackend>(backend)))
+			continue;
+		std::string	suffix = std::string(" (") + cryptoBackendName(static_cast<CryptoBackend>(backend)) + ")";
+
+		for (int algorithm = OTP_HASH_SHA1; algorithm <= OTP_HASH_SHA512; ++algorithm)
+		{
+			uint8_t		digest[OTP_HMAC_MAX_DIGEST];
+			uint64_t	counter = 0;
+			size_t		done = 0;
+
+			BenchStart	start;
+			for (size_t i = 0; i < count; ++i)
+			{
+				++counter;
+				cryptoHmac(static_cast<HashAlgorithm>(algorithm), secret.data(), secret.size(),
+					reinterpret_cast<const uint8_t *>(&counter), sizeof(counter), digest);
+				done += digest[0] & 1;
+			}
+			printResult(std::string("cryptoHmac ") + hashAlgorithmName(static_cast<HashAlgorithm>(algorithm))
+				+ suffix, count, start);
+			if (done > count)
+				std::cerr << FMT_WARNING " Unexpected HMAC result." << std::endl;
+		}
+
+		BenchStart	start;
+		for (size_t i = 0; i < count; ++i)
+			ciphers[i] = generator.encryptAES(key);
+		printResult("encryptAES" + suffix, count, start);
+
+		size_t	recovered = 0;
+		start = BenchStart();
+		for (size_t i = 0; i < count; ++i)
+			recovered += generator.decryptAES(ciphers[i]) == key;
+		printResult("decryptAES" + suffix, count, start);
+		if (recovered != count)
+			std::cerr << FMT_WARNING " decryptAES didn't recover every key." << std::endl;
+	}
+	cryptoSetBackend(defaultBackend);
+}
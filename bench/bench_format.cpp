@@ -0,0 +1,36 @@
+#include "bench.hpp"
+#include "../core/TOTPGenerator.hpp"
+
+/*
+ * Compare the string-returning generator with generateInto(), both from
+ * prepared keys so that only the formatting and the return path differ.
+ */
+void benchFormat(size_t count)
+{
+	std::vector<PreparedKey>	keys;
+	TOTPGenerator				generator(false);
+	char						code[OTP_TOTP_CODE_BUFFER];
+
+	keys.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		keys.push_back(PreparedKey(randomHexKey(OTP_MIN_KEY_STRENGTH)));
+
+	// String path: heap std::string returned for every code
+	BenchStart	start;
+	size_t		generated = 0;
+	for (size_t i = 0; i < count; ++i)
+		generated += generator.generateTOTPHmacSha1(keys[i]).size() / OTP_TOTP_CODE_DIGIT;
+	printResult("generateTOTPHmacSha1 (prepared)", generated, start);
+
+	// Fixed-size buffer path: no allocation, no exception
+	start = BenchStart();
+	generated = 0;
+	for (size_t i = 0; i < count; ++i)
+		generated += generator.generateInto(code, keys[i]);
+	printResult("generateInto", generated, start);
+
+	// Both paths must agree (unless the time step changed in between)
+	generator.generateInto(code, keys[0]);
+	if (generator.generateTOTPHmacSha1(keys[0]) != code)
+		std::cerr << FMT_WARNING " generateInto and generateTOTPHmacSha1 returned different codes." << std::endl;
+}
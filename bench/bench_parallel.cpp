@@ -0,0 +1,76 @@
+#include "bench.hpp"
+#include "../core/TOTPParallel.hpp"
+#include <thread>
+
+/*
+ * Scaling of the parallel batch engine from 1 to N threads.
+ *
+ * The thread counts are the powers of two below the number of hardware
+ * threads, then the number of hardware threads itself. The speedup is
+ * relative to the single-threaded run of the same engine.
+ */
+void benchParallel(size_t count, unsigned maxThreads, bool pin)
+{
+	std::vector<std::string>	hexKeys(count);
+	std::vector<PreparedKey>	keys;
+	std::vector<uint64_t>		counters(count);
+	std::vector<char>			codes(count * OTP_TOTP_CODE_DIGIT);
+	std::vector<uint8_t>		results(count);
+	TOTPGenerator				generator(false);
+	uint64_t					counter = generator.getTimeCounter(OTP_TOTP_TIME);
+
+	keys.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		hexKeys[i] = randomHexKey(OTP_MIN_KEY_STRENGTH);
+		keys.push_back(PreparedKey(hexKeys[i]));
+		counters[i] = counter;
+	}
+	if (maxThreads == 0)
+		maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+
+	double	baseline[3] = {0, 0, 0};
+	for (size_t t = 0; t < threadCounts.size(); ++t)
+	{
+		ThreadPoolParams	params;
+		params.threads = threadCounts[t];
+		params.pin = pin;
+		ParallelTOTP		engine(params, OTP_PARALLEL_CHUNK, count);
+		std::string			suffix = " (" + std::to_string(threadCounts[t]) + " threads)";
+		double				seconds[3];
+
+		BenchClock::time_point start = BenchClock::now();
+		size_t generated = engine.generate(keys.data(), counters.data(), count, codes.data());
+		seconds[0] = elapsedSeconds(start);
+		printResult("parallel generate" + suffix, generated, seconds[0]);
+
+		start = BenchClock::now();
+		size_t matches = engine.verify(keys.data(), counters.data(), codes.data(), count, results.data());
+		seconds[1] = elapsedSeconds(start);
+		printResult("parallel verify" + suffix, count, seconds[1]);
+		if (matches != count)
+			std::cerr << FMT_ERROR " Parallel verification rejected "
+				<< count - matches << " valid codes." << std::endl;
+
+		// The first run fills the per-thread key caches, the second one is measured
+		engine.verify(hexKeys.data(), counters.data(), codes.data(), count, results.data());
+		start = BenchClock::now();
+		matches = engine.verify(hexKeys.data(), counters.data(), codes.data(), count, results.data());
+		seconds[2] = elapsedSeconds(start);
+		printResult("parallel verify cached" + suffix, count, seconds[2]);
+		if (matches != count)
+			std::cerr << FMT_ERROR " Cached verification rejected "
+				<< count - matches << " valid codes." << std::endl;
+
+		if (t == 0)
+			std::copy(seconds, seconds + 3, baseline);
+		std::cout	<< "  speedup: generate x" << std::setprecision(2) << baseline[0] / seconds[0]
+					<< ", verify x" << baseline[1] / seconds[1]
+					<< ", verify cached x" << baseline[2] / seconds[2] << std::endl;
+	}
+}
@@ -0,0 +1,81 @@
+#include "bench.hpp"
+#include "../core/CodeSchedule.hpp"
+#include "../core/TOTPKernel.hpp"
+#include <algorithm>
+
+#define BENCH_SCHEDULE_SLOTS	16	// Accounts sharing a code, at most
+
+/*
+ * Code schedule: filling the table for every account, rolling it at a
+ * boundary (one column), then the codes read from it against the HMAC
+ * computed per request, which must give the same codes. Last, the
+ * accounts giving a code, from the reverse index: each account must be
+ * found from its own code.
+ */
+void benchSchedule(size_t count)
+{
+	FakeClock					clock(OTP_TOTP_TIME * 1000);
+	CodeSchedule				schedule(count, OTP_TOTP_CODE_DIGIT, OTP_TOTP_TIME, clock);
+	std::vector<PreparedKey>	keys;
+	uint64_t					counter = clock.now() / OTP_TOTP_TIME;
+	uint32_t					sum = 0;
+	size_t						mismatches = 0;
+
+	keys.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		keys.push_back(PreparedKey(randomHexKey(OTP_MIN_KEY_STRENGTH)));
+		schedule.add(keys.back());
+	}
+
+	BenchStart	start;
+	schedule.refresh();
+	printResult("CodeSchedule fill (3 steps)", 3 * count, start);
+
+	clock.advance(OTP_TOTP_TIME);
+	start = BenchStart();
+	schedule.refresh();
+	printResult("CodeSchedule roll (1 step)", count, start);
+	++counter;
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t	code = 0;
+
+		if (!schedule.lookup(i, counter, code))
+			++mismatches;
+		sum += code;
+	}
+	printResult("CodeSchedule lookup", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t	code = 0;
+		uint32_t	scheduled = 0;
+
+		mismatches += !computeTOTPCode(keys[i], clock.now(), OTP_TOTP_CODE_DIGIT, OTP_TOTP_TIME, code)
+			|| !schedule.lookup(i, counter, scheduled) || scheduled != code;
+		sum -= code;
+	}
+	printResult("computeTOTPCode (per request)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t	code = 0;
+		uint32_t	slots[BENCH_SCHEDULE_SLOTS];
+		size_t		found;
+
+		schedule.lookup(i, counter, code);
+		if (!schedule.findSlots(counter, code, slots, BENCH_SCHEDULE_SLOTS, found))
+			++mismatches;
+		else if (found <= BENCH_SCHEDULE_SLOTS)
+			mismatches += std::find(slots, slots + found, i) == slots + found;
+	}
+	printResult("CodeSchedule findSlots", count, start);
+
+	if (mismatches || sum != 0)
+		std::cerr << FMT_WARNING " " << mismatches << " scheduled codes differ from the computed ones." << std::endl;
+}
@@ -0,0 +1,181 @@
+#include "bench.hpp"
+#include "../core/TOTPGenerator.hpp"
+#include "../core/FileHandler.hpp"
+#include "../core/qrencode.hpp"
+#include <cstdio>
+
+// Files written by the benchmark in the current folder, removed at the end
+#define BENCH_KEY_FILE			"bench_key.hex"
+#define BENCH_ENCRYPTED_FILE	"bench_key.enc"
+#define BENCH_QRCODE_FILE		"bench_qrcode.png"
+
+static void writeFile(const char *path, const std::string &content)
+{
+	std::ofstream	file(path, std::ios::binary);
+
+	file << content;
+}
+
+// Key check, decoding and generation, from the same keys as the CLI gets them
+static void benchKeys(size_t count)
+{
+	std::vector<std::string>	hexKeys(count);
+	std::vector<std::string>	base32Keys(count);
+	std::vector<std::string>	ciphers(count);
+	TOTPGenerator				generator(false);
+	size_t						done = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		hexKeys[i] = randomHexKey(OTP_MIN_KEY_STRENGTH);
+		base32Keys[i] = randomBase32Key(OTP_MIN_KEY_STRENGTH);
+	}
+
+	BenchStart	start;
+	for (size_t i = 0; i < count; ++i)
+		done += generator.isValidHexOrBase32(hexKeys[i]) != 0;
+	printResult("isValidHexOrBase32 (hex)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		done += generator.isValidHexOrBase32(base32Keys[i]) != 0;
+	printResult("isValidHexOrBase32 (base32)", count, start);
+	if (done != 2 * count)
+		std::cerr << FMT_WARNING " isValidHexOrBase32 rejected a valid key." << std::endl;
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		done += generator.DecodeKey(hexKeys[i]).size();
+	printResult("DecodeKey (hex)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		done += generator.DecodeKey(base32Keys[i]).size();
+	printResult("DecodeKey (base32)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		done += generator.computeCounter(OTP_TOTP_TIME).size();
+	printResult("computeCounter", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		done += generator.generateTOTPHmacSha1(hexKeys[i]).size();
+	printResult("generateTOTPHmacSha1 (hex)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		done += generator.generateTOTPHmacSha1(base32Keys[i]).size();
+	printResult("generateTOTPHmacSha1 (base32)", count, start);
+
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		ciphers[i] = generator.encryptAES(hexKeys[i]);
+	printResult("encryptAES", count, start);
+
+	size_t	recovered = 0;
+	start = BenchStart();
+	for (size_t i = 0; i < count; ++i)
+		recovered += generator.decryptAES(ciphers[i]) == hexKeys[i];
+	printResult("decryptAES", count, start);
+	if (recovered != count)
+		std::cerr << FMT_WARNING " decryptAES didn't recover every key." << std::endl;
+
+	// Keep the results alive, so that no loop is optimized away
+	if (done == 0)
+		std::cerr << FMT_WARNING " No key was processed." << std::endl;
+}
+
+// Key files, read by -g (plain key) and by -k (key encrypted by -g)
+static void benchKeyFiles(size_t count)
+{
+	const std::string	key = randomHexKey(OTP_MIN_KEY_STRENGTH);
+	TOTPGenerator		generator(false);
+	size_t				matched = 0;
+
+	writeFile(BENCH_KEY_FILE, key);
+	writeFile(BENCH_ENCRYPTED_FILE, generator.encryptAES(key));
+	try
+	{
+		FileHandler	plainFile;
+		FileHandler	encryptedFile;
+
+		plainFile.setFilename(BENCH_KEY_FILE);
+		encryptedFile.setFilename(BENCH_ENCRYPTED_FILE);
+		encryptedFile.setMode(OTP_MODE_GEN_PWD);
+
+		BenchStart	start;
+		for (size_t i = 0; i < count; ++i)
+		{
+			ArenaScope	scope;
+			size_t		size;
+			const char	*read = plainFile.getKeyFromInFile(scope, size);
+			matched += key.compare(0, key.size(), read, size) == 0;
+		}
+		printResult("getKeyFromInFile (key file)", count, start);
+
+		start = BenchStart();
+		for (size_t i = 0; i < count; ++i)
+		{
+			ArenaScope	scope;
+			size_t		size;
+			const char	*read = encryptedFile.getKeyFromInFile(scope, size);
+			matched += key.compare(0, key.size(), read, size) == 0;
+		}
+		printResult("getKeyFromInFile (encrypted)", count, start);
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+	}
+	if (matched != 2 * count)
+		std::cerr << FMT_WARNING " getKeyFromInFile didn't return the saved key." << std::endl;
+	std::remove(BENCH_KEY_FILE);
+	std::remove(BENCH_ENCRYPTED_FILE);
+}
+
+// QR code of a secret, encoded then written as a PNG image
+static void benchQRCode(size_t count)
+{
+	const std::string	key = randomBase32Key(OTP_MIN_KEY_STRENGTH);
+	QRcode				*qrcode = nullptr;
+
+	BenchStart	start;
+	for (size_t i = 0; i < count; ++i)
+	{
+		QRcode_free(qrcode);
+		qrcode = generateQRCodeFromURI(key, false);
+	}
+	printResult("generateQRCodeFromURI", count, start);
+	if (!qrcode)
+	{
+		std::cerr << FMT_ERROR " Failed to generate the QR code." << std::endl;
+		return;
+	}
+
+	try
+	{
+		start = BenchStart();
+		for (size_t i = 0; i < count; ++i)
+			saveQRCodeAsPNG(qrcode, BENCH_QRCODE_FILE, OTP_QRCODE_SCALE);
+		printResult("saveQRCodeAsPNG", count, start);
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+	}
+	QRcode_free(qrcode);
+	std::remove(BENCH_QRCODE_FILE);
+}
+
+/*
+ * Every stage the CLI goes through, measured on its own with the calls it
+ * makes. The file and PNG stages are much slower than the others, so they
+ * run fewer times (BENCH_FILE_ITEMS, BENCH_PNG_ITEMS).
+ */
+void benchStages(size_t count)
+{
+	benchKeys(count);
+	benchKeyFiles(std::min<size_t>(count, BENCH_FILE_ITEMS));
+	benchQRCode(std::min<size_t>(count, BENCH_PNG_ITEMS));
+}
@@ -0,0 +1,83 @@
+#include "bench.hpp"
+#include "../core/AttemptThrottle.hpp"
+#include <atomic>
+#include <thread>
+
+// Checks done by each thread of the contention benchmark
+#define BENCH_THROTTLE_CHECKS	1000000
+
+// Run 'work(thread)' on 'threads' threads at once, returns the elapsed time
+template <class Work>
+static double runThreads(unsigned threads, Work work)
+{
+	std::vector<std::thread>	pool;
+	std::atomic<bool>			go(false);
+
+	for (unsigned t = 0; t < threads; ++t)
+		pool.push_back(std::thread([&, t] {
+			while (!go.load())
+				std::this_thread::yield();
+			work(t);
+		}));
+
+	BenchClock::time_point start = BenchClock::now();
+	go = true;
+	for (size_t t = 0; t < pool.size(); ++t)
+		pool[t].join();
+	return elapsedSeconds(start);
+}
+
+/*
+ * Contention of the throttle from 1 to N threads:
+ *  - every thread checks the same blocked account (an attacker hammering
+ *    one user): read-only, the cache line stays shared by all the cores;
+ *  - every thread fails and succeeds on its own accounts: the writes go
+ *    to different slots, so the cores don't fight over cache lines.
+ */
+void benchThrottle(unsigned maxThreads)
+{
+	if (maxThreads == 0)
+		maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned threads = 1; ; threads = std::min(threads * 2, maxThreads))
+	{
+		ThrottleParams		params;
+		params.accounts = 1024 * threads;
+		AttemptThrottle		throttle(params);
+		std::string			suffix = " (" + std::to_string(threads) + " threads)";
+		const int64_t		now = AttemptThrottle::now();
+		std::atomic<size_t>	allowed(0);
+
+		for (int i = 0; i < 10; ++i)
+			throttle.recordFailure("victim", now);
+
+		double seconds = runThreads(threads, [&](unsigned) {
+			size_t count = 0;
+			for (size_t i = 0; i < BENCH_THROTTLE_CHECKS; ++i)
+				count += throttle.allow("victim", now);
+			allowed += count;
+		});
+		printResult("throttle blocked check" + suffix, BENCH_THROTTLE_CHECKS * threads, seconds);
+		if (allowed != 0)
+			std::cerr << FMT_ERROR " A blocked account was allowed." << std::endl;
+
+		std::vector<std::string> accounts(1024 * threads);
+		for (size_t i = 0; i < accounts.size(); ++i)
+			accounts[i] = "user" + std::to_string(i);
+		seconds = runThreads(threads, [&](unsigned t) {
+			const std::string *own = &accounts[1024 * t];
+			for (size_t i = 0; i < BENCH_THROTTLE_CHECKS; ++i)
+			{
+				const std::string &account = own[i & 1023];
+				if (throttle.allow(account, now))
+					throttle.recordFailure(account, now);
+				if (i & 1)
+					throttle.recordSuccess(account);
+			}
+		});
+		printResult("throttle own accounts" + suffix, BENCH_THROTTLE_CHECKS * threads, seconds);
+
+		if (threads == maxThreads)
+			break;
+	}
+}
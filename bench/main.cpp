@@ -0,0 +1,144 @@
+#include "bench.hpp"
+#include <fstream>
+
+// A printed result, kept for writeResults()
+struct BenchResult
+{
+	std::string	name;
+	size_t		operations;
+	double		seconds;
+	size_t		allocations;
+};
+
+static std::vector<BenchResult>	g_results;
+
+double elapsedSeconds(BenchClock::time_point start)
+{
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Print the throughput, the average cost and the allocations of one operation
+void printResult(const std::string &name, size_t operations, double seconds, size_t allocations)
+{
+	std::cout	<< std::left << std::setw(36) << name
+				<< std::right << std::setw(14) << std::fixed << std::setprecision(0)
+				<< operations / seconds << " ops/s"
+				<< std::setw(12) << std::setprecision(1)
+				<< seconds * 1e9 / operations << " ns/op";
+	if (allocations != BENCH_NO_COUNT)
+		std::cout << std::setw(10) << std::setprecision(2)
+				  << static_cast<double>(allocations) / operations << " allocs/op";
+	std::cout << std::endl;
+
+	BenchResult	result = { name, operations, seconds, allocations };
+	g_results.push_back(result);
+}
+
+void printResult(const std::string &name, size_t operations, const BenchStart &start)
+{
+	double	seconds = elapsedSeconds(start.time);
+	size_t	allocations = allocationCount() - start.allocations;
+
+	printResult(name, operations, seconds, allocations);
+}
+
+/*
+ * One line per result, in the order they were printed. Unknown allocation
+ * counts are left empty, so a diff between two runs only shows the
+ * benchmarks whose numbers changed.
+ */
+bool writeResults(const char *path)
+{
+	std::ofstream	file(path);
+
+	if (!file)
+		return false;
+	file << "name,operations,seconds,ns_per_op,ops_per_s,allocs_per_op\n";
+	for (size_t i = 0; i < g_results.size(); ++i)
+	{
+		const BenchResult	&result = g_results[i];
+
+		file	<< '"' << result.name << "\"," << result.operations << ','
+				<< std::fixed << std::setprecision(9) << result.seconds << ','
+				<< std::setprecision(1)
+				<< result.seconds * 1e9 / result.operations << ','
+				<< std::setprecision(0) << result.operations / result.seconds << ',';
+		if (result.allocations != BENCH_NO_COUNT)
+			file << std::setprecision(2) << static_cast<double>(result.allocations) / result.operations;
+		file << std::defaultfloat << '\n';
+	}
+	return static_cast<bool>(file);
+}
+
+// Random Hex secret, long enough to be accepted by isValidHexOrBase32()
+std::string randomHexKey(size_t length)
+{
+	static const char	hexDigits[] = "0123456789abcdef";
+	std::string			key(length, '0');
+
+	for (size_t i = 0; i < length; ++i)
+		key[i] = hexDigits[std::rand() & 0x0F];
+	return key;
+}
+
+// Random Base32 secret (RFC 4648 alphabet, no padding)
+std::string randomBase32Key(size_t length)
+{
+	static const char	base32Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+	std::string			key(length, 'A');
+
+	for (size_t i = 0; i < length; ++i)
+		key[i] = base32Digits[std::rand() & 0x1F];
+	return key;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t		count = BENCH_DEFAULT_ITEMS;
+	unsigned	threads = 0;
+	bool		pin = false;
+	const char	*output = nullptr;
+
+	if (argc == 2 && std::string(argv[1]) == "conformance")
+		return checkCryptoBackends() ? 0 : 1;
+	if (argc > 2 && std::string(argv[1]) == "-o")
+	{
+		output = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc > 1)
+		count = std::strtoul(argv[1], nullptr, 10);
+	if (argc > 2)
+		threads = std::strtoul(argv[2], nullptr, 10);
+	if (argc > 3)
+		pin = std::string(argv[3]) == "pin";
+	if (count == 0 || argc > 4)
+	{
+		std::cerr	<< FMT_ERROR " Usage: ./ft_otp_bench [-o results.csv] "
+					<< "[number of secrets] [max threads] [pin]\n"
+					<< "       ./ft_otp_bench conformance" << std::endl;
+		return 1;
+	}
+
+	std::srand(42);
+	std::cout << FMT_INFO " Running benchmarks with " << count << " secrets..." << std::endl;
+	benchStages(count);
+	benchClock(count);
+	benchSchedule(count);
+	benchCrypto(count);
+	benchBatch(count);
+	benchFormat(count);
+	benchParallel(count, threads, pin);
+	benchThrottle(threads);
+	benchCounterLog(std::min<size_t>(count, BENCH_FILE_ITEMS), threads);
+
+	if (output && !writeResults(output))
+	{
+		std::cerr << FMT_ERROR " Failed to write the results to '" << output << "'." << std::endl;
+		return 1;
+	}
+	if (output)
+		std::cout << FMT_INFO " Results written to '" << output << "'." << std::endl;
+	return 0;
+}
@@ -0,0 +1,439 @@
+#include "agent.hpp"
+#include "server.hpp"
+#include "ft_otp_cli.hpp"
+#include "../core/BinaryIO.hpp"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+static volatile sig_atomic_t	g_stopAgent = 0;
+
+static void stopAgent(int) { g_stopAgent = 1; }
+
+static void toHex(const uint8_t *data, size_t size, char *out)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		out[2 * i] = digits[data[i] >> 4];
+		out[2 * i + 1] = digits[data[i] & 0x0f];
+	}
+}
+
+// Decode exactly 2 x 'size' hex digits
+static bool fromHex(const char *text, size_t size, uint8_t *out)
+{
+	for (size_t i = 0; i < 2 * size; ++i)
+	{
+		char	c = text[i];
+		int		value;
+
+		if (c >= '0' && c <= '9')
+			value = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			value = c - 'a' + 10;
+		else
+			return false;
+		out[i / 2] = static_cast<uint8_t>((i % 2) ? (out[i / 2] | value) : (value << 4));
+	}
+	return true;
+}
+
+static void writeText(int fd, const char *text)
+{
+	size_t length = strlen(text);
+
+	while (length > 0)
+	{
+		ssize_t written = write(fd, text, length);
+		if (written <= 0)
+			return;
+		text += written;
+		length -= static_cast<size_t>(written);
+	}
+}
+
+/**
+ * @brief Read a passphrase from the terminal, without echoing it.
+ *
+ * Without a terminal (e.g. in a script), it's read from the standard
+ * input instead. The passphrase is not '\0'-terminated.
+ *
+ * @return
+ *  The length of the passphrase. In case it's empty or too long, an
+ *  'AgentException' is thrown.
+ */
+static size_t readPassphrase(const char *prompt, char *buffer, size_t size)
+{
+	struct termios	saved, silent;
+	int				fd = open("/dev/tty", O_RDWR | O_CLOEXEC);
+	bool			tty = fd >= 0;
+	size_t			length = 0;
+	bool			tooLong = false;
+	char			c;
+
+	if (!tty)
+		fd = STDIN_FILENO;
+	bool echoOff = tty && tcgetattr(fd, &saved) == 0;
+	if (tty)
+		writeText(fd, prompt);
+	if (echoOff)
+	{
+		silent = saved;
+		silent.c_lflag &= ~static_cast<tcflag_t>(ECHO);
+		tcsetattr(fd, TCSAFLUSH, &silent);
+	}
+	while (read(fd, &c, 1) == 1 && c != '\n')
+	{
+		if (length < size)
+			buffer[length++] = c;
+		else
+			tooLong = true;
+	}
+	if (echoOff)
+	{
+		tcsetattr(fd, TCSAFLUSH, &saved);
+		writeText(fd, "\n");
+	}
+	if (tty)
+		close(fd);
+	secureWipe(&c, sizeof(c));
+
+	if (tooLong)
+		throw AgentException("the passphrase is too long");
+	if (length == 0)
+		throw AgentException("empty passphrase");
+	return length;
+}
+
+// Derive the key of a store from a passphrase, asked twice for a new store
+static void promptStoreKey(const StoreKdf &kdf, bool create, uint8_t *key)
+{
+	ArenaScope	scope;
+	char		*passphrase = reinterpret_cast<char *>(scope.allocate(OTP_MAX_PASSPHRASE));
+	size_t		length;
+
+	length = readPassphrase(create ? "New key store passphrase: " : "Key store passphrase: ",
+		passphrase, OTP_MAX_PASSPHRASE);
+	if (create)
+	{
+		char	*confirm = reinterpret_cast<char *>(scope.allocate(OTP_MAX_PASSPHRASE));
+		size_t	confirmLength = readPassphrase("Confirm the passphrase: ", confirm, OTP_MAX_PASSPHRASE);
+
+		if (confirmLength != length || memcmp(confirm, passphrase, length) != 0)
+			throw AgentException("the passphrases don't match");
+	}
+	deriveStoreKey(kdf, passphrase, length, key);
+}
+
+bool askAgent(const char *socketPath, const StoreKdf &kdf, uint8_t *key)
+{
+	char			request[OTP_AGENT_MAX_REQUEST];
+	char			answer[OTP_AGENT_MAX_REQUEST];
+	size_t			length = 0;
+	const size_t	requestSize = 4 + 2 * OTP_KDF_SALT_SIZE + 1;
+	const size_t	answerSize = 3 + 2 * OTP_STORE_KEY_SIZE + 1;
+	struct timeval	timeout = {OTP_AGENT_TIMEOUT_MS / 1000, (OTP_AGENT_TIMEOUT_MS % 1000) * 1000};
+
+	int fd = connectToServer(socketPath);
+	if (fd < 0)
+		return false;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	memcpy(request, "KEY ", 4);
+	toHex(kdf.salt, OTP_KDF_SALT_SIZE, request + 4);
+	request[requestSize - 1] = '\n';
+	bool sent = send(fd, request, requestSize, MSG_NOSIGNAL) == static_cast<ssize_t>(requestSize);
+	while (sent && length < sizeof(answer) && !memchr(answer, '\n', length))
+	{
+		ssize_t received = recv(fd, answer + length, sizeof(answer) - length, 0);
+		if (received <= 0)
+			break;
+		length += static_cast<size_t>(received);
+	}
+	close(fd);
+
+	bool found = length == answerSize && memcmp(answer, "OK ", 3) == 0 && answer[answerSize - 1] == '\n'
+		&& fromHex(answer + 3, OTP_STORE_KEY_SIZE, key);
+	secureWipe(answer, sizeof(answer));
+	return found;
+}
+
+StoreKeyProvider cliKeyProvider(const char *agentSocket, bool verbose)
+{
+	return [agentSocket, verbose](const StoreKdf &kdf, bool create, uint8_t *key) {
+		if (!create && askAgent(agentSocket, kdf, key))
+		{
+			if (verbose)
+				std::cout << FMT_INFO " Key store key given by the agent." << std::endl;
+			return;
+		}
+		promptStoreKey(kdf, create, key);
+	};
+}
+
+/**
+ * @brief Create the listening socket of the agent.
+ *
+ * A stale socket is replaced, but not the socket of a running agent. The
+ * socket is only accessible by its owner.
+ */
+static int listenAgent(const char *socketPath)
+{
+	struct sockaddr_un	address;
+	struct stat			buffer;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+		throw AgentException("socket path is too long");
+	if (stat(socketPath, &buffer) == 0 && S_ISSOCK(buffer.st_mode))
+	{
+		int fd = connectToServer(socketPath);
+		if (fd >= 0)
+		{
+			close(fd);
+			throw AgentException(std::string("an agent already runs on '") + socketPath + "'");
+		}
+		unlink(socketPath);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socketPath, strlen(socketPath));
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		throw AgentException(systemError("socket"));
+	mode_t previousMask = umask(0077);
+	int bound = bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+	umask(previousMask);
+	if (bound != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		std::string error = systemError("bind");
+		close(fd);
+		throw AgentException(error);
+	}
+	return fd;
+}
+
+// Answer the request of one connection, true if the agent must stop
+static bool answerClient(int fd, const StoreKdf &kdf, const uint8_t *key)
+{
+	struct ucred	peer;
+	socklen_t		peerSize = sizeof(peer);
+	struct timeval	timeout = {OTP_AGENT_TIMEOUT_MS / 1000, (OTP_AGENT_TIMEOUT_MS % 1000) * 1000};
+	char			request[OTP_AGENT_MAX_REQUEST];
+	char			answer[3 + 2 * OTP_STORE_KEY_SIZE + 1];
+	size_t			length = 0;
+	bool			stop = false;
+	uint8_t			salt[OTP_KDF_SALT_SIZE];
+
+	// Another user could only connect if the socket permissions were changed
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) != 0 || peer.uid != getuid())
+		return false;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	while (length < sizeof(request) && !memchr(request, '\n', length))
+	{
+		ssize_t received = recv(fd, request + length, sizeof(request) - length, 0);
+		if (received <= 0)
+			return false;
+		length += static_cast<size_t>(received);
+	}
+	const char *end = static_cast<const char *>(memchr(request, '\n', length));
+	if (!end)
+		return false;
+	length = static_cast<size_t>(end - request);
+
+	if (length == 4 + 2 * OTP_KDF_SALT_SIZE && memcmp(request, "KEY ", 4) == 0)
+	{
+		if (fromHex(request + 4, OTP_KDF_SALT_SIZE, salt) && memcmp(salt, kdf.salt, sizeof(salt)) == 0)
+		{
+			memcpy(answer, "OK ", 3);
+			toHex(key, OTP_STORE_KEY_SIZE, answer + 3);
+			answer[sizeof(answer) - 1] = '\n';
+			send(fd, answer, sizeof(answer), MSG_NOSIGNAL);
+			secureWipe(answer, sizeof(answer));
+		}
+		else
+			send(fd, "ERR unknown store\n", 18, MSG_NOSIGNAL);
+	}
+	else if (length == 4 && memcmp(request, "PING", 4) == 0)
+		send(fd, "PONG\n", 5, MSG_NOSIGNAL);
+	else if (length == 4 && memcmp(request, "STOP", 4) == 0)
+	{
+		send(fd, "OK\n", 3, MSG_NOSIGNAL);
+		stop = true;
+	}
+	else
+		send(fd, "ERR unknown request\n", 20, MSG_NOSIGNAL);
+	return stop;
+}
+
+// Serve the key until the TTL is over, or until SIGINT, SIGTERM or a STOP request
+static void serveKey(int listenFd, const StoreKdf &kdf, const uint8_t *key, long ttl)
+{
+	typedef std::chrono::steady_clock	Clock;
+	const Clock::time_point				deadline = Clock::now() + std::chrono::seconds(ttl);
+
+	while (!g_stopAgent)
+	{
+		int64_t remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - Clock::now()).count();
+		if (remaining <= 0)
+			break;
+
+		struct pollfd listening = {listenFd, POLLIN, 0};
+		if (poll(&listening, 1, static_cast<int>(std::min<int64_t>(remaining, INT_MAX))) <= 0)
+			continue;
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+		bool stop = answerClient(fd, kdf, key);
+		close(fd);
+		if (stop)
+			break;
+	}
+}
+
+/**
+ * @brief The agent process: check the passphrase, then serve the key.
+ *
+ * The memory locks of the parent are not inherited through fork(), so the
+ * key is derived here, straight into the locked arena of this process.
+ * 'status' gets one byte once the agent is ready, the parent exits then.
+ */
+static int agentProcess(const ServerParams &server, const StoreKdf &kdf, int status, bool verbose)
+{
+	try
+	{
+		SecureArena	arena;
+		uint8_t		*key = arena.allocate(OTP_STORE_KEY_SIZE);
+		int			listenFd = listenAgent(server.agentSocket);
+		try
+		{
+			ArenaScope	scope(arena);
+			char		*passphrase = reinterpret_cast<char *>(scope.allocate(OTP_MAX_PASSPHRASE));
+			size_t		length = readPassphrase("Key store passphrase: ", passphrase, OTP_MAX_PASSPHRASE);
+
+			deriveStoreKey(kdf, passphrase, length, key);
+			if (!isStoreKey(kdf, key))
+				throw AgentException("wrong passphrase");
+		}
+		catch (std::exception &)
+		{
+			close(listenFd);
+			unlink(server.agentSocket);
+			throw;
+		}
+		if (!arena.locked())
+			std::cerr << FMT_WARNING " The key can't be locked in memory (see ulimit -l)." << std::endl;
+
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = stopAgent;
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+		signal(SIGPIPE, SIG_IGN);
+		setsid();
+
+		char ready = 1;
+		if (write(status, &ready, 1) != 1)
+			throw AgentException(systemError("write"));
+		close(status);
+
+		/*
+		 * The standard output is released, so 'eval $(ft_otp agent)' returns
+		 * once the parent exits. Only the verbose messages are kept, on the
+		 * standard error.
+		 */
+		int null = open("/dev/null", O_RDWR);
+		if (null >= 0)
+		{
+			dup2(null, STDIN_FILENO);
+			dup2(verbose ? STDERR_FILENO : null, STDOUT_FILENO);
+			if (!verbose)
+				dup2(null, STDERR_FILENO);
+			close(null);
+		}
+
+		serveKey(listenFd, kdf, key, server.agentTTL);
+		close(listenFd);
+		unlink(server.agentSocket);
+		if (verbose)
+			std::cout << FMT_INFO " Agent stopped, key wiped." << std::endl;
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+		close(status);
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief Start the agent of a passphrase-protected key store (ft_otp agent).
+ *
+ * The agent process asks for the passphrase while it's still attached to
+ * the terminal, and the parent waits for it to be ready: it only exits
+ * after printing how to reach the agent, or the agent's error.
+ */
+int runAgent(const ServerParams &server, bool verbose)
+{
+	StoreKdf	kdf;
+	int			status[2];
+
+	try
+	{
+		KeyStore store(server.storeFile, verbose);
+		if (!store.getKdf(kdf))
+			throw AgentException(std::string("'") + server.storeFile + "' is not protected by a passphrase (see -P)");
+		if (pipe2(status, O_CLOEXEC) != 0)
+			throw AgentException(systemError("pipe"));
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+		return ERROR;
+	}
+
+	std::cout.flush();
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		std::cerr << FMT_ERROR " " << systemError("fork") << std::endl;
+		close(status[0]);
+		close(status[1]);
+		return ERROR;
+	}
+	if (pid == 0)
+	{
+		close(status[0]);
+		return agentProcess(server, kdf, status[1], verbose);
+	}
+
+	char	ready = 0;
+	close(status[1]);
+	ssize_t	received = read(status[0], &ready, 1);
+	close(status[0]);
+	if (received != 1 || ready != 1)
+		return ERROR;
+
+	if (verbose)
+		std::cerr << FMT_DONE " Agent started (pid " << pid << "), the key is kept for "
+				  << server.agentTTL << " s." << std::endl;
+	std::cout << OTP_AGENT_SOCKET_ENV "=" << server.agentSocket << "; export " OTP_AGENT_SOCKET_ENV ";" << std::endl;
+	return SUCCESS;
+}
@@ -0,0 +1,63 @@
+#ifndef AGENT_HPP
+# define AGENT_HPP
+
+# include <string>
+# include <stdexcept>
+
+# include "../core/StoreKey.hpp"
+
+# define OTP_AGENT_SOCKETFILENAME	"ft_otp-agent.sock"
+// Environment variable overriding the default agent socket, like SSH_AUTH_SOCK
+# define OTP_AGENT_SOCKET_ENV		"FT_OTP_AGENT_SOCK"
+
+/*
+ * Key store agent (ft_otp agent)
+ *
+ * Deriving the key of a passphrase-protected store is deliberately slow,
+ * so like ssh-agent, the agent asks for the passphrase once, keeps the
+ * derived key in locked memory (SecureArena) and gives it to the later
+ * invocations, which then skip both the prompt and the KDF. After its
+ * TTL, or when it's stopped, the agent wipes the key and exits.
+ *
+ * The agent forks after the passphrase was checked and keeps running in
+ * the background. Its socket is only accessible by its owner, and the
+ * peer of each connection must run as the same user (SO_PEERCRED).
+ *
+ * Protocol: one request per connection, answered with one line.
+ *  KEY <salt in hex>   -> OK <key in hex> | ERR unknown store
+ *  PING                -> PONG
+ *  STOP                -> OK, then the agent wipes the key and exits
+ */
+
+enum AgentLimits
+{
+	OTP_AGENT_TTL			= 15 * 60,			// Default, in seconds
+	OTP_AGENT_MAX_TTL		= 7 * 24 * 3600,
+	OTP_AGENT_MAX_REQUEST	= 128,
+	OTP_AGENT_TIMEOUT_MS	= 1000				// Of a connection
+};
+
+struct ServerParams;
+
+class AgentException : public std::exception
+{
+public:
+	explicit AgentException(const std::string &message) throw()
+		: msg("Agent error: " + message) {}
+	virtual const char *what() const throw() override {
+		return msg.c_str();
+	}
+	virtual ~AgentException() throw() {}
+
+private:
+	std::string msg;
+};
+
+// Run the agent of a passphrase-protected store, returns once the agent runs in the background
+int					runAgent(const ServerParams &server, bool verbose);
+// Ask a running agent for the key of a store, false if there is no agent or it has another key
+bool				askAgent(const char *socketPath, const StoreKdf &kdf, uint8_t *key);
+// Key of a store from the agent, or else derived from a passphrase read on the terminal
+StoreKeyProvider	cliKeyProvider(const char *agentSocket, bool verbose);
+
+#endif
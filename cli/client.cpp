@@ -0,0 +1,90 @@
+#include "server.hpp"
+#include "ft_otp_cli.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+int connectToServer(const char *socketPath)
+{
+	struct sockaddr_un address;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+		return -1;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Ask the daemon for the code of an account, or to verify one (--client).
+ *
+ * The answer is printed like in `-k` mode: only the code, or the drift
+ * offset of a verified code (its counter for an HOTP code). Without an
+ * account, the daemon finds the one giving the code: its label is
+ * printed before the offset.
+ */
+int runClient(const ServerParams &server, bool verbose)
+{
+	std::string	request = !server.label ? std::string("FIND ") + server.code + "\n"
+		: server.code
+		? std::string(server.hotp ? "HOTP " : "VERIFY ") + server.label + " " + server.code + "\n"
+		: std::string("GEN ") + server.label + "\n";
+	std::string	answer;
+	char		buffer[OTP_SERVER_MAX_REQUEST];
+
+	int fd = connectToServer(server.socketPath);
+	if (fd < 0)
+	{
+		std::cerr << FMT_ERROR " Failed to connect to '" << server.socketPath
+				  << "': " << std::strerror(errno) << std::endl;
+		return ERROR;
+	}
+	if (verbose)
+		std::cout << FMT_INFO " Request: " << request;
+
+	bool sent = send(fd, request.data(), request.size(), MSG_NOSIGNAL)
+		== static_cast<ssize_t>(request.size());
+	while (sent && answer.find('\n') == std::string::npos)
+	{
+		ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+		if (received <= 0)
+			break;
+		answer.append(buffer, received);
+	}
+	close(fd);
+
+	size_t end = answer.find('\n');
+	if (end == std::string::npos)
+	{
+		std::cerr << FMT_ERROR " No answer from the server." << std::endl;
+		return ERROR;
+	}
+	answer.resize(end);
+
+	if (answer.compare(0, 3, "OK ") == 0)
+	{
+		if (verbose)
+			std::cout << "\n" FMT_DONE " " << (!server.code ? "Generated TOTP key:"
+				: !server.label ? "Valid code, account and time step offset:"
+				: server.hotp ? "Valid code, counter:" : "Valid code, time step offset:") << std::endl;
+		std::cout << answer.substr(3) << std::endl;
+		return SUCCESS;
+	}
+	if (answer == "FAIL")
+		std::cerr << FMT_ERROR " Invalid code." << std::endl;
+	else
+		std::cerr << FMT_ERROR " " << answer.substr(answer.compare(0, 4, "ERR ") == 0 ? 4 : 0) << std::endl;
+	return ERROR;
+}
@@ -6,6 +6,7 @@
 
 # include "../core/FileHandler.hpp"
 # include "../core/qrencode.hpp"
+# include "server.hpp"
 
 enum e_returns 
 {
@@ -14,6 +15,7 @@ enum e_returns
 };
 
 void printHelp();
-void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose);
+void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose, TOTPParams &params,
+	ServerParams &server);
 
 #endif
@@ -6,15 +6,17 @@ int saveKeyToOutFile(FileHandler *fileHandler, bool qrCode, bool verbose)
 	try
 	{
 		fileHandler->setVerbose(verbose);
-		// Get the original secret from the given file
-		std::string key = fileHandler->getKeyFromInFile();
+		// Get the original secret from the given file, into the secure arena
+		ArenaScope	scope;
+		size_t		size;
+		const char	*key = fileHandler->getKeyFromInFile(scope, size);
 
-		if (key.empty() == false)
+		if (size != 0)
 		{
 			// Encrypt and save the key to the outfile
-			fileHandler->saveKeyToOutFile(key);
+			fileHandler->saveKeyToOutFile(key, size);
 			// If QR code mode is set, create QR code from the secret key
-			if (qrCode) generateQRcodePNGFromSecret(key, verbose);
+			if (qrCode) generateQRcodePNGFromSecret(std::string(key, size), verbose);
 		}
 	}
 	catch (std::exception &e)
@@ -26,16 +28,20 @@ int saveKeyToOutFile(FileHandler *fileHandler, bool qrCode, bool verbose)
 }
 
 // Generate the TOTP key from the given secret key (-k)
-int generateTOTPKey(FileHandler *filehandler, bool verbose)
+int generateTOTPKey(FileHandler *filehandler, bool verbose, const TOTPParams &params)
 {
 	std::string TOTPKey;
 	try
 	{
-		// Retrieve and decrypt the saved key from the file
-		const std::string	key = filehandler->getKeyFromInFile();
+		// Retrieve, decrypt and decode the saved key from the file, into the secure arena
+		ArenaScope		scope;
+		size_t			size;
+		const uint8_t	*secret = filehandler->getSecretFromInFile(scope, size);
 		// Generate the TOTP code
-		TOTPGenerator		TOTPGenerator(verbose);
-		TOTPKey = TOTPGenerator.generateTOTPHmacSha1(key);
+		TOTPGenerator	TOTPGenerator(verbose);
+		TOTPKey = params.hotp
+			? TOTPGenerator.generateHOTP(secret, size, params.counter, params.algorithm, params.digits)
+			: TOTPGenerator.generateTOTP(secret, size, params.algorithm, params.period, params.digits);
         if (TOTPKey.empty()) throw std::exception();
 	}
 	catch (std::exception &e)
@@ -54,10 +60,12 @@ int main(int argc, char *argv[])
 {
 	FileHandler fileHandler;
 	bool		verbose;
+	TOTPParams	params;
+	ServerParams	server;
 
 	try
 	{ // Parse the given arguments
-		parseArgv(argc, argv, &fileHandler, verbose);
+		parseArgv(argc, argv, &fileHandler, verbose, params, server);
 	} catch (std::exception &e)
 	{
 		std::cerr << FMT_ERROR " Invalid argument: " << e.what() << std::endl;
@@ -71,14 +79,28 @@ int main(int argc, char *argv[])
 	 * 	  00000101            00000001          00000001
 	 */
 	uint8_t	mode = fileHandler.getMode();
-	if (mode & OTP_MODE_SAVE_KEY)
+	// A passphrase-protected key store gets its key from the agent, or from a prompt
+	fileHandler.setKeyProvider(cliKeyProvider(server.agentSocket, verbose));
+	if (mode & OTP_MODE_AGENT)
+	{ // Cache the key of a passphrase-protected key store
+		if (runAgent(server, verbose) == ERROR) return 1;
+	}
+	else if (mode & OTP_MODE_SERVE)
+	{ // The local daemon answers the codes of the key store accounts
+		if (runServer(server, params, verbose) == ERROR) return 1;
+	}
+	else if (mode & OTP_MODE_CLIENT)
+	{ // Ask the local daemon instead of reading the key store
+		if (runClient(server, verbose) == ERROR) return 1;
+	}
+	else if (mode & OTP_MODE_SAVE_KEY)
 	{
 		bool	qrCode = mode & OTP_MODE_GEN_QR; // Check if QR code flag is set
 		if (saveKeyToOutFile(&fileHandler, qrCode, verbose) == ERROR) return 1;
 	}
 	else
 	{ // If we are in '-k' mode, we will retrieve that key and produce a TOTP code
-		if (generateTOTPKey(&fileHandler, verbose) == ERROR) return 1;
+		if (generateTOTPKey(&fileHandler, verbose, params) == ERROR) return 1;
 	}
 
 	return 0;
@@ -1,26 +1,90 @@
 #include <iostream>
 #include <getopt.h>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include "../core/FileHandler.hpp"
+#include "server.hpp"
 
 void printHelp()
 {
-    std::cout   << "Usage: ./ft_otp [OPTIONS] <key file>\n"
+    std::cout   << "Usage: ./ft_otp [OPTIONS] <key file | account label>\n"
+                << "       ./ft_otp --serve [OPTIONS] [key store]\n"
+                << "       ./ft_otp agent [-t seconds] [-s socket] [key store]\n"
                 << "Options:\n"
                 << "  -g, --generate     Generate and save the encrypted key\n"
-                << "  -k, --key          Generate password using the provided key\n"
+                << "  -k, --key          Generate password using the provided key file, or the key\n"
+                << "                     of an account label from the key store (" OTP_STOREFILENAME ")\n"
+                << "  -l, --label        Save the key in the key store under this account label (requires -g)\n"
+                << "  -P, --passphrase   Protect the key store with a passphrase (requires -l)\n"
                 << "  -q, --qrcode       Generate a QR code containing the key (requires -g)\n"
+                << "  -a, --algorithm    HMAC algorithm used with -k: sha1 (default), sha256, sha512\n"
+                << "  -d, --digits       Number of digits of the password (default: 6)\n"
+                << "  -p, --period       Time step in seconds (default: 30)\n"
+                << "  -n, --counter      Generate the HOTP (RFC 4226) code of this counter instead (with -k)\n"
+                << "  -S, --serve        Run the local daemon serving the key store accounts\n"
+                << "  -c, --client       Ask the local daemon for the code of an account (with -k)\n"
+                << "  -V, --verify       Code to verify with the local daemon (requires --client),\n"
+                << "                     without -k the daemon finds the account giving it\n"
+                << "  -s, --socket       Socket of the local daemon (default: " OTP_SOCKETFILENAME ")\n"
+                << "  -r, --replay       File keeping the used codes across daemon restarts (with --serve)\n"
+                << "  -C, --counters     HOTP counter log of the daemon (default: " OTP_COUNTERFILENAME ")\n"
+                << "  -H, --hotp         The code given with --verify is an HOTP code\n"
+                << "  -t, --ttl          Seconds the agent keeps the key store key (default: 900)\n"
+                << "Agent:\n"
+                << "  The agent asks for the passphrase of a protected key store once, and gives its key to\n"
+                << "  the next commands, found with " OTP_AGENT_SOCKET_ENV " (default: " OTP_AGENT_SOCKETFILENAME ").\n"
                 << "  -v, --verbose      Enable verbose output\n"
                 << "  -h, --help         Show this help message and exit\n";
 }
 
-void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose)
+// Parse a strictly positive integer option value
+static long parsePositive(const char *value, long max, const char *what)
 {
-    const char          *short_opts = "gkvhq";
+    char    *end;
+    long    number = std::strtol(value, &end, 10);
+
+    if (*value == '\0' || *end != '\0' || number <= 0 || number > max)
+        throw std::invalid_argument(std::string("Invalid ") + what + ": " + value);
+    return number;
+}
+
+// Parse an HOTP counter, 0 included
+static uint64_t parseCounter(const char *value)
+{
+    char                *end;
+    unsigned long long  number;
+
+    errno = 0;
+    number = std::strtoull(value, &end, 10);
+    if (*value < '0' || *value > '9' || *end != '\0' || errno == ERANGE)
+        throw std::invalid_argument(std::string("Invalid counter: ") + value);
+    return static_cast<uint64_t>(number);
+}
+
+void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose, TOTPParams &params,
+    ServerParams &server)
+{
+    const char          *short_opts = "gkvhqa:d:p:n:l:PScV:s:r:C:Ht:";
     const struct option long_opts[] = {
         {"generate", no_argument, nullptr, 'g'},
         {"key", no_argument, nullptr, 'k'},
         {"qrcode", no_argument, nullptr, 'q'},
+        {"label", required_argument, nullptr, 'l'},
+        {"passphrase", no_argument, nullptr, 'P'},
+        {"algorithm", required_argument, nullptr, 'a'},
+        {"digits", required_argument, nullptr, 'd'},
+        {"period", required_argument, nullptr, 'p'},
+        {"counter", required_argument, nullptr, 'n'},
+        {"serve", no_argument, nullptr, 'S'},
+        {"client", no_argument, nullptr, 'c'},
+        {"verify", required_argument, nullptr, 'V'},
+        {"socket", required_argument, nullptr, 's'},
+        {"replay", required_argument, nullptr, 'r'},
+        {"counters", required_argument, nullptr, 'C'},
+        {"hotp", no_argument, nullptr, 'H'},
+        {"ttl", required_argument, nullptr, 't'},
         {"verbose", no_argument, nullptr, 'v'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0}
@@ -28,8 +92,29 @@ void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose)
     int                 opt;
     bool                mode_set = false;
     bool                generate_mode = false;
+    bool                serve_mode = false;
+    bool                key_mode = false;
+    bool                client_mode = false;
+    bool                agent_mode = false;
+    bool                passphrase = false;
+    bool                label_set = false;
+    bool                ttl_set = false;
+    bool                counters_set = false;
     verbose = false;
 
+    if (const char *agentSocket = std::getenv(OTP_AGENT_SOCKET_ENV))
+        server.agentSocket = agentSocket;
+
+    // 'ft_otp agent [OPTIONS]': the options are parsed as if 'agent' was the program name
+    if (argc > 1 && std::strcmp(argv[1], "agent") == 0)
+    {
+        fileHandler->setMode(OTP_MODE_AGENT);
+        mode_set = true;
+        agent_mode = true;
+        --argc;
+        ++argv;
+    }
+
     while ((opt = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1)
     {
         switch (opt)
@@ -46,12 +131,72 @@ void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose)
                 throw std::invalid_argument("Only one mode (-g or -k) can be specified");
             fileHandler->setMode(OTP_MODE_GEN_PWD);
             mode_set = true;
+            key_mode = true;
             break;
         case 'q':
             if (!generate_mode)
                 throw std::invalid_argument("The -q option (QR code generation) requires -g (generate mode). Use -g along with -q.");
             fileHandler->setMode(OTP_MODE_GEN_QR);
             break;
+        case 'l':
+            if (!generate_mode)
+                throw std::invalid_argument("The -l option (account label) requires -g (generate mode).");
+            fileHandler->setLabel(optarg);
+            label_set = true;
+            break;
+        case 'P':
+            passphrase = true;
+            fileHandler->setPassphrase(true);
+            break;
+        case 'a':
+            if (!parseHashAlgorithm(optarg, params.algorithm))
+                throw std::invalid_argument(std::string("Unknown algorithm: ") + optarg);
+            break;
+        case 'd':
+            params.digits = static_cast<int>(parsePositive(optarg, 9, "number of digits"));
+            break;
+        case 'p':
+            params.period = static_cast<uint64_t>(parsePositive(optarg, 86400, "period"));
+            break;
+        case 'n':
+            params.hotp = true;
+            params.counter = parseCounter(optarg);
+            break;
+        case 'S':
+            if (mode_set)
+                throw std::invalid_argument("--serve can't be combined with -g, -k or agent");
+            fileHandler->setMode(OTP_MODE_SERVE);
+            mode_set = true;
+            serve_mode = true;
+            break;
+        case 'c':
+            if (!client_mode)
+                fileHandler->setMode(OTP_MODE_CLIENT);
+            client_mode = true;
+            break;
+        case 'V':
+            server.code = optarg;
+            break;
+        case 's':
+            if (agent_mode)
+                server.agentSocket = optarg;
+            else
+                server.socketPath = optarg;
+            break;
+        case 'r':
+            server.replayFile = optarg;
+            break;
+        case 'C':
+            server.counterFile = optarg;
+            counters_set = true;
+            break;
+        case 'H':
+            server.hotp = true;
+            break;
+        case 't':
+            server.agentTTL = parsePositive(optarg, OTP_AGENT_MAX_TTL, "TTL");
+            ttl_set = true;
+            break;
         case 'v':
             verbose = true;
             fileHandler->setVerbose(true);
@@ -64,8 +209,42 @@ void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose)
         }
     }
 
-    if (!mode_set)
+    if (!mode_set && !client_mode)
         throw std::invalid_argument("You must specify either -g (generate) or -k (key).");
+    if (client_mode && (generate_mode || serve_mode))
+        throw std::invalid_argument("--client requires -k (key) with an account label.");
+    if (server.code && !client_mode)
+        throw std::invalid_argument("--verify requires --client.");
+    if (server.replayFile && !serve_mode)
+        throw std::invalid_argument("--replay requires --serve.");
+    if (counters_set && !serve_mode)
+        throw std::invalid_argument("--counters requires --serve.");
+    if (server.hotp && !server.code)
+        throw std::invalid_argument("--hotp requires --client with --verify.");
+    if (params.hotp && (generate_mode || serve_mode || client_mode || agent_mode))
+        throw std::invalid_argument("--counter is an option of -k.");
+    if (ttl_set && !agent_mode)
+        throw std::invalid_argument("--ttl is an option of the agent.");
+    if (passphrase && !label_set)
+        throw std::invalid_argument("-P (passphrase) requires -g with -l (account label).");
+    if (agent_mode && (generate_mode || client_mode))
+        throw std::invalid_argument("The agent can't be combined with -g, -k or --client.");
+
+    // '--client --verify <code>' without -k: the daemon finds the account (FIND)
+    if (client_mode && !key_mode)
+    {
+        if (!server.code || server.hotp || optind < argc)
+            throw std::invalid_argument("--client requires -k (key) with an account label, or --verify (TOTP) alone.");
+        return;
+    }
+
+    // The daemon and the agent use the default key store unless another one is given
+    if (serve_mode || agent_mode)
+    {
+        if (optind < argc)
+            server.storeFile = argv[optind];
+        return;
+    }
 
     /*
      * optind is an external global variable declared in the <unistd.h> header,
@@ -77,4 +256,5 @@ void parseArgv(int argc, char *argv[], FileHandler *fileHandler, bool &verbose)
         throw std::invalid_argument("A key file must be provided.");
 
     fileHandler->setFilename(argv[optind]);
+    server.label = argv[optind];
 }
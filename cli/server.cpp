@@ -0,0 +1,838 @@
+#include "server.hpp"
+#include "ft_otp_cli.hpp"
+#include "../core/BinaryIO.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+
+static volatile sig_atomic_t	g_stopServer = 0;
+
+static void stopServer(int) { g_stopServer = 1; }
+
+// Room for the accounts of the store, and for the ones it will get while the daemon runs
+static size_t accountCapacity(KeyStore &store)
+{
+	try
+	{
+		return std::max<size_t>(static_cast<size_t>(store.size()) * 2, OTP_SERVER_MIN_ACCOUNTS);
+	}
+	catch (std::exception &)
+	{
+		return OTP_SERVER_MIN_ACCOUNTS;
+	}
+}
+
+static ThrottleParams throttleParams(size_t accounts)
+{
+	ThrottleParams params;
+
+	params.accounts = accounts;
+	return params;
+}
+
+/**
+ * @brief Create the listening socket and the epoll instance.
+ *
+ * A stale socket file left by a previous daemon is replaced, but any
+ * other kind of file at that path is left untouched, and so is the
+ * socket of a daemon still answering. The socket is only accessible by
+ * its owner.
+ */
+TOTPServer::TOTPServer(const ServerParams &server, const TOTPParams &params, bool verbose)
+	: _socketPath(server.socketPath), _params(params), _verbose(verbose),
+	  _store(server.storeFile, verbose), _capacity(accountCapacity(_store)), _generator(false, coarseClock()),
+	  _listenFd(-1), _epollFd(-1), _replay(_capacity), _replayFile(server.replayFile), _replayChanged(false),
+	  _throttle(throttleParams(_capacity)), _counterFile(server.counterFile)
+{
+	struct sockaddr_un	address;
+	struct stat			buffer;
+
+	// Checked first: a second daemon would keep its own used codes, so each could accept a code once
+	if (_socketPath.size() >= sizeof(address.sun_path))
+		throw ServerException("socket path is too long");
+	if (stat(_socketPath.c_str(), &buffer) == 0 && S_ISSOCK(buffer.st_mode))
+	{
+		int fd = connectToServer(_socketPath.c_str());
+		if (fd >= 0)
+		{
+			close(fd);
+			throw ServerException("a daemon already runs on '" + _socketPath + "'");
+		}
+		unlink(_socketPath.c_str());
+	}
+
+	// The codes accepted before a restart stay used
+	if (_replayFile && _replay.load(_replayFile) && _verbose)
+		std::cout << FMT_INFO " Loaded " << _replay.size() << " accounts from '"
+				  << _replayFile << "'." << std::endl;
+	_store.setKeyProvider(cliKeyProvider(server.agentSocket, verbose));
+	// The schedule only has the batch engine, which is HMAC-SHA1
+	if (_params.algorithm == OTP_HASH_SHA1)
+		_schedule.reset(new CodeSchedule(_capacity, _params.digits, _params.period,
+			coarseClock()));
+	preloadKeys();
+	if (_schedule)
+		_schedule->start();
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, _socketPath.c_str(), _socketPath.size());
+
+	_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_listenFd < 0)
+		throw ServerException(systemError("socket"));
+
+	mode_t previousMask = umask(0077);
+	int bound = bind(_listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+	umask(previousMask);
+	if (bound != 0 || listen(_listenFd, SOMAXCONN) != 0)
+	{
+		std::string error = systemError("bind");
+		close(_listenFd);
+		throw ServerException(error);
+	}
+
+	_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = _listenFd;
+	if (_epollFd < 0 || epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &event) != 0)
+	{
+		std::string error = systemError("epoll");
+		close(_listenFd);
+		if (_epollFd >= 0)
+			close(_epollFd);
+		unlink(_socketPath.c_str());
+		throw ServerException(error);
+	}
+}
+
+TOTPServer::~TOTPServer()
+{
+	for (std::unordered_map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		close(it->first);
+	close(_epollFd);
+	close(_listenFd);
+	unlink(_socketPath.c_str());
+}
+
+// Write the replay guard snapshot, if enabled and changed since the last one
+// A failed snapshot (e.g. a full disk) is only logged: it's tried again at the next tick
+void TOTPServer::saveReplay(void)
+{
+	if (!_replayFile || !_replayChanged)
+		return;
+	try
+	{
+		_replay.save(_replayFile);
+		_replayChanged = false;
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+	}
+}
+
+void TOTPServer::run(void)
+{
+	typedef std::chrono::steady_clock	Clock;
+
+	struct epoll_event	events[OTP_SERVER_MAX_EVENTS];
+	Clock::time_point	lastSnapshot = Clock::now();
+	int					timeout = _replayFile ? OTP_SERVER_SNAPSHOT_MS : -1;
+
+	g_stopServer = 0;
+	signal(SIGINT, stopServer);
+	signal(SIGTERM, stopServer);
+	signal(SIGPIPE, SIG_IGN);
+	if (_verbose)
+		std::cout << FMT_INFO " Listening on '" << _socketPath << "'..." << std::endl;
+
+	while (!g_stopServer)
+	{
+		int count = epoll_wait(_epollFd, events, OTP_SERVER_MAX_EVENTS, timeout);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw ServerException(systemError("epoll_wait"));
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			int			fd = events[i].data.fd;
+			uint32_t	flags = events[i].events;
+
+			if (fd == _listenFd)
+				acceptClients();
+			else if ((flags & (EPOLLERR | EPOLLHUP)) && !(flags & EPOLLIN))
+				closeClient(fd);
+			else if ((flags & EPOLLIN) && !readClient(fd))
+				continue;
+			else if (flags & EPOLLOUT)
+				writeClient(fd);
+		}
+		syncCounters();
+
+		if (_replayChanged && Clock::now() - lastSnapshot >= std::chrono::milliseconds(OTP_SERVER_SNAPSHOT_MS))
+		{
+			saveReplay();
+			lastSnapshot = Clock::now();
+		}
+	}
+	saveReplay();
+	if (_verbose)
+		std::cout << "\n" FMT_DONE " Server stopped." << std::endl;
+}
+
+// The FIND failures of all the connections of a local user share a throttle entry
+static std::string findThrottleName(int fd)
+{
+	struct ucred	peer;
+	socklen_t		peerSize = sizeof(peer);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) != 0)
+		return OTP_SERVER_FIND_THROTTLE;
+	return OTP_SERVER_FIND_THROTTLE " " + std::to_string(peer.uid);
+}
+
+void TOTPServer::acceptClients(void)
+{
+	struct epoll_event event;
+
+	for (;;)
+	{
+		int fd = accept4(_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;		// EAGAIN: no more pending connections
+
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		_clients[fd] = Client();
+		_clients[fd].findThrottle = findThrottleName(fd);
+	}
+}
+
+/**
+ * @brief Read everything available, then answer each complete request.
+ *
+ * @return
+ *  false if the connection has been closed.
+ */
+bool TOTPServer::readClient(int fd)
+{
+	char	buffer[OTP_SERVER_READ_SIZE];
+	Client	&client = _clients[fd];
+
+	while (!client.closing)
+	{
+		ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+		if (received > 0)
+			client.in.append(buffer, received);
+		else if (received == 0)
+			client.closing = true;	// Answer the last requests before closing
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		else if (errno != EINTR)
+		{
+			closeClient(fd);
+			return false;
+		}
+	}
+
+	// Pipelined requests are answered in order
+	size_t start = 0, end;
+	while ((end = client.in.find('\n', start)) != std::string::npos)
+	{
+		handleRequest(client.in.data() + start, end - start, client);
+		start = end + 1;
+	}
+	client.in.erase(0, start);
+	if (client.in.size() > OTP_SERVER_MAX_REQUEST)
+	{
+		client.out += "ERR request too long\n";
+		client.in.clear();
+		client.closing = true;
+	}
+	// Answers confirming HOTP codes are sent once their counters are durable
+	if (_counters && _counters->pending())
+	{
+		_syncWaiting.push_back(fd);
+		return true;
+	}
+	return writeClient(fd);
+}
+
+/**
+ * @brief Send as much of the pending answers as the socket accepts.
+ *
+ * @return
+ *  false if the connection has been closed.
+ */
+bool TOTPServer::writeClient(int fd)
+{
+	Client	&client = _clients[fd];
+	size_t	sent = 0;
+
+	while (sent < client.out.size())
+	{
+		ssize_t count = send(fd, client.out.data() + sent, client.out.size() - sent, MSG_NOSIGNAL);
+		if (count > 0)
+			sent += count;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		else if (errno != EINTR)
+		{
+			closeClient(fd);
+			return false;
+		}
+	}
+	client.out.erase(0, sent);
+
+	if (client.closing && client.out.empty())
+	{
+		closeClient(fd);
+		return false;
+	}
+	watchClient(fd, client);
+	return true;
+}
+
+// Only wait for the socket to be writable while some answers are pending
+void TOTPServer::watchClient(int fd, Client &client)
+{
+	bool writing = !client.out.empty();
+
+	if (writing == client.writing && !client.closing)
+		return;
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	// Once the peer has finished sending, the socket is always readable (EOF)
+	event.events = (client.closing ? 0u : static_cast<uint32_t>(EPOLLIN))
+		| (writing ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+	event.data.fd = fd;
+	epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event);
+	client.writing = writing;
+}
+
+void TOTPServer::closeClient(int fd)
+{
+	epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+	_clients.erase(fd);
+}
+
+// Prepare the HMAC key of an account from its stored key, false if the key is invalid
+bool TOTPServer::prepareKey(const std::string &label, const uint8_t *plain, size_t size)
+{
+	TOTPGenerator	TOTPGenerator(false);
+	const char		*key = reinterpret_cast<const char *>(plain);
+	uint8_t			keyFormat = TOTPGenerator.isValidHexOrBase32(key, size);
+
+	if (!keyFormat)
+		return false;
+
+	ArenaScope	scope;
+	size_t		capacity = TOTPGenerator::decodedKeyCapacity(size);
+	uint8_t		*secret = scope.allocate(capacity);
+	size_t		secretSize = TOTPGenerator.DecodeKeyInto(key, size, secret, capacity, keyFormat);
+
+	ServedKey	&served = _keys[label];
+	int32_t		drift;
+	switch (_params.algorithm)
+	{
+	case OTP_HASH_SHA256:	served.sha256.prepare(secret, secretSize); break;
+	case OTP_HASH_SHA512:	served.sha512.prepare(secret, secretSize); break;
+	default:				served.sha1.prepare(secret, secretSize); break;
+	}
+	if (_schedule && served.slot == OTP_SCHEDULE_FULL)
+	{
+		served.slot = _schedule->add(served.sha1);
+		if (served.slot == OTP_SCHEDULE_FULL)
+			_unscheduled.push_back(label);
+		else
+			_slotLabels.push_back(label);
+	}
+	// The estimate of the token outlives the prepared key (restart, reload)
+	if (_replay.drift(label, drift))
+		served.drift.restore(drift);
+	return true;
+}
+
+/**
+ * @brief Prepare the keys of all the accounts of the store.
+ *
+ * The whole store is decrypted in one pass, so the first request of each
+ * account doesn't have to open it. An account added later is still
+ * loaded on its first request.
+ *
+ * The key of a passphrase-protected store is asked for here, before the
+ * daemon serves anything: it must start, or fail, with the right key, and
+ * never prompt while it's serving.
+ */
+void TOTPServer::preloadKeys(void)
+{
+	StoreKdf	kdf;
+	bool		protectedStore = false;
+	KeyVisitor	prepare = [this](const std::string &label, const uint8_t *key, size_t size) {
+		try
+		{
+			prepareKey(label, key, size);
+		}
+		catch (std::exception &) {}
+	};
+
+	try
+	{
+		protectedStore = _store.getKdf(kdf);
+		_store.forEachKey(prepare);
+	}
+	catch (std::exception &e)
+	{
+		if (protectedStore)
+			throw;
+		if (_verbose)
+			std::cerr << FMT_WARNING " Keys not preloaded: " << e.what() << std::endl;
+		_keys.clear();
+		return;
+	}
+	_store.setKeyProvider(StoreKeyProvider());
+	if (_verbose)
+		std::cout << FMT_INFO " Loaded the keys of " << _keys.size() << " accounts." << std::endl;
+}
+
+/**
+ * @brief Get the prepared key of an account, loading it on first use.
+ *
+ * @return
+ *  null if the account is not in the key store or its key is invalid.
+ */
+TOTPServer::ServedKey *TOTPServer::findKey(const std::string &label)
+{
+	std::unordered_map<std::string, ServedKey>::iterator it = _keys.find(label);
+	if (it != _keys.end())
+		return &it->second;
+
+	try
+	{
+		ArenaScope		scope;
+		size_t			size;
+		const uint8_t	*plain = _store.loadKey(label, scope, size);
+
+		if (!prepareKey(label, plain, size))
+			return nullptr;
+		if (_verbose)
+			std::cout << FMT_INFO " Loaded the key of '" << label << "'." << std::endl;
+		return &_keys[label];
+	}
+	catch (std::exception &e)
+	{
+		if (_verbose)
+			std::cerr << FMT_ERROR " " << label << ": " << e.what() << std::endl;
+		return nullptr;
+	}
+}
+
+// From the code schedule when it has it, otherwise computed now (false if the configuration is invalid)
+bool TOTPServer::codeAt(const ServedKey &key, int64_t unixTime, uint32_t &code) const
+{
+	if (_schedule && unixTime >= 0
+		&& _schedule->lookup(key.slot, static_cast<uint64_t>(unixTime) / _params.period, code))
+		return true;
+	switch (_params.algorithm)
+	{
+	case OTP_HASH_SHA256:	return computeTOTPCode(key.sha256, unixTime, _params.digits, _params.period, code);
+	case OTP_HASH_SHA512:	return computeTOTPCode(key.sha512, unixTime, _params.digits, _params.period, code);
+	default:				return computeTOTPCode(key.sha1, unixTime, _params.digits, _params.period, code);
+	}
+}
+
+// Parse one request line and append its answer to the client's
+void TOTPServer::handleRequest(const char *line, size_t length, Client &client)
+{
+	std::string	&out = client.out;
+	std::string	words[3];
+	size_t		count = 0;
+
+	if (length > 0 && line[length - 1] == '\r')
+		--length;
+	for (size_t i = 0; i < length; ++i)
+	{
+		if (line[i] == ' ')
+		{
+			if (!words[count].empty() && ++count == 3)
+				break;
+		}
+		else
+			words[count] += line[i];
+	}
+	if (count < 3 && !words[count].empty())
+		++count;
+
+	if (count == 1 && words[0] == "PING")
+	{
+		out += "PONG\n";
+		return;
+	}
+	if (count == 2 && words[0] == "FIND")
+	{
+		findAccount(words[1], client.findThrottle, out);
+		return;
+	}
+	if (!((count == 2 && words[0] == "GEN") || (count == 3 && (words[0] == "VERIFY" || words[0] == "HOTP"))))
+	{
+		out += "ERR unknown request\n";
+		return;
+	}
+
+	// A throttled account is rejected before its key is even loaded
+	if (count == 3)
+	{
+		int64_t delay = _throttle.retryDelay(words[1], AttemptThrottle::now());
+		if (delay > 0)
+		{
+			out += "ERR too many attempts, retry in " + std::to_string((delay + 999) / 1000) + " s\n";
+			return;
+		}
+	}
+
+	ServedKey *key = findKey(words[1]);
+	if (!key)
+	{
+		out += "ERR unknown account\n";
+		return;
+	}
+
+	if (words[0] == "HOTP")
+	{
+		acceptHOTP(words[1], *key, words[2], out);
+		return;
+	}
+
+	int64_t		now = _generator.getUnixTime();
+	char		code[OTP_TOTP_CODE_BUFFER];
+	uint32_t	expected;
+	if (count == 2)
+	{
+		if (!codeAt(*key, now, expected))
+		{
+			out += "ERR invalid configuration\n";
+			return;
+		}
+		writeTOTPCode(expected, _params.digits, code);
+		out += "OK ";
+		out.append(code, _params.digits);
+		out += "\n";
+		return;
+	}
+
+	// Same order as TOTPGenerator::verifyTOTP: the predicted offset P, P-1, P+1, ...
+	uint32_t	submitted;
+	int			offset;
+	DriftSearch	search(key->drift, OTP_TOTP_WINDOW);
+	if (TOTPGenerator::parseCode(words[2], _params.digits, submitted))
+	{
+		while (search.next(offset))
+		{
+			int64_t	time = now + offset * static_cast<int64_t>(_params.period);
+
+			if (time >= 0 && codeAt(*key, time, expected) && expected == submitted)
+			{
+				if (acceptCode(words[1], static_cast<uint64_t>(time) / _params.period, out))
+				{
+					_throttle.recordSuccess(words[1]);
+					key->drift.record(offset);
+					_replay.setDrift(words[1], key->drift.scaled());
+					out += "OK " + std::to_string(offset) + "\n";
+				}
+				else	// A replayed code counts as a failure, it must not reset the throttle
+					recordFailure(words[1], out);
+				return;
+			}
+		}
+		if (resyncCode(words[1], *key, submitted, now, out))
+			return;
+	}
+	if (recordFailure(words[1], out))
+		out += "FAIL\n";
+}
+
+/**
+ * @brief Look for a code of a token further away than the search (RFC 6238, section 6).
+ *
+ * The offsets up to OTP_DRIFT_MAX_STEPS from T that the search didn't
+ * check are tried. A matching code is only accepted once it confirms the
+ * previous one (the next code of the token, at the same offset): then
+ * the drift estimate moves to its offset. A single code is answered as a
+ * failure, so guessing one still costs an attempt.
+ *
+ * @return
+ *  true if the code was confirmed, and answered.
+ */
+bool TOTPServer::resyncCode(const std::string &label, ServedKey &key, uint32_t submitted, int64_t now,
+	std::string &out)
+{
+	DriftSearch	search(key.drift, OTP_TOTP_WINDOW);
+	uint32_t	expected;
+
+	for (int offset = -OTP_DRIFT_MAX_STEPS; offset <= OTP_DRIFT_MAX_STEPS; ++offset)
+	{
+		int64_t	time = now + offset * static_cast<int64_t>(_params.period);
+
+		if (search.covers(offset) || time < 0 || !codeAt(key, time, expected) || expected != submitted)
+			continue;
+
+		uint64_t	counter = static_cast<uint64_t>(time) / _params.period;
+		bool		confirmed = key.drift.confirms(offset, counter);
+		if (confirmed && !acceptCode(label, counter, out))
+		{
+			recordFailure(label, out);
+			return true;
+		}
+		key.drift.resync(offset, counter);
+		if (!confirmed)
+			return false;
+		_throttle.recordSuccess(label);
+		_replay.setDrift(label, key.drift.scaled());
+		if (_verbose)
+			std::cout << FMT_INFO " Resynchronized '" << label << "' at offset " << offset << "." << std::endl;
+		out += "OK " + std::to_string(offset) + "\n";
+		return true;
+	}
+	return false;
+}
+
+// Count a failed attempt of 'account', false if the throttle can't track it (the error is answered)
+bool TOTPServer::recordFailure(const std::string &account, std::string &out)
+{
+	try
+	{
+		_throttle.recordFailure(account, AttemptThrottle::now());
+	}
+	catch (std::exception &e)
+	{
+		out += std::string("ERR ") + e.what() + "\n";
+		return false;
+	}
+	return true;
+}
+
+// Record a matching code, unless a code of this time step (or a later one) was already used
+bool TOTPServer::acceptCode(const std::string &label, uint64_t counter, std::string &out)
+{
+	try
+	{
+		if (!_replay.accept(label, counter))
+		{
+			out += "ERR code already used\n";
+			return false;
+		}
+	}
+	catch (std::exception &e)
+	{
+		out += std::string("ERR ") + e.what() + "\n";
+		return false;
+	}
+	_replayChanged = true;
+	return true;
+}
+
+// Keep the first account giving the code, and note if another account gives it too
+void TOTPServer::CodeMatch::add(const std::string &account, int64_t accountTime, int accountOffset)
+{
+	if (!label)
+	{
+		label = &account;
+		time = accountTime;
+		offset = accountOffset;
+	}
+	else if (*label != account)
+		ambiguous = true;
+}
+
+// Add the accounts giving 'code' at 'time' to the match, from the reverse index when it has them
+void TOTPServer::matchCode(uint32_t code, int64_t time, int offset, CodeMatch &match) const
+{
+	uint32_t	slots[2];	// A second account is enough to know the code is ambiguous
+	size_t		found;
+	uint32_t	expected;
+
+	if (_schedule && _schedule->findSlots(static_cast<uint64_t>(time) / _params.period, code, slots, 2, found))
+	{
+		for (size_t i = 0; i < found && i < 2; ++i)
+			match.add(_slotLabels[slots[i]], time, offset);
+		for (size_t i = 0; i < _unscheduled.size(); ++i)
+		{
+			std::unordered_map<std::string, ServedKey>::const_iterator it = _keys.find(_unscheduled[i]);
+			if (it != _keys.end() && codeAt(it->second, time, expected) && expected == code)
+				match.add(it->first, time, offset);
+		}
+		return;
+	}
+	for (std::unordered_map<std::string, ServedKey>::const_iterator it = _keys.begin(); it != _keys.end(); ++it)
+		if (codeAt(it->second, time, expected) && expected == code)
+			match.add(it->first, time, offset);
+}
+
+/**
+ * @brief Verify a code without its account (FIND).
+ *
+ * Every time step of the drift window is searched, in the same order as
+ * VERIFY: a code given by a single account is accepted for it, at the
+ * first step where it matches. A code given by several accounts is
+ * refused without being used, nor counted as a failure. 'throttled' is
+ * the throttle entry of the client's user.
+ */
+void TOTPServer::findAccount(const std::string &code, const std::string &throttled, std::string &out)
+{
+	int64_t delay = _throttle.retryDelay(throttled, AttemptThrottle::now());
+	if (delay > 0)
+	{
+		out += "ERR too many attempts, retry in " + std::to_string((delay + 999) / 1000) + " s\n";
+		return;
+	}
+
+	int64_t		now = _generator.getUnixTime();
+	uint32_t	submitted;
+	CodeMatch	match;
+
+	if (TOTPGenerator::parseCode(code, _params.digits, submitted))
+		for (int i = 0; i <= 2 * OTP_TOTP_WINDOW && !match.ambiguous; ++i)
+		{
+			int		offset = (i & 1) ? -(i + 1) / 2 : i / 2;
+			int64_t	time = now + offset * static_cast<int64_t>(_params.period);
+
+			if (time >= 0)
+				matchCode(submitted, time, offset, match);
+		}
+	if (match.ambiguous)
+	{
+		out += "ERR ambiguous code\n";
+		return;
+	}
+	if (match.label)
+	{
+		if (acceptCode(*match.label, static_cast<uint64_t>(match.time) / _params.period, out))
+		{
+			_throttle.recordSuccess(throttled);
+			DriftEstimate &drift = _keys[*match.label].drift;
+			drift.record(match.offset);
+			_replay.setDrift(*match.label, drift.scaled());
+			out += "OK " + *match.label + " " + std::to_string(match.offset) + "\n";
+		}
+		else	// Same as VERIFY: a replayed code is a failure
+			recordFailure(throttled, out);
+		return;
+	}
+	if (recordFailure(throttled, out))
+		out += "FAIL\n";
+}
+
+bool TOTPServer::hotpCode(const ServedKey &key, uint64_t counter, uint32_t &code) const
+{
+	switch (_params.algorithm)
+	{
+	case OTP_HASH_SHA256:	return computeHOTPCode(key.sha256, counter, _params.digits, code);
+	case OTP_HASH_SHA512:	return computeHOTPCode(key.sha512, counter, _params.digits, code);
+	default:				return computeHOTPCode(key.sha1, counter, _params.digits, code);
+	}
+}
+
+/**
+ * @brief Verify an HOTP code (RFC 4226) from the next expected counter.
+ *
+ * The counters from the expected one to OTP_HOTP_LOOK_AHEAD after it
+ * are checked, and the next expected counter moves after the matching
+ * one. The answer is only buffered: it's sent by syncCounters(), once
+ * the counter log is synced.
+ */
+void TOTPServer::acceptHOTP(const std::string &label, const ServedKey &key, const std::string &code,
+	std::string &out)
+{
+	uint32_t	submitted;
+	uint32_t	expected;
+
+	try
+	{
+		if (!_counters)
+			_counters.reset(new CounterLog(_counterFile));
+
+		uint64_t next = _counters->next(label);
+		if (TOTPGenerator::parseCode(code, _params.digits, submitted))
+			for (uint64_t counter = next; counter - next < OTP_HOTP_LOOK_AHEAD && counter != UINT64_MAX; ++counter)
+				if (hotpCode(key, counter, expected) && expected == submitted)
+				{
+					_throttle.recordSuccess(label);
+					_counters->advance(label, counter + 1);
+					out += "OK " + std::to_string(counter) + "\n";
+					return;
+				}
+		_throttle.recordFailure(label, AttemptThrottle::now());
+	}
+	catch (std::exception &e)
+	{
+		out += std::string("ERR ") + e.what() + "\n";
+		return;
+	}
+	out += "FAIL\n";
+}
+
+/**
+ * @brief Group commit of the HOTP counters moved in this round, then
+ * send the answers waiting for it.
+ *
+ * If the log can't be synced, the waiting connections are closed: their
+ * answers may accept codes whose counters were not saved.
+ */
+void TOTPServer::syncCounters(void)
+{
+	if (_syncWaiting.empty())
+		return;
+	try
+	{
+		_counters->sync();
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+		for (size_t i = 0; i < _syncWaiting.size(); ++i)
+			if (_clients.count(_syncWaiting[i]))
+				closeClient(_syncWaiting[i]);
+		_syncWaiting.clear();
+		return;
+	}
+	for (size_t i = 0; i < _syncWaiting.size(); ++i)
+		if (_clients.count(_syncWaiting[i]))
+			writeClient(_syncWaiting[i]);
+	_syncWaiting.clear();
+}
+
+// Serve the key store until the daemon is stopped (--serve)
+int runServer(const ServerParams &server, const TOTPParams &params, bool verbose)
+{
+	try
+	{
+		TOTPServer daemon(server, params, verbose);
+		daemon.run();
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << FMT_ERROR " " << e.what() << std::endl;
+		return ERROR;
+	}
+	return SUCCESS;
+}
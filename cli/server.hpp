@@ -0,0 +1,218 @@
+#ifndef SERVER_HPP
+# define SERVER_HPP
+
+# include <memory>
+# include <string>
+# include <unordered_map>
+# include <vector>
+# include <stdexcept>
+
+# include "../core/FileHandler.hpp"
+# include "../core/ReplayGuard.hpp"
+# include "../core/AttemptThrottle.hpp"
+# include "../core/CodeSchedule.hpp"
+# include "../core/CounterLog.hpp"
+# include "agent.hpp"
+
+# define OTP_SOCKETFILENAME	"ft_otp.sock"
+
+/*
+ * Local TOTP daemon (--serve)
+ *
+ * The daemon listens on a Unix domain socket and answers requests with the
+ * keys of the key store (ft_otp.store). All the keys are decrypted, decoded
+ * and prepared when the daemon starts (an account added later on its first
+ * request), then kept in memory, so a request only costs the two hash
+ * compressions of the HMAC.
+ *
+ * Protocol: one request per line, answered with one line, in order.
+ * Clients may send several requests without waiting for the answers.
+ *  GEN <label>             -> OK <code>
+ *  VERIFY <label> <code>   -> OK <time step offset> | FAIL
+ *  FIND <code>             -> OK <label> <time step offset> | FAIL
+ *  HOTP <label> <code>     -> OK <counter> | FAIL
+ *  PING                    -> PONG
+ * Any error is answered with: ERR <message>
+ *
+ * All the connections are served by a single thread with an epoll event
+ * loop on non-blocking sockets.
+ *
+ * VERIFY checks the time step offset predicted by the drift of the
+ * account's token first (see DriftSearch), so a token running ahead or
+ * behind usually costs a single code. A token further away (up to
+ * OTP_DRIFT_MAX_STEPS) is resynchronized by two consecutive codes. The
+ * estimate is kept with the account's last counter in the ReplayGuard,
+ * so it's saved in its snapshot (--replay) and survives a restart.
+ *
+ * A verified code can't be used twice: the time step of every accepted
+ * code is kept in a ReplayGuard, and a code from the same or an older
+ * time step is answered with "ERR code already used". With --replay,
+ * the guard is saved to a snapshot file (at most every few seconds, and
+ * when the daemon stops) and reloaded on start.
+ *
+ * With HMAC-SHA1 (the default), the codes of the previous, current and
+ * next time steps of every account are kept in a CodeSchedule, rolled
+ * forward by a background thread: GEN and VERIFY only read them, and the
+ * HMAC is computed at request time only for an account not scheduled yet.
+ *
+ * FIND verifies a code without its account, among the loaded accounts:
+ * the code of every account of the drift window is looked up in the
+ * reverse index of the schedule (or computed for each account without
+ * it). It's only accepted if a single account gives it; when several
+ * do, it's answered with "ERR ambiguous code" and the account must be
+ * given with VERIFY. Its failures are throttled by local user (the uid
+ * of the peer, from SO_PEERCRED), across all the accounts: one user
+ * guessing codes can't block FIND for the others.
+ *
+ * HOTP verifies an RFC 4226 code from the next expected counter of the
+ * account, with a look-ahead window. The counters are kept in a
+ * CounterLog (ft_otp.counters, opened on the first HOTP request), and
+ * an accepted code is only answered once its new counter is durable:
+ * the counters moved by all the requests of one round of the event loop
+ * are written with a single fdatasync, then the answers are sent.
+ *
+ * Failed verifications are throttled by an AttemptThrottle: after a few
+ * failures, an account is blocked for an exponentially growing delay,
+ * answered with "ERR too many attempts, retry in <n> s". A replayed
+ * code is counted as a failure, only an accepted code resets it.
+ */
+
+enum ServerLimits
+{
+	OTP_SERVER_MAX_EVENTS	= 64,
+	OTP_SERVER_READ_SIZE	= 4096,
+	OTP_SERVER_MAX_REQUEST	= 256,		// Longest accepted request line
+	OTP_SERVER_MIN_ACCOUNTS	= 65536,	// Accounts tracked by the replay guard at least
+	OTP_SERVER_SNAPSHOT_MS	= 5000		// Delay between two replay guard snapshots
+};
+
+// Throttled name of the FIND failures, followed by the uid of the peer: labels have no spaces
+# define OTP_SERVER_FIND_THROTTLE	" FIND"
+
+// Options of the --serve, --client and agent modes
+struct ServerParams
+{
+	const char	*socketPath;
+	const char	*agentSocket;	// Agent caching the key of a passphrase-protected store
+	long		agentTTL;		// Seconds the agent keeps the key
+	const char	*storeFile;		// Key store served by the daemon
+	const char	*label;			// Account requested by the client
+	const char	*code;			// Code to verify in client mode, null to generate one
+	const char	*replayFile;	// Replay guard snapshot of the daemon, null to keep it in memory
+	const char	*counterFile;	// HOTP counter log of the daemon
+	bool		hotp;			// The client verifies an HOTP code
+
+	ServerParams(): socketPath(OTP_SOCKETFILENAME), agentSocket(OTP_AGENT_SOCKETFILENAME), agentTTL(OTP_AGENT_TTL),
+		storeFile(OTP_STOREFILENAME), label(nullptr), code(nullptr), replayFile(nullptr),
+		counterFile(OTP_COUNTERFILENAME), hotp(false) {}
+};
+
+class TOTPServer
+{
+public:
+	TOTPServer(const ServerParams &server, const TOTPParams &params, bool verbose);
+	~TOTPServer();
+
+	// Serve until SIGINT or SIGTERM
+	void	run(void);
+
+	class ServerException : public std::exception
+	{
+	public:
+		explicit ServerException(const std::string &message) throw()
+			: msg("Server error: " + message) {}
+		virtual const char *what() const throw() override {
+			return msg.c_str();
+		}
+		virtual ~ServerException() throw() {}
+
+	private:
+		std::string msg;
+	};
+
+private:
+	// A key prepared for the hash function of the served configuration
+	struct ServedKey
+	{
+		PreparedKey			sha1;
+		PreparedKeySha256	sha256;
+		PreparedKeySha512	sha512;
+		size_t				slot;	// In the code schedule, OTP_SCHEDULE_FULL if not scheduled
+		DriftEstimate		drift;	// Of the token's clock, from the accepted codes
+
+		ServedKey(): slot(OTP_SCHEDULE_FULL) {}
+	};
+
+	// The account giving a code in FIND, and whether another one gives it too
+	struct CodeMatch
+	{
+		const std::string	*label;
+		int64_t				time;
+		int					offset;
+		bool				ambiguous;
+
+		CodeMatch(): label(nullptr), time(0), offset(0), ambiguous(false) {}
+		void	add(const std::string &account, int64_t accountTime, int accountOffset);
+	};
+
+	struct Client
+	{
+		std::string	in;			// Received bytes, not a full request yet
+		std::string	out;		// Answers not sent yet
+		std::string	findThrottle;	// Throttled name of its FIND failures, by peer uid
+		bool		writing;	// Waiting for the socket to be writable
+		bool		closing;	// The peer has finished sending
+
+		Client(): writing(false), closing(false) {}
+	};
+
+	std::string									_socketPath;
+	TOTPParams									_params;
+	bool										_verbose;
+	KeyStore									_store;
+	size_t										_capacity;	// Accounts of the store, and room for new ones
+	TOTPGenerator								_generator;	// Reads the coarse clock
+	int											_listenFd;
+	int											_epollFd;
+	std::unordered_map<int, Client>				_clients;
+	std::unordered_map<std::string, ServedKey>	_keys;
+	ReplayGuard									_replay;
+	const char									*_replayFile;
+	bool										_replayChanged;	// Not in the snapshot yet
+	AttemptThrottle								_throttle;
+	std::unique_ptr<CodeSchedule>				_schedule;	// Null unless the algorithm is SHA-1
+	std::vector<std::string>					_slotLabels;	// Account of each schedule slot
+	std::vector<std::string>					_unscheduled;	// Accounts added once the schedule was full
+	std::string									_counterFile;
+	std::unique_ptr<CounterLog>					_counters;	// Opened on the first HOTP request
+	std::vector<int>							_syncWaiting;	// Clients whose answers wait for the counter log
+
+	void				acceptClients(void);
+	bool				readClient(int fd);
+	bool				writeClient(int fd);
+	void				watchClient(int fd, Client &client);
+	void				closeClient(int fd);
+	void				handleRequest(const char *line, size_t length, Client &client);
+	bool				prepareKey(const std::string &label, const uint8_t *plain, size_t size);
+	void				preloadKeys(void);
+	ServedKey			*findKey(const std::string &label);
+	bool				codeAt(const ServedKey &key, int64_t unixTime, uint32_t &code) const;
+	void				findAccount(const std::string &code, const std::string &throttled, std::string &out);
+	void				matchCode(uint32_t code, int64_t time, int offset, CodeMatch &match) const;
+	bool				acceptCode(const std::string &label, uint64_t counter, std::string &out);
+	bool				resyncCode(const std::string &label, ServedKey &key, uint32_t submitted, int64_t now,
+							std::string &out);
+	bool				recordFailure(const std::string &account, std::string &out);
+	bool				hotpCode(const ServedKey &key, uint64_t counter, uint32_t &code) const;
+	void				acceptHOTP(const std::string &label, const ServedKey &key, const std::string &code,
+							std::string &out);
+	void				syncCounters(void);
+	void				saveReplay(void);
+};
+
+int		runServer(const ServerParams &server, const TOTPParams &params, bool verbose);
+int		runClient(const ServerParams &server, bool verbose);
+// Connect to a local socket (daemon or agent), -1 on error
+int		connectToServer(const char *socketPath);
+
+#endif
@@ -0,0 +1,177 @@
+#include "AttemptThrottle.hpp"
+#include "SipHash.hpp"
+#include <chrono>
+#include <new>
+
+static_assert(OTP_THROTTLE_SHARDS > 0 && (OTP_THROTTLE_SHARDS & (OTP_THROTTLE_SHARDS - 1)) == 0,
+    "The number of shards must be a power of two");
+
+// Number of bits of a hash used to pick the shard
+static int shardBits(void)
+{
+    int bits = 0;
+
+    while ((1 << bits) < OTP_THROTTLE_SHARDS)
+        ++bits;
+    return bits;
+}
+
+AttemptThrottle::AttemptThrottle(const ThrottleParams &params) : _params(params)
+{
+    static_assert(sizeof(Slot) == OTP_THROTTLE_CACHE_LINE, "A slot must fill a cache line");
+    static_assert(sizeof(Shard) == OTP_THROTTLE_CACHE_LINE, "A shard must fill a cache line");
+
+    newSipHashKey(_hashKey);
+
+    // Each shard is kept at most half full, with some margin for an uneven spread
+    size_t perShard = (params.accounts + OTP_THROTTLE_SHARDS - 1) / OTP_THROTTLE_SHARDS;
+    size_t slots = OTP_THROTTLE_MIN_SLOTS;
+    while (slots / 2 < perShard + perShard / 4)
+        slots *= 2;
+    _shardMask = slots - 1;
+    _maxAccounts = slots / 2;
+
+    const size_t total = slots * OTP_THROTTLE_SHARDS;
+    _storage.reset(new char[total * sizeof(Slot) + OTP_THROTTLE_CACHE_LINE]);
+    uintptr_t address = reinterpret_cast<uintptr_t>(_storage.get());
+    address = (address + OTP_THROTTLE_CACHE_LINE - 1) & ~static_cast<uintptr_t>(OTP_THROTTLE_CACHE_LINE - 1);
+    Slot *first = reinterpret_cast<Slot *>(address);
+
+    for (size_t i = 0; i < total; ++i)
+    {
+        Slot *slot = new (first + i) Slot;
+        slot->hash.store(0, std::memory_order_relaxed);
+        slot->blockedUntil.store(0, std::memory_order_relaxed);
+        slot->failures.store(0, std::memory_order_relaxed);
+    }
+
+    _shards.reset(new Shard[OTP_THROTTLE_SHARDS]);
+    for (size_t i = 0; i < OTP_THROTTLE_SHARDS; ++i)
+    {
+        _shards[i].accounts.store(0, std::memory_order_relaxed);
+        _shards[i].slots = first + i * slots;
+    }
+}
+
+// The slots only hold atomics of integers, they have nothing to destroy
+AttemptThrottle::~AttemptThrottle() {}
+
+int64_t AttemptThrottle::now(void)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Find the slot of an account in its shard.
+ *
+ * The high bits of the hash pick the shard and the low bits the first
+ * slot to probe, so both are independent. Like in ReplayGuard, a slot is
+ * claimed with a compare-and-swap of its hash.
+ *
+ * @return
+ *  null if the account has no slot and 'insert' is false. In case its
+ *  shard is full, a 'TableFullException' is thrown.
+ */
+AttemptThrottle::Slot *AttemptThrottle::findSlot(uint64_t hash, bool insert) const
+{
+    static const int    bits = shardBits();
+    Shard               &shard = _shards[bits ? hash >> (64 - bits) : 0];
+
+    for (size_t i = hash & _shardMask;; i = (i + 1) & _shardMask)
+    {
+        uint64_t slotHash = shard.slots[i].hash.load(std::memory_order_acquire);
+        if (slotHash == hash)
+            return &shard.slots[i];
+        if (slotHash == 0)
+            break;
+    }
+    if (!insert)
+        return nullptr;
+
+    if (shard.accounts.fetch_add(1, std::memory_order_relaxed) >= _maxAccounts)
+    {
+        shard.accounts.fetch_sub(1, std::memory_order_relaxed);
+        throw TableFullException();
+    }
+    for (size_t i = hash & _shardMask;; i = (i + 1) & _shardMask)
+    {
+        uint64_t expected = 0;
+        if (shard.slots[i].hash.compare_exchange_strong(expected, hash, std::memory_order_acq_rel))
+            return &shard.slots[i];
+        if (expected == hash)
+        {
+            shard.accounts.fetch_sub(1, std::memory_order_relaxed);
+            return &shard.slots[i];
+        }
+    }
+}
+
+// Exponential backoff: base, 2 x base, 4 x base, ... up to the maximum delay
+int64_t AttemptThrottle::delayAfter(uint32_t failures) const
+{
+    if (failures < _params.freeAttempts)
+        return 0;
+
+    uint32_t shift = failures - _params.freeAttempts;
+    if (shift >= 32 || _params.baseDelayMs > (_params.maxDelayMs >> shift))
+        return _params.maxDelayMs;
+    return _params.baseDelayMs << shift;
+}
+
+int64_t AttemptThrottle::retryDelay(const std::string &account, int64_t nowMs) const
+{
+    const Slot *slot = findSlot(hashAccount(_hashKey, account), false);
+    if (!slot)
+        return 0;
+
+    int64_t blockedUntil = slot->blockedUntil.load(std::memory_order_acquire);
+    return blockedUntil > nowMs ? blockedUntil - nowMs : 0;
+}
+
+bool AttemptThrottle::allow(const std::string &account, int64_t nowMs) const
+{
+    return retryDelay(account, nowMs) == 0;
+}
+
+/**
+ * @brief Count a failed attempt and block the account if needed.
+ *
+ * The block end is only ever pushed later (compare-and-swap loop), so
+ * two concurrent failures can't shorten each other's delay.
+ */
+void AttemptThrottle::recordFailure(const std::string &account, int64_t nowMs)
+{
+    Slot        *slot = findSlot(hashAccount(_hashKey, account), true);
+    uint32_t    failures = slot->failures.fetch_add(1, std::memory_order_acq_rel) + 1;
+    int64_t     delay = delayAfter(failures);
+
+    if (delay == 0)
+        return;
+
+    int64_t blockedUntil = nowMs + delay;
+    int64_t current = slot->blockedUntil.load(std::memory_order_acquire);
+    while (current < blockedUntil
+        && !slot->blockedUntil.compare_exchange_weak(current, blockedUntil, std::memory_order_acq_rel))
+        ;
+}
+
+void AttemptThrottle::recordSuccess(const std::string &account)
+{
+    Slot *slot = findSlot(hashAccount(_hashKey, account), false);
+    if (!slot)
+        return;
+
+    // Nothing to write for an account without failures, the usual case
+    if (slot->failures.load(std::memory_order_relaxed) != 0)
+        slot->failures.store(0, std::memory_order_release);
+    if (slot->blockedUntil.load(std::memory_order_relaxed) != 0)
+        slot->blockedUntil.store(0, std::memory_order_release);
+}
+
+uint32_t AttemptThrottle::failures(const std::string &account) const
+{
+    const Slot *slot = findSlot(hashAccount(_hashKey, account), false);
+
+    return slot ? slot->failures.load(std::memory_order_acquire) : 0;
+}
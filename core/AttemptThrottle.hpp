@@ -0,0 +1,105 @@
+#ifndef ATTEMPTTHROTTLE_HPP
+# define ATTEMPTTHROTTLE_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <atomic>
+# include <memory>
+# include <stdexcept>
+# include <string>
+
+/*
+ * Brute-force throttling of code verifications
+ *
+ * A 6-digit code has only 10^6 values, so the number of attempts on an
+ * account must be limited (RFC 4226, section 7.3). After a few free
+ * failures, every failed attempt blocks the account for a delay which
+ * doubles with each new failure, up to a maximum. A valid code resets
+ * the account.
+ *
+ * allow() is called before any HMAC is computed: for a blocked account
+ * it only costs the probe of the account slot and one atomic load, so
+ * hammering an account costs no crypto at all.
+ *
+ * The accounts are spread over independent shards (by the high bits of
+ * their hash, SipHash with a random key), each one an open addressing
+ * table with its own account count. Every slot takes a whole cache line, so threads working on
+ * different accounts never write to the same line.
+ */
+
+enum ThrottleLimits
+{
+	OTP_THROTTLE_SHARDS			= 64,		// Power of two
+	OTP_THROTTLE_MIN_SLOTS		= 64,		// Per shard, power of two
+	OTP_THROTTLE_CACHE_LINE		= 64
+};
+
+struct ThrottleParams
+{
+	uint32_t	freeAttempts;	// Failures allowed before the first delay
+	int64_t		baseDelayMs;	// Delay after the first throttled failure
+	int64_t		maxDelayMs;
+	size_t		accounts;		// Number of accounts that can be tracked
+
+	ThrottleParams(): freeAttempts(3), baseDelayMs(1000), maxDelayMs(15 * 60 * 1000), accounts(65536) {}
+};
+
+class AttemptThrottle
+{
+public:
+	explicit AttemptThrottle(const ThrottleParams &params = ThrottleParams());
+	~AttemptThrottle();
+
+	// Milliseconds of a monotonic clock, the time base of the functions below
+	static int64_t	now(void);
+
+	// 0 if the account may try a code at 'nowMs', otherwise the remaining delay in ms
+	int64_t		retryDelay(const std::string &account, int64_t nowMs) const;
+	bool		allow(const std::string &account, int64_t nowMs) const;
+	void		recordFailure(const std::string &account, int64_t nowMs);
+	void		recordSuccess(const std::string &account);
+	uint32_t	failures(const std::string &account) const;
+
+	class TableFullException : public std::exception
+	{
+	public:
+		TableFullException() throw() {}
+		const char *what() const throw() {
+			return "The throttle can't track more accounts.";
+		}
+		~TableFullException() throw() {}
+	};
+
+private:
+	// A whole cache line: the slots are allocated on a cache line boundary
+	struct Slot
+	{
+		std::atomic<uint64_t>	hash;			// 0: empty slot
+		std::atomic<int64_t>	blockedUntil;	// In ms, 0: not blocked
+		std::atomic<uint32_t>	failures;
+		char					padding[OTP_THROTTLE_CACHE_LINE - 20];
+	};
+
+	// The account counts of two shards are never in the same cache line
+	struct Shard
+	{
+		std::atomic<size_t>		accounts;
+		Slot					*slots;
+		char					padding[OTP_THROTTLE_CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(Slot *)];
+	};
+
+	ThrottleParams				_params;
+	uint64_t					_hashKey[2];	// SipHash key of the account hashes
+	size_t						_shardMask;		// Slot index mask inside a shard
+	size_t						_maxAccounts;	// Per shard
+	std::unique_ptr<char[]>		_storage;		// All the slots, with room for the alignment
+	std::unique_ptr<Shard[]>	_shards;
+
+	Slot		*findSlot(uint64_t hash, bool insert) const;
+	int64_t		delayAfter(uint32_t failures) const;
+
+	AttemptThrottle(const AttemptThrottle &);
+	AttemptThrottle &operator=(const AttemptThrottle &);
+};
+
+#endif
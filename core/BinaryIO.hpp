@@ -0,0 +1,88 @@
+#ifndef BINARYIO_HPP
+# define BINARYIO_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <cerrno>
+# include <cstring>
+# include <string>
+
+/*
+ * Helpers shared by the binary files and the system calls
+ *
+ * The key store, the replay guard snapshot and the HOTP counter log all
+ * store their integers little-endian, whatever the host byte order; the
+ * loads are also used to read hash input words. Byte by byte, they have
+ * no alignment requirement, and compilers turn them into a single move on
+ * little-endian hosts.
+ *
+ * The files replaced with a rename (snapshot, compacted log) are synced,
+ * then their directory, so a crash leaves either the old or the new one.
+ */
+
+inline void	storeLE32(uint8_t *p, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		p[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline uint32_t	loadLE32(const uint8_t *p)
+{
+	return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+		| static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline void	storeLE64(uint8_t *p, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+		p[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline uint64_t	loadLE64(const uint8_t *p)
+{
+	uint64_t value = 0;
+
+	for (int i = 7; i >= 0; --i)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+// "<what>: <error of errno>", the message of a failed system call
+inline std::string	systemError(const char *what)
+{
+	return std::string(what) + ": " + std::strerror(errno);
+}
+
+// write() until all the bytes are written, retried on EINTR
+inline bool	writeAll(int fd, const uint8_t *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t written = write(fd, data, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+// A renamed file is only durable once the entry in its directory is
+inline bool	syncDirectory(const std::string &fileName)
+{
+	size_t		slash = fileName.rfind('/');
+	std::string	directory = slash == std::string::npos ? "." : fileName.substr(0, slash + 1);
+	int			fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "Clock.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <time.h>
+
+int64_t SystemClock::now(void) const
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t CoarseClock::now(void) const
+{
+    struct timespec time;
+
+#ifdef CLOCK_REALTIME_COARSE
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &time) == 0)
+        return time.tv_sec;
+#endif
+    clock_gettime(CLOCK_REALTIME, &time);
+    return time.tv_sec;
+}
+
+FakeClock::FakeClock(int64_t unixTime): _time(unixTime) {}
+
+int64_t FakeClock::now(void) const { return _time.load(std::memory_order_relaxed); }
+void FakeClock::set(int64_t unixTime) { _time.store(unixTime, std::memory_order_relaxed); }
+void FakeClock::advance(int64_t seconds) { _time.fetch_add(seconds, std::memory_order_relaxed); }
+
+const Clock &systemClock(void)
+{
+    static const SystemClock clock;
+    return clock;
+}
+
+const Clock &coarseClock(void)
+{
+    static const CoarseClock clock;
+    return clock;
+}
+
+// The empty step (end <= start) matches no time, so the first call computes it
+CounterCache::CounterCache(): _step(), _period(0), _refreshes(0) {}
+
+CounterCache &CounterCache::local(void)
+{
+    static thread_local CounterCache cache;
+    return cache;
+}
+
+/**
+ * @brief Time step of a Unix time, from the cache when it's the same one.
+ *
+ * The counter is T = floor(time / period), times before the epoch are
+ * counted in the first step. The step must not be used after another
+ * call on the same thread: it's overwritten at the next boundary.
+ *
+ * @return
+ *  In case the period is 0, an 'invalid_argument' exception is thrown.
+ */
+const TimeStep &CounterCache::at(int64_t unixTime, uint64_t period)
+{
+    if (period == _period && unixTime >= _step.start && unixTime < _step.end)
+        return _step;
+    if (period == 0)
+        throw std::invalid_argument("The TOTP period must be positive.");
+
+    uint64_t counter = unixTime > 0 ? static_cast<uint64_t>(unixTime) / period : 0;
+
+    _period = period;
+    _step.counter = counter;
+    _step.start = static_cast<int64_t>(counter * period);
+    _step.end = _step.start + static_cast<int64_t>(period);
+    if (unixTime < 0)
+        _step.start = INT64_MIN;
+    for (int i = 7; i >= 0; --i)
+    {
+        _step.bytes[i] = counter & 0xFF;
+        counter >>= 8;
+    }
+    ++_refreshes;
+    return _step;
+}
+
+const TimeStep &CounterCache::current(const Clock &clock, uint64_t period)
+{
+    return at(clock.now(), period);
+}
+
+size_t CounterCache::refreshes(void) const { return _refreshes; }
+
+DriftEstimate::DriftEstimate(): _drift(0), _resyncCounter(0), _resyncOffset(0) {}
+
+int DriftEstimate::predicted(void) const
+{
+    int half = _drift < 0 ? -OTP_DRIFT_SCALE / 2 : OTP_DRIFT_SCALE / 2;
+
+    return (_drift + half) / OTP_DRIFT_SCALE;
+}
+
+static int32_t clampOffset(int offset)
+{
+    return std::max(-static_cast<int>(OTP_DRIFT_MAX_STEPS), std::min(offset, static_cast<int>(OTP_DRIFT_MAX_STEPS)));
+}
+
+// Exponential smoothing: one odd code doesn't move the prediction, a steady drift does
+void DriftEstimate::record(int offset)
+{
+    int32_t target = clampOffset(offset) * OTP_DRIFT_SCALE;
+
+    _drift += (target - _drift) / OTP_DRIFT_WEIGHT;
+    _resyncCounter = 0;
+}
+
+double DriftEstimate::drift(void) const
+{
+    return static_cast<double>(_drift) / OTP_DRIFT_SCALE;
+}
+
+int32_t DriftEstimate::scaled(void) const
+{
+    return _drift;
+}
+
+// A saved estimate is trusted no more than a computed one: it stays within OTP_DRIFT_MAX_STEPS
+void DriftEstimate::restore(int32_t scaled)
+{
+    const int32_t limit = OTP_DRIFT_MAX_STEPS * OTP_DRIFT_SCALE;
+
+    _drift = std::max(-limit, std::min(scaled, limit));
+    _resyncCounter = 0;
+}
+
+/**
+ * @brief Whether a code matched outside of the search confirms the last one.
+ *
+ * It must be the next code of the token (the counter right after the
+ * last one), at the same offset. The time step of the verifier may not
+ * have moved yet when the token's did, so the offset may also be one
+ * more.
+ */
+bool DriftEstimate::confirms(int offset, uint64_t counter) const
+{
+    return _resyncCounter != 0 && counter == _resyncCounter
+        && (offset == _resyncOffset || offset == _resyncOffset + 1);
+}
+
+void DriftEstimate::resync(int offset, uint64_t counter)
+{
+    if (confirms(offset, counter))
+    {
+        _drift = clampOffset(offset) * OTP_DRIFT_SCALE;
+        _resyncCounter = 0;
+        return;
+    }
+    // The last counter can't be followed, so 0 is never expected
+    _resyncCounter = counter + 1;
+    _resyncOffset = offset;
+}
+
+DriftSearch::DriftSearch(const DriftEstimate &drift, int window)
+    : _predicted(drift.predicted()), _window(std::max(window, 0)), _distance(0),
+      _limit(std::abs(drift.predicted()) + std::max(window, 0)), _above(false)
+{
+}
+
+/**
+ * @brief Offsets from the prediction P: P, P-1, P+1, P-2, P+2, ...
+ *
+ * Only the ones within 'window' of P or of 0 are given. With no drift,
+ * it's the same order as the stateless verification: 0, -1, +1, ...
+ */
+bool DriftSearch::next(int &offset)
+{
+    while (_distance <= _limit)
+    {
+        int candidate = _above ? _predicted + _distance : _predicted - _distance;
+
+        if (_above || _distance == 0)
+        {
+            ++_distance;
+            _above = false;
+        }
+        else
+            _above = true;
+        if (covers(candidate))
+        {
+            offset = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DriftSearch::covers(int offset) const
+{
+    return std::abs(offset - _predicted) <= _window || std::abs(offset) <= _window;
+}
@@ -0,0 +1,163 @@
+#ifndef CLOCK_HPP
+# define CLOCK_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <atomic>
+
+/*
+ * Clocks and time steps
+ *
+ * A TOTP code only depends on the Unix time in seconds, so the clock is
+ * injected (TOTPGenerator::setClock()) instead of being read directly:
+ *  - SystemClock: std::chrono::system_clock, the default
+ *  - CoarseClock: CLOCK_REALTIME_COARSE, read from the vDSO without a
+ *    syscall and much cheaper, at the cost of a few milliseconds of
+ *    precision which a 30-second window doesn't care about
+ *  - FakeClock: set by hand, for deterministic tests and benchmarks
+ *
+ * Each thread also keeps the current time step (CounterCache): its
+ * counter and the big-endian bytes hashed by HMAC are only computed
+ * again when the time leaves the step, so a batch of verifications in
+ * the same window shares one counter without any division or encoding.
+ *
+ * Tokens drift: a DriftEstimate keeps, for one account, the exponentially
+ * smoothed time step offset of its last accepted codes. A verification
+ * (DriftSearch) then checks the predicted offset first and goes outward
+ * from it, so a token running a step ahead costs one HMAC instead of the
+ * whole window. The offsets checked are the window around the prediction
+ * and the nominal window around T, so a token which was reset or drifted
+ * back still verifies (and moves the estimate back).
+ *
+ * A token further away is resynchronized (RFC 6238, section 6): a code
+ * matching outside of the search, up to OTP_DRIFT_MAX_STEPS steps from
+ * T, is not accepted, but its offset is kept. Once the next code of the
+ * token matches there too, it's accepted and the estimate moves to that
+ * offset at once.
+ */
+
+class Clock
+{
+public:
+	virtual ~Clock() {}
+	// Seconds since the Unix epoch
+	virtual int64_t	now(void) const = 0;
+};
+
+class SystemClock : public Clock
+{
+public:
+	virtual int64_t	now(void) const;
+};
+
+class CoarseClock : public Clock
+{
+public:
+	virtual int64_t	now(void) const;
+};
+
+class FakeClock : public Clock
+{
+public:
+	explicit FakeClock(int64_t unixTime = 0);
+
+	virtual int64_t	now(void) const;
+	void			set(int64_t unixTime);
+	void			advance(int64_t seconds);
+
+private:
+	std::atomic<int64_t>	_time;
+};
+
+// Shared instances, they have no state
+const Clock	&systemClock(void);
+const Clock	&coarseClock(void);
+
+// A time step: its counter, the counter as hashed by HMAC, and its bounds
+struct TimeStep
+{
+	uint64_t	counter;
+	uint8_t		bytes[8];	// Big-endian counter
+	int64_t		start;		// First second of the step
+	int64_t		end;		// First second of the next step
+};
+
+class CounterCache
+{
+public:
+	CounterCache();
+
+	// The cache of the calling thread
+	static CounterCache	&local(void);
+
+	// Time step of 'unixTime', computed again only outside of the cached one
+	const TimeStep		&at(int64_t unixTime, uint64_t period);
+	// Same as above, for the current time of 'clock' (read once)
+	const TimeStep		&current(const Clock &clock, uint64_t period);
+	// Times the step was computed, to check that it's only done at boundaries
+	size_t				refreshes(void) const;
+
+private:
+	TimeStep	_step;
+	uint64_t	_period;
+	size_t		_refreshes;
+
+	CounterCache(const CounterCache &);
+	CounterCache &operator=(const CounterCache &);
+};
+
+enum DriftLimits
+{
+	OTP_DRIFT_SCALE		= 256,	// Fixed point of the estimate: 1/256 time step
+	OTP_DRIFT_WEIGHT	= 4,	// Each new offset moves the estimate by 1/4 of the way
+	OTP_DRIFT_MAX_STEPS	= 10	// Largest predicted offset, in time steps
+};
+
+class DriftEstimate
+{
+public:
+	DriftEstimate();
+
+	// Offset to check first: the estimate rounded to a time step
+	int		predicted(void) const;
+	// A code was accepted at 'offset' time steps from T
+	void	record(int offset);
+	// Smoothed offset, in time steps
+	double	drift(void) const;
+
+	// The estimate in 1/OTP_DRIFT_SCALE time steps, to save it and restore it
+	int32_t	scaled(void) const;
+	void	restore(int32_t scaled);
+
+	// The code of 'counter' matched at 'offset', outside of the search: it follows the last one
+	bool	confirms(int offset, uint64_t counter) const;
+	// Move the estimate to 'offset' if confirms(), otherwise wait for the next code there
+	void	resync(int offset, uint64_t counter);
+
+private:
+	int32_t		_drift;			// In 1/OTP_DRIFT_SCALE time steps
+	uint64_t	_resyncCounter;	// Counter expected from the next code, 0: no resync pending
+	int			_resyncOffset;	// Offset of the last code matched outside of the search
+};
+
+// The offsets of one verification, in the order they're checked
+class DriftSearch
+{
+public:
+	// 'window' offsets on each side of the prediction, and of T
+	DriftSearch(const DriftEstimate &drift, int window);
+
+	// Next offset to check, false once all of them were given
+	bool	next(int &offset);
+	// 'offset' is one of the offsets checked
+	bool	covers(int offset) const;
+
+private:
+	int		_predicted;
+	int		_window;
+	int		_distance;	// From the prediction
+	int		_limit;		// Farthest offset of the nominal window
+	bool	_above;		// The offset above the prediction comes next
+};
+
+#endif
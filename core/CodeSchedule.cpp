@@ -0,0 +1,268 @@
+#include "CodeSchedule.hpp"
+#include "TOTPBatch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#ifdef __linux__
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+// Codes computed by the batch engine before they're published in the table
+#define OTP_SCHEDULE_CHUNK	256
+
+CodeSchedule::CodeSchedule(size_t capacity, int digits, uint64_t period, const Clock &clock)
+    : _capacity(capacity), _digits(digits), _period(period), _clock(clock), _size(0),
+      _buckets(0), _rolls(0), _stop(false)
+{
+    if (period == 0)
+        throw std::invalid_argument("The TOTP period must be positive.");
+    if (digits <= 0 || digits > 9)
+        throw std::invalid_argument("A scheduled code has 1 to 9 digits.");
+    if (capacity > UINT32_MAX)
+        throw std::invalid_argument("A code schedule holds at most 2^32 accounts.");
+
+    // About one account per bucket, and never more buckets than codes
+    _buckets = std::max<size_t>(capacity, OTP_SCHEDULE_MIN_BUCKETS);
+    _buckets = std::min<size_t>(_buckets, std::min<size_t>(codeModulus(digits), OTP_SCHEDULE_MAX_BUCKETS));
+
+    _keys.reset(new PreparedKey[capacity]);
+    _codes.reset(new std::atomic<uint32_t>[capacity * OTP_SCHEDULE_COLUMNS]);
+    _cursors.reset(new uint32_t[_buckets + 1]);
+    for (int i = 0; i < OTP_SCHEDULE_COLUMNS; ++i)
+    {
+        _columns[i].counter.store(OTP_SCHEDULE_EMPTY, std::memory_order_relaxed);
+        _columns[i].filled.store(0, std::memory_order_relaxed);
+        _columns[i].indexCounter.store(OTP_SCHEDULE_EMPTY, std::memory_order_relaxed);
+        _columns[i].bucketStart.reset(new std::atomic<uint32_t>[_buckets + 1]);
+        _columns[i].bucketSlots.reset(new std::atomic<uint32_t>[capacity]);
+    }
+}
+
+CodeSchedule::~CodeSchedule()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    if (_thread.joinable())
+        _thread.join();
+}
+
+/**
+ * @brief Fill the table for the current time, then keep rolling it.
+ *
+ * The table is complete when this returns, so the first requests are
+ * already served from it.
+ */
+void CodeSchedule::start(bool pin)
+{
+    if (_thread.joinable())
+        return;
+    refresh();
+    _thread = std::thread(&CodeSchedule::rollLoop, this);
+    if (pin)
+        pinThread();
+}
+
+// Pinning is only a hint, as for ThreadPool: the last CPU is left to the thread
+void CodeSchedule::pinThread(void)
+{
+#ifdef __linux__
+    unsigned cpus = std::thread::hardware_concurrency();
+    cpu_set_t set;
+
+    if (cpus < 2)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpus - 1, &set);
+    pthread_setaffinity_np(_thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+size_t CodeSchedule::add(const PreparedKey &key)
+{
+    size_t slot;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        slot = _size.load(std::memory_order_relaxed);
+        if (slot >= _capacity)
+            return OTP_SCHEDULE_FULL;
+        _keys[slot] = key;
+        _size.store(slot + 1, std::memory_order_release);
+    }
+    _wake.notify_one();
+    return slot;
+}
+
+size_t CodeSchedule::size(void) const { return _size.load(std::memory_order_acquire); }
+size_t CodeSchedule::rolls(void) const { return _rolls.load(std::memory_order_relaxed); }
+
+/**
+ * @brief Get a code from the table, without locking.
+ *
+ * The tag of the column is read again after the code: if the column was
+ * rewritten meanwhile, the code may be from another time step and the
+ * lookup fails.
+ */
+bool CodeSchedule::lookup(size_t slot, uint64_t counter, uint32_t &code) const noexcept
+{
+    const Column &column = _columns[counter % OTP_SCHEDULE_COLUMNS];
+
+    if (counter == OTP_SCHEDULE_EMPTY || column.counter.load(std::memory_order_acquire) != counter
+        || slot >= column.filled.load(std::memory_order_acquire))
+        return false;
+    code = _codes[(counter % OTP_SCHEDULE_COLUMNS) * _capacity + slot].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return column.counter.load(std::memory_order_relaxed) == counter;
+}
+
+/**
+ * @brief Find the accounts giving a code, without locking.
+ *
+ * Only the bucket of the code is read, and every slot in it is compared
+ * with the code: different codes can share a bucket when they have more
+ * than 6 digits. As for lookup(), the tag is read again at the end.
+ */
+bool CodeSchedule::findSlots(uint64_t counter, uint32_t code, uint32_t *slots, size_t maxSlots,
+    size_t &found) const noexcept
+{
+    size_t          index = counter % OTP_SCHEDULE_COLUMNS;
+    const Column    &column = _columns[index];
+
+    found = 0;
+    if (counter == OTP_SCHEDULE_EMPTY || column.indexCounter.load(std::memory_order_acquire) != counter)
+        return false;
+
+    const std::atomic<uint32_t> *codes = &_codes[index * _capacity];
+    size_t                      bucket = code % _buckets;
+    size_t                      begin = column.bucketStart[bucket].load(std::memory_order_relaxed);
+    // Bounded even if the column is rewritten meanwhile, the tag check then fails
+    size_t                      end = std::min<size_t>(
+        column.bucketStart[bucket + 1].load(std::memory_order_relaxed), _capacity);
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint32_t slot = column.bucketSlots[i].load(std::memory_order_relaxed);
+
+        if (slot >= _capacity || codes[slot].load(std::memory_order_relaxed) != code)
+            continue;
+        if (found < maxSlots)
+            slots[found] = slot;
+        ++found;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (column.indexCounter.load(std::memory_order_relaxed) == counter)
+        return true;
+    found = 0;
+    return false;
+}
+
+/**
+ * @brief Compute the codes of a time step, for the first 'count' accounts.
+ *
+ * A column already holding this step only gets the accounts added since
+ * it was computed. Otherwise its tag is cleared before the first code is
+ * overwritten, and set to the new step once every code is written. The
+ * index is built again in both cases, under its own tag.
+ */
+void CodeSchedule::fillColumn(uint64_t counter, size_t count)
+{
+    Column                  &column = _columns[counter % OTP_SCHEDULE_COLUMNS];
+    std::atomic<uint32_t>   *codes = &_codes[(counter % OTP_SCHEDULE_COLUMNS) * _capacity];
+    uint32_t                computed[OTP_SCHEDULE_CHUNK];
+    size_t                  base = 0;
+
+    if (column.counter.load(std::memory_order_relaxed) == counter)
+    {
+        base = column.filled.load(std::memory_order_relaxed);
+        if (base >= count && column.indexCounter.load(std::memory_order_relaxed) == counter)
+            return;
+        column.indexCounter.store(OTP_SCHEDULE_EMPTY, std::memory_order_relaxed);
+    }
+    else
+    {
+        column.counter.store(OTP_SCHEDULE_EMPTY, std::memory_order_relaxed);
+        column.indexCounter.store(OTP_SCHEDULE_EMPTY, std::memory_order_relaxed);
+        column.filled.store(0, std::memory_order_relaxed);
+        _rolls.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (; base < count; base += OTP_SCHEDULE_CHUNK)
+    {
+        size_t chunk = std::min<size_t>(OTP_SCHEDULE_CHUNK, count - base);
+
+        computeTOTPBatch(&_keys[base], counter, chunk, computed, _digits);
+        for (size_t i = 0; i < chunk; ++i)
+            codes[base + i].store(computed[i], std::memory_order_relaxed);
+        column.filled.store(base + chunk, std::memory_order_release);
+    }
+    column.counter.store(counter, std::memory_order_release);
+
+    indexColumn(column, codes, count);
+    column.indexCounter.store(counter, std::memory_order_release);
+}
+
+// Counting sort of the slots by bucket: the slots of a bucket stay in ascending order
+void CodeSchedule::indexColumn(Column &column, const std::atomic<uint32_t> *codes, size_t count)
+{
+    std::fill(_cursors.get(), _cursors.get() + _buckets + 1, 0);
+    for (size_t slot = 0; slot < count; ++slot)
+        ++_cursors[codes[slot].load(std::memory_order_relaxed) % _buckets + 1];
+    for (size_t bucket = 0; bucket < _buckets; ++bucket)
+        _cursors[bucket + 1] += _cursors[bucket];
+    for (size_t bucket = 0; bucket <= _buckets; ++bucket)
+        column.bucketStart[bucket].store(_cursors[bucket], std::memory_order_relaxed);
+    for (size_t slot = 0; slot < count; ++slot)
+    {
+        uint32_t &cursor = _cursors[codes[slot].load(std::memory_order_relaxed) % _buckets];
+        column.bucketSlots[cursor++].store(static_cast<uint32_t>(slot), std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Compute the steps T-1, T and T+1, T being the step of the time
+ * OTP_SCHEDULE_LEAD seconds from now.
+ *
+ * Called shortly before a boundary, the next step is then the new T: the
+ * only column computed is the one of T+2, written over the one of T-2.
+ */
+uint64_t CodeSchedule::refresh(void)
+{
+    std::lock_guard<std::mutex> guard(_refreshLock);
+    int64_t                     ahead = _clock.now() + OTP_SCHEDULE_LEAD;
+    uint64_t                    center = ahead > 0 ? static_cast<uint64_t>(ahead) / _period : 0;
+    size_t                      count = _size.load(std::memory_order_acquire);
+
+    // The current step first, it's the one most requests need
+    fillColumn(center, count);
+    fillColumn(center + 1, count);
+    if (center > 0)
+        fillColumn(center - 1, count);
+    return center;
+}
+
+// Roll the table before each boundary, and compute the codes of the accounts added meanwhile
+void CodeSchedule::rollLoop(void)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    while (!_stop)
+    {
+        size_t count = _size.load(std::memory_order_relaxed);
+
+        lock.unlock();
+        uint64_t center = refresh();
+        lock.lock();
+
+        int64_t next = static_cast<int64_t>((center + 1) * _period) - OTP_SCHEDULE_LEAD;
+        int64_t delay = next - _clock.now();
+        if (delay > 0)
+            _wake.wait_for(lock, std::chrono::seconds(delay), [this, count]() {
+                return _stop || _size.load(std::memory_order_relaxed) != count;
+            });
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef CODESCHEDULE_HPP
+# define CODESCHEDULE_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <atomic>
+# include <condition_variable>
+# include <memory>
+# include <mutex>
+# include <thread>
+
+# include "Clock.hpp"
+# include "PreparedKey.hpp"
+# include "TOTPGenerator.hpp"
+
+/*
+ * Rolling table of upcoming codes (HMAC-SHA1 only)
+ *
+ * For every account added to it, the schedule keeps the codes of the
+ * time steps T-1, T and T+1 in a compact array, one column of codes per
+ * time step. A background thread rolls the table forward shortly before
+ * each boundary (OTP_SCHEDULE_LEAD seconds): it computes the column of
+ * T+2 in bulk with the batch engine, over the column of T-2 which is not
+ * used anymore. Verifying or generating a code is then an array lookup,
+ * without any HMAC at request time.
+ *
+ * The thread is pinned to the last CPU (Linux only), which the event
+ * loop of the daemon doesn't use.
+ *
+ * Lookups never lock: each column is tagged with its counter, which is
+ * checked before and after reading a code (as a seqlock), so a code of
+ * a column being rewritten is never returned. A lookup can fail (new
+ * account not computed yet, time outside of the table): the caller then
+ * computes the code itself.
+ *
+ * Each column also has a reverse index, from a code to the accounts
+ * giving it at that time step, for the flows where the user only enters
+ * a code. The codes are sorted by bucket (code % buckets, at most 10^6
+ * buckets: one per code up to 6 digits) with a counting sort, so a
+ * bucket is a range of slots and a lookup only reads that range. The
+ * index of a column is built when the column is computed, and again
+ * when accounts are added to it; it has its own tag, cleared meanwhile.
+ */
+
+enum ScheduleLimits
+{
+	OTP_SCHEDULE_COLUMNS	= 4,	// T-1, T, T+1, and the one being computed
+	OTP_SCHEDULE_LEAD		= 2,	// Seconds before a boundary when the table rolls
+	OTP_SCHEDULE_MIN_BUCKETS	= 1024,
+	OTP_SCHEDULE_MAX_BUCKETS	= 1000000
+};
+
+# define OTP_SCHEDULE_FULL	static_cast<size_t>(-1)
+# define OTP_SCHEDULE_EMPTY	UINT64_MAX	// Tag of a column without valid codes
+
+class CodeSchedule
+{
+public:
+	// At most 'capacity' accounts, with codes of 'digits' digits and a 'period' seconds time step
+	// (an 'invalid_argument' exception is thrown for a period of 0, invalid digits or a capacity over 2^32)
+	CodeSchedule(size_t capacity, int digits = OTP_TOTP_CODE_DIGIT, uint64_t period = OTP_TOTP_TIME,
+		const Clock &clock = systemClock());
+	~CodeSchedule();
+
+	// Fill the table and roll it from a background thread, until destroyed
+	void	start(bool pin = true);
+	// Add an account, returns its slot or OTP_SCHEDULE_FULL
+	size_t	add(const PreparedKey &key);
+	size_t	size(void) const;
+	// Code of the account in 'slot' at 'counter', false if it isn't in the table
+	bool	lookup(size_t slot, uint64_t counter, uint32_t &code) const noexcept;
+	/*
+	 * Slots of the accounts whose code at 'counter' is 'code', in ascending
+	 * order: the first 'maxSlots' are written to 'slots', and 'found' is set
+	 * to the number of accounts, which may be more. False if the index of
+	 * this time step isn't in the table.
+	 */
+	bool	findSlots(uint64_t counter, uint32_t code, uint32_t *slots, size_t maxSlots,
+				size_t &found) const noexcept;
+	// Bring the table up to date with the clock (done by the thread), returns the counter served
+	uint64_t	refresh(void);
+	// Columns computed so far, new accounts not included
+	size_t	rolls(void) const;
+
+private:
+	struct Column
+	{
+		std::atomic<uint64_t>	counter;	// OTP_SCHEDULE_EMPTY while it's written
+		std::atomic<size_t>		filled;		// Slots computed
+		std::atomic<uint64_t>	indexCounter;	// Tag of the index, OTP_SCHEDULE_EMPTY while it's built
+		std::unique_ptr<std::atomic<uint32_t>[]>	bucketStart;	// First entry of each bucket, and the end
+		std::unique_ptr<std::atomic<uint32_t>[]>	bucketSlots;	// Slots, sorted by bucket then slot
+	};
+
+	size_t								_capacity;
+	int									_digits;
+	uint64_t							_period;
+	const Clock							&_clock;
+	std::unique_ptr<PreparedKey[]>		_keys;
+	std::atomic<size_t>					_size;		// Keys added, published after the key itself
+	Column								_columns[OTP_SCHEDULE_COLUMNS];
+	std::unique_ptr<std::atomic<uint32_t>[]>	_codes;	// Column 'c' holds slots [c * capacity, (c + 1) * capacity)
+	size_t								_buckets;
+	std::unique_ptr<uint32_t[]>			_cursors;	// Counting sort of the index builds
+	std::atomic<size_t>					_rolls;
+	std::mutex							_lock;		// Adding accounts and stopping the thread
+	std::mutex							_refreshLock;	// One refresh at a time
+	std::condition_variable				_wake;
+	std::thread							_thread;
+	bool								_stop;
+
+	void	fillColumn(uint64_t counter, size_t count);
+	void	indexColumn(Column &column, const std::atomic<uint32_t> *codes, size_t count);
+	void	rollLoop(void);
+	void	pinThread(void);
+
+	CodeSchedule(const CodeSchedule &);
+	CodeSchedule &operator=(const CodeSchedule &);
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "CounterLog.hpp"
+#include "BinaryIO.hpp"
+#include "SipHash.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// Mix of both fields (splitmix64 finalizer), so a torn or zeroed record doesn't pass
+static uint64_t recordCheck(uint64_t hash, uint64_t counter)
+{
+    uint64_t x = hash ^ (counter * 0x9E3779B97F4A7C15ull);
+
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+CounterLog::CounterLog(const std::string &fileName)
+    : _fileName(fileName), _fd(-1), _appended(0), _durable(0), _records(0),
+      _syncs(0), _compactions(0), _syncing(false), _failed(false)
+{
+    _fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_fd < 0)
+        throw LogException(systemError(fileName.c_str()));
+    try
+    {
+        replay();
+    }
+    catch (std::exception &)
+    {
+        close(_fd);
+        throw;
+    }
+}
+
+// The records still buffered are written, but no one waits for them anymore
+CounterLog::~CounterLog()
+{
+    if (!_buffer.empty() && !_failed)
+        writeRecords(_buffer);
+    close(_fd);
+}
+
+/**
+ * @brief Load the counters from the log, creating it if it's empty.
+ *
+ * The log ends at the first invalid record: what follows is cut off, so
+ * the next records are appended right after the valid ones.
+ */
+void CounterLog::replay(void)
+{
+    struct stat             status;
+    std::vector<uint8_t>    content;
+
+    if (fstat(_fd, &status) != 0)
+        throw LogException(systemError("fstat"));
+    content.resize(status.st_size);
+    for (size_t done = 0; done < content.size();)
+    {
+        ssize_t count = pread(_fd, content.data() + done, content.size() - done, done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            throw LogException(systemError("read"));
+        done += count;
+    }
+
+    if (content.empty())
+    {
+        newSipHashKey(_hashKey);
+        if (!writeHeader(_fd) || fdatasync(_fd) != 0 || !syncDirectory(_fileName))
+            throw LogException(systemError("create"));
+        return;
+    }
+    if (content.size() < OTP_COUNTER_LOG_HEADER_SIZE
+        || memcmp(content.data(), OTP_COUNTER_LOG_MAGIC, OTP_COUNTER_LOG_MAGIC_SIZE) != 0)
+        throw LogException("'" + _fileName + "' is not a counter log.");
+    loadSipHashKey(&content[OTP_COUNTER_LOG_MAGIC_SIZE], _hashKey);
+
+    size_t end = OTP_COUNTER_LOG_HEADER_SIZE;
+    for (; end + OTP_COUNTER_LOG_RECORD_SIZE <= content.size(); end += OTP_COUNTER_LOG_RECORD_SIZE)
+    {
+        uint64_t hash = loadLE64(&content[end]);
+        uint64_t counter = loadLE64(&content[end + 8]);
+
+        if (hash == 0 || loadLE64(&content[end + 16]) != recordCheck(hash, counter))
+            break;
+        uint64_t &next = _counters[hash];
+        next = std::max(next, counter);
+        ++_records;
+    }
+    if (end != content.size() && (ftruncate(_fd, end) != 0 || fdatasync(_fd) != 0))
+        throw LogException(systemError("truncate"));
+    if (lseek(_fd, end, SEEK_SET) < 0)
+        throw LogException(systemError("lseek"));
+}
+
+bool CounterLog::writeHeader(int fd) const
+{
+    uint8_t header[OTP_COUNTER_LOG_HEADER_SIZE];
+
+    memcpy(header, OTP_COUNTER_LOG_MAGIC, OTP_COUNTER_LOG_MAGIC_SIZE);
+    storeSipHashKey(header + OTP_COUNTER_LOG_MAGIC_SIZE, _hashKey);
+    return writeAll(fd, header, sizeof(header));
+}
+
+void CounterLog::appendRecord(std::vector<uint8_t> &records, uint64_t hash, uint64_t counter) const
+{
+    records.resize(records.size() + OTP_COUNTER_LOG_RECORD_SIZE);
+    uint8_t *record = &records[records.size() - OTP_COUNTER_LOG_RECORD_SIZE];
+    storeLE64(record, hash);
+    storeLE64(record + 8, counter);
+    storeLE64(record + 16, recordCheck(hash, counter));
+}
+
+uint64_t CounterLog::next(const std::string &account) const
+{
+    std::lock_guard<std::mutex>                             guard(_lock);
+    std::unordered_map<uint64_t, uint64_t>::const_iterator  it = _counters.find(hashAccount(_hashKey, account));
+
+    return it == _counters.end() ? 0 : it->second;
+}
+
+bool CounterLog::advance(const std::string &account, uint64_t counter)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    uint64_t                    hash = hashAccount(_hashKey, account);
+
+    if (_failed)
+        throw LogException("a previous write failed.");
+
+    std::unordered_map<uint64_t, uint64_t>::iterator it = _counters.find(hash);
+    if (it == _counters.end() ? counter == 0 : counter <= it->second)
+        return false;
+    _counters[hash] = counter;
+    appendRecord(_buffer, hash, counter);
+    ++_appended;
+    return true;
+}
+
+/**
+ * @brief Group commit: wait until every record appended so far is durable.
+ *
+ * If no write is in progress, the caller writes all the buffered records
+ * (its own and the ones of the threads waiting) and syncs them once.
+ * Otherwise it waits: the records it's waiting for were either in the
+ * write in progress, or are written by the next leader.
+ *
+ * In case a write fails, a 'LogException' is thrown to every caller
+ * waiting for it, and to all the next ones.
+ */
+void CounterLog::sync(void)
+{
+    std::unique_lock<std::mutex>    lock(_lock);
+    uint64_t                        target = _appended;
+
+    while (_durable < target && !_failed)
+    {
+        if (_syncing)
+        {
+            _synced.wait(lock);
+            continue;
+        }
+        _syncing = true;
+
+        std::vector<uint8_t>    records;
+        uint64_t                upTo = _appended;
+        size_t                  total = _records + _buffer.size() / OTP_COUNTER_LOG_RECORD_SIZE;
+        bool                    compacting = total >= std::max<size_t>(
+            OTP_COUNTER_LOG_MIN_COMPACTION, 4 * _counters.size());
+
+        // Compacting: one record per account, which already includes the buffered ones
+        if (compacting)
+        {
+            records.reserve(_counters.size() * OTP_COUNTER_LOG_RECORD_SIZE);
+            for (std::unordered_map<uint64_t, uint64_t>::const_iterator it = _counters.begin();
+                it != _counters.end(); ++it)
+                appendRecord(records, it->first, it->second);
+            _buffer.clear();
+        }
+        else
+            records.swap(_buffer);
+
+        lock.unlock();
+        bool written = compacting ? compact(records) : writeRecords(records);
+        lock.lock();
+
+        _syncing = false;
+        if (written)
+        {
+            _durable = upTo;
+            _records = (compacting ? 0 : _records) + records.size() / OTP_COUNTER_LOG_RECORD_SIZE;
+            ++_syncs;
+            _compactions += compacting;
+        }
+        else
+            _failed = true;
+        _synced.notify_all();
+    }
+    if (_failed)
+        throw LogException("failed to write the counters, they are not durable.");
+}
+
+bool CounterLog::commit(const std::string &account, uint64_t counter)
+{
+    if (!advance(account, counter))
+        return false;
+    sync();
+    return true;
+}
+
+// Only the leader of a sync writes, so the file descriptor needs no lock
+bool CounterLog::writeRecords(const std::vector<uint8_t> &records)
+{
+    return writeAll(_fd, records.data(), records.size()) && fdatasync(_fd) == 0;
+}
+
+// Write the records to a new log, which then replaces the current one
+bool CounterLog::compact(const std::vector<uint8_t> &records)
+{
+    const std::string   tmpName = _fileName + ".tmp";
+    int                 fd = open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (fd < 0)
+        return false;
+    if (!writeHeader(fd) || !writeAll(fd, records.data(), records.size()) || fdatasync(fd) != 0
+        || std::rename(tmpName.c_str(), _fileName.c_str()) != 0)
+    {
+        close(fd);
+        unlink(tmpName.c_str());
+        return false;
+    }
+    close(_fd);
+    _fd = fd;
+    return syncDirectory(_fileName);
+}
+
+bool CounterLog::pending(void) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _durable < _appended;
+}
+
+size_t CounterLog::size(void) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _counters.size();
+}
+
+size_t CounterLog::syncs(void) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _syncs;
+}
+
+size_t CounterLog::compactions(void) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _compactions;
+}
@@ -0,0 +1,122 @@
+#ifndef COUNTERLOG_HPP
+# define COUNTERLOG_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <condition_variable>
+# include <mutex>
+# include <exception>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# define OTP_COUNTERFILENAME		"ft_otp.counters"
+# define OTP_COUNTER_LOG_MAGIC	"FTOTPCL2"
+
+/*
+ * Durable HOTP counters (RFC 4226)
+ *
+ * An HOTP verifier keeps the next expected counter of every account, and
+ * must never move it back: after a restart, an already used code would
+ * be valid again. The counters are kept in memory and every change is
+ * appended to a write-ahead log, which is replayed when the log is
+ * opened.
+ *
+ * Group commit: advance() only appends the record to a buffer, and
+ * sync() makes every buffered record durable with one write and one
+ * fdatasync. The first thread calling sync() does it for all the others
+ * (the leader), the threads arriving meanwhile wait for the next round,
+ * which a single one of them does for all. commit() is both, so many
+ * concurrent verifications share one fdatasync instead of one each. A
+ * single-threaded caller (the daemon) can also call advance() for a
+ * whole batch of requests, then sync() once.
+ *
+ * Compaction: once the log holds many more records than accounts, the
+ * next sync() writes the current counters to a new log, which replaces
+ * the old one with a rename.
+ *
+ * Log file (little-endian):
+ *  | magic (8) | hash key (16) | records x { account hash (8), next counter (8), check (8) } |
+ * The accounts are identified by their SipHash, with the random key
+ * drawn when the log is created (see SipHash.hpp).
+ * A record with a wrong check ends the log: it's the tail of a write
+ * interrupted by a crash, and it's cut off when the log is opened.
+ */
+
+enum CounterLogLimits
+{
+	OTP_COUNTER_LOG_MAGIC_SIZE		= 8,
+	OTP_COUNTER_LOG_HEADER_SIZE		= 24,
+	OTP_COUNTER_LOG_RECORD_SIZE		= 24,
+	OTP_COUNTER_LOG_MIN_COMPACTION	= 4096	// Records written before a compaction, at least
+};
+
+class CounterLog
+{
+public:
+	// Open (or create) the log and replay it
+	explicit CounterLog(const std::string &fileName);
+	~CounterLog();
+
+	// Next expected counter of the account, 0 for a new one
+	uint64_t	next(const std::string &account) const;
+	/**
+	 * Move the next counter of the account to 'counter' if it's greater,
+	 * and buffer the record: it's only durable after the next sync().
+	 * Returns false if the counter isn't greater (e.g. another
+	 * verification of the same code got there first).
+	 */
+	bool		advance(const std::string &account, uint64_t counter);
+	// Make every buffered record durable, shared with the concurrent calls
+	void		sync(void);
+	// advance() then sync() if the counter moved
+	bool		commit(const std::string &account, uint64_t counter);
+	// Records not durable yet
+	bool		pending(void) const;
+
+	size_t		size(void) const;
+	// Number of fdatasync() so far, compactions included
+	size_t		syncs(void) const;
+	size_t		compactions(void) const;
+
+	class LogException : public std::exception
+	{
+	public:
+		explicit LogException(const std::string &message) throw()
+			: msg("HOTP counter log: " + message) {}
+		virtual const char *what() const throw() override {
+			return msg.c_str();
+		}
+		virtual ~LogException() throw() {}
+
+	private:
+		std::string msg;
+	};
+
+private:
+	std::string							_fileName;
+	int									_fd;
+	uint64_t							_hashKey[2];	// SipHash key of the account hashes
+	mutable std::mutex					_lock;
+	std::condition_variable				_synced;
+	std::unordered_map<uint64_t, uint64_t>	_counters;	// Account hash -> next counter
+	std::vector<uint8_t>				_buffer;	// Records not written yet
+	uint64_t							_appended;	// Records appended since the log was opened
+	uint64_t							_durable;	// Of them, the ones synced
+	size_t								_records;	// In the log file, to know when to compact
+	size_t								_syncs;
+	size_t								_compactions;
+	bool								_syncing;	// A leader is writing
+	bool								_failed;	// A write failed, the log can't be trusted anymore
+
+	void	replay(void);
+	bool	writeHeader(int fd) const;
+	bool	writeRecords(const std::vector<uint8_t> &records);
+	bool	compact(const std::vector<uint8_t> &records);
+	void	appendRecord(std::vector<uint8_t> &records, uint64_t hash, uint64_t counter) const;
+
+	CounterLog(const CounterLog &);
+	CounterLog &operator=(const CounterLog &);
+};
+
+#endif
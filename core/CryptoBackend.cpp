@@ -0,0 +1,345 @@
+#include "CryptoBackend.hpp"
+#include "SecureArena.hpp"
+#include <atomic>
+#include <cstring>
+#include <cryptopp/aes.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/modes.h>
+#include <cryptopp/sha.h>
+
+#ifdef OTP_WITH_OPENSSL
+# include <openssl/core_names.h>
+# include <openssl/evp.h>
+#endif
+
+// PKCS#7: 1 to 16 bytes of padding, each one holding the padding size
+static size_t addPadding(const uint8_t *plain, size_t size, uint8_t *lastBlock)
+{
+    size_t  tail = size % OTP_AES_BLOCK_SIZE;
+    uint8_t padding = static_cast<uint8_t>(OTP_AES_BLOCK_SIZE - tail);
+
+    memcpy(lastBlock, plain + size - tail, tail);
+    memset(lastBlock + tail, padding, padding);
+    return size - tail;
+}
+
+// Size of the plain text once the padding is removed (0 for an empty message), false if the padding is invalid
+static bool removePadding(const uint8_t *plain, size_t size, size_t &plainSize)
+{
+    uint8_t padding = plain[size - 1];
+    uint8_t difference = 0;
+
+    if (padding == 0 || padding > OTP_AES_BLOCK_SIZE)
+        return false;
+    for (size_t i = size - padding; i < size; ++i)
+        difference |= plain[i] ^ padding;
+    plainSize = size - padding;
+    return difference == 0;
+}
+
+/*
+ * Crypto++
+ *
+ * CBC is used on whole blocks (ProcessData) with the padding done here,
+ * rather than through a StreamTransformationFilter: the filter chain
+ * allocates a few objects for every message.
+ */
+
+// One HMAC object per thread and hash function: rekeying it reuses its buffers
+template <class Hash>
+static void cryptoppHmac(const uint8_t *key, size_t keySize,
+    const uint8_t *message, size_t size, uint8_t *digest)
+{
+    static thread_local CryptoPP::HMAC<Hash>    hmac;
+
+    hmac.SetKey(key, keySize);
+    hmac.CalculateDigest(digest, message, size);
+}
+
+static bool cryptoppAesEncrypt(const uint8_t *key, const uint8_t *iv,
+    const uint8_t *plain, size_t size, uint8_t *cipher)
+{
+    uint8_t lastBlock[OTP_AES_BLOCK_SIZE];
+    size_t  whole = addPadding(plain, size, lastBlock);
+
+    try
+    {
+        CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption   aes;
+
+        aes.SetKeyWithIV(key, OTP_AES_KEY_SIZE, iv);
+        if (whole)
+            aes.ProcessData(cipher, plain, whole);
+        aes.ProcessData(cipher + whole, lastBlock, sizeof(lastBlock));
+    }
+    catch (const CryptoPP::Exception &)
+    {
+        secureWipe(lastBlock, sizeof(lastBlock));
+        return false;
+    }
+    secureWipe(lastBlock, sizeof(lastBlock));
+    return true;
+}
+
+static bool cryptoppAesDecrypt(const uint8_t *key, const uint8_t *iv,
+    const uint8_t *cipher, size_t size, uint8_t *plain)
+{
+    try
+    {
+        CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption   aes;
+
+        aes.SetKeyWithIV(key, OTP_AES_KEY_SIZE, iv);
+        aes.ProcessData(plain, cipher, size);
+    }
+    catch (const CryptoPP::Exception &)
+    {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * OpenSSL (EVP)
+ *
+ * The HMAC and cipher implementations are fetched once, and each thread
+ * keeps one HMAC context per hash function, with its digest already set:
+ * only the key changes from one call to the next.
+ */
+
+#ifdef OTP_WITH_OPENSSL
+
+static EVP_MAC *opensslMac(void)
+{
+    static EVP_MAC  *mac = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_HMAC, NULL);
+    return mac;
+}
+
+static EVP_CIPHER *opensslAes(void)
+{
+    static EVP_CIPHER   *aes = EVP_CIPHER_fetch(NULL, "AES-256-CBC", NULL);
+    return aes;
+}
+
+class OpenSSLHmacContexts
+{
+public:
+    OpenSSLHmacContexts() { memset(_contexts, 0, sizeof(_contexts)); }
+    ~OpenSSLHmacContexts()
+    {
+        for (size_t i = 0; i < sizeof(_contexts) / sizeof(_contexts[0]); ++i)
+            EVP_MAC_CTX_free(_contexts[i]);
+    }
+
+    EVP_MAC_CTX *get(HashAlgorithm algorithm)
+    {
+        static const char   *digests[] = { "SHA1", "SHA256", "SHA512" };
+        EVP_MAC_CTX         *&context = _contexts[algorithm];
+
+        if (context || !opensslMac())
+            return context;
+        context = EVP_MAC_CTX_new(opensslMac());
+
+        OSSL_PARAM  params[] = {
+            OSSL_PARAM_construct_utf8_string(
+                OSSL_MAC_PARAM_DIGEST, const_cast<char *>(digests[algorithm]), 0),
+            OSSL_PARAM_construct_end()
+        };
+        if (context && !EVP_MAC_CTX_set_params(context, params))
+        {
+            EVP_MAC_CTX_free(context);
+            context = NULL;
+        }
+        return context;
+    }
+
+private:
+    EVP_MAC_CTX *_contexts[OTP_HASH_SHA512 + 1];
+
+    OpenSSLHmacContexts(const OpenSSLHmacContexts &);
+    OpenSSLHmacContexts &operator=(const OpenSSLHmacContexts &);
+};
+
+static bool opensslHmac(HashAlgorithm algorithm, const uint8_t *key, size_t keySize,
+    const uint8_t *message, size_t size, uint8_t *digest)
+{
+    static thread_local OpenSSLHmacContexts contexts;
+    EVP_MAC_CTX                             *context = contexts.get(algorithm);
+    size_t                                  digestSize;
+
+    return context
+        && EVP_MAC_init(context, key, keySize, NULL)
+        && EVP_MAC_update(context, message, size)
+        && EVP_MAC_final(context, digest, &digestSize, cryptoHmacSize(algorithm));
+}
+
+// Whole blocks only, the padding is done by the callers as for Crypto++
+static bool opensslAesCbc(bool encrypt, const uint8_t *key, const uint8_t *iv,
+    const uint8_t *in, size_t size, uint8_t *out)
+{
+    EVP_CIPHER_CTX  *context = EVP_CIPHER_CTX_new();
+    int             written = 0;
+    int             finalSize = 0;
+    bool            done;
+
+    done = context && opensslAes()
+        && EVP_CipherInit_ex2(context, opensslAes(), key, iv, encrypt, NULL)
+        && EVP_CIPHER_CTX_set_padding(context, 0)
+        && EVP_CipherUpdate(context, out, &written, in, static_cast<int>(size))
+        && EVP_CipherFinal_ex(context, out + written, &finalSize)
+        && static_cast<size_t>(written + finalSize) == size;
+    EVP_CIPHER_CTX_free(context);
+    return done;
+}
+
+static bool opensslAesEncrypt(const uint8_t *key, const uint8_t *iv,
+    const uint8_t *plain, size_t size, uint8_t *cipher)
+{
+    uint8_t lastBlock[OTP_AES_BLOCK_SIZE];
+    size_t  whole = addPadding(plain, size, lastBlock);
+
+    // The padded block is copied after the whole ones, then encrypted in one call
+    memmove(cipher, plain, whole);
+    memcpy(cipher + whole, lastBlock, sizeof(lastBlock));
+    secureWipe(lastBlock, sizeof(lastBlock));
+    if (opensslAesCbc(true, key, iv, cipher, whole + OTP_AES_BLOCK_SIZE, cipher))
+        return true;
+    secureWipe(cipher, whole + OTP_AES_BLOCK_SIZE);
+    return false;
+}
+
+#endif // OTP_WITH_OPENSSL
+
+/*
+ * Backend selection
+ */
+
+bool cryptoIsBackendSupported(CryptoBackend backend)
+{
+    switch (backend)
+    {
+    case OTP_CRYPTO_CRYPTOPP:
+        return true;
+#ifdef OTP_WITH_OPENSSL
+    case OTP_CRYPTO_OPENSSL:
+        return opensslMac() && opensslAes();
+#endif
+    default:
+        return false;
+    }
+}
+
+static CryptoBackend defaultBackend(void)
+{
+    if (cryptoIsBackendSupported(OTP_CRYPTO_OPENSSL))
+        return OTP_CRYPTO_OPENSSL;
+    return OTP_CRYPTO_CRYPTOPP;
+}
+
+static std::atomic<int> &currentBackend(void)
+{
+    static std::atomic<int> backend(defaultBackend());
+    return backend;
+}
+
+CryptoBackend cryptoGetBackend(void)
+{
+    return static_cast<CryptoBackend>(currentBackend().load(std::memory_order_relaxed));
+}
+
+bool cryptoSetBackend(CryptoBackend backend)
+{
+    if (!cryptoIsBackendSupported(backend))
+        return false;
+    currentBackend().store(backend, std::memory_order_relaxed);
+    return true;
+}
+
+const char *cryptoBackendName(CryptoBackend backend)
+{
+    static const char *names[OTP_CRYPTO_BACKEND_COUNT] = { "crypto++", "openssl" };
+
+    if (backend < 0 || backend >= OTP_CRYPTO_BACKEND_COUNT)
+        return "unknown";
+    return names[backend];
+}
+
+/*
+ * Operations
+ */
+
+size_t cryptoHmacSize(HashAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case OTP_HASH_SHA256:
+        return OTP_SHA256_DIGEST_SIZE;
+    case OTP_HASH_SHA512:
+        return OTP_SHA512_DIGEST_SIZE;
+    default:
+        return OTP_SHA1_DIGEST_SIZE;
+    }
+}
+
+void cryptoHmac(HashAlgorithm algorithm, const uint8_t *key, size_t keySize,
+    const uint8_t *message, size_t size, uint8_t *digest)
+{
+    if (algorithm != OTP_HASH_SHA256 && algorithm != OTP_HASH_SHA512)
+        algorithm = OTP_HASH_SHA1;
+#ifdef OTP_WITH_OPENSSL
+    // Crypto++ is still there if OpenSSL fails (e.g. a provider can't be loaded)
+    if (cryptoGetBackend() == OTP_CRYPTO_OPENSSL
+        && opensslHmac(algorithm, key, keySize, message, size, digest))
+        return;
+#endif
+    switch (algorithm)
+    {
+    case OTP_HASH_SHA256:
+        cryptoppHmac<CryptoPP::SHA256>(key, keySize, message, size, digest);
+        break;
+    case OTP_HASH_SHA512:
+        cryptoppHmac<CryptoPP::SHA512>(key, keySize, message, size, digest);
+        break;
+    default:
+        cryptoppHmac<CryptoPP::SHA1>(key, keySize, message, size, digest);
+        break;
+    }
+}
+
+size_t cryptoAesCipherSize(size_t size)
+{
+    return size - size % OTP_AES_BLOCK_SIZE + OTP_AES_BLOCK_SIZE;
+}
+
+bool cryptoAesEncrypt(const uint8_t *key, const uint8_t *iv,
+    const uint8_t *plain, size_t size, uint8_t *cipher)
+{
+#ifdef OTP_WITH_OPENSSL
+    if (cryptoGetBackend() == OTP_CRYPTO_OPENSSL)
+        return opensslAesEncrypt(key, iv, plain, size, cipher);
+#endif
+    return cryptoppAesEncrypt(key, iv, plain, size, cipher);
+}
+
+bool cryptoAesDecrypt(const uint8_t *key, const uint8_t *iv,
+    const uint8_t *cipher, size_t size, uint8_t *plain, size_t &plainSize)
+{
+    bool    done;
+
+    plainSize = 0;
+    if (size == 0 || size % OTP_AES_BLOCK_SIZE != 0)
+        return false;
+#ifdef OTP_WITH_OPENSSL
+    if (cryptoGetBackend() == OTP_CRYPTO_OPENSSL)
+        done = opensslAesCbc(false, key, iv, cipher, size, plain);
+    else
+        done = cryptoppAesDecrypt(key, iv, cipher, size, plain);
+#else
+    done = cryptoppAesDecrypt(key, iv, cipher, size, plain);
+#endif
+    done = done && removePadding(plain, size, plainSize);
+    if (!done)
+    {
+        plainSize = 0;
+        secureWipe(plain, size);
+    }
+    return done;
+}
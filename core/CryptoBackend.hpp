@@ -0,0 +1,59 @@
+#ifndef CRYPTOBACKEND_HPP
+# define CRYPTOBACKEND_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include "HashAlgorithms.hpp"
+
+/*
+ * Library used for the one-shot HMAC and for the AES of the key files
+ *
+ * Crypto++ is always built in. OpenSSL 3 (libcrypto, EVP interface) is
+ * built in with the OTP_WITH_OPENSSL flag ('make CRYPTO_BACKEND=openssl'),
+ * and then it's the default backend: it ships better tuned assembly for
+ * SHA and AES on most hosts. Both backends give the same output, which
+ * 'make conformance' in the bench folder checks.
+ *
+ * Prepared keys (PreparedKey.hpp) don't go through a backend: they keep
+ * the HMAC midstates, which neither library exposes.
+ *
+ * The key files are encrypted with AES-256-CBC and PKCS#7 padding.
+ */
+
+enum CryptoBackend
+{
+	OTP_CRYPTO_CRYPTOPP			= 0,
+	OTP_CRYPTO_OPENSSL			= 1,
+	OTP_CRYPTO_BACKEND_COUNT	= 2
+};
+
+enum CryptoSizes
+{
+	OTP_AES_KEY_SIZE		= 32,	// AES-256
+	OTP_AES_BLOCK_SIZE		= 16,
+	OTP_HMAC_MAX_DIGEST		= OTP_SHA512_DIGEST_SIZE
+};
+
+bool			cryptoIsBackendSupported(CryptoBackend backend);
+CryptoBackend	cryptoGetBackend(void);
+// Force a backend (e.g. for benchmarks), returns false if it isn't built in
+bool			cryptoSetBackend(CryptoBackend backend);
+const char		*cryptoBackendName(CryptoBackend backend);
+
+// Digest size of HMAC with 'algorithm'
+size_t			cryptoHmacSize(HashAlgorithm algorithm);
+// HMAC of a message, 'digest' gets cryptoHmacSize() bytes
+void			cryptoHmac(HashAlgorithm algorithm, const uint8_t *key, size_t keySize,
+					const uint8_t *message, size_t size, uint8_t *digest);
+
+// Size of the cipher of 'size' bytes, padding included
+size_t			cryptoAesCipherSize(size_t size);
+// AES-256-CBC with a 32-byte key and a 16-byte IV, 'cipher' gets cryptoAesCipherSize() bytes
+bool			cryptoAesEncrypt(const uint8_t *key, const uint8_t *iv,
+					const uint8_t *plain, size_t size, uint8_t *cipher);
+// 'plain' must hold 'size' bytes, 'plainSize' is set to the size without the padding
+bool			cryptoAesDecrypt(const uint8_t *key, const uint8_t *iv,
+					const uint8_t *cipher, size_t size, uint8_t *plain, size_t &plainSize);
+
+#endif
@@ -1,14 +1,68 @@
 #include "FileHandler.hpp"
+#include <cerrno>
+#include <cstring>
 
-FileHandler::FileHandler() : _fileName(), _mode(0), _verbose() {}
+FileHandler::FileHandler() : _fileName(), _label(), _mode(0), _verbose(), _keyFormat(0), _passphrase(false) {}
 
 FileHandler::~FileHandler() {}
 
 void FileHandler::setFilename(const char *fileName) { _fileName = fileName; }
 void FileHandler::setMode(uint8_t mode) { _mode ^= mode; }
 void FileHandler::setVerbose(bool verbose) { _verbose = verbose; }
+void FileHandler::setLabel(const char *label) { _label = label; }
+void FileHandler::setPassphrase(bool passphrase) { _passphrase = passphrase; }
+void FileHandler::setKeyProvider(const StoreKeyProvider &provider) { _keyProvider = provider; }
 
 uint8_t FileHandler::getMode(void) const { return _mode; }
+uint8_t FileHandler::getKeyFormat(void) const { return _keyFormat; }
+
+bool isRegularFile(const std::string& path) {
+    struct stat buffer;
+    return (stat(path.c_str(), &buffer) == 0 && S_ISREG(buffer.st_mode));
+}
+
+// Only a name which is a valid label, and not an existing path, is looked up in the key store
+static bool isAccountLabel(const char *name)
+{
+    struct stat buffer;
+    return stat(name, &buffer) != 0 && errno == ENOENT && KeyStore::isValidLabel(name)
+        && stat(OTP_STOREFILENAME, &buffer) == 0;
+}
+
+/**
+ * @brief Decrypt the key saved during `-g` mode into a buffer of 'scope'.
+ *
+ * The encrypted file is memory-mapped, and its cipher is decrypted from
+ * the mapping straight into the SecureArena. An account label, when there
+ * is no file of that name and it's a valid label, is decrypted the same
+ * way from its record (only that record is read from the key store,
+ * OTP_STOREFILENAME). Any other name which isn't a regular file gives
+ * the same error as a missing key file.
+ */
+const uint8_t *FileHandler::decryptKeyFromInFile(ArenaScope &scope, size_t &size)
+{
+	if (isAccountLabel(_fileName))
+	{
+		KeyStore store(OTP_STOREFILENAME, _verbose);
+		store.setKeyProvider(_keyProvider);
+		return store.loadKey(_fileName, scope, size);
+	}
+	if (!isRegularFile(_fileName))
+		throw OpenFileException();
+
+	if (_verbose)
+		std::cout	<< FMT_INFO " Opening secret key file '"
+					<< _fileName << "'..." << std::endl;
+	MappedFile		file(_fileName);
+	TOTPGenerator	TOTPGenerator(_verbose);
+
+	if (file.empty())
+		throw DecryptionException();
+	uint8_t	*plain = scope.allocate(file.size());
+	if (!TOTPGenerator.decryptAES(file.data(), file.size(), plain, size))
+		throw DecryptionException();
+	return plain;
+}
 
 /**
  * @brief Read the key to be encrypted from the given filename.
@@ -18,58 +72,91 @@ uint8_t FileHandler::getMode(void) const { return _mode; }
  * 	  by this program during `-g` mode.
  * 	  Then, the key will be recovered to get back its orginal format
  * 	  which corresponds to the original key read during `-k` mode. 
+ * 	  If there is no file of that name and it's a valid label, it is an
+ * 	  account label: only the record of that account is read from the key
+ * 	  store (OTP_STOREFILENAME).
+ *
+ * The key is checked in the file mapping, then copied into a buffer of
+ * 'scope' (or decrypted into it in `-k` mode), so it's never held in a
+ * heap string, and it's wiped when the caller's scope ends.
  *
  * @return 
  *  - In `-g` mode, the read key.
  *  - In `-k` mode, the recovered key.
  */
+const char *FileHandler::getKeyFromInFile(ArenaScope &scope, size_t &size)
+{
+	TOTPGenerator	TOTPGenerator(_verbose);
 
-bool isRegularFile(const std::string& path) {
-    struct stat buffer;
-    return (stat(path.c_str(), &buffer) == 0 && S_ISREG(buffer.st_mode));
-}
+	if (_mode == OTP_MODE_GEN_PWD)
+	{
+		const char *recovered = reinterpret_cast<const char *>(decryptKeyFromInFile(scope, size));
 
-std::string FileHandler::getKeyFromInFile()
-{
-    if (!isRegularFile(_fileName)) throw OpenFileException();
+		// Keep the format so that the key isn't classified again when decoded
+		_keyFormat = TOTPGenerator.isValidHexOrBase32(recovered, size);
+		if (!_keyFormat)
+			throw InvalidKeyFormatException();
+		return recovered;
+	}
 
-	// Create a file stream object for reading from the file
-	std::ifstream file(_fileName);
 	if (_verbose)
 		std::cout	<< FMT_INFO " Opening secret key file '"
 					<< _fileName << "'..." << std::endl;
-	;
-	// Check if the file is open
-	if (!file)
-		throw OpenFileException();
-	// Read the content of the file
-	std::string key(
-		(std::istreambuf_iterator<char>(file)),
-		std::istreambuf_iterator<char>());
-	file.close();
+	MappedFile	file(_fileName);
+	const char	*key = reinterpret_cast<const char *>(file.data());
+
+	_keyFormat = TOTPGenerator.isValidHexOrBase32(key, file.size());
+	if (!_keyFormat)
+		throw InvalidKeyFormatException();
+
+	uint8_t	*copy = scope.allocate(file.size());
+	memcpy(copy, file.data(), file.size());
+	size = file.size();
+	return reinterpret_cast<const char *>(copy);
+}
 
-	std::string		recovered;
+/**
+ * @brief Decrypt and decode the key saved during `-g` mode (`-k` mode).
+ *
+ * The key is decrypted from the file mapping, then decoded, without any
+ * intermediate string: both the key text and the secret are in buffers
+ * of 'scope', in the SecureArena of the thread. They stay in locked
+ * memory, and are wiped when the caller's scope ends.
+ *
+ * @return
+ *  The decoded secret, ready to be used as an HMAC key.
+ */
+const uint8_t *FileHandler::getSecretFromInFile(ArenaScope &scope, size_t &size)
+{
 	TOTPGenerator	TOTPGenerator(_verbose);
-	if (_mode == OTP_MODE_GEN_PWD)
-	{
-		try {
-			recovered = TOTPGenerator.decryptAES(key);
-			if (recovered.empty()) throw std::exception();
-		} catch (std::exception &e) {
-			std::cerr << FMT_ERROR "Failed to decrypt key from file." << std::endl;
-			return nullptr;
-		}
-	}
-	else recovered = key;
+	size_t			plainSize;
+	const char		*recovered = reinterpret_cast<const char *>(decryptKeyFromInFile(scope, plainSize));
 
-	if (TOTPGenerator.isValidHexOrBase32(recovered))
-		return recovered;
-	else
+	_keyFormat = TOTPGenerator.isValidHexOrBase32(recovered, plainSize);
+	if (!_keyFormat)
 		throw InvalidKeyFormatException();
+
+	size_t	capacity = TOTPGenerator::decodedKeyCapacity(plainSize);
+	uint8_t	*secret = scope.allocate(capacity);
+	size = TOTPGenerator.DecodeKeyInto(recovered, plainSize, secret, capacity, _keyFormat);
+	return secret;
 }
 
-void FileHandler::saveKeyToOutFile(std::string key)
+void FileHandler::saveKeyToOutFile(const char *key, size_t size)
 {
+	// With an account label, the key is added to the multi-account key store
+	if (_label)
+	{
+		KeyStore store(OTP_STOREFILENAME, _verbose);
+		store.setKeyProvider(_keyProvider);
+		if (_passphrase)
+			store.usePassphrase();
+		store.saveKey(_label, key, size);
+		if (_verbose)
+			std::cout << "\n" << FMT_DONE " Key encrypted and saved." << std::endl;
+		return;
+	}
+
 	// Create a file stream object for writing in the file
 	std::ofstream file(OTP_OUTFILENAME);
 	// Check if the file is open
@@ -80,7 +167,7 @@ void FileHandler::saveKeyToOutFile(std::string key)
 	try
 	{
 		TOTPGenerator	TOTPGenerator(_verbose);
-		cipher = TOTPGenerator.encryptAES(key);
+		cipher = TOTPGenerator.encryptAES(key, size);
 		if (cipher.empty()) throw std::exception();
 	}
 	catch (std::exception &e)
@@ -8,6 +8,9 @@
 
 # include "ascii_format.hpp"
 # include "TOTPGenerator.hpp"
+# include "KeyStore.hpp"
+# include "MappedFile.hpp"
+# include "SecureArena.hpp"
  
 # define OTP_OUTFILENAME "ft_otp.key"
 
@@ -15,7 +18,10 @@ enum otp_e_modes
 {
 	OTP_MODE_SAVE_KEY	= 1,
 	OTP_MODE_GEN_PWD	= 2,
-	OTP_MODE_GEN_QR		= 4
+	OTP_MODE_GEN_QR		= 4,
+	OTP_MODE_SERVE		= 8,	// Run the local daemon (--serve)
+	OTP_MODE_CLIENT		= 16,	// Ask the local daemon (--client)
+	OTP_MODE_AGENT		= 32	// Cache the key store key (agent)
 };
 
 class FileHandler
@@ -28,18 +34,33 @@ public:
 	void		setFilename(const char *fileName);
 	void		setMode(uint8_t mode);
 	void		setVerbose(bool verbose);
+	void		setLabel(const char *label);
+	// Protect the key store with a passphrase when saving a key under a label
+	void		setPassphrase(bool passphrase);
+	void		setKeyProvider(const StoreKeyProvider &provider);
 
 	// Getters
 	uint8_t		getMode(void) const;
+	uint8_t		getKeyFormat(void) const;
 
+	// Key text in a buffer of 'scope', its size in 'size'
+	const char				*getKeyFromInFile(ArenaScope &scope, size_t &size);
+	// Decoded secret in a buffer of 'scope', its size in 'size'
+	const uint8_t			*getSecretFromInFile(ArenaScope &scope, size_t &size);
 	// Save key in outfile
-	std::string	getKeyFromInFile();
-	void		saveKeyToOutFile(std::string key);
+	void					saveKeyToOutFile(const char *key, size_t size);
 
 private:
 	const char *_fileName;
+	const char	*_label;	// Account label in the key store, if any
 	uint8_t		_mode;
 	bool		_verbose;
+	uint8_t		_keyFormat;	// Format of the last key read, detected only once
+	bool		_passphrase;
+	StoreKeyProvider	_keyProvider;	// Key of a passphrase-protected key store
+
+	// Decrypted key text in a buffer of 'scope', its size in 'size'
+	const uint8_t	*decryptKeyFromInFile(ArenaScope &scope, size_t &size);
 
 	class InvalidKeyFormatException: public std::exception
 	{
@@ -53,6 +74,17 @@ private:
 		~InvalidKeyFormatException() throw() {}
 	};
 
+	class DecryptionException: public std::exception
+	{
+	public:
+		DecryptionException() throw() {}
+		const char *what() const throw()
+		{
+			return "Failed to decrypt key from file.";
+		}
+		~DecryptionException() throw() {}
+	};
+
 	class EncryptionException: public std::exception
 	{
 	public:
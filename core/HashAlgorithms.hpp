@@ -0,0 +1,73 @@
+#ifndef HASHALGORITHMS_HPP
+# define HASHALGORITHMS_HPP
+
+# include <stdint.h>
+# include <stddef.h>
+
+# include "sha1.hpp"
+# include "sha2.hpp"
+
+/*
+ * Hash functions allowed by RFC 6238 for TOTP.
+ *
+ * Each structure describes one hash function so that the HMAC and TOTP
+ * code can be written once as templates: sizes are compile-time
+ * constants, and the raw compression function is used to keep midstates.
+ */
+
+enum HashAlgorithm
+{
+	OTP_HASH_SHA1	= 0,
+	OTP_HASH_SHA256	= 1,
+	OTP_HASH_SHA512	= 2
+};
+
+struct Sha1Hash
+{
+	typedef uint32_t	Word;
+	enum
+	{
+		ALGORITHM	= OTP_HASH_SHA1,
+		BLOCK_SIZE	= OTP_SHA1_BLOCK_SIZE,
+		DIGEST_SIZE	= OTP_SHA1_DIGEST_SIZE,
+		STATE_WORDS	= OTP_SHA1_STATE_WORDS
+	};
+
+	static void	init(Word *state) { sha1Init(state); }
+	static void	compress(Word *state, const Word *words) { sha1CompressWords(state, words); }
+	static void	hash(const uint8_t *data, size_t size, uint8_t *digest) { sha1(data, size, digest); }
+};
+
+struct Sha256Hash
+{
+	typedef uint32_t	Word;
+	enum
+	{
+		ALGORITHM	= OTP_HASH_SHA256,
+		BLOCK_SIZE	= OTP_SHA256_BLOCK_SIZE,
+		DIGEST_SIZE	= OTP_SHA256_DIGEST_SIZE,
+		STATE_WORDS	= OTP_SHA256_STATE_WORDS
+	};
+
+	static void	init(Word *state) { sha256Init(state); }
+	static void	compress(Word *state, const Word *words) { sha256CompressWords(state, words); }
+	static void	hash(const uint8_t *data, size_t size, uint8_t *digest) { sha256(data, size, digest); }
+};
+
+struct Sha512Hash
+{
+	typedef uint64_t	Word;
+	enum
+	{
+		ALGORITHM	= OTP_HASH_SHA512,
+		BLOCK_SIZE	= OTP_SHA512_BLOCK_SIZE,
+		DIGEST_SIZE	= OTP_SHA512_DIGEST_SIZE,
+		STATE_WORDS	= OTP_SHA512_STATE_WORDS
+	};
+
+	static void	init(Word *state) { sha512Init(state); }
+	static void	compress(Word *state, const Word *words) { sha512CompressWords(state, words); }
+	static void	hash(const uint8_t *data, size_t size, uint8_t *digest) { sha512(data, size, digest); }
+};
+
+#endif
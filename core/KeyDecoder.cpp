@@ -0,0 +1,449 @@
+#include "KeyDecoder.hpp"
+#include <string.h>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define OTP_DECODER_X86 1
+# include <immintrin.h>
+#else
+# define OTP_DECODER_X86 0
+#endif
+
+// Formats each character can appear in, as OTP_KEYFORMAT_* flags
+static constexpr uint8_t keyClasses[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 3, 3, 3, 3, 3, 3, 1, 1, 0, 0, 0, 2, 0, 0,
+    0, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+    0, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/*
+ * The same classes for SIMD lookups, split by nibble: a character is in
+ * a group when both its low and its high nibble have the group bit set.
+ * Characters above 0x7F have a high nibble of 8-F, which is in no group.
+ */
+enum CharGroup
+{
+    OTP_GROUP_HEX_DIGIT     = 0x01,     // 0-9
+    OTP_GROUP_HEX_LETTER    = 0x02,     // A-F a-f
+    OTP_GROUP_BASE32_DIGIT  = 0x04,     // 2-7
+    OTP_GROUP_BASE32_PAD    = 0x08,     // =
+    OTP_GROUP_BASE32_LOW    = 0x10,     // A-O a-o
+    OTP_GROUP_BASE32_HIGH   = 0x20,     // P-Z p-z
+    OTP_GROUPS_HEX          = 0x03,
+    OTP_GROUPS_BASE32       = 0x3C
+};
+
+alignas(16) static constexpr uint8_t lowNibbleGroups[16] = {
+    0x21, 0x33, 0x37, 0x37, 0x37, 0x37, 0x37, 0x35, 0x31, 0x31, 0x30, 0x10, 0x10, 0x18, 0x10, 0x10
+};
+alignas(16) static constexpr uint8_t highNibbleGroups[16] = {
+    0x00, 0x00, 0x00, 0x0D, 0x12, 0x20, 0x12, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// Value of each character, -1 if it's not an hexadecimal digit
+static constexpr int8_t hexValues[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Value of each character in the RFC 4648 Base32 alphabet (A-Z, 2-7, case
+// insensitive), -2 for the padding character '=' and -1 if invalid
+static constexpr int8_t base32Values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, 26, 27, 28, 29, 30, 31, -1, -1, -1, -1, -1, -2, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+#define OTP_BASE32_PADDING	-2
+
+static DecodeResult makeResult(DecodeStatus status, size_t size, size_t errorOffset)
+{
+    DecodeResult result;
+
+    result.status = status;
+    result.size = size;
+    result.errorOffset = errorOffset;
+    return result;
+}
+
+// A trailing odd digit can't make a full byte and is dropped
+size_t hexDecodedSize(size_t length) { return length / 2; }
+
+// Upper bound: every 8 characters give 5 bytes, padding only reduces it
+size_t base32DecodedSize(size_t length) { return length * 5 / 8; }
+
+#if OTP_DECODER_X86
+
+/*
+ * SIMD kernels
+ *
+ * Each kernel decodes one chunk of characters, or returns false if the
+ * chunk contains any character outside of the alphabet (including the
+ * Base32 padding). The scalar code then takes over from the start of
+ * that chunk, to report the exact offset or to handle the padding.
+ *
+ * Range checks use the unsigned trick: (c - first) <= (last - first),
+ * done with a minimum and a comparison as SSE has no unsigned compare.
+ */
+
+#define OTP_IN_RANGE_128(x, max) \
+    _mm_cmpeq_epi8(_mm_min_epu8((x), _mm_set1_epi8(max)), (x))
+#define OTP_IN_RANGE_256(x, max) \
+    _mm256_cmpeq_epi8(_mm256_min_epu8((x), _mm256_set1_epi8(max)), (x))
+
+// 16 hex characters -> 8 bytes
+__attribute__((target("ssse3")))
+static bool decodeHexChunkSsse3(const char *in, uint8_t *out)
+{
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isDigit = OTP_IN_RANGE_128(digit, 9);
+    __m128i isLetter = OTP_IN_RANGE_128(letter, 5);
+
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+        return false;
+
+    __m128i values = _mm_or_si128(
+        _mm_and_si128(isDigit, digit),
+        _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+    // Each pair of nibbles becomes (high * 16 + low) in a 16-bit lane
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0110));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(pairs, pairs));
+    return true;
+}
+
+// 32 hex characters -> 16 bytes
+__attribute__((target("avx2")))
+static bool decodeHexChunkAvx2(const char *in, uint8_t *out)
+{
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+    __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isDigit = OTP_IN_RANGE_256(digit, 9);
+    __m256i isLetter = OTP_IN_RANGE_256(letter, 5);
+
+    if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter))) != 0xFFFFFFFF)
+        return false;
+
+    __m256i values = _mm256_or_si256(
+        _mm256_and_si256(isDigit, digit),
+        _mm256_and_si256(isLetter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+    __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi16(0x0110));
+    // The pack works on each 128-bit half, keep the first 8 bytes of both
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs, pairs), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(packed));
+    return true;
+}
+
+/*
+ * 16 Base32 characters -> 10 bytes
+ *
+ * The 5-bit values are merged by pairs with multiply-adds:
+ *  8-bit lanes (5 bits) -> 16-bit lanes (10 bits) -> 32-bit lanes (20 bits)
+ * then two 20-bit values make the 40 bits (5 bytes) of each 64-bit lane,
+ * which are finally shuffled to big-endian order.
+ */
+__attribute__((target("ssse3")))
+static bool decodeBase32ChunkSsse3(const char *in, uint8_t *out)
+{
+    uint8_t bytes[16];
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('2'));
+    __m128i isLetter = OTP_IN_RANGE_128(letter, 25);
+    __m128i isDigit = OTP_IN_RANGE_128(digit, 5);
+
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+        return false;
+
+    __m128i values = _mm_or_si128(
+        _mm_and_si128(isLetter, letter),
+        _mm_and_si128(isDigit, _mm_add_epi8(digit, _mm_set1_epi8(26))));
+    __m128i merged16 = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0120));
+    __m128i merged32 = _mm_madd_epi16(merged16, _mm_set1_epi32(0x00010400));
+    __m128i merged64 = _mm_or_si128(
+        _mm_slli_epi64(_mm_and_si128(merged32, _mm_set_epi32(0, -1, 0, -1)), 20),
+        _mm_srli_epi64(merged32, 32));
+    __m128i ordered = _mm_shuffle_epi8(merged64, _mm_setr_epi8(
+        4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes), ordered);
+    memcpy(out, bytes, 10);
+    return true;
+}
+
+// 32 Base32 characters -> 20 bytes, same steps on both 128-bit halves
+__attribute__((target("avx2")))
+static bool decodeBase32ChunkAvx2(const char *in, uint8_t *out)
+{
+    uint8_t bytes[32];
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('2'));
+    __m256i isLetter = OTP_IN_RANGE_256(letter, 25);
+    __m256i isDigit = OTP_IN_RANGE_256(digit, 5);
+
+    if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter))) != 0xFFFFFFFF)
+        return false;
+
+    __m256i values = _mm256_or_si256(
+        _mm256_and_si256(isLetter, letter),
+        _mm256_and_si256(isDigit, _mm256_add_epi8(digit, _mm256_set1_epi8(26))));
+    __m256i merged16 = _mm256_maddubs_epi16(values, _mm256_set1_epi16(0x0120));
+    __m256i merged32 = _mm256_madd_epi16(merged16, _mm256_set1_epi32(0x00010400));
+    __m256i merged64 = _mm256_or_si256(
+        _mm256_slli_epi64(_mm256_and_si256(merged32, _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1)), 20),
+        _mm256_srli_epi64(merged32, 32));
+    __m256i ordered = _mm256_shuffle_epi8(merged64, _mm256_setr_epi8(
+        4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1,
+        4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(bytes), ordered);
+    memcpy(out, bytes, 10);
+    memcpy(out + 10, bytes + 16, 10);
+    return true;
+}
+
+/*
+ * Classify 16 or 32 characters: one bit per character is set in
+ * 'notHex'/'notBase32' when it can't be part of a key in that format.
+ */
+__attribute__((target("ssse3")))
+static void classifyChunkSsse3(const char *in, uint32_t &notHex, uint32_t &notBase32)
+{
+    const __m128i lowTable = _mm_load_si128(reinterpret_cast<const __m128i *>(lowNibbleGroups));
+    const __m128i highTable = _mm_load_si128(reinterpret_cast<const __m128i *>(highNibbleGroups));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    __m128i groups = _mm_and_si128(
+        _mm_shuffle_epi8(lowTable, _mm_and_si128(c, nibbleMask)),
+        _mm_shuffle_epi8(highTable, _mm_and_si128(_mm_srli_epi16(c, 4), nibbleMask)));
+
+    notHex = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_and_si128(groups, _mm_set1_epi8(OTP_GROUPS_HEX)), zero));
+    notBase32 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_and_si128(groups, _mm_set1_epi8(OTP_GROUPS_BASE32)), zero));
+}
+
+__attribute__((target("avx2")))
+static void classifyChunkAvx2(const char *in, uint32_t &notHex, uint32_t &notBase32)
+{
+    const __m256i lowTable = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(lowNibbleGroups)));
+    const __m256i highTable = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(highNibbleGroups)));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+    __m256i groups = _mm256_and_si256(
+        _mm256_shuffle_epi8(lowTable, _mm256_and_si256(c, nibbleMask)),
+        _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(c, 4), nibbleMask)));
+
+    notHex = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_and_si256(groups, _mm256_set1_epi8(OTP_GROUPS_HEX)), zero)));
+    notBase32 = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_and_si256(groups, _mm256_set1_epi8(OTP_GROUPS_BASE32)), zero)));
+}
+
+static bool cpuHasAvx2(void)
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+static bool cpuHasSsse3(void)
+{
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+}
+
+#endif // OTP_DECODER_X86
+
+// Keep the offset of the first invalid character of each format
+static inline void updateFormatEnd(size_t &end, size_t length, size_t base, uint32_t invalidMask)
+{
+    if (invalidMask && end == length)
+        end = base + __builtin_ctz(invalidMask);
+}
+
+/**
+ * @brief Detect whether a key could be Hex and/or Base32, in a single pass.
+ *
+ * Both formats are checked at once, and the scan stops as soon as a
+ * character rules out the last remaining one. The Base32 padding '='
+ * is accepted anywhere, as the decoder stops at the first one.
+ *
+ * @return
+ *  The possible formats, and the offset of the character which made the
+ *  key invalid (only meaningful when the format is 0).
+ */
+KeyClassification classifyKey(const char *key, size_t length)
+{
+    KeyClassification   result;
+    size_t              hexEnd = length;    // Offset of the first non-Hex character
+    size_t              base32End = length; // Offset of the first non-Base32 character
+    size_t              i = 0;
+
+#if OTP_DECODER_X86
+    uint32_t            notHex, notBase32;
+
+    if (cpuHasAvx2())
+        for (; i + 32 <= length && (hexEnd == length || base32End == length); i += 32)
+        {
+            classifyChunkAvx2(key + i, notHex, notBase32);
+            updateFormatEnd(hexEnd, length, i, notHex);
+            updateFormatEnd(base32End, length, i, notBase32);
+        }
+    if (cpuHasSsse3())
+        for (; i + 16 <= length && (hexEnd == length || base32End == length); i += 16)
+        {
+            classifyChunkSsse3(key + i, notHex, notBase32);
+            updateFormatEnd(hexEnd, length, i, notHex);
+            updateFormatEnd(base32End, length, i, notBase32);
+        }
+#endif
+
+    for (; i < length && (hexEnd == length || base32End == length); ++i)
+    {
+        uint8_t formats = keyClasses[static_cast<uint8_t>(key[i])];
+
+        updateFormatEnd(hexEnd, length, i, !(formats & OTP_KEYFORMAT_HEX));
+        updateFormatEnd(base32End, length, i, !(formats & OTP_KEYFORMAT_BASE32));
+    }
+
+    result.format = (hexEnd == length ? OTP_KEYFORMAT_HEX : 0) |
+                    (base32End == length ? OTP_KEYFORMAT_BASE32 : 0);
+    result.errorOffset = std::max(hexEnd, base32End);
+    return result;
+}
+
+/**
+ * @brief Decode an hexadecimal string, case-insensitive.
+ *
+ * @return
+ *  OTP_DECODE_INVALID_CHAR with the offset of the first character which
+ *  isn't an hexadecimal digit, or OTP_DECODE_OK and the decoded size.
+ */
+DecodeResult decodeHex(const char *in, size_t length, uint8_t *out, size_t capacity)
+{
+    size_t i = 0;
+
+    if (capacity < hexDecodedSize(length))
+        return makeResult(OTP_DECODE_BUFFER_TOO_SMALL, 0, 0);
+
+#if OTP_DECODER_X86
+    if (cpuHasAvx2())
+        for (; i + 32 <= length && decodeHexChunkAvx2(in + i, out + i / 2); i += 32)
+            ;
+    if (cpuHasSsse3())
+        for (; i + 16 <= length && decodeHexChunkSsse3(in + i, out + i / 2); i += 16)
+            ;
+#endif
+
+    for (; i < length; ++i)
+    {
+        int8_t value = hexValues[static_cast<uint8_t>(in[i])];
+
+        if (value < 0)
+            return makeResult(OTP_DECODE_INVALID_CHAR, i / 2, i);
+        if (i & 1)
+            out[i / 2] |= static_cast<uint8_t>(value);
+        else if (i + 1 < length)
+            out[i / 2] = static_cast<uint8_t>(value << 4);
+    }
+    return makeResult(OTP_DECODE_OK, length / 2, 0);
+}
+
+/**
+ * @brief Decode a Base32 string (RFC 4648 section 6), case-insensitive.
+ *
+ * Decoding stops at the first padding character '='. Bits which don't
+ * make a full byte at the end are dropped.
+ *
+ * @return
+ *  OTP_DECODE_INVALID_CHAR with the offset of the first character out of
+ *  the alphabet, or OTP_DECODE_OK and the decoded size.
+ */
+DecodeResult decodeBase32(const char *in, size_t length, uint8_t *out, size_t capacity)
+{
+    size_t      i = 0;
+    size_t      size = 0;
+    uint32_t    buffer = 0;
+    int         bitsLeft = 0;
+
+    if (capacity < base32DecodedSize(length))
+        return makeResult(OTP_DECODE_BUFFER_TOO_SMALL, 0, 0);
+
+    // Chunks of 16 characters are exactly 10 bytes, so no bits are left between chunks
+#if OTP_DECODER_X86
+    if (cpuHasAvx2())
+        for (; i + 32 <= length && decodeBase32ChunkAvx2(in + i, out + size); i += 32)
+            size += 20;
+    if (cpuHasSsse3())
+        for (; i + 16 <= length && decodeBase32ChunkSsse3(in + i, out + size); i += 16)
+            size += 10;
+#endif
+
+    for (; i < length; ++i)
+    {
+        int8_t value = base32Values[static_cast<uint8_t>(in[i])];
+
+        if (value == OTP_BASE32_PADDING)    // Padding character means we have reached the end of the key
+            break;
+        if (value < 0)
+            return makeResult(OTP_DECODE_INVALID_CHAR, size, i);
+
+        buffer = (buffer << 5) | static_cast<uint32_t>(value);
+        bitsLeft += 5;
+        if (bitsLeft >= 8)
+        {
+            out[size++] = static_cast<uint8_t>(buffer >> (bitsLeft - 8));
+            bitsLeft -= 8;
+        }
+    }
+    return makeResult(OTP_DECODE_OK, size, 0);
+}
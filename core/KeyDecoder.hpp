@@ -0,0 +1,57 @@
+#ifndef KEYDECODER_HPP
+# define KEYDECODER_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+ * Hex and Base32 (RFC 4648) decoders
+ *
+ * Characters are mapped through 256-entry lookup tables, and long inputs
+ * are decoded 16 or 32 characters at a time with SSSE3/AVX2 when the CPU
+ * supports it. Each decoder validates its input in the same pass as it
+ * decodes it, and writes into a buffer sized by the caller beforehand
+ * with hexDecodedSize()/base32DecodedSize().
+ *
+ * classifyKey() tells in a single pass which formats a key could be in,
+ * so the format can be detected once and passed along to the decoders.
+ */
+
+// Values to identify the given key (secret) format.
+// These values will be used in bitwise operations.
+enum KeyFormat
+{
+	OTP_KEYFORMAT_HEX		= 1,
+	OTP_KEYFORMAT_BASE32	= 2,
+	OTP_KEYFORMAT_DEFAULT	= 3
+};
+
+enum DecodeStatus
+{
+	OTP_DECODE_OK				= 0,
+	OTP_DECODE_INVALID_CHAR		= 1,	// 'errorOffset' is the offset of the character
+	OTP_DECODE_BUFFER_TOO_SMALL	= 2
+};
+
+struct DecodeResult
+{
+	DecodeStatus	status;
+	size_t			size;			// Number of bytes written
+	size_t			errorOffset;	// Offset of the first invalid character
+};
+
+struct KeyClassification
+{
+	uint8_t			format;			// OTP_KEYFORMAT_* flags, 0 if neither
+	size_t			errorOffset;	// First character invalid in every format (length if none)
+};
+
+KeyClassification	classifyKey(const char *key, size_t length);
+
+size_t			hexDecodedSize(size_t length);
+size_t			base32DecodedSize(size_t length);
+
+DecodeResult	decodeHex(const char *in, size_t length, uint8_t *out, size_t capacity);
+DecodeResult	decodeBase32(const char *in, size_t length, uint8_t *out, size_t capacity);
+
+#endif
@@ -0,0 +1,549 @@
+#include "KeyStore.hpp"
+#include "BinaryIO.hpp"
+#include <cstdio>
+#include <vector>
+
+static std::streamoff bucketOffset(uint32_t headerSize, uint32_t bucket)
+{
+	return headerSize + static_cast<std::streamoff>(bucket) * OTP_STORE_BUCKET_SIZE;
+}
+
+static std::streamoff recordOffset(uint32_t headerSize, uint32_t bucketCount, uint32_t record)
+{
+	return bucketOffset(headerSize, bucketCount) + static_cast<std::streamoff>(record) * OTP_STORE_RECORD_SIZE;
+}
+
+
+static bool fileExists(const std::string &path)
+{
+	struct stat buffer;
+	return stat(path.c_str(), &buffer) == 0;
+}
+
+// Fill a whole record: its label, then the key encrypted with a new nonce
+static void sealRecord(RecordCipher &cipher, const std::string &label, const uint8_t *key, size_t size,
+	uint8_t *record)
+{
+	memset(record, 0, OTP_STORE_RECORD_SIZE);
+	memcpy(record, label.data(), label.size());
+	storeLE32(record + OTP_STORE_LABEL_SIZE, static_cast<uint32_t>(size + OTP_RECORD_TAG_SIZE));
+	cipher.seal(record, OTP_STORE_LABEL_SIZE, key, size,
+		record + OTP_STORE_NONCE_OFFSET, record + OTP_STORE_CIPHER_OFFSET);
+}
+
+KeyStore::KeyStore(const std::string &fileName, bool verbose)
+	: _fileName(fileName), _verbose(verbose), _passphrase(false)
+{
+	memset(_cipherSalt, 0, sizeof(_cipherSalt));
+}
+
+KeyStore::~KeyStore() {}
+
+// No '/': a label given to -k must never be mistaken for a key file path
+bool KeyStore::isValidLabel(const std::string &label)
+{
+	return !label.empty() && label.size() < OTP_STORE_LABEL_SIZE
+		&& label.find('\0') == std::string::npos && label.find('/') == std::string::npos;
+}
+
+// 32-bit FNV-1a hash of the account label
+uint32_t KeyStore::hashLabel(const std::string &label)
+{
+	uint32_t hash = 2166136261u;
+
+	for (char c : label)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Check the header, and that the mapping is large enough for the index and the records
+void KeyStore::readHeader(const MappedFile &store, Header &header)
+{
+	const uint8_t *buffer = store.data();
+
+	if (store.size() < OTP_STORE_HEADER_SIZE)
+		throw InvalidStoreException();
+
+	header.version = loadLE32(buffer + 8);
+	header.size = OTP_STORE_HEADER_SIZE;
+	header.bucketCount = loadLE32(buffer + 16);
+	header.recordCount = loadLE32(buffer + 20);
+	memset(&header.kdf, 0, sizeof(header.kdf));
+	if (header.version == OTP_STORE_KDF_VERSION)
+	{
+		header.size = OTP_STORE_KDF_HEADER;
+		if (store.size() < OTP_STORE_KDF_HEADER)
+			throw InvalidStoreException();
+		header.kdf.log2Cost = buffer[24];
+		header.kdf.blockSize = buffer[25];
+		header.kdf.parallelism = buffer[26];
+		memcpy(header.kdf.salt, buffer + 32, OTP_KDF_SALT_SIZE);
+		memcpy(header.kdf.check, buffer + 48, OTP_KDF_CHECK_SIZE);
+		if (!isValidStoreKdf(header.kdf))
+			throw InvalidStoreException();
+	}
+	if (memcmp(buffer, OTP_STORE_MAGIC, 8) != 0
+		|| header.version < OTP_STORE_CBC_VERSION || header.version > OTP_STORE_KDF_VERSION
+		|| loadLE32(buffer + 12) != OTP_STORE_RECORD_SIZE
+		|| header.bucketCount < OTP_STORE_MIN_BUCKETS
+		|| (header.bucketCount & (header.bucketCount - 1)) != 0
+		|| header.recordCount > header.bucketCount / 2
+		|| static_cast<std::streamoff>(store.size())
+			< recordOffset(header.size, header.bucketCount, header.recordCount))
+		throw InvalidStoreException();
+}
+
+void KeyStore::writeHeader(std::fstream &file, const Header &header)
+{
+	uint8_t buffer[OTP_STORE_KDF_HEADER];
+
+	memset(buffer, 0, sizeof(buffer));
+	memcpy(buffer, OTP_STORE_MAGIC, 8);
+	storeLE32(buffer + 8, header.version);
+	storeLE32(buffer + 12, OTP_STORE_RECORD_SIZE);
+	storeLE32(buffer + 16, header.bucketCount);
+	storeLE32(buffer + 20, header.recordCount);
+	if (header.version == OTP_STORE_KDF_VERSION)
+	{
+		buffer[24] = header.kdf.log2Cost;
+		buffer[25] = header.kdf.blockSize;
+		buffer[26] = header.kdf.parallelism;
+		memcpy(buffer + 32, header.kdf.salt, OTP_KDF_SALT_SIZE);
+		memcpy(buffer + 48, header.kdf.check, OTP_KDF_CHECK_SIZE);
+	}
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char *>(buffer), header.size);
+}
+
+/**
+ * @brief Look for the record of an account in the index.
+ *
+ * The buckets are probed from the one of the label hash until the label
+ * or an empty bucket is found. The stored hash avoids reading the label
+ * of a record whose hash doesn't even match.
+ *
+ * @param bucket
+ *  Set to the bucket of the label, or to the empty bucket where it should
+ *  be inserted.
+ *
+ * @return
+ *  true if the label is in the store, its record number is set in 'record'.
+ */
+bool KeyStore::findRecord(const MappedFile &store, const Header &header, const std::string &label,
+	uint32_t &bucket, uint32_t &record)
+{
+	const uint32_t	hash = hashLabel(label);
+	const uint32_t	mask = header.bucketCount - 1;
+
+	for (uint32_t i = 0; i < header.bucketCount; ++i)
+	{
+		bucket = (hash + i) & mask;
+		const uint8_t *entry = store.data() + bucketOffset(header.size, bucket);
+
+		uint32_t entryRecord = loadLE32(entry + 4);
+		if (entryRecord == 0)
+			return false;
+		if (loadLE32(entry) != hash)
+			continue;
+		if (entryRecord > header.recordCount)
+			throw InvalidStoreException();
+
+		const char *storedLabel = reinterpret_cast<const char *>(
+			store.data() + recordOffset(header.size, header.bucketCount, entryRecord - 1));
+		if (strncmp(storedLabel, label.c_str(), OTP_STORE_LABEL_SIZE) == 0)
+		{
+			record = entryRecord - 1;
+			return true;
+		}
+	}
+	throw InvalidStoreException();	// The index is never full
+}
+
+// Write an empty store: the header and an index of empty buckets
+void KeyStore::createStore(void)
+{
+	Header header;
+
+	header.version = OTP_STORE_VERSION;
+	header.size = OTP_STORE_HEADER_SIZE;
+	header.bucketCount = OTP_STORE_MIN_BUCKETS;
+	header.recordCount = 0;
+	// The passphrase is asked first, so a failed prompt leaves no empty store behind
+	if (_passphrase)
+		newStoreKey(header);
+
+	std::fstream file(_fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw OpenFileException();
+	writeHeader(file, header);
+
+	std::vector<char> index(static_cast<size_t>(header.bucketCount) * OTP_STORE_BUCKET_SIZE, 0);
+	file.write(index.data(), index.size());
+	if (!file)
+		throw OpenFileException();
+	if (_verbose)
+		std::cout << FMT_INFO " Created the key store '" << _fileName << "'." << std::endl;
+}
+
+/**
+ * @brief Rewrite the store with the index size and the format of 'rewritten'.
+ *
+ * The records keep their numbers and are moved after the new index. If
+ * the format changes, they're decrypted and sealed again with the cipher
+ * of the new format, otherwise they're copied as they are. The store is
+ * rewritten in a temporary file which then replaces the old one, and the
+ * old mapping stays valid until it is destroyed by the caller.
+ */
+void KeyStore::rewriteStore(const MappedFile &store, Header &header, const Header &rewritten)
+{
+	const std::string	tmpName = _fileName + ".tmp";
+	const uint32_t		bucketCount = rewritten.bucketCount;
+	char				label[OTP_STORE_LABEL_SIZE];
+
+	std::vector<uint8_t> index(static_cast<size_t>(bucketCount) * OTP_STORE_BUCKET_SIZE, 0);
+
+	for (uint32_t record = 0; record < header.recordCount; ++record)
+	{
+		memcpy(label, store.data() + recordOffset(header.size, header.bucketCount, record), sizeof(label));
+		label[OTP_STORE_LABEL_SIZE - 1] = '\0';
+
+		uint32_t hash = hashLabel(label);
+		uint32_t bucket = hash & (bucketCount - 1);
+		while (loadLE32(&index[bucket * OTP_STORE_BUCKET_SIZE + 4]) != 0)
+			bucket = (bucket + 1) & (bucketCount - 1);
+		storeLE32(&index[bucket * OTP_STORE_BUCKET_SIZE], hash);
+		storeLE32(&index[bucket * OTP_STORE_BUCKET_SIZE + 4], record + 1);
+	}
+
+	std::fstream tmp(tmpName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!tmp)
+		throw OpenFileException();
+	writeHeader(tmp, rewritten);
+	tmp.write(reinterpret_cast<const char *>(index.data()), index.size());
+	if (header.version == rewritten.version)
+	{
+		// The records are copied straight from the mapping
+		tmp.write(reinterpret_cast<const char *>(store.data() + recordOffset(header.size, header.bucketCount, 0)),
+			static_cast<std::streamsize>(header.recordCount) * OTP_STORE_RECORD_SIZE);
+	}
+	else
+	{
+		ArenaScope		scope;
+		uint8_t			*key = scope.allocate(OTP_STORE_CIPHER_SIZE);
+		uint8_t			*buffer = scope.allocate(OTP_STORE_RECORD_SIZE);
+		RecordCipher	&sealer = cipher(rewritten);
+
+		for (uint32_t record = 0; record < header.recordCount; ++record)
+		{
+			const uint8_t *recordData = store.data() + recordOffset(header.size, header.bucketCount, record);
+			size_t size = openRecord(header, recordData, key);
+
+			memcpy(label, recordData, sizeof(label));
+			label[OTP_STORE_LABEL_SIZE - 1] = '\0';
+			sealRecord(sealer, label, key, size, buffer);
+			secureWipe(key, size);
+			tmp.write(reinterpret_cast<const char *>(buffer), OTP_STORE_RECORD_SIZE);
+		}
+	}
+	tmp.close();
+	if (!tmp)
+		throw OpenFileException();
+
+	if (std::rename(tmpName.c_str(), _fileName.c_str()) != 0)
+		throw OpenFileException();
+
+	if (_verbose && header.version != rewritten.version)
+		std::cout << FMT_INFO " Key store converted to version " << rewritten.version
+				  << (rewritten.version == OTP_STORE_KDF_VERSION ? " (passphrase)." : " (AES-GCM records).")
+				  << std::endl;
+	if (_verbose && bucketCount != header.bucketCount)
+		std::cout << FMT_INFO " Key store index grown to "
+				  << bucketCount << " buckets." << std::endl;
+	header = rewritten;
+}
+
+/**
+ * @brief Encrypt a key and store it under the given account label.
+ *
+ * The store is created if it doesn't exist yet. If the label is already
+ * used, its record is overwritten in place.
+ */
+void KeyStore::saveKey(const std::string &label, const char *key, size_t size)
+{
+	uint8_t			buffer[OTP_STORE_RECORD_SIZE];
+	uint8_t			entry[OTP_STORE_BUCKET_SIZE];
+	uint32_t		bucket, record;
+	Header			header;
+
+	if (!isValidLabel(label))
+		throw InvalidLabelException();
+	if (size > OTP_STORE_MAX_KEY_SIZE)
+		throw KeyTooLongException();
+	if (size == 0)
+		throw CipherException();
+
+	if (!fileExists(_fileName))
+		createStore();
+
+	// Look for the label in the mapped store, the writes go through a stream
+	bool replace, rewritten = false;
+	{
+		MappedFile store(_fileName.c_str());
+		readHeader(store, header);
+		replace = findRecord(store, header, label, bucket, record);
+
+		// The store is rewritten to grow its index, or to change its format
+		Header target = header;
+		if (!replace && (header.recordCount + 1) > header.bucketCount / 2)
+			target.bucketCount = header.bucketCount * 2;
+		if (_passphrase && header.version != OTP_STORE_KDF_VERSION)
+			newStoreKey(target);
+		else if (header.version == OTP_STORE_CBC_VERSION)
+			target.version = OTP_STORE_VERSION;
+		if (target.bucketCount != header.bucketCount || target.version != header.version)
+		{
+			rewriteStore(store, header, target);
+			rewritten = true;
+		}
+	}
+	if (rewritten)
+	{
+		MappedFile store(_fileName.c_str());
+		readHeader(store, header);
+		findRecord(store, header, label, bucket, record);
+	}
+	if (!replace)
+		record = header.recordCount;
+
+	std::fstream file(_fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	if (!file)
+		throw OpenFileException();
+
+	// The record is written before the index, so it's never referenced half-written
+	try
+	{
+		sealRecord(cipher(header), label, reinterpret_cast<const uint8_t *>(key), size, buffer);
+	}
+	catch (const CryptoPP::Exception &)
+	{
+		throw CipherException();
+	}
+	file.seekp(recordOffset(header.size, header.bucketCount, record));
+	file.write(reinterpret_cast<const char *>(buffer), sizeof(buffer));
+
+	if (!replace)
+	{
+		storeLE32(entry, hashLabel(label));
+		storeLE32(entry + 4, record + 1);
+		file.seekp(bucketOffset(header.size, bucket));
+		file.write(reinterpret_cast<const char *>(entry), sizeof(entry));
+
+		header.recordCount++;
+		writeHeader(file, header);
+	}
+	file.flush();
+	if (!file)
+		throw OpenFileException();
+
+	if (_verbose)
+		std::cout << FMT_INFO " Key of '" << label << "' saved in record "
+				  << record << " of '" << _fileName << "'." << std::endl;
+}
+
+/**
+ * @brief Decrypt the key of one account, straight from the mapped store.
+ *
+ * Only the header, the probed index buckets and the account record are
+ * touched, so the cost doesn't depend on the number of stored accounts.
+ * The key is decrypted into a buffer of 'scope', so it stays in locked
+ * memory and is wiped when the caller's scope ends.
+ */
+const uint8_t *KeyStore::loadKey(const std::string &label, ArenaScope &scope, size_t &size)
+{
+	const uint8_t *key = findKey(label, scope, size);
+
+	if (!key)
+		throw KeyNotFoundException();
+	return key;
+}
+
+const uint8_t *KeyStore::findKey(const std::string &label, ArenaScope &scope, size_t &size)
+{
+	uint32_t	bucket, record;
+	Header		header;
+
+	if (!isValidLabel(label))
+		throw InvalidLabelException();
+
+	MappedFile store(_fileName.c_str());
+	readHeader(store, header);
+	if (!findRecord(store, header, label, bucket, record))
+		return nullptr;
+
+	if (_verbose)
+		std::cout << FMT_INFO " Reading the key of '" << label << "' from record "
+				  << record << " of '" << _fileName << "'..." << std::endl;
+
+	uint8_t	*key = scope.allocate(OTP_STORE_CIPHER_SIZE);
+	size = openRecord(header, store.data() + recordOffset(header.size, header.bucketCount, record), key);
+	return key;
+}
+
+/**
+ * @brief Decrypt the key of one record into 'key' (OTP_STORE_CIPHER_SIZE bytes).
+ *
+ * @return
+ *  The size of the key. In case the record is corrupted or was modified,
+ *  an 'InvalidStoreException' or a 'CipherException' is thrown.
+ */
+size_t KeyStore::openRecord(const Header &header, const uint8_t *recordData, uint8_t *key)
+{
+	uint32_t cipherSize = loadLE32(recordData + OTP_STORE_LABEL_SIZE);
+	if (cipherSize == 0 || cipherSize > OTP_STORE_CIPHER_SIZE)
+		throw InvalidStoreException();
+
+	if (header.version == OTP_STORE_CBC_VERSION)
+	{
+		TOTPGenerator	TOTPGenerator(false);
+		size_t			size;
+
+		// The padding can only shrink the cipher, which fits in 'key'
+		if (!TOTPGenerator.decryptAES(recordData + OTP_STORE_CIPHER_OFFSET, cipherSize, key, size))
+			throw CipherException();
+		return size;
+	}
+
+	try
+	{
+		if (cipher(header).open(recordData, OTP_STORE_LABEL_SIZE, recordData + OTP_STORE_NONCE_OFFSET,
+				recordData + OTP_STORE_CIPHER_OFFSET, cipherSize, key))
+			return cipherSize - OTP_RECORD_TAG_SIZE;
+	}
+	catch (const CryptoPP::Exception &) {}
+	throw CipherException();
+}
+
+/**
+ * @brief Decrypt the keys of all the accounts.
+ *
+ * The records are read in file order rather than through the index, so
+ * the mapping is scanned sequentially, and all of them are opened with
+ * the same keyed cipher. Each key is decrypted into the secure arena and
+ * wiped once 'visit' returns.
+ */
+void KeyStore::forEachKey(const KeyVisitor &visit)
+{
+	Header		header;
+	MappedFile	store(_fileName.c_str());
+	ArenaScope	scope;
+	uint8_t		*key = scope.allocate(OTP_STORE_CIPHER_SIZE);
+	char		label[OTP_STORE_LABEL_SIZE];
+
+	readHeader(store, header);
+	for (uint32_t record = 0; record < header.recordCount; ++record)
+	{
+		const uint8_t *recordData = store.data() + recordOffset(header.size, header.bucketCount, record);
+		size_t size = openRecord(header, recordData, key);
+
+		memcpy(label, recordData, sizeof(label));
+		label[OTP_STORE_LABEL_SIZE - 1] = '\0';
+		try
+		{
+			visit(label, key, size);
+		}
+		catch (...)
+		{
+			secureWipe(key, size);
+			throw;
+		}
+		secureWipe(key, size);
+	}
+}
+
+// Number of accounts in the store
+uint32_t KeyStore::size(void)
+{
+	Header		header;
+	MappedFile	store(_fileName.c_str());
+
+	readHeader(store, header);
+	return header.recordCount;
+}
+
+void KeyStore::setKeyProvider(const StoreKeyProvider &provider)
+{
+	_keyProvider = provider;
+}
+
+void KeyStore::usePassphrase(void)
+{
+	_passphrase = true;
+}
+
+bool KeyStore::getKdf(StoreKdf &kdf)
+{
+	Header		header;
+	MappedFile	store(_fileName.c_str());
+
+	readHeader(store, header);
+	kdf = header.kdf;
+	return header.version == OTP_STORE_KDF_VERSION;
+}
+
+/**
+ * @brief The cipher of the records of a store.
+ *
+ * For a passphrase-protected store, the key is asked to the provider the
+ * first time, and checked against the header. Only the keyed cipher is
+ * kept, the key itself is wiped.
+ *
+ * @return
+ *  In case there is no provider, a 'PassphraseRequiredException' is
+ *  thrown, and a 'WrongPassphraseException' if the key is not the one
+ *  of the store.
+ */
+RecordCipher &KeyStore::cipher(const Header &header)
+{
+	if (header.version != OTP_STORE_KDF_VERSION)
+		return RecordCipher::local();
+	if (_cipher && memcmp(_cipherSalt, header.kdf.salt, OTP_KDF_SALT_SIZE) == 0)
+		return *_cipher;
+	if (!_keyProvider)
+		throw PassphraseRequiredException();
+
+	ArenaScope	scope;
+	uint8_t		*key = scope.allocate(OTP_STORE_KEY_SIZE);
+
+	_keyProvider(header.kdf, false, key);
+	if (!isStoreKey(header.kdf, key))
+		throw WrongPassphraseException();
+	setCipher(header.kdf, key);
+	return *_cipher;
+}
+
+void KeyStore::setCipher(const StoreKdf &kdf, const uint8_t *key)
+{
+	_cipher.reset(new RecordCipher(key, OTP_STORE_KEY_SIZE));
+	memcpy(_cipherSalt, kdf.salt, OTP_KDF_SALT_SIZE);
+}
+
+// Switch a header to a passphrase-protected store, with a new salt and a new passphrase
+void KeyStore::newStoreKey(Header &header)
+{
+	if (!_keyProvider)
+		throw PassphraseRequiredException();
+
+	ArenaScope	scope;
+	uint8_t		*key = scope.allocate(OTP_STORE_KEY_SIZE);
+
+	newStoreKdf(header.kdf);
+	_keyProvider(header.kdf, true, key);
+	setStoreKeyCheck(header.kdf, key);
+	setCipher(header.kdf, key);
+	header.version = OTP_STORE_KDF_VERSION;
+	header.size = OTP_STORE_KDF_HEADER;
+}
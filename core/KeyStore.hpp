@@ -0,0 +1,206 @@
+#ifndef KEYSTORE_HPP
+# define KEYSTORE_HPP
+
+# include <iostream>
+# include <fstream>
+# include <functional>
+# include <memory>
+# include <stdexcept>
+# include <string>
+# include <stdint.h>
+# include <sys/stat.h>
+
+# include "ascii_format.hpp"
+# include "TOTPGenerator.hpp"
+# include "MappedFile.hpp"
+# include "RecordCipher.hpp"
+# include "StoreKey.hpp"
+
+# define OTP_STOREFILENAME	"ft_otp.store"
+# define OTP_STORE_MAGIC	"FTOTPKS1"
+
+/*
+ * Multi-account key store
+ *
+ * File layout (all integers are little-endian):
+ *
+ *  header  | magic (8) | version (4) | record size (4) | bucket count (4) | record count (4) | reserved (8) |
+ *          | version 3 only: scrypt log2 N, r, p (3) | reserved (5) | salt (16) | key check (16) |
+ *  index   | bucket count x { label hash (4), record number + 1 (4) }    (0 = empty bucket)
+ *  records | record count x { label (64) | cipher size (4) | nonce (12) | AES-GCM cipher and tag (560) }
+ *
+ * The index is an open addressing hash table (linear probing) keyed by
+ * the account label, and every record has the same size. The store is
+ * memory-mapped, so opening it is constant time, and looking up an
+ * account only touches the header, a few index buckets and one record,
+ * whatever the number of accounts. The index is kept at most half full,
+ * and is rebuilt with twice as many buckets when a new account doesn't
+ * fit anymore.
+ *
+ * Each record is encrypted on its own (see RecordCipher), with a random
+ * nonce and its label as associated data. Version 1 stores, whose records
+ * were AES-CBC with a fixed IV, can still be read; they're rewritten in
+ * the current format when a key is saved.
+ *
+ * The records of a version 2 store are encrypted with the built-in key.
+ * Those of a version 3 store are encrypted with a key derived from a
+ * passphrase (see StoreKey.hpp), given by a StoreKeyProvider the first
+ * time a record is opened; the key schedule is then kept by the store.
+ */
+
+enum KeyStoreLayout
+{
+	OTP_STORE_VERSION		= 2,
+	OTP_STORE_CBC_VERSION	= 1,		// AES-CBC records, read-only
+	OTP_STORE_KDF_VERSION	= 3,		// Passphrase-derived key
+	OTP_STORE_HEADER_SIZE	= 32,
+	OTP_STORE_KDF_HEADER	= 64,		// Header size of version 3
+	OTP_STORE_BUCKET_SIZE	= 8,
+	OTP_STORE_MIN_BUCKETS	= 1024,		// Power of two
+	OTP_STORE_LABEL_SIZE	= 64,		// Including the terminating '\0'
+	OTP_STORE_NONCE_OFFSET	= 68,
+	OTP_STORE_CIPHER_OFFSET	= 80,
+	OTP_STORE_CIPHER_SIZE	= 560,
+	OTP_STORE_RECORD_SIZE	= 640,
+	OTP_STORE_MAX_KEY_SIZE	= 512		// Plus the 16-byte tag
+};
+
+// Called with the label and the decrypted key of each account, the key is wiped afterwards
+typedef std::function<void(const std::string &label, const uint8_t *key, size_t size)>	KeyVisitor;
+
+class KeyStore
+{
+public:
+	KeyStore(const std::string &fileName, bool verbose = false);
+	~KeyStore();
+
+	// Add the key of an account, or replace it if the label already exists
+	void		saveKey(const std::string &label, const char *key, size_t size);
+	// Decrypt the key of a single account into a buffer of 'scope', its size in 'size'
+	const uint8_t	*loadKey(const std::string &label, ArenaScope &scope, size_t &size);
+	// Same as above, but returns null instead of throwing if the account doesn't exist
+	const uint8_t	*findKey(const std::string &label, ArenaScope &scope, size_t &size);
+	// Decrypt the keys of all the accounts, in one sequential pass over the records
+	void		forEachKey(const KeyVisitor &visit);
+	uint32_t	size(void);
+
+	// Source of the key of a passphrase-protected store
+	void		setKeyProvider(const StoreKeyProvider &provider);
+	// Protect the store with a passphrase the next time a key is saved, if it isn't yet
+	void		usePassphrase(void);
+	// Scrypt parameters of the store, false if it's not protected by a passphrase
+	bool		getKdf(StoreKdf &kdf);
+
+	static uint32_t	hashLabel(const std::string &label);
+	static bool		isValidLabel(const std::string &label);
+
+private:
+	struct Header
+	{
+		uint32_t	version;
+		uint32_t	size;			// The index follows the header
+		uint32_t	bucketCount;
+		uint32_t	recordCount;
+		StoreKdf	kdf;			// Version 3 only
+	};
+
+	std::string						_fileName;
+	bool							_verbose;
+	bool							_passphrase;
+	StoreKeyProvider				_keyProvider;
+	std::unique_ptr<RecordCipher>	_cipher;		// Keyed for the store of '_cipherSalt'
+	uint8_t							_cipherSalt[OTP_KDF_SALT_SIZE];
+
+	void		readHeader(const MappedFile &store, Header &header);
+	void		writeHeader(std::fstream &file, const Header &header);
+	bool		findRecord(const MappedFile &store, const Header &header, const std::string &label,
+					uint32_t &bucket, uint32_t &record);
+	void		createStore(void);
+	void		rewriteStore(const MappedFile &store, Header &header, const Header &rewritten);
+	size_t		openRecord(const Header &header, const uint8_t *recordData, uint8_t *key);
+	RecordCipher	&cipher(const Header &header);
+	void		setCipher(const StoreKdf &kdf, const uint8_t *key);
+	void		newStoreKey(Header &header);
+
+	class InvalidStoreException : public std::exception
+	{
+	public:
+		InvalidStoreException() throw() {}
+		const char *what() const throw() {
+			return "The key store file is corrupted or has an unknown format.";
+		}
+		~InvalidStoreException() throw() {}
+	};
+
+	class InvalidLabelException : public std::exception
+	{
+	public:
+		InvalidLabelException() throw() {}
+		const char *what() const throw() {
+			return "An account label must have between 1 and 63 characters, without '/'.";
+		}
+		~InvalidLabelException() throw() {}
+	};
+
+	class KeyNotFoundException : public std::exception
+	{
+	public:
+		KeyNotFoundException() throw() {}
+		const char *what() const throw() {
+			return "No key is stored under this account label.";
+		}
+		~KeyNotFoundException() throw() {}
+	};
+
+	class KeyTooLongException : public std::exception
+	{
+	public:
+		KeyTooLongException() throw() {}
+		const char *what() const throw() {
+			return "The key is too long to be stored (512 characters at most).";
+		}
+		~KeyTooLongException() throw() {}
+	};
+
+	class CipherException : public std::exception
+	{
+	public:
+		CipherException() throw() {}
+		const char *what() const throw() {
+			return "Failed to encrypt or decrypt the stored key.";
+		}
+		~CipherException() throw() {}
+	};
+
+	class PassphraseRequiredException : public std::exception
+	{
+	public:
+		PassphraseRequiredException() throw() {}
+		const char *what() const throw() {
+			return "The key store is protected by a passphrase.";
+		}
+		~PassphraseRequiredException() throw() {}
+	};
+
+	class WrongPassphraseException : public std::exception
+	{
+	public:
+		WrongPassphraseException() throw() {}
+		const char *what() const throw() {
+			return "Wrong passphrase for the key store.";
+		}
+		~WrongPassphraseException() throw() {}
+	};
+
+	class OpenFileException : public std::exception
+	{
+	public:
+		OpenFileException() throw() {}
+		const char *what() const throw() {
+			return "Failed to open the key store file.";
+		}
+		~OpenFileException() throw() {}
+	};
+};
+
+#endif
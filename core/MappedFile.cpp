@@ -0,0 +1,52 @@
+#include "MappedFile.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Map a regular file in memory, read-only.
+ *
+ * The file descriptor is closed right away, the mapping stays valid until
+ * the object is destroyed. An empty file has no mapping (data() is null).
+ *
+ * @return
+ *  In case the file is not a regular file or can't be mapped,
+ *  an 'OpenFileException' is thrown.
+ */
+MappedFile::MappedFile(const char *fileName) : _data(nullptr), _size(0)
+{
+	struct stat	buffer;
+	int			fd = open(fileName, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		throw OpenFileException();
+	if (fstat(fd, &buffer) != 0 || !S_ISREG(buffer.st_mode))
+	{
+		close(fd);
+		throw OpenFileException();
+	}
+
+	_size = static_cast<size_t>(buffer.st_size);
+	if (_size > 0)
+	{
+		void *mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			close(fd);
+			throw OpenFileException();
+		}
+		_data = static_cast<const uint8_t *>(mapping);
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (_data)
+		munmap(const_cast<uint8_t *>(_data), _size);
+}
+
+const uint8_t *MappedFile::data(void) const { return _data; }
+size_t MappedFile::size(void) const { return _size; }
+bool MappedFile::empty(void) const { return _size == 0; }
@@ -0,0 +1,45 @@
+#ifndef MAPPEDFILE_HPP
+# define MAPPEDFILE_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <exception>
+
+/*
+ * Read-only memory mapping of a whole file
+ *
+ * Opening a file is constant time whatever its size: the pages are only
+ * read by the kernel when they are accessed, and the content can be used
+ * in place, without copying it into a string first.
+ */
+
+class MappedFile
+{
+public:
+	explicit MappedFile(const char *fileName);
+	~MappedFile();
+
+	const uint8_t	*data(void) const;
+	size_t			size(void) const;
+	bool			empty(void) const;
+
+	class OpenFileException : public std::exception
+	{
+	public:
+		OpenFileException() throw() {}
+		const char *what() const throw() {
+			return "Failed to open the file.";
+		}
+		~OpenFileException() throw() {}
+	};
+
+private:
+	const uint8_t	*_data;
+	size_t			_size;
+
+	// A mapping can't be shared between two objects
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "PreparedKey.hpp"
+#include "TOTPGenerator.hpp"
+
+template <class Hash>
+BasicPreparedKey<Hash>::BasicPreparedKey()
+{
+    memset(_innerState, 0, sizeof(_innerState));
+    memset(_outerState, 0, sizeof(_outerState));
+}
+
+// Decode a Hex or Base32 key (of a known format, if not 0), then precompute its key schedule
+template <class Hash>
+BasicPreparedKey<Hash>::BasicPreparedKey(const std::string &key, bool verbose, uint8_t keyFormat)
+{
+    TOTPGenerator   TOTPGenerator(verbose);
+    ArenaScope      scope;
+    size_t          capacity = TOTPGenerator::decodedKeyCapacity(key.size());
+    uint8_t         *decodedKey = scope.allocate(capacity);
+
+    prepare(decodedKey, TOTPGenerator.DecodeKeyInto(key.data(), key.size(), decodedKey, capacity, keyFormat));
+}
+
+template <class Hash>
+BasicPreparedKey<Hash>::BasicPreparedKey(const uint8_t *secret, size_t size)
+{
+    prepare(secret, size);
+}
+
+template <class Hash>
+BasicPreparedKey<Hash>::~BasicPreparedKey()
+{
+    // The midstates are as sensitive as the secret itself
+    volatile Word *inner = _innerState;
+    volatile Word *outer = _outerState;
+    for (int i = 0; i < Hash::STATE_WORDS; ++i)
+        inner[i] = outer[i] = 0;
+}
+
+template <class Hash>
+const typename Hash::Word *BasicPreparedKey<Hash>::getInnerState(void) const { return _innerState; }
+template <class Hash>
+const typename Hash::Word *BasicPreparedKey<Hash>::getOuterState(void) const { return _outerState; }
+
+// Load a block as big-endian words and compress it
+template <class Hash>
+static void compressBlock(typename Hash::Word *state, const uint8_t *block)
+{
+    typedef typename Hash::Word Word;
+    Word words[16];
+
+    for (int i = 0; i < 16; ++i)
+    {
+        words[i] = 0;
+        for (size_t j = 0; j < sizeof(Word); ++j)
+            words[i] = (words[i] << 8) | block[i * sizeof(Word) + j];
+    }
+    Hash::compress(state, words);
+}
+
+/**
+ * @brief Hash the (K ^ ipad) and (K ^ opad) blocks once.
+ *
+ * As defined in RFC 2104, keys longer than the block size are first
+ * hashed, and shorter keys are padded with zeros up to the block size.
+ */
+template <class Hash>
+void BasicPreparedKey<Hash>::prepare(const uint8_t *secret, size_t size)
+{
+    uint8_t block[Hash::BLOCK_SIZE];
+    uint8_t pad[Hash::BLOCK_SIZE];
+
+    memset(block, 0, sizeof(block));
+    if (size > static_cast<size_t>(Hash::BLOCK_SIZE))
+        Hash::hash(secret, size, block);
+    else if (size)
+        memcpy(block, secret, size);
+
+    for (int i = 0; i < Hash::BLOCK_SIZE; ++i)
+        pad[i] = block[i] ^ 0x36;
+    Hash::init(_innerState);
+    compressBlock<Hash>(_innerState, pad);
+
+    for (int i = 0; i < Hash::BLOCK_SIZE; ++i)
+        pad[i] = block[i] ^ 0x5C;
+    Hash::init(_outerState);
+    compressBlock<Hash>(_outerState, pad);
+
+    secureWipe(block, sizeof(block));
+    secureWipe(pad, sizeof(pad));
+}
+
+/**
+ * @brief Compute HMAC(K, counter) from the precomputed midstates.
+ *
+ * The counter is the 8-byte big-endian moving factor from RFC 4226.
+ * Both remaining blocks are built directly as message words:
+ *  - inner: counter || 0x80 || zeros || bit length of (block + 8 bytes)
+ *  - outer: inner digest || 0x80 || zeros || bit length of (block + digest)
+ * The digest of SHA-1, SHA-256 and SHA-512 is exactly their state, so the
+ * inner state words are copied as is into the outer block.
+ */
+template <class Hash>
+void BasicPreparedKey<Hash>::hmac(uint64_t counter, uint8_t digest[Hash::DIGEST_SIZE]) const
+{
+    const int   counterWords = 8 / sizeof(Word);
+    const Word  paddingBit = static_cast<Word>(1) << (sizeof(Word) * 8 - 1);
+    Word        words[16];
+    Word        state[Hash::STATE_WORDS];
+
+    memcpy(state, _innerState, sizeof(state));
+    memset(words, 0, sizeof(words));
+    if (counterWords == 1)
+        words[0] = static_cast<Word>(counter);
+    else
+    {
+        words[0] = static_cast<Word>(counter >> 32);
+        words[1] = static_cast<Word>(counter);
+    }
+    words[counterWords] = paddingBit;
+    words[15] = (Hash::BLOCK_SIZE + 8) * 8;
+    Hash::compress(state, words);
+
+    memset(words, 0, sizeof(words));
+    memcpy(words, state, sizeof(state));
+    memcpy(state, _outerState, sizeof(state));
+    words[Hash::STATE_WORDS] = paddingBit;
+    words[15] = (Hash::BLOCK_SIZE + Hash::DIGEST_SIZE) * 8;
+    Hash::compress(state, words);
+
+    for (int i = 0; i < Hash::STATE_WORDS; ++i)
+        for (size_t j = 0; j < sizeof(Word); ++j)
+            digest[i * sizeof(Word) + j] = static_cast<uint8_t>(state[i] >> (8 * (sizeof(Word) - 1 - j)));
+}
+
+template class BasicPreparedKey<Sha1Hash>;
+template class BasicPreparedKey<Sha256Hash>;
+template class BasicPreparedKey<Sha512Hash>;
@@ -0,0 +1,55 @@
+#ifndef PREPAREDKEY_HPP
+# define PREPAREDKEY_HPP
+
+# include <string>
+# include <stdint.h>
+
+# include "HashAlgorithms.hpp"
+
+/*
+ * The precomputed HMAC key schedule of a decoded secret.
+ *
+ * HMAC(K, m) = H((K ^ opad) || H((K ^ ipad) || m))
+ *
+ * With a fixed K, the first block of both the inner and the outer hash
+ * never changes, so we hash them once here and keep the two resulting
+ * hash states. Computing the HMAC of an 8-byte counter then only costs
+ * one compression for the inner hash and one for the outer hash, without
+ * any decoding or heap allocation.
+ *
+ * The secret itself is not kept, the two states are all the HMAC needs.
+ *
+ * 'Hash' is one of the structures from HashAlgorithms.hpp.
+ */
+template <class Hash>
+class BasicPreparedKey
+{
+public:
+	typedef typename Hash::Word	Word;
+
+	BasicPreparedKey();
+	BasicPreparedKey(const std::string &key, bool verbose = false, uint8_t keyFormat = 0);
+	BasicPreparedKey(const uint8_t *secret, size_t size);
+	~BasicPreparedKey();
+
+	void							prepare(const uint8_t *secret, size_t size);
+	void							hmac(uint64_t counter, uint8_t digest[Hash::DIGEST_SIZE]) const;
+	const Word						*getInnerState(void) const;
+	const Word						*getOuterState(void) const;
+
+private:
+	Word					_innerState[Hash::STATE_WORDS];
+	Word					_outerState[Hash::STATE_WORDS];
+};
+
+// HMAC-SHA1 is the default TOTP mode
+typedef BasicPreparedKey<Sha1Hash>		PreparedKey;
+typedef BasicPreparedKey<Sha256Hash>	PreparedKeySha256;
+typedef BasicPreparedKey<Sha512Hash>	PreparedKeySha512;
+
+// Instantiated once in PreparedKey.cpp
+extern template class BasicPreparedKey<Sha1Hash>;
+extern template class BasicPreparedKey<Sha256Hash>;
+extern template class BasicPreparedKey<Sha512Hash>;
+
+#endif
@@ -0,0 +1,57 @@
+#include "RecordCipher.hpp"
+#include "TOTPGenerator.hpp"
+#include <memory>
+
+using namespace CryptoPP;
+
+RecordCipher::RecordCipher()
+    : RecordCipher(reinterpret_cast<const uint8_t *>(OTP_AES_KEY), OTP_AES_KEY_LEN) {}
+
+// Both directions are keyed once, the nonce is given again for every record
+RecordCipher::RecordCipher(const uint8_t *key, size_t size)
+{
+    byte nonce[OTP_RECORD_NONCE_SIZE] = {0};
+
+    _encryption.SetKeyWithIV(key, size, nonce, sizeof(nonce));
+    _decryption.SetKeyWithIV(key, size, nonce, sizeof(nonce));
+}
+
+RecordCipher &RecordCipher::local(void)
+{
+    static thread_local std::unique_ptr<RecordCipher> cipher;
+
+    if (!cipher)
+        cipher.reset(new RecordCipher());
+    return *cipher;
+}
+
+void RecordCipher::seal(const uint8_t *label, size_t labelSize, const uint8_t *plain, size_t size,
+    uint8_t *nonce, uint8_t *cipher)
+{
+    _random.GenerateBlock(nonce, OTP_RECORD_NONCE_SIZE);
+    _encryption.EncryptAndAuthenticate(cipher, cipher + size, OTP_RECORD_TAG_SIZE,
+        nonce, OTP_RECORD_NONCE_SIZE, label, labelSize, plain, size);
+}
+
+/**
+ * @brief Decrypt and authenticate one record.
+ *
+ * @return
+ *  false if the cipher is too short, or if the record or its label were
+ *  modified. 'plain' is wiped in that case.
+ */
+bool RecordCipher::open(const uint8_t *label, size_t labelSize, const uint8_t *nonce,
+    const uint8_t *cipher, size_t size, uint8_t *plain)
+{
+    if (size <= OTP_RECORD_TAG_SIZE)
+        return false;
+
+    size_t plainSize = size - OTP_RECORD_TAG_SIZE;
+    if (!_decryption.DecryptAndVerify(plain, cipher + plainSize, OTP_RECORD_TAG_SIZE,
+            nonce, OTP_RECORD_NONCE_SIZE, label, labelSize, cipher, plainSize))
+    {
+        secureWipe(plain, plainSize);
+        return false;
+    }
+    return true;
+}
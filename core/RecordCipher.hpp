@@ -0,0 +1,60 @@
+#ifndef RECORDCIPHER_HPP
+# define RECORDCIPHER_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include <cryptopp/aes.h>
+# include <cryptopp/gcm.h>
+# include <cryptopp/osrng.h>
+
+/*
+ * Authenticated encryption of a single key store record (AES-GCM)
+ *
+ * Every record gets its own random 96-bit nonce, so two accounts with the
+ * same key don't have the same cipher, and each record can be decrypted
+ * on its own. The account label is authenticated with the cipher: a
+ * record copied under another label, or a modified one, fails to open
+ * instead of decrypting to garbage.
+ *
+ * The AES key schedule and the GHASH tables are computed once by the
+ * constructor, only the nonce changes from one record to the next, so
+ * decrypting all the records of a store with one object is much cheaper
+ * than creating a cipher per record (the random pool too, which is seeded
+ * from the system). Crypto++ runs the counter blocks of a record through
+ * AES-NI and PCLMUL when the CPU has them.
+ */
+
+enum RecordCipherLayout
+{
+	OTP_RECORD_NONCE_SIZE	= 12,
+	OTP_RECORD_TAG_SIZE		= 16
+};
+
+class RecordCipher
+{
+public:
+	// Keyed with the built-in store key, or with the key of a passphrase-protected store
+	RecordCipher();
+	RecordCipher(const uint8_t *key, size_t size);
+
+	// The cipher of the calling thread with the built-in key, keyed on first use
+	static RecordCipher	&local(void);
+
+	// Encrypt 'size' bytes into 'cipher' (size + tag bytes) with a new nonce, written to 'nonce'
+	void	seal(const uint8_t *label, size_t labelSize, const uint8_t *plain, size_t size,
+				uint8_t *nonce, uint8_t *cipher);
+	// Decrypt 'size' bytes of cipher (tag included) into 'plain', false if it's not authentic
+	bool	open(const uint8_t *label, size_t labelSize, const uint8_t *nonce,
+				const uint8_t *cipher, size_t size, uint8_t *plain);
+
+private:
+	CryptoPP::GCM<CryptoPP::AES>::Encryption	_encryption;
+	CryptoPP::GCM<CryptoPP::AES>::Decryption	_decryption;
+	CryptoPP::AutoSeededRandomPool				_random;
+
+	RecordCipher(const RecordCipher &);
+	RecordCipher &operator=(const RecordCipher &);
+};
+
+#endif
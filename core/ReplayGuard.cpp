@@ -0,0 +1,242 @@
+#include "ReplayGuard.hpp"
+#include "BinaryIO.hpp"
+#include "SipHash.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Twice as many slots as accounts, rounded up to a power of two
+static size_t slotCount(size_t accounts)
+{
+    size_t slots = OTP_REPLAY_MIN_SLOTS;
+
+    while (slots / 2 < accounts)
+        slots *= 2;
+    return slots;
+}
+
+ReplayGuard::ReplayGuard(size_t accounts)
+    : _slots(new Slot[slotCount(accounts)]), _mask(slotCount(accounts) - 1),
+      _maxAccounts((_mask + 1) / 2), _accounts(0)
+{
+    for (size_t i = 0; i <= _mask; ++i)
+    {
+        _slots[i].hash.store(0, std::memory_order_relaxed);
+        _slots[i].counter.store(0, std::memory_order_relaxed);
+        _slots[i].drift.store(0, std::memory_order_relaxed);
+    }
+    newSipHashKey(_hashKey);
+}
+
+ReplayGuard::~ReplayGuard() {}
+
+const ReplayGuard::Slot *ReplayGuard::findSlot(uint64_t hash) const
+{
+    for (size_t i = hash & _mask;; i = (i + 1) & _mask)
+    {
+        uint64_t slotHash = _slots[i].hash.load(std::memory_order_acquire);
+        if (slotHash == hash)
+            return &_slots[i];
+        if (slotHash == 0)
+            return nullptr;
+    }
+}
+
+/**
+ * @brief Find the slot of an account, claiming an empty one if needed.
+ *
+ * A slot is claimed with a compare-and-swap of its hash: if another
+ * thread claims it first, for the same account, its slot is used,
+ * otherwise the probing goes on.
+ *
+ * @return
+ *  In case the table already holds its maximum number of accounts,
+ *  a 'TableFullException' is thrown.
+ */
+ReplayGuard::Slot *ReplayGuard::findSlot(uint64_t hash, bool insert)
+{
+    Slot *slot = const_cast<Slot *>(static_cast<const ReplayGuard *>(this)->findSlot(hash));
+    if (slot || !insert)
+        return slot;
+
+    // Reserve room first, so the table never gets more than half full
+    if (_accounts.fetch_add(1, std::memory_order_relaxed) >= _maxAccounts)
+    {
+        _accounts.fetch_sub(1, std::memory_order_relaxed);
+        throw TableFullException();
+    }
+    for (size_t i = hash & _mask;; i = (i + 1) & _mask)
+    {
+        uint64_t expected = 0;
+        if (_slots[i].hash.compare_exchange_strong(expected, hash, std::memory_order_acq_rel))
+            return &_slots[i];
+        if (expected == hash)
+        {
+            _accounts.fetch_sub(1, std::memory_order_relaxed);
+            return &_slots[i];
+        }
+    }
+}
+
+// Store 'stored' (counter + 1) if it's greater than the current value
+bool ReplayGuard::raiseCounter(Slot &slot, uint64_t stored)
+{
+    uint64_t current = slot.counter.load(std::memory_order_acquire);
+
+    while (current < stored)
+    {
+        // On failure 'current' is reloaded, and the loop ends if another thread got further
+        if (slot.counter.compare_exchange_weak(current, stored, std::memory_order_acq_rel))
+            return true;
+    }
+    return false;
+}
+
+bool ReplayGuard::accept(const std::string &account, uint64_t counter)
+{
+    if (counter == UINT64_MAX)
+        return false;
+    return raiseCounter(*findSlot(hashAccount(_hashKey, account), true), counter + 1);
+}
+
+bool ReplayGuard::lastCounter(const std::string &account, uint64_t &counter) const
+{
+    const Slot *slot = findSlot(hashAccount(_hashKey, account));
+    if (!slot)
+        return false;
+
+    uint64_t stored = slot->counter.load(std::memory_order_acquire);
+    if (stored == 0)
+        return false;
+    counter = stored - 1;
+    return true;
+}
+
+// Only an account with an accepted code has a drift: its slot already exists
+void ReplayGuard::setDrift(const std::string &account, int32_t drift)
+{
+    Slot *slot = findSlot(hashAccount(_hashKey, account), false);
+
+    if (slot)
+        slot->drift.store(drift, std::memory_order_release);
+}
+
+bool ReplayGuard::drift(const std::string &account, int32_t &drift) const
+{
+    const Slot *slot = findSlot(hashAccount(_hashKey, account));
+    if (!slot || slot->counter.load(std::memory_order_acquire) == 0)
+        return false;
+
+    drift = slot->drift.load(std::memory_order_acquire);
+    return true;
+}
+
+size_t ReplayGuard::size(void) const
+{
+    return _accounts.load(std::memory_order_relaxed);
+}
+
+size_t ReplayGuard::capacity(void) const
+{
+    return _maxAccounts;
+}
+
+/**
+ * @brief Write every account with an accepted counter to a snapshot file.
+ *
+ * Verifications may go on while the snapshot is taken: each entry is a
+ * consistent (hash, counter) pair, read atomically. The temporary file
+ * is synced before the rename, and the directory after it, so a crash
+ * never leaves an empty or torn snapshot in place of the old one.
+ *
+ * @return
+ *  In case the snapshot can't be written, a 'SnapshotException' is
+ *  thrown and the previous snapshot is left untouched.
+ */
+void ReplayGuard::save(const std::string &fileName) const
+{
+    const std::string       tmpName = fileName + ".tmp";
+    std::vector<uint8_t>    entries;
+    uint8_t                 header[OTP_REPLAY_HEADER_SIZE];
+
+    for (size_t i = 0; i <= _mask; ++i)
+    {
+        uint64_t hash = _slots[i].hash.load(std::memory_order_acquire);
+        uint64_t stored = _slots[i].counter.load(std::memory_order_acquire);
+        if (hash == 0 || stored == 0)
+            continue;
+
+        entries.resize(entries.size() + OTP_REPLAY_ENTRY_SIZE);
+        uint8_t *entry = &entries[entries.size() - OTP_REPLAY_ENTRY_SIZE];
+        storeLE64(entry, hash);
+        storeLE64(entry + 8, stored - 1);
+        storeLE32(entry + 16, static_cast<uint32_t>(_slots[i].drift.load(std::memory_order_acquire)));
+        storeLE32(entry + 20, 0);
+    }
+    memcpy(header, OTP_REPLAY_MAGIC, 8);
+    storeSipHashKey(header + 8, _hashKey);
+    storeLE64(header + 24, entries.size() / OTP_REPLAY_ENTRY_SIZE);
+
+    int fd = open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        throw SnapshotException();
+    bool written = writeAll(fd, header, sizeof(header))
+        && writeAll(fd, entries.data(), entries.size()) && fdatasync(fd) == 0;
+    if (close(fd) != 0 || !written || std::rename(tmpName.c_str(), fileName.c_str()) != 0)
+    {
+        unlink(tmpName.c_str());
+        throw SnapshotException();
+    }
+    if (!syncDirectory(fileName))
+        throw SnapshotException();
+}
+
+/**
+ * @brief Merge a snapshot file into the guard.
+ *
+ * An empty guard takes the hash key of the snapshot. A guard which
+ * already holds accounts can only merge a snapshot taken with its own key.
+ * The drift of an account comes with its counter, when the snapshot's is
+ * the greater one. A snapshot of the previous version has no drift.
+ *
+ * @return
+ *  false if the file doesn't exist. In case it's not a valid snapshot,
+ *  or was taken with another key, a 'SnapshotException' is thrown.
+ */
+bool ReplayGuard::load(const std::string &fileName)
+{
+    std::ifstream   file(fileName.c_str(), std::ios::binary);
+    uint8_t         header[OTP_REPLAY_HEADER_SIZE];
+    uint8_t         buffer[OTP_REPLAY_ENTRY_SIZE];
+    uint64_t        key[2];
+
+    if (!file)
+        return false;
+    if (!file.read(reinterpret_cast<char *>(header), sizeof(header)))
+        throw SnapshotException();
+    bool withDrift = memcmp(header, OTP_REPLAY_MAGIC, 8) == 0;
+    if (!withDrift && memcmp(header, OTP_REPLAY_MAGIC_V2, 8) != 0)
+        throw SnapshotException();
+    size_t entrySize = withDrift ? OTP_REPLAY_ENTRY_SIZE : OTP_REPLAY_ENTRY_SIZE_V2;
+
+    loadSipHashKey(header + 8, key);
+    if (size() == 0)
+        memcpy(_hashKey, key, sizeof(_hashKey));
+    else if (memcmp(_hashKey, key, sizeof(_hashKey)) != 0)
+        throw SnapshotException();
+
+    for (uint64_t count = loadLE64(header + 24); count > 0; --count)
+    {
+        if (!file.read(reinterpret_cast<char *>(buffer), entrySize))
+            throw SnapshotException();
+        uint64_t hash = loadLE64(buffer);
+        uint64_t counter = loadLE64(buffer + 8);
+        if (hash == 0 || counter == UINT64_MAX)
+            throw SnapshotException();
+        Slot &slot = *findSlot(hash, true);
+        if (raiseCounter(slot, counter + 1) && withDrift)
+            slot.drift.store(static_cast<int32_t>(loadLE32(buffer + 16)), std::memory_order_release);
+    }
+    return true;
+}
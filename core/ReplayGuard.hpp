@@ -0,0 +1,122 @@
+#ifndef REPLAYGUARD_HPP
+# define REPLAYGUARD_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <atomic>
+# include <memory>
+# include <stdexcept>
+# include <string>
+
+# define OTP_REPLAY_MAGIC	"FTOTPRG3"
+// Snapshots without the drift estimates are still loaded
+# define OTP_REPLAY_MAGIC_V2	"FTOTPRG2"
+
+/*
+ * Replay protection (RFC 6238, section 5.2)
+ *
+ * A verifier must not accept the same code twice, but a TOTP code stays
+ * valid for its whole time step (and the drift window). The guard keeps
+ * the last accepted counter of every account, and a code is only
+ * accepted if its counter is greater than that one.
+ *
+ * The table uses open addressing with linear probing. Each slot holds a
+ * 64-bit hash of the account (SipHash, with a random key: see SipHash.hpp)
+ * and the last accepted counter, both atomics:
+ *  - a new account claims an empty slot with a compare-and-swap of its
+ *    hash;
+ *  - a verification raises the counter with a compare-and-swap loop.
+ * So two threads accepting codes at the same time (even for the same
+ * account) never take a lock, and only one of two identical codes wins.
+ * Slots are never freed, so the capacity bounds the number of accounts.
+ *
+ * A slot also keeps the drift estimate of the account's token (see
+ * DriftEstimate::scaled()), so it survives a restart with the counter.
+ *
+ * Snapshot file (little-endian):
+ *  | magic (8) | hash key (16) | entry count (8) |
+ *  | entry count x { account hash (8), last counter (8), drift (4), reserved (4) } |
+ * The hashes of the snapshot are only valid with its key, which an empty
+ * guard adopts when it loads the snapshot.
+ */
+
+enum ReplayGuardLimits
+{
+	OTP_REPLAY_MIN_SLOTS	= 1024,
+	OTP_REPLAY_HEADER_SIZE	= 32,
+	OTP_REPLAY_ENTRY_SIZE	= 24,
+	OTP_REPLAY_ENTRY_SIZE_V2	= 16
+};
+
+class ReplayGuard
+{
+public:
+	// Room for 'accounts' accounts, the table is kept at most half full
+	explicit ReplayGuard(size_t accounts = OTP_REPLAY_MIN_SLOTS / 2);
+	~ReplayGuard();
+
+	/**
+	 * Accept 'counter' for the account if it's greater than its last
+	 * accepted counter, and record it. Thread-safe and lock-free.
+	 */
+	bool		accept(const std::string &account, uint64_t counter);
+	// Last accepted counter, false if none was accepted yet
+	bool		lastCounter(const std::string &account, uint64_t &counter) const;
+	// Drift estimate of an account with an accepted counter, false if it has none
+	void		setDrift(const std::string &account, int32_t drift);
+	bool		drift(const std::string &account, int32_t &drift) const;
+	size_t		size(void) const;
+	size_t		capacity(void) const;
+
+	/*
+	 * The snapshot is written and synced to a temporary file which then
+	 * replaces the old one. Loading merges the snapshot (the greater counter wins), a
+	 * missing file is not an error: load() returns false. A guard only
+	 * loads a snapshot before it's shared, as it may change its hash key.
+	 */
+	void		save(const std::string &fileName) const;
+	bool		load(const std::string &fileName);
+
+	class TableFullException : public std::exception
+	{
+	public:
+		TableFullException() throw() {}
+		const char *what() const throw() {
+			return "The replay guard can't track more accounts.";
+		}
+		~TableFullException() throw() {}
+	};
+
+	class SnapshotException : public std::exception
+	{
+	public:
+		SnapshotException() throw() {}
+		const char *what() const throw() {
+			return "Failed to read or write the replay guard snapshot.";
+		}
+		~SnapshotException() throw() {}
+	};
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t>	hash;		// 0: empty slot
+		std::atomic<uint64_t>	counter;	// Last accepted counter + 1, 0: none
+		std::atomic<int32_t>	drift;		// In 1/OTP_DRIFT_SCALE time steps
+	};
+
+	std::unique_ptr<Slot[]>	_slots;
+	uint64_t				_hashKey[2];	// SipHash key of the account hashes
+	size_t					_mask;
+	size_t					_maxAccounts;
+	std::atomic<size_t>		_accounts;
+
+	Slot		*findSlot(uint64_t hash, bool insert);
+	const Slot	*findSlot(uint64_t hash) const;
+	bool		raiseCounter(Slot &slot, uint64_t stored);
+
+	ReplayGuard(const ReplayGuard &);
+	ReplayGuard &operator=(const ReplayGuard &);
+};
+
+#endif
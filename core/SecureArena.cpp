@@ -0,0 +1,118 @@
+#include "SecureArena.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+
+void secureWipe(void *data, size_t size)
+{
+    if (size == 0)
+        return;
+    memset(data, 0, size);
+    // The buffer is "used" by the barrier, so the memset can't be removed as a dead store
+    __asm__ __volatile__("" : : "r"(data) : "memory");
+}
+
+static size_t pageSize(void)
+{
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+/**
+ * @brief Map the region between two guard pages, and lock it in RAM.
+ *
+ * @return
+ *  In case the region can't be mapped, a 'std::bad_alloc' is thrown.
+ */
+SecureArena::SecureArena(size_t size)
+    : _mapping(nullptr), _mappingSize(0), _region(nullptr), _size(0), _top(0), _locked(false)
+{
+    const size_t page = pageSize();
+
+    _size = (std::max<size_t>(size, 1) + page - 1) / page * page;
+    _mappingSize = _size + 2 * page;
+
+    void *mapping = mmap(nullptr, _mappingSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+        throw std::bad_alloc();
+    _mapping = static_cast<uint8_t *>(mapping);
+    _region = _mapping + page;
+    if (mprotect(_region, _size, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(_mapping, _mappingSize);
+        throw std::bad_alloc();
+    }
+    _locked = mlock(_region, _size) == 0;
+#ifdef MADV_DONTDUMP
+    madvise(_region, _size, MADV_DONTDUMP);
+#endif
+}
+
+SecureArena::~SecureArena()
+{
+    secureWipe(_region, _size);
+    if (_locked)
+        munlock(_region, _size);
+    munmap(_mapping, _mappingSize);
+}
+
+SecureArena &SecureArena::local(void)
+{
+    static thread_local std::unique_ptr<SecureArena> arena;
+
+    if (!arena)
+        arena.reset(new SecureArena());
+    return *arena;
+}
+
+uint8_t *SecureArena::allocate(size_t size, size_t align)
+{
+    size_t start = (_top + align - 1) & ~(align - 1);
+
+    if (start > _size || size > _size - start)
+        throw std::bad_alloc();
+    _top = start + size;
+    return _region + start;
+}
+
+size_t SecureArena::mark(void) const
+{
+    return _top;
+}
+
+void SecureArena::rewind(size_t mark)
+{
+    if (mark >= _top)
+        return;
+    secureWipe(_region + mark, _top - mark);
+    _top = mark;
+}
+
+void SecureArena::reset(void)
+{
+    secureWipe(_region, _top);
+    _top = 0;
+}
+
+size_t SecureArena::used(void) const
+{
+    return _top;
+}
+
+size_t SecureArena::capacity(void) const
+{
+    return _size;
+}
+
+bool SecureArena::locked(void) const
+{
+    return _locked;
+}
+
+bool SecureArena::contains(const void *data) const
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    return p >= _region && p < _region + _size;
+}
@@ -0,0 +1,88 @@
+#ifndef SECUREARENA_HPP
+# define SECUREARENA_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <new>
+
+/*
+ * Locked, zeroizing memory arena for secrets
+ *
+ * Decoded keys and HMAC blocks only live for the duration of a call, but
+ * each SecByteBlock used to hold them is a heap allocation, a wipe and a
+ * free. The arena reserves one region up front instead:
+ *  - the region is locked in RAM (mlock), so secrets are never written to
+ *    swap, and excluded from core dumps;
+ *  - it's surrounded by inaccessible guard pages, so an overflow faults
+ *    instead of reading or overwriting a neighbour allocation;
+ *  - buffers are bump-allocated, and released in bulk by an ArenaScope,
+ *    which wipes all of them at once.
+ *
+ * Key texts and decoded secrets only live until they're keyed (into a
+ * PreparedKey), so a scope around each use is all they need.
+ *
+ * An arena is not thread-safe: SecureArena::local() gives each thread
+ * its own one.
+ */
+
+enum SecureArenaLimits
+{
+	OTP_ARENA_SIZE			= 64 * 1024,	// Default usable size, rounded up to whole pages
+	OTP_ARENA_ALIGN			= 16
+};
+
+// Overwrite a buffer in a way the compiler can't optimize away
+void	secureWipe(void *data, size_t size);
+
+class SecureArena
+{
+public:
+	explicit SecureArena(size_t size = OTP_ARENA_SIZE);
+	~SecureArena();
+
+	// The arena of the calling thread, created on first use
+	static SecureArena	&local(void);
+
+	// Scratch allocation, released by rewind() or reset(); throws std::bad_alloc when full
+	uint8_t		*allocate(size_t size, size_t align = OTP_ARENA_ALIGN);
+	size_t		mark(void) const;
+	// Wipe and release everything allocated since 'mark'
+	void		rewind(size_t mark);
+	void		reset(void);
+
+	size_t		used(void) const;
+	size_t		capacity(void) const;
+	// false if mlock() was refused (RLIMIT_MEMLOCK), the arena still works
+	bool		locked(void) const;
+	bool		contains(const void *data) const;
+
+private:
+	uint8_t		*_mapping;		// Guard page, region, guard page
+	size_t		_mappingSize;
+	uint8_t		*_region;
+	size_t		_size;
+	size_t		_top;			// Bump pointer, from the start of the region
+	bool		_locked;
+
+	SecureArena(const SecureArena &);
+	SecureArena &operator=(const SecureArena &);
+};
+
+// Wipe and release the scratch buffers allocated during a scope
+class ArenaScope
+{
+public:
+	explicit ArenaScope(SecureArena &arena = SecureArena::local()) : _arena(arena), _mark(arena.mark()) {}
+	~ArenaScope() { _arena.rewind(_mark); }
+
+	uint8_t	*allocate(size_t size) { return _arena.allocate(size); }
+
+private:
+	SecureArena	&_arena;
+	size_t		_mark;
+
+	ArenaScope(const ArenaScope &);
+	ArenaScope &operator=(const ArenaScope &);
+};
+
+#endif
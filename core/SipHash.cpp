@@ -0,0 +1,97 @@
+#include "SipHash.hpp"
+#include "BinaryIO.hpp"
+#include <cryptopp/osrng.h>
+
+#define SIPROUND(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+        v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+        v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+        v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+    } while (0)
+
+void newSipHashKey(uint64_t key[2])
+{
+    CryptoPP::AutoSeededRandomPool  random;
+    uint8_t                         bytes[OTP_SIPHASH_KEY_SIZE];
+
+    random.GenerateBlock(bytes, sizeof(bytes));
+    loadSipHashKey(bytes, key);
+}
+
+void storeSipHashKey(uint8_t *p, const uint64_t key[2])
+{
+    storeLE64(p, key[0]);
+    storeLE64(p + 8, key[1]);
+}
+
+void loadSipHashKey(const uint8_t *p, uint64_t key[2])
+{
+    key[0] = loadLE64(p);
+    key[1] = loadLE64(p + 8);
+}
+
+/*
+ * Compression of the message, shared by both output sizes: 'v1' starts
+ * with 0xee for the 128-bit variant, as in the reference implementation.
+ */
+static void sipCompress(const uint8_t *data, size_t size, uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3)
+{
+    size_t      end = size - size % 8;
+    uint64_t    last = static_cast<uint64_t>(size) << 56;
+
+    for (size_t i = 0; i < end; i += 8)
+    {
+        uint64_t m = loadLE64(data + i);
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    for (size_t i = end; i < size; ++i)
+        last |= static_cast<uint64_t>(data[i]) << (8 * (i - end));
+    v3 ^= last;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= last;
+}
+
+uint64_t sipHash64(const uint64_t key[2], const uint8_t *data, size_t size)
+{
+    uint64_t    v0 = key[0] ^ 0x736f6d6570736575ull;
+    uint64_t    v1 = key[1] ^ 0x646f72616e646f6dull;
+    uint64_t    v2 = key[0] ^ 0x6c7967656e657261ull;
+    uint64_t    v3 = key[1] ^ 0x7465646279746573ull;
+
+    sipCompress(data, size, v0, v1, v2, v3);
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+        SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// SipHash-2-4 with a 128-bit output (reference variant)
+void sipHash128(const uint64_t key[2], const uint8_t *data, size_t size, uint64_t out[2])
+{
+    uint64_t    v0 = key[0] ^ 0x736f6d6570736575ull;
+    uint64_t    v1 = key[1] ^ 0x646f72616e646f6dull ^ 0xee;
+    uint64_t    v2 = key[0] ^ 0x6c7967656e657261ull;
+    uint64_t    v3 = key[1] ^ 0x7465646279746573ull;
+
+    sipCompress(data, size, v0, v1, v2, v3);
+    v2 ^= 0xee;
+    for (int i = 0; i < 4; ++i)
+        SIPROUND(v0, v1, v2, v3);
+    out[0] = v0 ^ v1 ^ v2 ^ v3;
+    v1 ^= 0xdd;
+    for (int i = 0; i < 4; ++i)
+        SIPROUND(v0, v1, v2, v3);
+    out[1] = v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t hashAccount(const uint64_t key[2], const std::string &account)
+{
+    uint64_t hash = sipHash64(key, reinterpret_cast<const uint8_t *>(account.data()), account.size());
+
+    return hash ? hash : 1;
+}
@@ -0,0 +1,34 @@
+#ifndef SIPHASH_HPP
+# define SIPHASH_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <string>
+
+/*
+ * SipHash-2-4, a hash keyed with 128 random bits
+ *
+ * Without the key, no one can choose two inputs with the same hash. The
+ * tables indexed by a hash of an account label (ReplayGuard,
+ * AttemptThrottle, CounterLog) or of a secret (PreparedKeyCache) use it,
+ * so a label can't be crafted to share the entry of another account.
+ * A table whose hashes are saved to a file saves its key with them.
+ */
+
+enum SipHashSizes
+{
+	OTP_SIPHASH_KEY_SIZE	= 16
+};
+
+// Fill a key from the system's random source
+void		newSipHashKey(uint64_t key[2]);
+void		storeSipHashKey(uint8_t *p, const uint64_t key[2]);
+void		loadSipHashKey(const uint8_t *p, uint64_t key[2]);
+
+uint64_t	sipHash64(const uint64_t key[2], const uint8_t *data, size_t size);
+void		sipHash128(const uint64_t key[2], const uint8_t *data, size_t size, uint64_t out[2]);
+
+// Hash of an account label, never 0 (the empty slot of the tables)
+uint64_t	hashAccount(const uint64_t key[2], const std::string &account);
+
+#endif
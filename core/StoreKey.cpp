@@ -0,0 +1,62 @@
+#include "StoreKey.hpp"
+#include "SecureArena.hpp"
+#include "sha2.hpp"
+#include <cstring>
+#include <cryptopp/osrng.h>
+#include <cryptopp/scrypt.h>
+
+// Prefix of the hashed key, so the check is not a plain hash of the key
+#define OTP_KDF_CHECK_CONTEXT	"ft_otp store key check"
+
+void newStoreKdf(StoreKdf &kdf)
+{
+    CryptoPP::AutoSeededRandomPool random;
+
+    memset(&kdf, 0, sizeof(kdf));
+    kdf.log2Cost = OTP_KDF_LOG2_COST;
+    kdf.blockSize = OTP_KDF_BLOCK_SIZE;
+    kdf.parallelism = OTP_KDF_PARALLELISM;
+    random.GenerateBlock(kdf.salt, sizeof(kdf.salt));
+}
+
+// The bounds keep a corrupted header from asking for gigabytes of memory
+bool isValidStoreKdf(const StoreKdf &kdf)
+{
+    return kdf.log2Cost >= OTP_KDF_MIN_LOG2_COST && kdf.log2Cost <= OTP_KDF_MAX_LOG2_COST
+        && kdf.blockSize >= 1 && kdf.blockSize <= 32
+        && kdf.parallelism >= 1 && kdf.parallelism <= 16;
+}
+
+void deriveStoreKey(const StoreKdf &kdf, const char *passphrase, size_t size, uint8_t *key)
+{
+    CryptoPP::Scrypt scrypt;
+
+    scrypt.DeriveKey(key, OTP_STORE_KEY_SIZE,
+        reinterpret_cast<const CryptoPP::byte *>(passphrase), size,
+        kdf.salt, sizeof(kdf.salt),
+        static_cast<CryptoPP::word64>(1) << kdf.log2Cost, kdf.blockSize, kdf.parallelism);
+}
+
+void setStoreKeyCheck(StoreKdf &kdf, const uint8_t *key)
+{
+    const size_t    contextSize = sizeof(OTP_KDF_CHECK_CONTEXT) - 1;
+    uint8_t         message[sizeof(OTP_KDF_CHECK_CONTEXT) - 1 + OTP_STORE_KEY_SIZE];
+    uint8_t         digest[OTP_SHA256_DIGEST_SIZE];
+
+    memcpy(message, OTP_KDF_CHECK_CONTEXT, contextSize);
+    memcpy(message + contextSize, key, OTP_STORE_KEY_SIZE);
+    sha256(message, sizeof(message), digest);
+    memcpy(kdf.check, digest, sizeof(kdf.check));
+    secureWipe(message, sizeof(message));
+}
+
+bool isStoreKey(const StoreKdf &kdf, const uint8_t *key)
+{
+    StoreKdf    expected = kdf;
+    uint8_t     difference = 0;
+
+    setStoreKeyCheck(expected, key);
+    for (size_t i = 0; i < sizeof(kdf.check); ++i)
+        difference |= expected.check[i] ^ kdf.check[i];
+    return difference == 0;
+}
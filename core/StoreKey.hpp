@@ -0,0 +1,59 @@
+#ifndef STOREKEY_HPP
+# define STOREKEY_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <functional>
+
+/*
+ * Passphrase-derived key of a key store
+ *
+ * The key of a protected store is derived from a passphrase with scrypt,
+ * a memory-hard function: with the default cost, one derivation takes
+ * 32 MiB and about a tenth of a second, for the user as for an attacker
+ * trying passphrases. The salt and the cost are kept in the store header,
+ * with a check value of the key, so a wrong passphrase is detected before
+ * any record is opened.
+ *
+ * The check is a hash of the derived key, it reveals nothing about it but
+ * tells whether a key (e.g. one served by the agent) is the right one.
+ */
+
+enum StoreKeyLimits
+{
+	OTP_STORE_KEY_SIZE		= 32,	// AES-256
+	OTP_KDF_SALT_SIZE		= 16,
+	OTP_KDF_CHECK_SIZE		= 16,
+	OTP_KDF_LOG2_COST		= 15,	// N = 2^15: 128 x N x r bytes = 32 MiB
+	OTP_KDF_MIN_LOG2_COST	= 10,
+	OTP_KDF_MAX_LOG2_COST	= 22,
+	OTP_KDF_BLOCK_SIZE		= 8,	// r
+	OTP_KDF_PARALLELISM		= 1,	// p
+	OTP_MAX_PASSPHRASE		= 1024
+};
+
+// scrypt parameters of a store, and the check value of its key
+struct StoreKdf
+{
+	uint8_t	log2Cost;
+	uint8_t	blockSize;
+	uint8_t	parallelism;
+	uint8_t	salt[OTP_KDF_SALT_SIZE];
+	uint8_t	check[OTP_KDF_CHECK_SIZE];
+};
+
+/*
+ * Give the key of a store (OTP_STORE_KEY_SIZE bytes) for its parameters.
+ * 'create' is true for a new store: the passphrase is chosen, not checked.
+ */
+typedef std::function<void(const StoreKdf &kdf, bool create, uint8_t *key)>	StoreKeyProvider;
+
+// Default cost and a new random salt, the check is set by setStoreKeyCheck()
+void	newStoreKdf(StoreKdf &kdf);
+bool	isValidStoreKdf(const StoreKdf &kdf);
+void	deriveStoreKey(const StoreKdf &kdf, const char *passphrase, size_t size, uint8_t *key);
+void	setStoreKeyCheck(StoreKdf &kdf, const uint8_t *key);
+// Constant-time comparison of the key check
+bool	isStoreKey(const StoreKdf &kdf, const uint8_t *key);
+
+#endif
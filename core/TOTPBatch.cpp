@@ -0,0 +1,157 @@
+#include "TOTPBatch.hpp"
+#include "sha1_multibuffer.hpp"
+#include <algorithm>
+
+// Number of digests computed at once by the multi-buffer kernel (widest SIMD width)
+#define OTP_BATCH_CHUNK	16
+
+static inline bool isValidDigits(int digits)
+{
+    return digits > 0 && digits <= OTP_TOTP_MAX_DIGITS;
+}
+
+// Read back a fixed-width code, returns false if a character is not a digit
+static inline bool readCode(const char *in, int digits, uint32_t &value)
+{
+    value = 0;
+    for (int i = 0; i < digits; ++i)
+    {
+        if (in[i] < '0' || in[i] > '9')
+            return false;
+        value = value * 10 + (in[i] - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief Generate the codes of 'count' prepared keys.
+ *
+ * @param codes
+ *  Caller-owned buffer of at least (count * digits) characters.
+ *
+ * @return
+ *  The number of generated codes (0 if the parameters are invalid).
+ */
+size_t generateTOTPBatch(
+    const PreparedKey *keys, const uint64_t *counters, size_t count,
+    char *codes, int digits) noexcept
+{
+    uint8_t hmacDigests[OTP_BATCH_CHUNK][OTP_SHA1_DIGEST_SIZE];
+
+    if (!keys || !counters || !codes || !isValidDigits(digits))
+        return 0;
+
+    const uint32_t modulus = codeModulus(digits);
+    for (size_t base = 0; base < count; base += OTP_BATCH_CHUNK)
+    {
+        size_t chunk = std::min<size_t>(OTP_BATCH_CHUNK, count - base);
+
+        hmacSha1Batch(keys + base, counters + base, chunk, hmacDigests);
+        for (size_t i = 0; i < chunk; ++i)
+        {
+            uint32_t otp = TOTPGenerator::truncateDigest(
+                hmacDigests[i], OTP_SHA1_DIGEST_SIZE) % modulus;
+            writeTOTPCode(otp, digits, codes + (base + i) * digits);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Compute the codes of 'count' prepared keys at the same counter,
+ * as integers (e.g. to fill a table of codes looked up later).
+ *
+ * @param codes
+ *  Caller-owned array of at least 'count' codes.
+ *
+ * @return
+ *  The number of computed codes (0 if the parameters are invalid).
+ */
+size_t computeTOTPBatch(
+    const PreparedKey *keys, uint64_t counter, size_t count,
+    uint32_t *codes, int digits) noexcept
+{
+    uint8_t     hmacDigests[OTP_BATCH_CHUNK][OTP_SHA1_DIGEST_SIZE];
+    uint64_t    counters[OTP_BATCH_CHUNK];
+
+    if (!keys || !codes || !isValidDigits(digits))
+        return 0;
+
+    const uint32_t modulus = codeModulus(digits);
+    std::fill(counters, counters + OTP_BATCH_CHUNK, counter);
+    for (size_t base = 0; base < count; base += OTP_BATCH_CHUNK)
+    {
+        size_t chunk = std::min<size_t>(OTP_BATCH_CHUNK, count - base);
+
+        hmacSha1Batch(keys + base, counters, chunk, hmacDigests);
+        for (size_t i = 0; i < chunk; ++i)
+            codes[base + i] = TOTPGenerator::truncateDigest(
+                hmacDigests[i], OTP_SHA1_DIGEST_SIZE) % modulus;
+    }
+    return count;
+}
+
+// Both forms of the keys: contiguous, or an array of pointers
+template <class Keys>
+static size_t verifyBatch(
+    Keys keys, const uint64_t *counters, const char *codes, size_t count,
+    uint8_t *results, int digits) noexcept
+{
+    uint8_t hmacDigests[OTP_BATCH_CHUNK][OTP_SHA1_DIGEST_SIZE];
+    size_t  matches = 0;
+
+    if (!keys || !counters || !codes || !results || !isValidDigits(digits))
+        return 0;
+
+    const uint32_t modulus = codeModulus(digits);
+    for (size_t base = 0; base < count; base += OTP_BATCH_CHUNK)
+    {
+        size_t chunk = std::min<size_t>(OTP_BATCH_CHUNK, count - base);
+
+        hmacSha1Batch(keys + base, counters + base, chunk, hmacDigests);
+        for (size_t i = 0; i < chunk; ++i)
+        {
+            uint32_t submitted;
+
+            results[base + i] = OTP_BATCH_MISMATCH;
+            if (!readCode(codes + (base + i) * digits, digits, submitted))
+                continue;
+
+            uint32_t otp = TOTPGenerator::truncateDigest(
+                hmacDigests[i], OTP_SHA1_DIGEST_SIZE) % modulus;
+            if (otp == submitted)
+            {
+                results[base + i] = OTP_BATCH_MATCH;
+                ++matches;
+            }
+        }
+    }
+    return matches;
+}
+
+/**
+ * @brief Verify the submitted codes of 'count' prepared keys.
+ *
+ * Each item is checked against its exact counter only: drift windows
+ * can be handled by calling this function again with shifted counters.
+ *
+ * @param results
+ *  Caller-owned array of 'count' bytes, set to OTP_BATCH_MATCH or
+ *  OTP_BATCH_MISMATCH. A malformed code is a mismatch.
+ *
+ * @return
+ *  The number of matching codes (0 if the parameters are invalid).
+ */
+size_t verifyTOTPBatch(
+    const PreparedKey *keys, const uint64_t *counters, const char *codes, size_t count,
+    uint8_t *results, int digits) noexcept
+{
+    return verifyBatch(keys, counters, codes, count, results, digits);
+}
+
+size_t verifyTOTPBatch(
+    const PreparedKey *const *keys, const uint64_t *counters, const char *codes, size_t count,
+    uint8_t *results, int digits) noexcept
+{
+    return verifyBatch(keys, counters, codes, count, results, digits);
+}
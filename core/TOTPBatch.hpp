@@ -0,0 +1,43 @@
+#ifndef TOTPBATCH_HPP
+# define TOTPBATCH_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include "PreparedKey.hpp"
+# include "TOTPGenerator.hpp"
+
+/*
+ * Batch TOTP engine
+ *
+ * Generate or verify the codes of many prepared secrets in one call.
+ * Item 'i' uses keys[i] with counters[i], and its code is stored in
+ * (or read from) the fixed-width slot codes[i * digits .. i * digits + digits - 1]
+ * of a buffer owned by the caller. Slots are not NUL-terminated.
+ *
+ * These functions never allocate and never throw, so they can be used
+ * on a hot path. Invalid parameters make them return 0.
+ */
+
+enum BatchResult
+{
+	OTP_BATCH_MISMATCH	= 0,
+	OTP_BATCH_MATCH		= 1
+};
+
+size_t	generateTOTPBatch(
+	const PreparedKey *keys, const uint64_t *counters, size_t count,
+	char *codes, int digits = OTP_TOTP_CODE_DIGIT) noexcept;
+size_t	verifyTOTPBatch(
+	const PreparedKey *keys, const uint64_t *counters, const char *codes, size_t count,
+	uint8_t *results, int digits = OTP_TOTP_CODE_DIGIT) noexcept;
+// Same, item 'i' using the key at keys[i] (e.g. keys found in a cache or a table)
+size_t	verifyTOTPBatch(
+	const PreparedKey *const *keys, const uint64_t *counters, const char *codes, size_t count,
+	uint8_t *results, int digits = OTP_TOTP_CODE_DIGIT) noexcept;
+// Every key at the same counter, the codes as integers instead of characters
+size_t	computeTOTPBatch(
+	const PreparedKey *keys, uint64_t counter, size_t count,
+	uint32_t *codes, int digits = OTP_TOTP_CODE_DIGIT) noexcept;
+
+#endif
@@ -1,91 +1,83 @@
 #include "TOTPGenerator.hpp"
 using namespace CryptoPP;
 
-TOTPGenerator::TOTPGenerator(bool verbose): _verbose(verbose) {}
+TOTPGenerator::TOTPGenerator(bool verbose, const Clock &clock): _verbose(verbose), _clock(&clock) {}
 TOTPGenerator::~TOTPGenerator() {}
 
+void TOTPGenerator::setClock(const Clock &clock) { _clock = &clock; }
+const Clock &TOTPGenerator::getClock(void) const { return *_clock; }
+
+/**
+ * @brief Detect the format of a key: Hex and/or Base32.
+ *
+ * The classification is done by classifyKey() in a single pass, and the
+ * returned flags can be given back to DecodeKey() so that the key is not
+ * classified again.
+ *
+ * @return
+ *  OTP_KEYFORMAT_* flags, or 0 if the key is too short or in none of them.
+ */
 uint8_t TOTPGenerator::isValidHexOrBase32(const std::string &str)
 {
-    if (str.size() < OTP_MIN_KEY_STRENGTH)
+    return isValidHexOrBase32(str.data(), str.size());
+}
+
+uint8_t TOTPGenerator::isValidHexOrBase32(const char *str, size_t size)
+{
+    if (size < OTP_MIN_KEY_STRENGTH)
         return 0;
-    // By default Hex and Base32 are set to true
-    uint8_t keyFormat = OTP_KEYFORMAT_DEFAULT;
 
-    for (char c : str)
-    {
-        /*
-         * Check for valid hex characters using bitwise operations.
-         *
-         * Bitwise operations are faster than other operations because they
-         * operate directly on binary digits at the hardware level.
-         *
-         * Here, keyFormat & OTP_KEYFORMAT_HEX is checking if OTP_KEYFORMAT_HEX
-         * flag is set in keyFormat.
-         *  Ex.: keyFormat (00000001) & OTP_KEYFORMAT_HEX (00000001) = 00000001 (flag is set)
-         *
-         * On the other hand, keyFormat ^= OTP_KEYFORMAT_HEX will toggle the
-         * OTP_KEYFORMAT_HEX flag in keyFormat.
-         *  Ex.: keyFormat (00000001) ^⁼ OTP_KEYFORMAT_HEX (00000001)
-         *      <=> keyFormat (00000001) = keyFormat ^ OTP_KEYFORMAT_HEX (00000001)
-         *      = 00000000 (unset OTP_KEYFORMAT_HEX in keyFormat)
-         *
-         */
-        if ((keyFormat & OTP_KEYFORMAT_HEX) && !std::isxdigit(c))
-            keyFormat ^= OTP_KEYFORMAT_HEX;
-
-        // Check for valid Base32 characters
-        if ((keyFormat & OTP_KEYFORMAT_BASE32) &&
-            c != '=' && (!std::isalnum(c) || (std::toupper(c) > '7' && std::toupper(c) < 'A')))
-            keyFormat ^= OTP_KEYFORMAT_BASE32;
-    }
+    KeyClassification classification = classifyKey(str, size);
+    if (_verbose && classification.format == 0)
+        std::cerr << FMT_ERROR " Invalid key character at offset "
+                  << classification.errorOffset << std::endl;
+    return classification.format;
+}
 
-    return keyFormat;
+// The AES key and IV are used in place, without copying them into heap blocks
+static const byte *aesKey(void)
+{
+    return reinterpret_cast<const byte *>(OTP_AES_KEY);
+}
+
+static const byte *aesIV(void)
+{
+    return reinterpret_cast<const byte *>(OTP_AES_IV);
 }
 
-static SecByteBlock convertStringToBytes(const char *str, int size)
+// AES-256-CBC through the crypto backend (CryptoBackend.hpp)
+std::string TOTPGenerator::encryptAES(const std::string &plain)
 {
-    SecByteBlock key(
-        reinterpret_cast<const byte *>(str), size);
-    return key;
+    return encryptAES(plain.data(), plain.size());
 }
 
-std::string TOTPGenerator::encryptAES(std::string plain)
+std::string TOTPGenerator::encryptAES(const char *plain, size_t size)
 {
-    // Convert macro key and initialization vector to the approriate data type
-    SecByteBlock    key = convertStringToBytes(OTP_AES_KEY, OTP_AES_KEY_LEN);
-    SecByteBlock    iv = convertStringToBytes(OTP_AES_IV, OTP_AES_IV_LEN);
     HexEncoder      encoder(new FileSink(std::cout));
-    std::string     cipher;
+    std::string     cipher(cryptoAesCipherSize(size), '\0');
 
     if (_verbose)
-        std::cout << "Plain text: " << plain << std::endl;
-
-    try
     {
-        CBC_Mode<AES>::Encryption e;
-        e.SetKeyWithIV(key, key.size(), iv);
-
-        StringSource s(plain, true,
-                       new StreamTransformationFilter(
-                            e,
-                            new StringSink(cipher)
-                        ) // StreamTransformationFilter
-        ); // StringSource
+        std::cout << "Plain text: ";
+        std::cout.write(plain, size) << std::endl;
     }
-    catch (const Exception &e)
+
+    if (!cryptoAesEncrypt(aesKey(), aesIV(), reinterpret_cast<const byte *>(plain),
+            size, reinterpret_cast<byte *>(&cipher[0])))
     {
-        std::cerr << FMT_ERROR << " " << e.what() << std::endl;
+        std::cerr << FMT_ERROR " AES encryption failed ("
+                  << cryptoBackendName(cryptoGetBackend()) << ")." << std::endl;
         return "";
     }
 
     if (_verbose) {
         std::cout << "Key: ";
-        encoder.Put(key, key.size());
+        encoder.Put(aesKey(), OTP_AES_KEY_LEN);
         encoder.MessageEnd();
         std::cout << std::endl;
 
         std::cout << "IV: ";
-        encoder.Put(iv, iv.size());
+        encoder.Put(aesIV(), OTP_AES_IV_LEN);
         encoder.MessageEnd();
         std::cout << std::endl;
 
@@ -101,57 +93,39 @@ std::string TOTPGenerator::encryptAES(std::string plain)
 // Function to perform AES decryption
 std::string TOTPGenerator::decryptAES(std::string &cipher)
 {
-    // Convert macro key and initialization vector to the approriate data type
-    SecByteBlock    key = convertStringToBytes(OTP_AES_KEY, OTP_AES_KEY_LEN);
-    SecByteBlock    iv = convertStringToBytes(OTP_AES_IV, OTP_AES_IV_LEN);
-    std::string     recovered;
+    std::string     recovered(cipher.size(), '\0');
+    size_t          recoveredSize;
 
-    try
+    if (!cryptoAesDecrypt(aesKey(), aesIV(), reinterpret_cast<const byte *>(cipher.data()),
+            cipher.size(), reinterpret_cast<byte *>(&recovered[0]), recoveredSize))
     {
-        CBC_Mode<AES>::Decryption d;
-        d.SetKeyWithIV(key, key.size(), iv);
-
-        StringSource s(
-            cipher,
-            true,
-            new StreamTransformationFilter(
-                d,
-                new StringSink(recovered)));
-    }
-    catch (const Exception &e)
-    {
-        std::cerr << FMT_ERROR << " " << e.what() << std::endl;
+        std::cerr << FMT_ERROR " AES decryption failed: invalid cipher or padding." << std::endl;
         return "";
     }
+    recovered.resize(recoveredSize);
     return recovered;
 }
 
-std::vector<uint8_t> decodeBase32RFC4648(const std::string &base32String)
+/**
+ * @brief AES decryption of a buffer used in place (e.g. a file mapping).
+ *
+ * The plain text is written into 'plain', a buffer of at least 'size'
+ * bytes owned by the caller (the padding can only shrink the cipher).
+ * With a buffer from the SecureArena, no copy of the key is left on the
+ * heap.
+ *
+ * @return
+ *  false if the cipher can't be decrypted, 'plain' is wiped then
+ *  (see cryptoAesDecrypt()).
+ */
+bool TOTPGenerator::decryptAES(const uint8_t *cipher, size_t size, uint8_t *plain, size_t &plainSize)
 {
-    static const std::string    base32Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
-    std::vector<uint8_t>        decoded;
-    uint32_t                    buffer = 0;
-    int                         bitsLeft = 0;
-
-    for (char c : base32String)
+    if (!cryptoAesDecrypt(aesKey(), aesIV(), cipher, size, plain, plainSize))
     {
-        if (c == '=')   // Padding character
-            break;      // Padding character means we have reached the end of the key
-
-        size_t index = base32Alphabet.find(std::toupper(c));
-        if (index == std::string::npos)
-            throw std::invalid_argument("Invalid Base32 character");
-
-        buffer = (buffer << 5) | index;
-        bitsLeft += 5;
-
-        if (bitsLeft >= 8)
-        {
-            decoded.push_back((buffer >> (bitsLeft - 8)) & 0xFF);
-            bitsLeft -= 8;
-        }
+        std::cerr << FMT_ERROR " AES decryption failed: invalid cipher or padding." << std::endl;
+        return false;
     }
-    return decoded;
+    return true;
 }
 
 /**
@@ -160,219 +134,515 @@ std::vector<uint8_t> decodeBase32RFC4648(const std::string &base32String)
  * It will convert a human-readable string representation of data
  * back into its raw binary form.
  *
+ * The key is decoded as Hex first, then as Base32: the decoders validate
+ * the characters while decoding, so no separate scan of the key is needed.
+ * When the format is already known (from isValidHexOrBase32()), only the
+ * matching decoder is run.
+ *
  * @param Hex or Base32 string
+ * @param keyFormat OTP_KEYFORMAT_* flags of the key, 0 if unknown
  *
  * @return
  *  In case the given string is not a Hex/Base32 key,
  *  an 'invalid_argument' exception is thrown.
  */
-SecByteBlock TOTPGenerator::DecodeKey(const std::string &key)
+SecByteBlock TOTPGenerator::DecodeKey(const std::string &key, uint8_t keyFormat)
+{
+    return DecodeKey(key.data(), key.size(), keyFormat);
+}
+
+// Same as above, from a key read in place (file mapping, decrypted buffer)
+SecByteBlock TOTPGenerator::DecodeKey(const char *key, size_t size, uint8_t keyFormat)
 {
     SecByteBlock decodedKey;
-    // bool            isHex = true, isBase32 = true;
 
-    uint8_t keyFormat = isValidHexOrBase32(key);
+    decodedKey.CleanNew(decodedKeyCapacity(size));
+    decodedKey.resize(DecodeKeyInto(key, size, decodedKey, decodedKey.size(), keyFormat));
+    return decodedKey;
+}
+
+// Size of a buffer large enough for DecodeKeyInto(), whatever the key format
+size_t TOTPGenerator::decodedKeyCapacity(size_t size)
+{
+    return std::max(hexDecodedSize(size), base32DecodedSize(size));
+}
+
+/**
+ * @brief Same as DecodeKey(), into a buffer owned by the caller.
+ *
+ * This is the path used for short-lived secrets: with a buffer from the
+ * SecureArena, decoding a key allocates nothing and the secret never
+ * leaves locked memory.
+ *
+ * @return
+ *  The size of the decoded key. In case the given string is not a
+ *  Hex/Base32 key, or 'capacity' is smaller than decodedKeyCapacity(),
+ *  an 'invalid_argument' exception is thrown.
+ */
+size_t TOTPGenerator::DecodeKeyInto(
+    const char *key, size_t size, uint8_t *out, size_t capacity, uint8_t keyFormat)
+{
+    DecodeResult result;
+
+    if (size < OTP_MIN_KEY_STRENGTH)
+        throw std::invalid_argument("Key must be in Base32 or Hex format.");
+    if (capacity < decodedKeyCapacity(size))
+        throw std::invalid_argument("The buffer is too small for the decoded key.");
+    if (keyFormat == 0)
+        keyFormat = OTP_KEYFORMAT_DEFAULT;
+
     // Decode the key based on its format
+    result.status = OTP_DECODE_INVALID_CHAR;
     if (keyFormat & OTP_KEYFORMAT_HEX)
+        result = decodeHex(key, size, out, capacity);
+    if (result.status == OTP_DECODE_OK)
     {
-        HexDecoder  decoder;
-        decoder.Put((byte *)key.data(), key.size());
-        decoder.MessageEnd();
-        size_t  size = decoder.MaxRetrievable();
-        decodedKey.resize(size);
-        decoder.Get(decodedKey, size);
-
         if (_verbose) {
             std::cout << "Hex Key: ";
-            for (size_t i = 0; i < decodedKey.size(); ++i)
+            for (size_t i = 0; i < result.size; ++i)
             {
-                std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(decodedKey[i]);
+                std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(out[i]);
             }
             std::cout << std::dec << std::endl;
         }
 
-        return decodedKey;
+        return result.size;
     }
-    else if (keyFormat & OTP_KEYFORMAT_BASE32)
-    {
-        std::vector<uint8_t> decodedByteVector = decodeBase32RFC4648(key);
-        SecByteBlock decodedKey(decodedByteVector.data(), decodedByteVector.size());
 
+    if (keyFormat & OTP_KEYFORMAT_BASE32)
+        result = decodeBase32(key, size, out, capacity);
+    if (result.status == OTP_DECODE_OK)
+    {
         if (_verbose) {
-            std::cout << "Base32 secret: " << key << std::endl;
+            std::cout << "Base32 secret: ";
+            std::cout.write(key, size) << std::endl;
 
             std::cout << "Decoded Base32 Key: ";
-            for (size_t i = 0; i < decodedKey.size(); ++i)
+            for (size_t i = 0; i < result.size; ++i)
             {
                 std::cout << std::hex << std::setw(2) << std::setfill('0')
-                    << static_cast<int>(decodedKey[i]) << std::dec;
+                    << static_cast<int>(out[i]) << std::dec;
             }
             std::cout << std::endl;
         }
-        return decodedKey;
+        return result.size;
+    }
+    // Nothing of a partly decoded key is left behind
+    secureWipe(out, capacity);
+    throw std::invalid_argument("Key must be in Base32 or Hex format.");
+}
+
+// Current time of the generator's clock, in seconds
+int64_t TOTPGenerator::getUnixTime(void)
+{
+    return _clock->now();
+}
+
+/**
+ * @brief Time step of the current time, from the cache of the thread.
+ *
+ * The clock is read once, and the counter and its big-endian bytes are
+ * only computed again when a new time step has started.
+ *
+ * @return
+ *  The step, valid until the next call on the same thread.
+ */
+const TimeStep &TOTPGenerator::currentTimeStep(uint64_t timeStep)
+{
+    int64_t         currentTime = getUnixTime();
+    const TimeStep  &step = CounterCache::local().at(currentTime, timeStep);
+
+    // Print the counter both in uppercase Hex and decimal formats
+    if (_verbose) {
+        std::cout << "Step size (seconds): " << timeStep << std::endl;
+        std::cout << "Current time: " << currentTime << std::endl;
+        std::cout << "Counter: 0X" << std::uppercase << std::hex << step.counter
+            << std::dec << " (" << step.counter << ")" << std::endl;
     }
-    else throw std::invalid_argument("Key must be in Base32 or Hex format.");
+
+    return step;
+}
+
+// Get the number of time steps elapsed since the Unix epoch
+uint64_t TOTPGenerator::getTimeCounter(uint64_t timeStep)
+{
+    return currentTimeStep(timeStep).counter;
+}
+
+// Raw bytes of the counter, big-endian whatever the system is
+CryptoPP::SecByteBlock TOTPGenerator::computeCounter(uint64_t timeStep)
+{
+    const TimeStep &step = currentTimeStep(timeStep);
+
+    return CryptoPP::SecByteBlock(step.bytes, sizeof(step.bytes));
 }
 
-// Convert a 64-bit counter to big-endian format
-static void ConvertToBigEndian(uint64_t counter, uint8_t *outputBuffer)
+// Print the resulted HMAC digest
+void TOTPGenerator::printDigest(const uint8_t *digest, size_t digestSize)
 {
-    for (int i = 7; i >= 0; --i)
+    std::cout << "TOTP mode: HMAC-SHA1" << std::endl;
+    std::cout << "HMAC-SHA1: ";
+    for (size_t i = 0; i < digestSize; ++i)
     {
-        outputBuffer[i] = counter & 0xFF; // Extract the least significant byte
-        counter >>= 8;                    // Shift to the next byte
+        std::cout << std::hex << std::setw(2) << std::setfill('0')
+                << static_cast<int>(digest[i]);
     }
+    std::cout << std::dec << std::endl;
+}
+
+/*
+    As the output of the HMAC-SHA-1 calculation is 160 bits,
+    we must truncate this value to something that can be easily
+    entered by a user.
+*/
+uint32_t TOTPGenerator::truncateDigest(const uint8_t *digest, size_t digestSize)
+{
+    // Extract the lower 31 bits as an integer
+    int offset = digest[digestSize - 1] & 0x0F;
+    return (digest[offset] & 0x7F) << 24 |
+           (digest[offset + 1] & 0xFF) << 16 |
+           (digest[offset + 2] & 0xFF) << 8 |
+           (digest[offset + 3] & 0xFF);
+}
+
+std::string TOTPGenerator::formatCode(uint32_t binaryCode, int digits)
+{
+    char otpString[OTP_TOTP_CODE_BUFFER];
+
+    if (digits <= 0 || digits > OTP_TOTP_MAX_DIGITS)
+        throw std::invalid_argument("The TOTP code must have 1 to 9 digits.");
+
+    /*
+     * Compute TOTP code:
+     *
+     * If digit = 10⁶, this line below equals to:
+     *  binaryCode %= 1000000;
+     *
+     * This is to ensure that the resulting code is a fixed length,
+     * specifically a 6-digit number.
+     *
+     * The modulo operation also adds a layer of obfuscation.
+     * An attacker who only sees the TOTP code (the 6-digit output) does not have
+     * direct access to the original HMAC value.
+     */
+    uint32_t otp = binaryCode % codeModulus(digits);
+
+    // Format OTP as zero-padded string
+    writeTOTPCode(otp, digits, otpString);
+    return std::string(otpString, digits);
 }
 
 /**
- * @brief Check if the system is little-endian
+ * @brief Generate the TOTP code (HMAC-SHA1) of a Hex or Base32 key.
  *
- * If little-endian, the least significant byte (LSB) of a
- * multi-byte value is stored at the lowest memory address.
+ * 'userKey' is the shared secret between client and server; each HOTP
+ * generator has a different and unique secret. It's decoded into the
+ * SecureArena of the thread, and its HMAC key schedule is computed on the
+ * stack, so generating a code doesn't allocate: the decoded secret is
+ * wiped when the scope ends.
+ */
+std::string TOTPGenerator::generateTOTPHmacSha1(
+    const std::string &userKey, uint64_t timeStep, int digits, uint8_t keyFormat)
+{
+    ArenaScope  scope;
+    uint8_t     *decodedKey = scope.allocate(decodedKeyCapacity(userKey.size()));
+    size_t      decodedSize = DecodeKeyInto(
+        userKey.data(), userKey.size(), decodedKey, decodedKeyCapacity(userKey.size()), keyFormat);
+
+    /*
+     * The 'counter' needed by HMAC is an 8-byte counter value, the moving
+     * factor. This counter MUST be synchronized between the HOTP generator
+     * (client) and the HOTP validator (server).
+     */
+    return generateTOTPHmacSha1(PreparedKey(decodedKey, decodedSize), timeStep, digits);
+}
+
+/**
+ * @brief Generate the TOTP code from a prepared key.
  *
- * Memory layout:
- * Little-endian: [01 00]  -> testBytes[0] == 0x01
- * Big-endian:    [00 01]  -> testBytes[0] == 0x00
+ * The key has already been decoded and its HMAC key schedule computed,
+ * so only the two SHA-1 compressions depending on the counter are left.
  */
-static bool IsLittleEndian()
+std::string TOTPGenerator::generateTOTPHmacSha1(
+    const PreparedKey &key, uint64_t timeStep, int digits)
 {
-    uint16_t testValue = 0x1;
-    uint8_t *testBytes = reinterpret_cast<uint8_t *>(&testValue);
-    return testBytes[0] == 0x1; // If the least significant byte is first, it's little-endian.
+    uint8_t hmacDigest[OTP_SHA1_DIGEST_SIZE];
+
+    key.hmac(getTimeCounter(timeStep), hmacDigest);
+    if (_verbose) printDigest(hmacDigest, sizeof(hmacDigest));
+
+    return formatCode(truncateDigest(hmacDigest, sizeof(hmacDigest)), digits);
 }
 
-static void ConvertToBigEndianIfNeeded(uint64_t counter, uint8_t *outputBuffer)
+/**
+ * @brief Generate the TOTP code from a prepared key into a fixed-size buffer.
+ *
+ * This is the hot path for servers generating many codes: the modulus
+ * comes from an integer table and the digits are written directly into
+ * the caller's buffer, so nothing is allocated and nothing is thrown.
+ * Unlike the string functions, nothing is printed in verbose mode.
+ *
+ * @param out
+ *  Set to the zero-padded, NUL-terminated code (an empty string on error).
+ *
+ * @return
+ *  false if 'digits' or 'timeStep' is invalid.
+ */
+template <class Hash>
+bool TOTPGenerator::generateInto(
+    char (&out)[OTP_TOTP_CODE_BUFFER], const BasicPreparedKey<Hash> &key,
+    uint64_t timeStep, int digits) noexcept
 {
-    if (IsLittleEndian())
+    uint32_t    code;
+
+    if (digits > OTP_TOTP_MAX_DIGITS || !computeTOTPCode(key, getUnixTime(), digits, timeStep, code))
     {
-        ConvertToBigEndian(counter, outputBuffer);
+        out[0] = '\0';
+        return false;
     }
-    else
+
+    writeTOTPCode(code, digits, out);
+    out[digits] = '\0';
+    return true;
+}
+
+template bool TOTPGenerator::generateInto<Sha1Hash>(
+    char (&)[OTP_TOTP_CODE_BUFFER], const PreparedKey &, uint64_t, int) noexcept;
+template bool TOTPGenerator::generateInto<Sha256Hash>(
+    char (&)[OTP_TOTP_CODE_BUFFER], const PreparedKeySha256 &, uint64_t, int) noexcept;
+template bool TOTPGenerator::generateInto<Sha512Hash>(
+    char (&)[OTP_TOTP_CODE_BUFFER], const PreparedKeySha512 &, uint64_t, int) noexcept;
+
+// Convert a submitted code to an integer, it must be exactly 'digits' digits long
+bool TOTPGenerator::parseCode(const std::string &code, int digits, uint32_t &value)
+{
+    if (digits <= 0 || digits > 9 || code.size() != static_cast<size_t>(digits))
+        return false;
+
+    value = 0;
+    for (char c : code)
     {
-        std::memcpy(outputBuffer, &counter, 8); // Already big-endian, just copy
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + (c - '0');
     }
+    return true;
 }
 
-CryptoPP::SecByteBlock TOTPGenerator::computeCounter(uint64_t timeStep)
+/**
+ * @brief Verify a TOTP code while tolerating some clock drift.
+ *
+ * RFC 6238 (section 5.2) recommends to accept codes from a few time steps
+ * before and after the current one, as the client clock may drift and
+ * the code may have been typed close to a window boundary.
+ *
+ * Every counter reuses the same prepared key schedule, and counters are
+ * tested from the most likely to the least likely one:
+ *  T, T-1, T+1, T-2, T+2, ...
+ * so the search stops as soon as possible.
+ *
+ * @param offset
+ *  Set to the matched offset (counter - T) when the code is valid.
+ *
+ * @return
+ *  true if the code matches one of the counters in the window.
+ */
+bool TOTPGenerator::verifyTOTP(
+    const PreparedKey &key, const std::string &code, int window, int &offset,
+    uint64_t timeStep, int digits)
 {
-    // Calculate the current time in seconds
-    int64_t currentTime =
-        std::chrono::duration_cast<std::chrono::seconds>(
-            std::chrono::system_clock::now()
-                .time_since_epoch())
-            .count();
+    DriftEstimate   noDrift;
 
-    uint64_t counter = currentTime / timeStep;
-    CryptoPP::SecByteBlock counterByteArray(8);
+    return verifyTOTP(key, code, window, offset, noDrift, timeStep, digits);
+}
+
+/**
+ * @brief Same as above, from the drift of the account's token.
+ *
+ * The offset predicted by 'drift' is tested first, then the ones around
+ * it (see DriftSearch): a token with a steady drift usually matches at
+ * the first HMAC. The accepted offset is recorded into 'drift'.
+ */
+bool TOTPGenerator::verifyTOTP(
+    const PreparedKey &key, const std::string &code, int window, int &offset,
+    DriftEstimate &drift, uint64_t timeStep, int digits)
+{
+    uint32_t    expected;
+    uint8_t     hmacDigest[OTP_SHA1_DIGEST_SIZE];
+    int         candidate;
+
+    if (!parseCode(code, digits, expected) || window < 0)
+        return false;
+
+    uint32_t    modulus = codeModulus(digits);
+    uint64_t    counter = getTimeCounter(timeStep);
+    DriftSearch search(drift, window);
+
+    while (search.next(candidate))
+    {
+        // Don't wrap around before the Unix epoch
+        if (candidate < 0 && counter < static_cast<uint64_t>(-candidate))
+            continue;
+
+        key.hmac(counter + candidate, hmacDigest);
+        if (truncateDigest(hmacDigest, sizeof(hmacDigest)) % modulus == expected)
+        {
+            offset = candidate;
+            drift.record(candidate);
+            if (_verbose)
+                std::cout << "Code matched at offset " << candidate << std::endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Same as above, the key is decoded and keyed only once for the whole window
+bool TOTPGenerator::verifyTOTP(
+    const std::string &key, const std::string &code, int window, int &offset,
+    uint64_t timeStep, int digits)
+{
+    PreparedKey preparedKey(key, _verbose);
+
+    return verifyTOTP(preparedKey, code, window, offset, timeStep, digits);
+}
+
+/*
+ * HMAC of a counter for a single code, from midstates prepared on the
+ * stack for each hash function (the kernels of TOTPKernel.hpp use the
+ * same keys), so no mode allocates.
+ */
+static void counterHmac(
+    HashAlgorithm algorithm, const uint8_t *key, size_t size, uint64_t counter, uint8_t *digest)
+{
+    switch (algorithm)
+    {
+    case OTP_HASH_SHA256:   PreparedKeySha256(key, size).hmac(counter, digest); break;
+    case OTP_HASH_SHA512:   PreparedKeySha512(key, size).hmac(counter, digest); break;
+    default:                PreparedKey(key, size).hmac(counter, digest); break;
+    }
+}
+
+/**
+ * @brief Generate a TOTP code with any of the RFC 6238 hash functions.
+ *
+ * The key is decoded, then the HMAC of the counter is computed by
+ * counterHmac(), from midstates prepared on the stack.
+ *
+ * @return
+ *  In case the parameters are invalid, an 'invalid_argument' exception
+ *  is thrown.
+ */
+std::string TOTPGenerator::generateTOTP(
+    const std::string &userKey, HashAlgorithm algorithm, uint64_t timeStep, int digits,
+    uint8_t keyFormat)
+{
+    if (digits <= 0 || digits > 9 || timeStep == 0)
+        throw std::invalid_argument("The TOTP code must have 1 to 9 digits and a non-zero period.");
+
+    // The decoded key only lives in the locked arena, see generateTOTPHmacSha1()
+    ArenaScope  scope;
+    uint8_t     *decodedKey = scope.allocate(decodedKeyCapacity(userKey.size()));
+    size_t      decodedSize = DecodeKeyInto(
+        userKey.data(), userKey.size(), decodedKey, decodedKeyCapacity(userKey.size()), keyFormat);
+
+    return generateTOTP(decodedKey, decodedSize, algorithm, timeStep, digits);
+}
+
+// Same as above, from a key that has already been decoded
+std::string TOTPGenerator::generateTOTP(
+    const CryptoPP::SecByteBlock &decodedKey, HashAlgorithm algorithm, uint64_t timeStep, int digits)
+{
+    return generateTOTP(decodedKey.data(), decodedKey.size(), algorithm, timeStep, digits);
+}
+
+std::string TOTPGenerator::generateTOTP(
+    const uint8_t *decodedKey, size_t size, HashAlgorithm algorithm, uint64_t timeStep, int digits)
+{
+    if (digits <= 0 || digits > 9 || timeStep == 0)
+        throw std::invalid_argument("The TOTP code must have 1 to 9 digits and a non-zero period.");
+
+    int64_t     currentTime = getUnixTime();
+    uint8_t     hmacDigest[OTP_HMAC_MAX_DIGEST];
 
-    // Print the counter both in uppercase Hex and decimal formats
     if (_verbose) {
+        std::cout << "TOTP mode: HMAC-" << hashAlgorithmName(algorithm) << std::endl;
         std::cout << "Step size (seconds): " << timeStep << std::endl;
         std::cout << "Current time: " << currentTime << std::endl;
-        std::cout << "Counter: 0X" << std::uppercase << std::hex << counter
-            << std::dec << " (" << counter << ")" << std::endl;
     }
 
-    // Get a raw bytes representation of the counter (convert if needed)
-    ConvertToBigEndianIfNeeded(counter, counterByteArray);
+    const TimeStep &step = CounterCache::local().at(currentTime, timeStep);
+    counterHmac(algorithm, decodedKey, size, step.counter, hmacDigest);
 
-    return counterByteArray;
+    return formatCode(truncateDigest(hmacDigest, cryptoHmacSize(algorithm)), digits);
 }
 
-std::string TOTPGenerator::generateTOTPHmacSha1(
-    const std::string &userKey, uint64_t timeStep, int digits)
+/**
+ * @brief Generate an RFC 4226 HOTP code: the HMAC of an event counter
+ * instead of a time step, truncated the same way.
+ *
+ * @return
+ *  In case the number of digits is invalid, an 'invalid_argument'
+ *  exception is thrown.
+ */
+std::string TOTPGenerator::generateHOTP(
+    const uint8_t *decodedKey, size_t size, uint64_t counter, HashAlgorithm algorithm, int digits)
 {
-    std::string otpString = ""; // The TOTP code to return
+    if (digits <= 0 || digits > 9)
+        throw std::invalid_argument("The HOTP code must have 1 to 9 digits.");
 
-    try
-    {
-        // 'hexKey' is the shared secret between client and server;
-        // each HOTP generator has a different and unique secret.
-        CryptoPP::SecByteBlock decodedKey = DecodeKey(userKey);
-
-        /*
-         * Generate the 'counter' needed by HMAC.
-         *	'counter' is an 8-byte counter value, the moving factor.
-         *
-         *	This counter MUST be synchronized between the HOTP generator)
-         *	(client) and the HOTP validator (server).
-         */
-
-        CryptoPP::SecByteBlock counterByteArray(8);
-        const size_t counterByteArraySize = 8;
-        byte hmacDigest[CryptoPP::HMAC<CryptoPP::SHA1>::DIGESTSIZE];
-
-        counterByteArray = computeCounter(timeStep);
-
-        // Create an HMAC (Hash-based Message Authentication Code) object with SHA-1,
-        // as defined in RFC 2104 [BCK2].
-        CryptoPP::HMAC<CryptoPP::SHA1> hmac(
-            decodedKey, decodedKey.size());
-
-        /*
-         * We compute the HMAC digest:
-         *
-         * An HMAC digest refers to the output generated by the HMAC process.
-         * It is a byte array like here, or a fixed-size string, that serves as a
-         * unique representation of the input data (message) combined with a secret key.
-         *
-         * 'CalculateDigest' can be replaced by these two methods below used together:
-         *  hmac.Update(counterByteArray, counterByteArraySize);
-         *  hmac.Final(hmacDigest);
-         */
-        hmac.CalculateDigest(hmacDigest, counterByteArray, counterByteArraySize);
-
-        // Print the resulted HMAC digest
-        if (_verbose) {
-            std::cout << "TOTP mode: HMAC-SHA1" << std::endl;
-            std::cout << "HMAC-SHA1: ";
-            for (size_t i = 0; i < sizeof(hmacDigest); ++i)
-            {
-                std::cout << std::hex << std::setw(2) << std::setfill('0')
-                        << static_cast<int>(hmacDigest[i]);
-            }
-            std::cout << std::dec << std::endl;
-        }
+    uint8_t     hmacDigest[OTP_HMAC_MAX_DIGEST];
 
-        /*
-            As the output of the HMAC-SHA-1 calculation is 160 bits,
-            we must truncate this value to something that can be easily
-            entered by a user.
-        */
-        // Extract the lower 31 bits as an integer
-        int offset = hmacDigest[SHA1::DIGESTSIZE - 1] & 0x0F;
-        uint32_t binaryCode = (hmacDigest[offset] & 0x7F) << 24 |
-                              (hmacDigest[offset + 1] & 0xFF) << 16 |
-                              (hmacDigest[offset + 2] & 0xFF) << 8 |
-                              (hmacDigest[offset + 3] & 0xFF);
-
-        /*
-         * Compute TOTP code:
-         *
-         * If digit = 10⁶, this line below equals to:
-         *  binaryCode %= 1000000;
-         *
-         * This is to ensure that the resulting code is a fixed length,
-         * specifically a 6-digit number.
-         *
-         * The modulo operation also adds a layer of obfuscation.
-         * An attacker who only sees the TOTP code (the 6-digit output) does not have
-         * direct access to the original HMAC value.
-         */
-        uint32_t otp = binaryCode % static_cast<uint32_t>(std::pow(10, digits));
-
-        // Format OTP as zero-padded string
-        otpString = std::to_string(otp);
-        while (otpString.size() < static_cast<size_t>(digits))
-        {
-            otpString = "0" + otpString;
-        }
+    if (_verbose) {
+        std::cout << "HOTP mode: HMAC-" << hashAlgorithmName(algorithm) << std::endl;
+        std::cout << "Counter: " << counter << std::endl;
     }
-    catch (const CryptoPP::Exception &e)
+
+    counterHmac(algorithm, decodedKey, size, counter, hmacDigest);
+
+    return formatCode(truncateDigest(hmacDigest, cryptoHmacSize(algorithm)), digits);
+}
+
+std::string TOTPGenerator::generateHOTP(
+    const CryptoPP::SecByteBlock &decodedKey, uint64_t counter, HashAlgorithm algorithm, int digits)
+{
+    return generateHOTP(decodedKey.data(), decodedKey.size(), counter, algorithm, digits);
+}
+
+/**
+ * @brief Verify an HOTP code with a look-ahead window.
+ *
+ * A token's counter moves forward each time a code is generated, even
+ * if the code is never used, so the counters after the expected one are
+ * checked too (RFC 4226, section 7.4). The caller must then store
+ * 'matched' + 1 as the next expected counter, so the code (and the ones
+ * before it) can't be used again.
+ *
+ * @return
+ *  true if the code matches one of the counters of the window.
+ */
+bool TOTPGenerator::verifyHOTP(
+    const PreparedKey &key, const std::string &code, uint64_t counter, int lookAhead,
+    uint64_t &matched, int digits)
+{
+    uint32_t    expected;
+    uint8_t     hmacDigest[OTP_SHA1_DIGEST_SIZE];
+
+    if (!parseCode(code, digits, expected) || lookAhead <= 0)
+        return false;
+
+    uint32_t    modulus = codeModulus(digits);
+
+    for (int i = 0; i < lookAhead && counter + i >= counter; ++i)
     {
-        throw TOTPException();
-        return "";
+        key.hmac(counter + i, hmacDigest);
+        if (truncateDigest(hmacDigest, sizeof(hmacDigest)) % modulus == expected)
+        {
+            matched = counter + i;
+            if (_verbose)
+                std::cout << "Code matched at counter " << matched << std::endl;
+            return true;
+        }
     }
-
-    return otpString;
+    return false;
 }
@@ -24,12 +24,15 @@
 #include <cryptopp/filters.h>
 #include <cryptopp/base32.h>
 
-// For TOTP HMAC-SHA1 hash
-#include <iomanip>
 #include <chrono>
-#include <openssl/hmac.h>
 
 #include "ascii_format.hpp"
+#include "Clock.hpp"
+#include "CryptoBackend.hpp"
+#include "PreparedKey.hpp"
+#include "TOTPKernel.hpp"
+#include "KeyDecoder.hpp"
+#include "SecureArena.hpp"
 
 // Key used for outfile (where the key is stored) encryption
 # define OTP_AES_KEY		"4a1c4b646cfd6740d738330d30019a62"
@@ -42,16 +45,24 @@ enum OTP
 	OTP_AES_KEY_LEN			= 32,
 	OTP_AES_IV_LEN			= 32,
 	OTP_TOTP_TIME			= 30,	// Time step used in TOTP
-	OTP_TOTP_CODE_DIGIT		= 6		// Length of the TOTP code
+	OTP_TOTP_CODE_DIGIT		= 6,	// Length of the TOTP code
+	OTP_TOTP_MAX_DIGITS		= 9,	// Longest code fitting in 31 bits
+	OTP_TOTP_CODE_BUFFER	= 10,	// Longest code and its terminating '\0'
+	OTP_TOTP_WINDOW			= 1,	// Accepted time steps before/after the current one
+	OTP_HOTP_LOOK_AHEAD		= 10	// Counters checked from the expected one (RFC 4226, section 7.4)
 };
 
-// Values to identify the given key (secret) format.
-// These values will be used in bitwise operations.
-enum KeyFormat
+// A TOTP configuration chosen at runtime (RFC 6238 defaults)
+struct TOTPParams
 {
-	OTP_KEYFORMAT_HEX		= 1,
-	OTP_KEYFORMAT_BASE32	= 2,
-	OTP_KEYFORMAT_DEFAULT	= 3
+	HashAlgorithm	algorithm;
+	int				digits;
+	uint64_t		period;
+	bool			hotp;		// RFC 4226 code of 'counter' instead of the current time step
+	uint64_t		counter;
+
+	TOTPParams(): algorithm(OTP_HASH_SHA1), digits(OTP_TOTP_CODE_DIGIT), period(OTP_TOTP_TIME),
+		hotp(false), counter(0) {}
 };
 
 using std::string;
@@ -59,19 +70,86 @@ using std::string;
 class TOTPGenerator
 {
 private:
-	bool	_verbose;
+	bool		_verbose;
+	const Clock	*_clock;
 
 public:
-	TOTPGenerator(bool verbose);
+	TOTPGenerator(bool verbose, const Clock &clock = systemClock());
 	~TOTPGenerator();
 
+	// The clock must outlive the generator
+	void						setClock(const Clock &clock);
+	const Clock					&getClock(void) const;
+
 	uint8_t						isValidHexOrBase32(const std::string &str);
-	std::string 				encryptAES(std::string plain);
+	uint8_t						isValidHexOrBase32(const char *str, size_t size);
+	std::string 				encryptAES(const std::string &plain);
+	std::string 				encryptAES(const char *plain, size_t size);
 	std::string					decryptAES(std::string &cipher);
+	// Decrypt into a caller-owned buffer of 'size' bytes, the plain text size in 'plainSize'
+	bool						decryptAES(const uint8_t *cipher, size_t size, uint8_t *plain, size_t &plainSize);
+	// 'keyFormat' is the result of isValidHexOrBase32() if already known, 0 otherwise
+	std::string					generateTOTPHmacSha1(
+		const std::string &key, uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT,
+		uint8_t keyFormat = 0);
+	// Same as above, from a key that has already been decoded and keyed
 	std::string					generateTOTPHmacSha1(
-		const std::string &key, uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
-	CryptoPP::SecByteBlock		DecodeKey(const std::string &key);
+		const PreparedKey &key, uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
+	// Same as above without any allocation, the code is written into 'out'
+	template <class Hash>
+	bool						generateInto(
+		char (&out)[OTP_TOTP_CODE_BUFFER], const BasicPreparedKey<Hash> &key,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT) noexcept;
+	// RFC 6238 modes: HMAC-SHA1, HMAC-SHA256 or HMAC-SHA512
+	std::string					generateTOTP(
+		const std::string &key, HashAlgorithm algorithm,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT, uint8_t keyFormat = 0);
+	std::string					generateTOTP(
+		const CryptoPP::SecByteBlock &decodedKey, HashAlgorithm algorithm,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
+	std::string					generateTOTP(
+		const uint8_t *decodedKey, size_t size, HashAlgorithm algorithm,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
+	// Check a submitted code against the counters T-window..T+window
+	bool						verifyTOTP(
+		const PreparedKey &key, const std::string &code, int window, int &offset,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
+	// Same as above, from the offset predicted by the drift of the account, updated on a match
+	bool						verifyTOTP(
+		const PreparedKey &key, const std::string &code, int window, int &offset, DriftEstimate &drift,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
+	bool						verifyTOTP(
+		const std::string &key, const std::string &code, int window, int &offset,
+		uint64_t timeStep = OTP_TOTP_TIME, int digits = OTP_TOTP_CODE_DIGIT);
+	// RFC 4226 HOTP: the code of an event counter
+	std::string					generateHOTP(
+		const uint8_t *decodedKey, size_t size, uint64_t counter,
+		HashAlgorithm algorithm = OTP_HASH_SHA1, int digits = OTP_TOTP_CODE_DIGIT);
+	std::string					generateHOTP(
+		const CryptoPP::SecByteBlock &decodedKey, uint64_t counter,
+		HashAlgorithm algorithm = OTP_HASH_SHA1, int digits = OTP_TOTP_CODE_DIGIT);
+	// Check a submitted code against the counters 'counter'..'counter' + lookAhead - 1
+	bool						verifyHOTP(
+		const PreparedKey &key, const std::string &code, uint64_t counter, int lookAhead,
+		uint64_t &matched, int digits = OTP_TOTP_CODE_DIGIT);
+	CryptoPP::SecByteBlock		DecodeKey(const std::string &key, uint8_t keyFormat = 0);
+	CryptoPP::SecByteBlock		DecodeKey(const char *key, size_t size, uint8_t keyFormat = 0);
+	// Decode into a caller-owned buffer of decodedKeyCapacity(size) bytes, returns the key size
+	size_t						DecodeKeyInto(
+		const char *key, size_t size, uint8_t *out, size_t capacity, uint8_t keyFormat = 0);
 	CryptoPP::SecByteBlock		computeCounter(uint64_t timeStep);
+	// Same as above without any allocation, from the time step cache of the thread
+	const TimeStep				&currentTimeStep(uint64_t timeStep);
+	uint64_t					getTimeCounter(uint64_t timeStep);
+	int64_t						getUnixTime(void);
+
+	static size_t				decodedKeyCapacity(size_t size);
+	static uint32_t				truncateDigest(const uint8_t *digest, size_t digestSize);
+	static bool					parseCode(const std::string &code, int digits, uint32_t &value);
+
+private:
+	void						printDigest(const uint8_t *digest, size_t digestSize);
+	std::string					formatCode(uint32_t binaryCode, int digits);
 };
 
 class TOTPException : public std::exception
@@ -0,0 +1,148 @@
+#include "TOTPKernel.hpp"
+#include <cctype>
+
+// Integer powers of ten for the runtime path
+static const uint32_t powersOfTen[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/*
+ * Dynamic truncation from RFC 4226 (section 5.3): the low 4 bits of the
+ * last byte give the offset of 4 bytes from which 31 bits are extracted.
+ */
+template <int DigestSize>
+static inline uint32_t truncate(const uint8_t *digest)
+{
+    int offset = digest[DigestSize - 1] & 0x0F;
+    return (digest[offset] & 0x7F) << 24 |
+           (digest[offset + 1] & 0xFF) << 16 |
+           (digest[offset + 2] & 0xFF) << 8 |
+           (digest[offset + 3] & 0xFF);
+}
+
+template <class Hash, int Digits, int Period>
+uint64_t TOTPKernel<Hash, Digits, Period>::counter(int64_t unixTime)
+{
+    return static_cast<uint64_t>(unixTime) / Period;
+}
+
+template <class Hash, int Digits, int Period>
+uint32_t TOTPKernel<Hash, Digits, Period>::code(const BasicPreparedKey<Hash> &key, uint64_t counter)
+{
+    uint8_t digest[Hash::DIGEST_SIZE];
+
+    key.hmac(counter, digest);
+    return truncate<Hash::DIGEST_SIZE>(digest) % PowerOfTen<Digits>::value;
+}
+
+template <class Hash, int Digits, int Period>
+uint32_t TOTPKernel<Hash, Digits, Period>::codeAt(const BasicPreparedKey<Hash> &key, int64_t unixTime)
+{
+    return code(key, counter(unixTime));
+}
+
+template struct TOTPKernel<Sha1Hash, 6, 30>;
+template struct TOTPKernel<Sha256Hash, 6, 30>;
+template struct TOTPKernel<Sha512Hash, 8, 30>;
+
+// The configuration each hash function is most commonly used with
+template <class Hash> struct CommonKernel;
+template <> struct CommonKernel<Sha1Hash> { typedef TOTPKernelSha1 Kernel; };
+template <> struct CommonKernel<Sha256Hash> { typedef TOTPKernelSha256 Kernel; };
+template <> struct CommonKernel<Sha512Hash> { typedef TOTPKernelSha512 Kernel; };
+
+/**
+ * @brief Compute a TOTP code for a configuration known at runtime.
+ *
+ * When the digits and period match the common configuration of the hash
+ * function, the specialized kernel is used. Otherwise the modulus comes
+ * from a table and the division by the period is done at runtime.
+ *
+ * @param code
+ *  Set to the code as an integer (to be zero-padded to 'digits'
+ *  characters), left untouched on error.
+ *
+ * @return
+ *  false if 'digits' or 'period' is invalid.
+ */
+template <class Hash>
+bool computeTOTPCode(const BasicPreparedKey<Hash> &key, int64_t unixTime, int digits, uint64_t period,
+    uint32_t &code)
+{
+    typedef typename CommonKernel<Hash>::Kernel Fast;
+    uint8_t digest[Hash::DIGEST_SIZE];
+
+    if (digits == Fast::DIGITS && period == static_cast<uint64_t>(Fast::PERIOD))
+    {
+        code = Fast::codeAt(key, unixTime);
+        return true;
+    }
+    if (digits <= 0 || digits > 9 || period == 0)
+        return false;
+
+    key.hmac(static_cast<uint64_t>(unixTime) / period, digest);
+    code = truncate<Hash::DIGEST_SIZE>(digest) % powersOfTen[digits];
+    return true;
+}
+
+template bool computeTOTPCode<Sha1Hash>(const PreparedKey &, int64_t, int, uint64_t, uint32_t &);
+template bool computeTOTPCode<Sha256Hash>(const PreparedKeySha256 &, int64_t, int, uint64_t, uint32_t &);
+template bool computeTOTPCode<Sha512Hash>(const PreparedKeySha512 &, int64_t, int, uint64_t, uint32_t &);
+
+template <class Hash>
+bool computeHOTPCode(const BasicPreparedKey<Hash> &key, uint64_t counter, int digits, uint32_t &code)
+{
+    uint8_t digest[Hash::DIGEST_SIZE];
+
+    if (digits <= 0 || digits > 9)
+        return false;
+    key.hmac(counter, digest);
+    code = truncate<Hash::DIGEST_SIZE>(digest) % powersOfTen[digits];
+    return true;
+}
+
+template bool computeHOTPCode<Sha1Hash>(const PreparedKey &, uint64_t, int, uint32_t &);
+template bool computeHOTPCode<Sha256Hash>(const PreparedKeySha256 &, uint64_t, int, uint32_t &);
+template bool computeHOTPCode<Sha512Hash>(const PreparedKeySha512 &, uint64_t, int, uint32_t &);
+
+uint32_t codeModulus(int digits)
+{
+    return powersOfTen[digits];
+}
+
+// The digits are written right to left, so the zero padding comes for free
+void writeTOTPCode(uint32_t code, int digits, char *out)
+{
+    for (int i = digits - 1; i >= 0; --i)
+    {
+        out[i] = static_cast<char>('0' + code % 10);
+        code /= 10;
+    }
+}
+
+// Names as used by the 'algorithm' parameter of the Key URI Format
+const char *hashAlgorithmName(HashAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case OTP_HASH_SHA256:   return "SHA256";
+    case OTP_HASH_SHA512:   return "SHA512";
+    default:                return "SHA1";
+    }
+}
+
+// Parse "sha1", "SHA256", "sha-512"..., case-insensitive
+bool parseHashAlgorithm(const std::string &name, HashAlgorithm &algorithm)
+{
+    std::string normalized;
+
+    for (char c : name)
+        if (c != '-')
+            normalized += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+    if (normalized == "SHA1")           algorithm = OTP_HASH_SHA1;
+    else if (normalized == "SHA256")    algorithm = OTP_HASH_SHA256;
+    else if (normalized == "SHA512")    algorithm = OTP_HASH_SHA512;
+    else return false;
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef TOTPKERNEL_HPP
+# define TOTPKERNEL_HPP
+
+# include <string>
+# include <stdint.h>
+
+# include "HashAlgorithms.hpp"
+# include "PreparedKey.hpp"
+
+/*
+ * RFC 6238 TOTP kernels
+ *
+ * A TOTP configuration is a hash function, a number of digits and a
+ * period (time step). TOTPKernel fixes all three at compile time, so the
+ * digest size, the truncation offset, the modulus (10^Digits) and the
+ * division by the period are all constants folded by the compiler.
+ *
+ * The common configurations are instantiated once in TOTPKernel.cpp:
+ *  - HMAC-SHA1,   6 digits, 30 s (default of most authenticator apps)
+ *  - HMAC-SHA256, 6 digits, 30 s
+ *  - HMAC-SHA512, 8 digits, 30 s (RFC 6238 test vectors)
+ * Any other configuration goes through computeTOTPCode(), which picks
+ * the matching kernel or falls back to a generic runtime path.
+ */
+
+// 10^N computed at compile time
+template <int N>
+struct PowerOfTen
+{
+	static const uint32_t value = 10 * PowerOfTen<N - 1>::value;
+};
+
+template <>
+struct PowerOfTen<0>
+{
+	static const uint32_t value = 1;
+};
+
+template <class Hash, int Digits, int Period>
+struct TOTPKernel
+{
+	static_assert(Digits > 0 && Digits <= 9, "A TOTP code must have between 1 and 9 digits");
+	static_assert(Period > 0, "The TOTP period must be positive");
+
+	enum
+	{
+		DIGITS	= Digits,
+		PERIOD	= Period
+	};
+
+	static uint64_t	counter(int64_t unixTime);
+	static uint32_t	code(const BasicPreparedKey<Hash> &key, uint64_t counter);
+	static uint32_t	codeAt(const BasicPreparedKey<Hash> &key, int64_t unixTime);
+};
+
+typedef TOTPKernel<Sha1Hash, 6, 30>		TOTPKernelSha1;
+typedef TOTPKernel<Sha256Hash, 6, 30>	TOTPKernelSha256;
+typedef TOTPKernel<Sha512Hash, 8, 30>	TOTPKernelSha512;
+
+extern template struct TOTPKernel<Sha1Hash, 6, 30>;
+extern template struct TOTPKernel<Sha256Hash, 6, 30>;
+extern template struct TOTPKernel<Sha512Hash, 8, 30>;
+
+/*
+ * Runtime dispatcher, for a configuration only known at runtime.
+ * Returns false, without setting 'code', if 'digits' isn't from 1 to 9
+ * or 'period' is 0: 0 is a valid code, so it can't mark an error.
+ */
+template <class Hash>
+bool	computeTOTPCode(const BasicPreparedKey<Hash> &key, int64_t unixTime, int digits, uint64_t period,
+			uint32_t &code);
+
+extern template bool computeTOTPCode<Sha1Hash>(const PreparedKey &, int64_t, int, uint64_t, uint32_t &);
+extern template bool computeTOTPCode<Sha256Hash>(const PreparedKeySha256 &, int64_t, int, uint64_t, uint32_t &);
+extern template bool computeTOTPCode<Sha512Hash>(const PreparedKeySha512 &, int64_t, int, uint64_t, uint32_t &);
+
+// RFC 4226 HOTP: the same truncation, of an event counter instead of a time step (false if 'digits' is invalid)
+template <class Hash>
+bool	computeHOTPCode(const BasicPreparedKey<Hash> &key, uint64_t counter, int digits, uint32_t &code);
+
+extern template bool computeHOTPCode<Sha1Hash>(const PreparedKey &, uint64_t, int, uint32_t &);
+extern template bool computeHOTPCode<Sha256Hash>(const PreparedKeySha256 &, uint64_t, int, uint32_t &);
+extern template bool computeHOTPCode<Sha512Hash>(const PreparedKeySha512 &, uint64_t, int, uint32_t &);
+
+// Integer 10^digits (digits from 0 to 9)
+uint32_t	codeModulus(int digits);
+// Write a code as 'digits' zero-padded characters, without any allocation
+void		writeTOTPCode(uint32_t code, int digits, char *out);
+
+const char	*hashAlgorithmName(HashAlgorithm algorithm);
+bool		parseHashAlgorithm(const std::string &name, HashAlgorithm &algorithm);
+
+#endif
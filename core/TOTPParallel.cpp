@@ -0,0 +1,173 @@
+#include "TOTPParallel.hpp"
+#include "SipHash.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+PreparedKeyCache::PreparedKeyCache(size_t capacity) : _capacity(capacity ? capacity : 1)
+{
+    newSipHashKey(_hashKey);
+}
+
+bool PreparedKeyCache::Digest::operator==(const Digest &other) const
+{
+    return words[0] == other.words[0] && words[1] == other.words[1];
+}
+
+// The digest is already uniformly distributed, one word is enough
+size_t PreparedKeyCache::DigestHash::operator()(const Digest &digest) const
+{
+    return static_cast<size_t>(digest.words[0]);
+}
+
+/**
+ * @brief Get the prepared key of a secret, decoding it on first use.
+ *
+ * The cache isn't emptied here, so the keys found for a whole group stay
+ * valid until trim() is called.
+ */
+const PreparedKey *PreparedKeyCache::find(const std::string &secret)
+{
+    Digest digest;
+
+    sipHash128(_hashKey, reinterpret_cast<const uint8_t *>(secret.data()), secret.size(), digest.words);
+    std::unordered_map<Digest, PreparedKey, DigestHash>::iterator it = _keys.find(digest);
+    if (it != _keys.end())
+        return &it->second;
+
+    TOTPGenerator   TOTPGenerator(false);
+    uint8_t         keyFormat = TOTPGenerator.isValidHexOrBase32(secret);
+    if (!keyFormat)
+        return nullptr;
+
+    try
+    {
+        ArenaScope  scope;
+        size_t      capacity = TOTPGenerator::decodedKeyCapacity(secret.size());
+        uint8_t     *decodedKey = scope.allocate(capacity);
+        size_t      size = TOTPGenerator.DecodeKeyInto(secret.data(), secret.size(), decodedKey, capacity, keyFormat);
+
+        PreparedKey &key = _keys[digest];
+        key.prepare(decodedKey, size);
+        return &key;
+    }
+    catch (std::invalid_argument &)
+    {
+        return nullptr;
+    }
+}
+
+/**
+ * @brief When the cache is over its capacity it is simply emptied: a bulk
+ * run goes through the secrets in the same order every time, so keeping
+ * the most recent ones would not save more work than starting over.
+ */
+void PreparedKeyCache::trim(void)
+{
+    if (_keys.size() > _capacity)
+        _keys.clear();
+}
+
+size_t PreparedKeyCache::size(void) const { return _keys.size(); }
+void PreparedKeyCache::clear(void) { _keys.clear(); }
+
+ParallelTOTP::ParallelTOTP(const ThreadPoolParams &params, size_t chunkSize, size_t cacheSize)
+    : _pool(params), _chunkSize(chunkSize ? chunkSize : static_cast<size_t>(OTP_PARALLEL_CHUNK))
+{
+    // One at a time, so that every cache draws its own hash key
+    _caches.reserve(_pool.size());
+    for (unsigned i = 0; i < _pool.size(); ++i)
+        _caches.emplace_back(cacheSize);
+}
+
+unsigned ParallelTOTP::threads(void) const
+{
+    return _pool.size();
+}
+
+size_t ParallelTOTP::generate(
+    const PreparedKey *keys, const uint64_t *counters, size_t count, char *codes, int digits)
+{
+    std::atomic<size_t> generated(0);
+
+    if (!keys || !counters || !codes || digits <= 0 || digits > OTP_TOTP_MAX_DIGITS)
+        return 0;
+
+    _pool.parallelFor(count, _chunkSize, [&](size_t begin, size_t end, unsigned) {
+        generated += generateTOTPBatch(
+            keys + begin, counters + begin, end - begin, codes + begin * digits, digits);
+    });
+    return generated;
+}
+
+size_t ParallelTOTP::verify(
+    const PreparedKey *keys, const uint64_t *counters, const char *codes, size_t count,
+    uint8_t *results, int digits)
+{
+    std::atomic<size_t> matches(0);
+
+    if (!keys || !counters || !codes || !results || digits <= 0 || digits > OTP_TOTP_MAX_DIGITS)
+        return 0;
+
+    _pool.parallelFor(count, _chunkSize, [&](size_t begin, size_t end, unsigned) {
+        matches += verifyTOTPBatch(
+            keys + begin, counters + begin, codes + begin * digits, end - begin,
+            results + begin, digits);
+    });
+    return matches;
+}
+
+/**
+ * @brief Same as verifyTOTPBatch(), with the keys taken from the cache of the worker.
+ *
+ * A task is split into groups: the keys of a group are looked up, the
+ * group is verified by the batch engine, and only then the cache is
+ * trimmed, so no key of the group is released meanwhile. An invalid
+ * secret stands in the group as 'invalidKey', and its result is a
+ * mismatch whatever the engine found.
+ */
+size_t ParallelTOTP::verify(
+    const std::string *secrets, const uint64_t *counters, const char *codes, size_t count,
+    uint8_t *results, int digits)
+{
+    static const PreparedKey    invalidKey;
+    std::atomic<size_t>         matches(0);
+
+    if (!secrets || !counters || !codes || !results || digits <= 0 || digits > OTP_TOTP_MAX_DIGITS)
+        return 0;
+
+    _pool.parallelFor(count, _chunkSize, [&](size_t begin, size_t end, unsigned worker) {
+        PreparedKeyCache    &cache = _caches[worker];
+        const PreparedKey   *keys[OTP_PARALLEL_GROUP];
+        size_t              chunkMatches = 0;
+
+        for (size_t base = begin; base < end; base += OTP_PARALLEL_GROUP)
+        {
+            size_t  size = std::min<size_t>(OTP_PARALLEL_GROUP, end - base);
+            bool    invalid = false;
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                keys[i] = cache.find(secrets[base + i]);
+                if (!keys[i])
+                {
+                    keys[i] = &invalidKey;
+                    invalid = true;
+                }
+            }
+
+            size_t groupMatches = verifyTOTPBatch(
+                keys, counters + base, codes + base * digits, size, results + base, digits);
+            for (size_t i = 0; invalid && i < size; ++i)
+                if (keys[i] == &invalidKey && results[base + i] == OTP_BATCH_MATCH)
+                {
+                    results[base + i] = OTP_BATCH_MISMATCH;
+                    --groupMatches;
+                }
+            chunkMatches += groupMatches;
+            cache.trim();
+        }
+        matches += chunkMatches;
+    });
+    return matches;
+}
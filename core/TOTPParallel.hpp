@@ -0,0 +1,98 @@
+#ifndef TOTPPARALLEL_HPP
+# define TOTPPARALLEL_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# include "ThreadPool.hpp"
+# include "TOTPBatch.hpp"
+
+/*
+ * Parallel batch TOTP engine
+ *
+ * Runs the batch engine of TOTPBatch.hpp on every core: a batch is cut
+ * into chunks which are spread over the workers of a ThreadPool, and
+ * each chunk goes through generateTOTPBatch() or verifyTOTPBatch(), so
+ * it still uses the multi-buffer HMAC-SHA1. The buffers follow the same
+ * layout as the single-threaded functions.
+ *
+ * Batches of encoded (Hex/Base32) secrets are also accepted: every
+ * worker keeps its own cache of prepared keys, so a secret seen again in
+ * a later batch is not decoded and keyed again, and the workers never
+ * share a cache, so there is no locking. The cache is indexed by a keyed
+ * 128-bit hash of the secrets (SipHash, with a random key per cache),
+ * never by the secrets themselves: without the key, no one can choose
+ * two secrets sharing an entry. The keys of a
+ * group of items are looked up first, then the whole group goes through
+ * the batch engine.
+ */
+
+enum ParallelLimits
+{
+	OTP_PARALLEL_CHUNK		= 4096,		// Items per task, amortizes the queueing
+	OTP_PARALLEL_GROUP		= 256,		// Items of a task whose keys are looked up before verifying them
+	OTP_KEY_CACHE_SIZE		= 65536,	// Prepared keys kept by each worker
+	OTP_KEY_DIGEST_SIZE		= 16		// Hash of a secret in the cache
+};
+
+// Prepared keys of the secrets seen by one worker
+class PreparedKeyCache
+{
+public:
+	explicit PreparedKeyCache(size_t capacity = OTP_KEY_CACHE_SIZE);
+
+	// Null if the secret is not a valid Hex or Base32 key, valid until the cache is emptied
+	const PreparedKey	*find(const std::string &secret);
+	// Empty the cache if it holds more keys than its capacity
+	void				trim(void);
+	size_t				size(void) const;
+	void				clear(void);
+
+private:
+	struct Digest
+	{
+		uint64_t	words[OTP_KEY_DIGEST_SIZE / 8];
+
+		bool	operator==(const Digest &other) const;
+	};
+	struct DigestHash
+	{
+		size_t	operator()(const Digest &digest) const;
+	};
+
+	size_t										_capacity;
+	uint64_t									_hashKey[2];	// SipHash key, random
+	std::unordered_map<Digest, PreparedKey, DigestHash>	_keys;	// Hash of the secret -> key
+};
+
+class ParallelTOTP
+{
+public:
+	explicit ParallelTOTP(
+		const ThreadPoolParams &params = ThreadPoolParams(), size_t chunkSize = OTP_PARALLEL_CHUNK,
+		size_t cacheSize = OTP_KEY_CACHE_SIZE);
+
+	unsigned	threads(void) const;
+
+	// Same as generateTOTPBatch() and verifyTOTPBatch(), on every worker
+	size_t		generate(
+		const PreparedKey *keys, const uint64_t *counters, size_t count,
+		char *codes, int digits = OTP_TOTP_CODE_DIGIT);
+	size_t		verify(
+		const PreparedKey *keys, const uint64_t *counters, const char *codes, size_t count,
+		uint8_t *results, int digits = OTP_TOTP_CODE_DIGIT);
+	// Same as above from encoded secrets, an invalid secret is a mismatch
+	size_t		verify(
+		const std::string *secrets, const uint64_t *counters, const char *codes, size_t count,
+		uint8_t *results, int digits = OTP_TOTP_CODE_DIGIT);
+
+private:
+	ThreadPool						_pool;
+	size_t							_chunkSize;
+	std::vector<PreparedKeyCache>	_caches;	// One per worker
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#ifdef __linux__
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+ThreadPool::ThreadPool(const ThreadPoolParams &params)
+    : _queued(0), _pending(0), _next(0), _stop(false)
+{
+    unsigned threads = params.threads;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    _workers.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i)
+        _workers.push_back(std::unique_ptr<Worker>(new Worker));
+    // Every queue exists before the first worker may try to steal from it
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        _workers[i]->thread = std::thread(&ThreadPool::work, this, i);
+        if (params.pin)
+            pinThread(i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _workers.size(); ++i)
+        _workers[i]->thread.join();
+}
+
+unsigned ThreadPool::size(void) const
+{
+    return static_cast<unsigned>(_workers.size());
+}
+
+// Pinning is only a hint: the pool works the same if it fails
+void ThreadPool::pinThread(unsigned index)
+{
+#ifdef __linux__
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(index % cpus, &set);
+    pthread_setaffinity_np(_workers[index]->thread.native_handle(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+// Tasks are queued round-robin, the idle workers balance the load by stealing
+void ThreadPool::submit(const Task &task)
+{
+    Worker *worker;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        worker = _workers[_next].get();
+        _next = (_next + 1) % _workers.size();
+        ++_pending;
+    }
+    {
+        std::lock_guard<std::mutex> guard(worker->lock);
+        worker->tasks.push_back(task);
+    }
+    {
+        // Under the lock, so a worker can't miss the wake up between its check and its wait
+        std::lock_guard<std::mutex> guard(_lock);
+        ++_queued;
+    }
+    _wake.notify_one();
+}
+
+/**
+ * @brief Take a task from the worker's own queue, or steal one.
+ *
+ * The owner pops from the back and thieves from the front, so they only
+ * compete for the same task when a single one is left.
+ */
+bool ThreadPool::takeTask(unsigned index, Task &task)
+{
+    const size_t count = _workers.size();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        Worker                      &worker = *_workers[(index + i) % count];
+        std::lock_guard<std::mutex> guard(worker.lock);
+
+        if (worker.tasks.empty())
+            continue;
+        if (i == 0)
+        {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        --_queued;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::finishTasks(size_t count)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _pending -= count;
+    if (_pending == 0)
+        _done.notify_all();
+}
+
+void ThreadPool::work(unsigned index)
+{
+    Task task;
+
+    for (;;)
+    {
+        if (takeTask(index, task))
+        {
+            try
+            {
+                task(index);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(_lock);
+                if (!_error)
+                    _error = std::current_exception();
+            }
+            task = nullptr;
+            finishTasks(1);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(_lock);
+        _wake.wait(guard, [this] { return _stop || _queued.load() != 0; });
+        if (_stop && _queued.load() == 0)
+            return;
+    }
+}
+
+void ThreadPool::wait(void)
+{
+    std::unique_lock<std::mutex> guard(_lock);
+
+    _done.wait(guard, [this] { return _pending == 0; });
+    if (_error)
+    {
+        std::exception_ptr error = _error;
+        _error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief Run a range of items in parallel, one task per chunk.
+ *
+ * Each worker first gets a contiguous block of chunks, so the items it
+ * processes are adjacent in memory; stealing then evens out the blocks
+ * that take longer. All the queues are filled before any worker is woken.
+ */
+void ThreadPool::parallelFor(size_t count, size_t chunkSize, const RangeTask &task)
+{
+    if (count == 0)
+        return;
+    if (chunkSize == 0)
+        chunkSize = 1;
+
+    const size_t chunks = (count + chunkSize - 1) / chunkSize;
+    const size_t workers = _workers.size();
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _pending += chunks;
+    }
+    for (size_t w = 0; w < workers; ++w)
+    {
+        size_t first = chunks * w / workers;
+        size_t last = chunks * (w + 1) / workers;
+
+        std::lock_guard<std::mutex> guard(_workers[w]->lock);
+        // Pushed in reverse, so the owner (popping from the back) starts with the first chunk
+        for (size_t c = last; c-- > first;)
+        {
+            size_t begin = c * chunkSize;
+            size_t end = std::min(count, begin + chunkSize);
+            _workers[w]->tasks.push_back([task, begin, end](unsigned worker) { task(begin, end, worker); });
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _queued += chunks;
+    }
+    _wake.notify_all();
+    wait();
+}
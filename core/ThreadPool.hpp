@@ -0,0 +1,80 @@
+#ifndef THREADPOOL_HPP
+# define THREADPOOL_HPP
+
+# include <stddef.h>
+# include <atomic>
+# include <condition_variable>
+# include <deque>
+# include <exception>
+# include <functional>
+# include <memory>
+# include <mutex>
+# include <thread>
+# include <vector>
+
+/*
+ * Work-stealing thread pool
+ *
+ * Every worker owns a queue of tasks. A worker takes its own tasks from
+ * the back of its queue (the most recently submitted, still hot in its
+ * cache), and when it runs out of work it steals from the front of the
+ * other queues, so an uneven batch still keeps every core busy.
+ *
+ * Tasks receive the index of the worker running them, which lets the
+ * caller keep per-thread state (such as prepared key caches) without
+ * any locking.
+ */
+
+struct ThreadPoolParams
+{
+	unsigned	threads;	// 0: one per hardware thread
+	bool		pin;		// Pin worker 'i' to CPU 'i' (Linux only)
+
+	ThreadPoolParams(): threads(0), pin(false) {}
+};
+
+class ThreadPool
+{
+public:
+	typedef std::function<void(unsigned worker)>						Task;
+	typedef std::function<void(size_t begin, size_t end, unsigned worker)>	RangeTask;
+
+	explicit ThreadPool(const ThreadPoolParams &params = ThreadPoolParams());
+	~ThreadPool();
+
+	unsigned	size(void) const;
+	void		submit(const Task &task);
+	// Wait until every submitted task has run, rethrow the first exception of a task
+	void		wait(void);
+	// Split [0, count) into chunks of 'chunkSize' items, run them all and wait
+	void		parallelFor(size_t count, size_t chunkSize, const RangeTask &task);
+
+private:
+	struct Worker
+	{
+		std::mutex			lock;
+		std::deque<Task>	tasks;
+		std::thread			thread;
+	};
+
+	std::vector<std::unique_ptr<Worker> >	_workers;
+	std::mutex								_lock;
+	std::condition_variable					_wake;		// Tasks were queued, or the pool stops
+	std::condition_variable					_done;		// Every task has run
+	std::atomic<size_t>						_queued;	// Tasks not taken by a worker yet
+	size_t									_pending;	// Tasks not finished yet
+	unsigned								_next;		// Queue of the next submitted task
+	bool									_stop;
+	std::exception_ptr						_error;
+
+	void		work(unsigned index);
+	bool		takeTask(unsigned index, Task &task);
+	void		finishTasks(size_t count);
+	void		pinThread(unsigned index);
+
+	// The workers keep a pointer to the pool
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "sha1.hpp"
+#include <string.h>
+
+/*
+ * SHA-1 compression function, as described in FIPS 180-4 section 6.1.2.
+ *
+ * Each 64-byte block is seen as sixteen big-endian 32-bit words which are
+ * expanded to 80 words, then mixed into the 5-word state in 80 rounds.
+ * Only the last 16 expanded words are kept at any time (rolling schedule).
+ */
+
+static inline uint32_t rotl32(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+// W[i] = ROTL1(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16]), on a rolling 16-word window
+#define SHA1_SCHEDULE(w, i) \
+    (w[(i) & 15] = rotl32(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+
+#define SHA1_ROUND(a, b, c, d, e, f, k, wi) \
+    do { \
+        uint32_t temp = rotl32(a, 5) + (f) + e + (k) + (wi); \
+        e = d; \
+        d = c; \
+        c = rotl32(b, 30); \
+        b = a; \
+        a = temp; \
+    } while (0)
+
+static inline uint32_t loadBigEndian32(const uint8_t *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) |
+           (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) |
+           static_cast<uint32_t>(p[3]);
+}
+
+void sha1Init(uint32_t state[OTP_SHA1_STATE_WORDS])
+{
+    state[0] = 0x67452301;
+    state[1] = 0xEFCDAB89;
+    state[2] = 0x98BADCFE;
+    state[3] = 0x10325476;
+    state[4] = 0xC3D2E1F0;
+}
+
+void sha1CompressWords(uint32_t state[OTP_SHA1_STATE_WORDS], const uint32_t words[16])
+{
+    uint32_t w[16];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    memcpy(w, words, sizeof(w));
+
+    /*
+     * The 80 rounds are split in 4 loops of 20 rounds, one per round
+     * function, so that no round has to select its function at runtime.
+     */
+    for (int i = 0; i < 20; ++i)
+    {
+        if (i >= 16)
+            SHA1_SCHEDULE(w, i);
+        SHA1_ROUND(a, b, c, d, e, (b & c) | (~b & d), 0x5A827999, w[i & 15]);
+    }
+    for (int i = 20; i < 40; ++i)
+    {
+        SHA1_SCHEDULE(w, i);
+        SHA1_ROUND(a, b, c, d, e, b ^ c ^ d, 0x6ED9EBA1, w[i & 15]);
+    }
+    for (int i = 40; i < 60; ++i)
+    {
+        SHA1_SCHEDULE(w, i);
+        SHA1_ROUND(a, b, c, d, e, (b & c) | (b & d) | (c & d), 0x8F1BBCDC, w[i & 15]);
+    }
+    for (int i = 60; i < 80; ++i)
+    {
+        SHA1_SCHEDULE(w, i);
+        SHA1_ROUND(a, b, c, d, e, b ^ c ^ d, 0xCA62C1D6, w[i & 15]);
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha1Compress(uint32_t state[OTP_SHA1_STATE_WORDS], const uint8_t block[OTP_SHA1_BLOCK_SIZE])
+{
+    uint32_t words[16];
+
+    for (int i = 0; i < 16; ++i)
+        words[i] = loadBigEndian32(block + i * 4);
+    sha1CompressWords(state, words);
+}
+
+void sha1StateToDigest(const uint32_t state[OTP_SHA1_STATE_WORDS], uint8_t digest[OTP_SHA1_DIGEST_SIZE])
+{
+    for (int i = 0; i < OTP_SHA1_STATE_WORDS; ++i)
+    {
+        digest[i * 4]     = static_cast<uint8_t>(state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+    }
+}
+
+// One-shot SHA-1 of an arbitrary message (used for keys longer than a block)
+void sha1(const uint8_t *data, size_t size, uint8_t digest[OTP_SHA1_DIGEST_SIZE])
+{
+    uint32_t    state[OTP_SHA1_STATE_WORDS];
+    uint8_t     block[OTP_SHA1_BLOCK_SIZE];
+    uint64_t    bitLength = static_cast<uint64_t>(size) * 8;
+
+    sha1Init(state);
+    for (; size >= OTP_SHA1_BLOCK_SIZE; size -= OTP_SHA1_BLOCK_SIZE, data += OTP_SHA1_BLOCK_SIZE)
+        sha1Compress(state, data);
+
+    /*
+     * Padding: a single '1' bit, zeros, then the message length in bits
+     * as a 64-bit big-endian integer. If the length doesn't fit in the
+     * current block, an extra block is needed.
+     */
+    memset(block, 0, sizeof(block));
+    memcpy(block, data, size);
+    block[size] = 0x80;
+    if (size >= OTP_SHA1_BLOCK_SIZE - 8)
+    {
+        sha1Compress(state, block);
+        memset(block, 0, sizeof(block));
+    }
+    for (int i = 0; i < 8; ++i)
+        block[OTP_SHA1_BLOCK_SIZE - 1 - i] = static_cast<uint8_t>(bitLength >> (i * 8));
+    sha1Compress(state, block);
+
+    sha1StateToDigest(state, digest);
+    memset(block, 0, sizeof(block));
+}
@@ -0,0 +1,30 @@
+#ifndef SHA1_HPP
+# define SHA1_HPP
+
+# include <stdint.h>
+# include <stddef.h>
+
+/*
+ * Minimal SHA-1 (FIPS 180-4) primitives.
+ *
+ * Crypto++ only exposes SHA-1 as a streaming object, which makes it
+ * impossible to keep the intermediate state (the "midstate") between
+ * two HMAC computations. HMAC with a fixed key always starts by hashing
+ * the same (key ^ ipad) and (key ^ opad) blocks, so we expose the raw
+ * compression function to be able to hash those blocks only once.
+ */
+
+enum Sha1Sizes
+{
+	OTP_SHA1_BLOCK_SIZE		= 64,	// Size of a message block in bytes
+	OTP_SHA1_DIGEST_SIZE	= 20,	// Size of the final digest in bytes
+	OTP_SHA1_STATE_WORDS	= 5		// Number of 32-bit words in the state
+};
+
+void	sha1Init(uint32_t state[OTP_SHA1_STATE_WORDS]);
+void	sha1CompressWords(uint32_t state[OTP_SHA1_STATE_WORDS], const uint32_t words[16]);
+void	sha1Compress(uint32_t state[OTP_SHA1_STATE_WORDS], const uint8_t block[OTP_SHA1_BLOCK_SIZE]);
+void	sha1StateToDigest(const uint32_t state[OTP_SHA1_STATE_WORDS], uint8_t digest[OTP_SHA1_DIGEST_SIZE]);
+void	sha1(const uint8_t *data, size_t size, uint8_t digest[OTP_SHA1_DIGEST_SIZE]);
+
+#endif
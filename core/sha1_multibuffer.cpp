@@ -0,0 +1,414 @@
+#include "sha1_multibuffer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define OTP_SHA1_X86 1
+# include <immintrin.h>
+# include <cpuid.h>
+#else
+# define OTP_SHA1_X86 0
+#endif
+
+// Sizes of the two blocks hashed after the midstates, in bits
+#define OTP_HMAC_INNER_BITS	((OTP_SHA1_BLOCK_SIZE + 8) * 8)
+#define OTP_HMAC_OUTER_BITS	((OTP_SHA1_BLOCK_SIZE + OTP_SHA1_DIGEST_SIZE) * 8)
+
+static void storeDigest(const uint32_t state[OTP_SHA1_STATE_WORDS], uint8_t *digest)
+{
+    sha1StateToDigest(state, digest);
+}
+
+// Scalar path, one message at a time
+static void hmacSha1Scalar(
+    const PreparedKey *const *keys, const uint64_t *counters, size_t count,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    for (size_t i = 0; i < count; ++i)
+        keys[i]->hmac(counters[i], digests[i]);
+}
+
+#if OTP_SHA1_X86
+
+/*
+ * Lane-parallel kernel
+ *
+ * The same code is used for 4, 8 and 16 lanes thanks to the GCC/Clang
+ * vector extensions: arithmetic operators work element-wise, so each
+ * 32-bit element of a vector holds the value of one independent message.
+ * The kernel is always inlined into a function compiled for the target
+ * instruction set, which decides the generated instructions.
+ */
+
+typedef uint32_t Sha1Vec4 __attribute__((vector_size(16)));
+typedef uint32_t Sha1Vec8 __attribute__((vector_size(32)));
+typedef uint32_t Sha1Vec16 __attribute__((vector_size(64)));
+
+#define SHA1_ROTL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+// Same round and message schedule as sha1CompressWords(), on vectors
+#define SHA1_LANES_SCHEDULE(w, i) \
+    (w[(i) & 15] = SHA1_ROTL(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+
+#define SHA1_LANES_ROUND(V, a, b, c, d, e, f, k, wi) \
+    do { \
+        V temp = SHA1_ROTL(a, 5) + (f) + e + (k) + (wi); \
+        e = d; \
+        d = c; \
+        c = SHA1_ROTL(b, 30); \
+        b = a; \
+        a = temp; \
+    } while (0)
+
+template <class V>
+static inline __attribute__((always_inline))
+void sha1CompressLanes(V *state, V *w)
+{
+    V a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (int i = 0; i < 20; ++i)
+    {
+        if (i >= 16)
+            SHA1_LANES_SCHEDULE(w, i);
+        SHA1_LANES_ROUND(V, a, b, c, d, e, (b & c) | (~b & d), 0x5A827999, w[i & 15]);
+    }
+    for (int i = 20; i < 40; ++i)
+    {
+        SHA1_LANES_SCHEDULE(w, i);
+        SHA1_LANES_ROUND(V, a, b, c, d, e, b ^ c ^ d, 0x6ED9EBA1, w[i & 15]);
+    }
+    for (int i = 40; i < 60; ++i)
+    {
+        SHA1_LANES_SCHEDULE(w, i);
+        SHA1_LANES_ROUND(V, a, b, c, d, e, (b & c) | (b & d) | (c & d), 0x8F1BBCDC, w[i & 15]);
+    }
+    for (int i = 60; i < 80; ++i)
+    {
+        SHA1_LANES_SCHEDULE(w, i);
+        SHA1_LANES_ROUND(V, a, b, c, d, e, b ^ c ^ d, 0xCA62C1D6, w[i & 15]);
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+/*
+ * HMAC of LANES counters: the midstates of each key are gathered into
+ * the lanes, then both the inner and outer blocks are hashed at once.
+ */
+template <class V, int LANES>
+static inline __attribute__((always_inline))
+void hmacSha1Lanes(
+    const PreparedKey *const *keys, const uint64_t *counters,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    const V zero = {};
+    V       state[OTP_SHA1_STATE_WORDS];
+    V       w[16];
+
+    for (int s = 0; s < OTP_SHA1_STATE_WORDS; ++s)
+        for (int lane = 0; lane < LANES; ++lane)
+            state[s][lane] = keys[lane]->getInnerState()[s];
+    for (int lane = 0; lane < LANES; ++lane)
+    {
+        w[0][lane] = static_cast<uint32_t>(counters[lane] >> 32);
+        w[1][lane] = static_cast<uint32_t>(counters[lane]);
+    }
+    w[2] = zero + 0x80000000;
+    for (int i = 3; i < 15; ++i)
+        w[i] = zero;
+    w[15] = zero + OTP_HMAC_INNER_BITS;
+    sha1CompressLanes(state, w);
+
+    for (int s = 0; s < OTP_SHA1_STATE_WORDS; ++s)
+    {
+        w[s] = state[s];
+        for (int lane = 0; lane < LANES; ++lane)
+            state[s][lane] = keys[lane]->getOuterState()[s];
+    }
+    // The message schedule has been expanded in place, clear it again
+    w[5] = zero + 0x80000000;
+    for (int i = 6; i < 15; ++i)
+        w[i] = zero;
+    w[15] = zero + OTP_HMAC_OUTER_BITS;
+    sha1CompressLanes(state, w);
+
+    for (int lane = 0; lane < LANES; ++lane)
+    {
+        uint32_t laneState[OTP_SHA1_STATE_WORDS];
+        for (int s = 0; s < OTP_SHA1_STATE_WORDS; ++s)
+            laneState[s] = state[s][lane];
+        storeDigest(laneState, digests[lane]);
+    }
+}
+
+__attribute__((target("sse2")))
+static void hmacSha1Sse2(
+    const PreparedKey *const *keys, const uint64_t *counters,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    hmacSha1Lanes<Sha1Vec4, 4>(keys, counters, digests);
+}
+
+__attribute__((target("avx2")))
+static void hmacSha1Avx2(
+    const PreparedKey *const *keys, const uint64_t *counters,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    hmacSha1Lanes<Sha1Vec8, 8>(keys, counters, digests);
+}
+
+__attribute__((target("avx512f")))
+static void hmacSha1Avx512(
+    const PreparedKey *const *keys, const uint64_t *counters,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    hmacSha1Lanes<Sha1Vec16, 16>(keys, counters, digests);
+}
+
+/*
+ * SHA-NI kernel
+ *
+ * The SHA extensions compute 4 rounds per 'sha1rnds4' instruction, and
+ * 'sha1msg1'/'sha1msg2' expand the message schedule 4 words at a time.
+ * The instructions expect the words in reverse order in the registers
+ * (A in the highest element), hence the 0x1B shuffles.
+ *
+ * Rounds are processed by groups of 4 (G = 0..19). Group G hashes the
+ * message vector M[G % 4], and schedules the words needed 1 to 3 groups
+ * later, as in Intel's reference implementation.
+ */
+template <int G>
+static inline __attribute__((always_inline, target("sha,sse4.1")))
+void sha1ShaNiGroup(__m128i &abcd, __m128i &e, __m128i &eNext, __m128i *m)
+{
+    __m128i &x = m[G % 4];
+
+    if (G == 0)
+        e = _mm_add_epi32(e, x);
+    else
+        e = _mm_sha1nexte_epu32(e, x);
+    eNext = abcd;
+    if (G >= 3 && G <= 18)
+        m[(G + 1) % 4] = _mm_sha1msg2_epu32(m[(G + 1) % 4], x);
+    abcd = _mm_sha1rnds4_epu32(abcd, e, G / 5);
+    if (G >= 1 && G <= 16)
+        m[(G + 3) % 4] = _mm_sha1msg1_epu32(m[(G + 3) % 4], x);
+    if (G >= 2 && G <= 17)
+        m[(G + 2) % 4] = _mm_xor_si128(m[(G + 2) % 4], x);
+}
+
+__attribute__((target("sha,sse4.1")))
+static void sha1CompressShaNi(uint32_t state[OTP_SHA1_STATE_WORDS], const uint32_t words[16])
+{
+    __m128i abcd = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1B);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    __m128i e1;
+    __m128i abcdSave = abcd;
+    __m128i eSave = e0;
+    __m128i m[4];
+
+    for (int i = 0; i < 4; ++i)
+        m[i] = _mm_shuffle_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + i * 4)), 0x1B);
+
+    sha1ShaNiGroup<0>(abcd, e0, e1, m);
+    sha1ShaNiGroup<1>(abcd, e1, e0, m);
+    sha1ShaNiGroup<2>(abcd, e0, e1, m);
+    sha1ShaNiGroup<3>(abcd, e1, e0, m);
+    sha1ShaNiGroup<4>(abcd, e0, e1, m);
+    sha1ShaNiGroup<5>(abcd, e1, e0, m);
+    sha1ShaNiGroup<6>(abcd, e0, e1, m);
+    sha1ShaNiGroup<7>(abcd, e1, e0, m);
+    sha1ShaNiGroup<8>(abcd, e0, e1, m);
+    sha1ShaNiGroup<9>(abcd, e1, e0, m);
+    sha1ShaNiGroup<10>(abcd, e0, e1, m);
+    sha1ShaNiGroup<11>(abcd, e1, e0, m);
+    sha1ShaNiGroup<12>(abcd, e0, e1, m);
+    sha1ShaNiGroup<13>(abcd, e1, e0, m);
+    sha1ShaNiGroup<14>(abcd, e0, e1, m);
+    sha1ShaNiGroup<15>(abcd, e1, e0, m);
+    sha1ShaNiGroup<16>(abcd, e0, e1, m);
+    sha1ShaNiGroup<17>(abcd, e1, e0, m);
+    sha1ShaNiGroup<18>(abcd, e0, e1, m);
+    sha1ShaNiGroup<19>(abcd, e1, e0, m);
+
+    // After the last group, e0 holds A of round 76 which gives the new E
+    e0 = _mm_sha1nexte_epu32(e0, eSave);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+__attribute__((target("sha,sse4.1")))
+static void hmacSha1ShaNi(
+    const PreparedKey *const *keys, const uint64_t *counters, size_t count,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    uint32_t    words[16];
+    uint32_t    state[OTP_SHA1_STATE_WORDS];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(state, keys[i]->getInnerState(), sizeof(state));
+        memset(words, 0, sizeof(words));
+        words[0] = static_cast<uint32_t>(counters[i] >> 32);
+        words[1] = static_cast<uint32_t>(counters[i]);
+        words[2] = 0x80000000;
+        words[15] = OTP_HMAC_INNER_BITS;
+        sha1CompressShaNi(state, words);
+
+        memcpy(words, state, sizeof(state));
+        memcpy(state, keys[i]->getOuterState(), sizeof(state));
+        words[5] = 0x80000000;
+        words[15] = OTP_HMAC_OUTER_BITS;
+        sha1CompressShaNi(state, words);
+
+        storeDigest(state, digests[i]);
+    }
+}
+
+// The SHA extensions are reported by CPUID leaf 7, EBX bit 29
+static bool cpuHasShaNi(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ebx & (1u << 29)) && __builtin_cpu_supports("sse4.1");
+}
+
+#endif // OTP_SHA1_X86
+
+bool sha1IsBackendSupported(Sha1Backend backend)
+{
+    switch (backend)
+    {
+    case OTP_SHA1_BACKEND_SCALAR:
+        return true;
+#if OTP_SHA1_X86
+    case OTP_SHA1_BACKEND_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case OTP_SHA1_BACKEND_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case OTP_SHA1_BACKEND_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case OTP_SHA1_BACKEND_SHANI:
+        return cpuHasShaNi();
+#endif
+    default:
+        return false;
+    }
+}
+
+/*
+ * Preferred order, from the measured throughput on batches: the widest
+ * lane-parallel kernels hash more messages per cycle than SHA-NI, which
+ * is limited by the latency of a single message, but SHA-NI still beats
+ * the 4-lane SSE2 kernel.
+ */
+static Sha1Backend detectBackend(void)
+{
+    static const Sha1Backend preferred[] = {
+        OTP_SHA1_BACKEND_AVX512,
+        OTP_SHA1_BACKEND_AVX2,
+        OTP_SHA1_BACKEND_SHANI,
+        OTP_SHA1_BACKEND_SSE2
+    };
+
+    for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); ++i)
+        if (sha1IsBackendSupported(preferred[i]))
+            return preferred[i];
+    return OTP_SHA1_BACKEND_SCALAR;
+}
+
+static std::atomic<int> &currentBackend(void)
+{
+    static std::atomic<int> backend(detectBackend());
+    return backend;
+}
+
+Sha1Backend sha1GetBackend(void)
+{
+    return static_cast<Sha1Backend>(currentBackend().load(std::memory_order_relaxed));
+}
+
+// Force a backend (e.g. for benchmarks), returns false if the CPU lacks it
+bool sha1SetBackend(Sha1Backend backend)
+{
+    if (!sha1IsBackendSupported(backend))
+        return false;
+    currentBackend().store(backend, std::memory_order_relaxed);
+    return true;
+}
+
+const char *sha1BackendName(Sha1Backend backend)
+{
+    static const char *names[OTP_SHA1_BACKEND_COUNT] = {
+        "scalar", "sse2", "avx2", "avx512", "sha-ni"
+    };
+
+    if (backend < 0 || backend >= OTP_SHA1_BACKEND_COUNT)
+        return "unknown";
+    return names[backend];
+}
+
+/**
+ * @brief Compute HMAC-SHA1(*keys[i], counters[i]) for 'count' items.
+ *
+ * With a lane-parallel backend, items are processed by groups of the
+ * vector width, and the remaining ones go through narrower kernels.
+ */
+void hmacSha1Batch(
+    const PreparedKey *const *keys, const uint64_t *counters, size_t count,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    size_t i = 0;
+
+#if OTP_SHA1_X86
+    switch (sha1GetBackend())
+    {
+    case OTP_SHA1_BACKEND_SHANI:
+        hmacSha1ShaNi(keys, counters, count, digests);
+        return;
+    case OTP_SHA1_BACKEND_AVX512:
+        for (; i + 16 <= count; i += 16)
+            hmacSha1Avx512(keys + i, counters + i, digests + i);
+        // fall through
+    case OTP_SHA1_BACKEND_AVX2:
+        for (; i + 8 <= count; i += 8)
+            hmacSha1Avx2(keys + i, counters + i, digests + i);
+        // fall through
+    case OTP_SHA1_BACKEND_SSE2:
+        for (; i + 4 <= count; i += 4)
+            hmacSha1Sse2(keys + i, counters + i, digests + i);
+        break;
+    default:
+        break;
+    }
+#endif
+    hmacSha1Scalar(keys + i, counters + i, count - i, digests + i);
+}
+
+// Same as above with contiguous keys, by groups of the widest vector width
+void hmacSha1Batch(
+    const PreparedKey *keys, const uint64_t *counters, size_t count,
+    uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE])
+{
+    const PreparedKey *group[OTP_SHA1_MAX_LANES];
+
+    for (size_t base = 0; base < count; base += OTP_SHA1_MAX_LANES)
+    {
+        size_t size = std::min<size_t>(OTP_SHA1_MAX_LANES, count - base);
+
+        for (size_t i = 0; i < size; ++i)
+            group[i] = keys + base + i;
+        hmacSha1Batch(group, counters + base, size, digests + base);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SHA1_MULTIBUFFER_HPP
+# define SHA1_MULTIBUFFER_HPP
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include "sha1.hpp"
+# include "PreparedKey.hpp"
+
+/*
+ * Multi-buffer HMAC-SHA1 for batched TOTP.
+ *
+ * The HMAC of an 8-byte counter from a prepared key is always exactly two
+ * SHA-1 compressions with a fixed layout, so several independent messages
+ * can be hashed at the same time, one per SIMD lane:
+ *  - SSE2:     4 lanes
+ *  - AVX2:     8 lanes
+ *  - AVX-512: 16 lanes
+ * On CPUs with the SHA extensions, SHA-NI hashes one message at a time
+ * but much faster than the scalar code.
+ *
+ * The best backend is selected at runtime from the CPU features, and the
+ * output is bit-exact with a regular HMAC-SHA1.
+ */
+
+enum Sha1Backend
+{
+	OTP_SHA1_BACKEND_SCALAR	= 0,
+	OTP_SHA1_BACKEND_SSE2	= 1,
+	OTP_SHA1_BACKEND_AVX2	= 2,
+	OTP_SHA1_BACKEND_AVX512	= 3,
+	OTP_SHA1_BACKEND_SHANI	= 4,
+	OTP_SHA1_BACKEND_COUNT	= 5
+};
+
+bool		sha1IsBackendSupported(Sha1Backend backend);
+Sha1Backend	sha1GetBackend(void);
+bool		sha1SetBackend(Sha1Backend backend);
+const char	*sha1BackendName(Sha1Backend backend);
+
+// Most lanes hashed at once (AVX-512)
+# define OTP_SHA1_MAX_LANES	16
+
+void		hmacSha1Batch(
+	const PreparedKey *keys, const uint64_t *counters, size_t count,
+	uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE]);
+// Same, item 'i' using the key at keys[i], for keys which aren't stored contiguously
+void		hmacSha1Batch(
+	const PreparedKey *const *keys, const uint64_t *counters, size_t count,
+	uint8_t (*digests)[OTP_SHA1_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,232 @@
+#include "sha2.hpp"
+#include <string.h>
+
+/*
+ * SHA-256 and SHA-512 compression functions, as described in FIPS 180-4
+ * sections 6.2.2 and 6.4.2. Both share the same structure and only
+ * differ by their word size, rotation amounts and number of rounds.
+ */
+
+static const uint32_t sha256RoundConstants[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static const uint64_t sha512RoundConstants[80] = {
+    0x428A2F98D728AE22ULL, 0x7137449123EF65CDULL,
+    0xB5C0FBCFEC4D3B2FULL, 0xE9B5DBA58189DBBCULL,
+    0x3956C25BF348B538ULL, 0x59F111F1B605D019ULL,
+    0x923F82A4AF194F9BULL, 0xAB1C5ED5DA6D8118ULL,
+    0xD807AA98A3030242ULL, 0x12835B0145706FBEULL,
+    0x243185BE4EE4B28CULL, 0x550C7DC3D5FFB4E2ULL,
+    0x72BE5D74F27B896FULL, 0x80DEB1FE3B1696B1ULL,
+    0x9BDC06A725C71235ULL, 0xC19BF174CF692694ULL,
+    0xE49B69C19EF14AD2ULL, 0xEFBE4786384F25E3ULL,
+    0x0FC19DC68B8CD5B5ULL, 0x240CA1CC77AC9C65ULL,
+    0x2DE92C6F592B0275ULL, 0x4A7484AA6EA6E483ULL,
+    0x5CB0A9DCBD41FBD4ULL, 0x76F988DA831153B5ULL,
+    0x983E5152EE66DFABULL, 0xA831C66D2DB43210ULL,
+    0xB00327C898FB213FULL, 0xBF597FC7BEEF0EE4ULL,
+    0xC6E00BF33DA88FC2ULL, 0xD5A79147930AA725ULL,
+    0x06CA6351E003826FULL, 0x142929670A0E6E70ULL,
+    0x27B70A8546D22FFCULL, 0x2E1B21385C26C926ULL,
+    0x4D2C6DFC5AC42AEDULL, 0x53380D139D95B3DFULL,
+    0x650A73548BAF63DEULL, 0x766A0ABB3C77B2A8ULL,
+    0x81C2C92E47EDAEE6ULL, 0x92722C851482353BULL,
+    0xA2BFE8A14CF10364ULL, 0xA81A664BBC423001ULL,
+    0xC24B8B70D0F89791ULL, 0xC76C51A30654BE30ULL,
+    0xD192E819D6EF5218ULL, 0xD69906245565A910ULL,
+    0xF40E35855771202AULL, 0x106AA07032BBD1B8ULL,
+    0x19A4C116B8D2D0C8ULL, 0x1E376C085141AB53ULL,
+    0x2748774CDF8EEB99ULL, 0x34B0BCB5E19B48A8ULL,
+    0x391C0CB3C5C95A63ULL, 0x4ED8AA4AE3418ACBULL,
+    0x5B9CCA4F7763E373ULL, 0x682E6FF3D6B2B8A3ULL,
+    0x748F82EE5DEFB2FCULL, 0x78A5636F43172F60ULL,
+    0x84C87814A1F0AB72ULL, 0x8CC702081A6439ECULL,
+    0x90BEFFFA23631E28ULL, 0xA4506CEBDE82BDE9ULL,
+    0xBEF9A3F7B2C67915ULL, 0xC67178F2E372532BULL,
+    0xCA273ECEEA26619CULL, 0xD186B8C721C0C207ULL,
+    0xEADA7DD6CDE0EB1EULL, 0xF57D4F7FEE6ED178ULL,
+    0x06F067AA72176FBAULL, 0x0A637DC5A2C898A6ULL,
+    0x113F9804BEF90DAEULL, 0x1B710B35131C471BULL,
+    0x28DB77F523047D84ULL, 0x32CAAB7B40C72493ULL,
+    0x3C9EBE0A15C9BEBCULL, 0x431D67C49C100D4CULL,
+    0x4CC5D4BECB3E42B6ULL, 0x597F299CFC657E2AULL,
+    0x5FCB6FAB3AD6FAECULL, 0x6C44198C4A475817ULL
+};
+
+static const uint32_t sha256InitialState[OTP_SHA256_STATE_WORDS] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint64_t sha512InitialState[OTP_SHA512_STATE_WORDS] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL,
+    0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+    0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+};
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+static inline uint64_t rotr64(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+void sha256Init(uint32_t state[OTP_SHA256_STATE_WORDS])
+{
+    memcpy(state, sha256InitialState, sizeof(sha256InitialState));
+}
+
+void sha512Init(uint64_t state[OTP_SHA512_STATE_WORDS])
+{
+    memcpy(state, sha512InitialState, sizeof(sha512InitialState));
+}
+
+void sha256CompressWords(uint32_t state[OTP_SHA256_STATE_WORDS], const uint32_t words[16])
+{
+    uint32_t w[64];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    memcpy(w, words, 16 * sizeof(uint32_t));
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + ch + sha256RoundConstants[i] + w[i];
+        uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha512CompressWords(uint64_t state[OTP_SHA512_STATE_WORDS], const uint64_t words[16])
+{
+    uint64_t w[80];
+    uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    memcpy(w, words, 16 * sizeof(uint64_t));
+    for (int i = 16; i < 80; ++i)
+    {
+        uint64_t s0 = rotr64(w[i - 15], 1) ^ rotr64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = rotr64(w[i - 2], 19) ^ rotr64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    for (int i = 0; i < 80; ++i)
+    {
+        uint64_t s1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+        uint64_t ch = (e & f) ^ (~e & g);
+        uint64_t temp1 = h + s1 + ch + sha512RoundConstants[i] + w[i];
+        uint64_t s0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+        uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint64_t temp2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+// Load a block of big-endian words and compress it
+template <class Word, int BlockSize>
+static void compressBlock(void (*compress)(Word *, const Word *), Word *state, const uint8_t *block)
+{
+    Word words[16];
+
+    for (int i = 0; i < 16; ++i)
+    {
+        words[i] = 0;
+        for (size_t j = 0; j < sizeof(Word); ++j)
+            words[i] = (words[i] << 8) | block[i * sizeof(Word) + j];
+    }
+    compress(state, words);
+}
+
+/*
+ * One-shot hash of an arbitrary message (used for keys longer than a block).
+ * The padding is the same as SHA-1, except that SHA-512 stores the message
+ * length on 128 bits (LengthSize bytes).
+ */
+template <class Word, int BlockSize, int StateWords, int LengthSize>
+static void hashMessage(
+    void (*init)(Word *), void (*compress)(Word *, const Word *),
+    const uint8_t *data, size_t size, uint8_t *digest)
+{
+    Word        state[StateWords];
+    uint8_t     block[BlockSize];
+    uint64_t    bitLength = static_cast<uint64_t>(size) * 8;
+
+    init(state);
+    for (; size >= static_cast<size_t>(BlockSize); size -= BlockSize, data += BlockSize)
+        compressBlock<Word, BlockSize>(compress, state, data);
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, data, size);
+    block[size] = 0x80;
+    if (size >= static_cast<size_t>(BlockSize - LengthSize))
+    {
+        compressBlock<Word, BlockSize>(compress, state, block);
+        memset(block, 0, sizeof(block));
+    }
+    for (int i = 0; i < 8; ++i)
+        block[BlockSize - 1 - i] = static_cast<uint8_t>(bitLength >> (i * 8));
+    compressBlock<Word, BlockSize>(compress, state, block);
+
+    for (int i = 0; i < StateWords; ++i)
+        for (size_t j = 0; j < sizeof(Word); ++j)
+            digest[i * sizeof(Word) + j] = static_cast<uint8_t>(state[i] >> (8 * (sizeof(Word) - 1 - j)));
+    memset(block, 0, sizeof(block));
+}
+
+void sha256(const uint8_t *data, size_t size, uint8_t digest[OTP_SHA256_DIGEST_SIZE])
+{
+    hashMessage<uint32_t, OTP_SHA256_BLOCK_SIZE, OTP_SHA256_STATE_WORDS, 8>(
+        sha256Init, sha256CompressWords, data, size, digest);
+}
+
+void sha512(const uint8_t *data, size_t size, uint8_t digest[OTP_SHA512_DIGEST_SIZE])
+{
+    hashMessage<uint64_t, OTP_SHA512_BLOCK_SIZE, OTP_SHA512_STATE_WORDS, 16>(
+        sha512Init, sha512CompressWords, data, size, digest);
+}
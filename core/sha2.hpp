@@ -0,0 +1,34 @@
+#ifndef SHA2_HPP
+# define SHA2_HPP
+
+# include <stdint.h>
+# include <stddef.h>
+
+/*
+ * Minimal SHA-256 and SHA-512 (FIPS 180-4) primitives.
+ *
+ * Same purpose as sha1.hpp: the raw compression functions let us keep
+ * the HMAC midstates of a key, which Crypto++ doesn't expose.
+ * Message blocks are given as big-endian words already loaded in host
+ * order (32-bit words for SHA-256, 64-bit words for SHA-512).
+ */
+
+enum Sha2Sizes
+{
+	OTP_SHA256_BLOCK_SIZE	= 64,
+	OTP_SHA256_DIGEST_SIZE	= 32,
+	OTP_SHA256_STATE_WORDS	= 8,
+	OTP_SHA512_BLOCK_SIZE	= 128,
+	OTP_SHA512_DIGEST_SIZE	= 64,
+	OTP_SHA512_STATE_WORDS	= 8
+};
+
+void	sha256Init(uint32_t state[OTP_SHA256_STATE_WORDS]);
+void	sha256CompressWords(uint32_t state[OTP_SHA256_STATE_WORDS], const uint32_t words[16]);
+void	sha256(const uint8_t *data, size_t size, uint8_t digest[OTP_SHA256_DIGEST_SIZE]);
+
+void	sha512Init(uint64_t state[OTP_SHA512_STATE_WORDS]);
+void	sha512CompressWords(uint64_t state[OTP_SHA512_STATE_WORDS], const uint64_t words[16]);
+void	sha512(const uint8_t *data, size_t size, uint8_t digest[OTP_SHA512_DIGEST_SIZE]);
+
+#endif
@@ -40,7 +40,7 @@ int MainWindow::generate_TOTP(std::string inputKeyStr)
     else ui->keyErrorLabel->setText("");
 
     try {
-        TOTP = QString::fromStdString(TOTPGen.generateTOTPHmacSha1(inputKeyStr, 30, 6));
+        TOTP = QString::fromStdString(TOTPGen.generateTOTPHmacSha1(inputKeyStr, 30, 6, keyFormat));
         ui->lineTOTP->setText(TOTP);
         if (TOTP.isEmpty()) throw std::exception();
     } catch (const std::exception &e) {
@@ -0,0 +1,360 @@
+#include "ftotp.h"
+#include "../core/TOTPGenerator.hpp"
+#include "../core/TOTPBatch.hpp"
+#include "../core/KeyStore.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+// Items of ftotp_verify_batch() kept on the stack at once
+#define FTOTP_BATCH_CHUNK	64
+
+/*
+ * Every exported function catches everything: a C caller can't handle a
+ * C++ exception, and letting one cross the ABI would terminate the server.
+ */
+
+struct ftotp_key
+{
+	HashAlgorithm		algorithm;
+	PreparedKey			sha1;
+	PreparedKeySha256	sha256;
+	PreparedKeySha512	sha512;
+};
+
+static bool isValidAlgorithm(ftotp_algorithm algorithm)
+{
+	return algorithm == FTOTP_SHA1 || algorithm == FTOTP_SHA256 || algorithm == FTOTP_SHA512;
+}
+
+static bool isValidConfig(int digits, uint64_t period)
+{
+	return digits > 0 && digits <= FTOTP_MAX_DIGITS && period != 0;
+}
+
+// Bounds the work of a call, and keeps 2 * window from overflowing
+static bool isValidWindow(int window)
+{
+	return window >= 0 && window <= FTOTP_MAX_WINDOW;
+}
+
+// Offsets of the time steps checked, from the most likely: 0, -1, +1, -2, +2, ...
+static int windowOffset(int i)
+{
+	return (i & 1) ? -(i + 1) / 2 : i / 2;
+}
+
+static bool codeAt(const ftotp_key *key, int64_t unixTime, int digits, uint64_t period, uint32_t &code)
+{
+	switch (key->algorithm)
+	{
+	case OTP_HASH_SHA256:	return computeTOTPCode(key->sha256, unixTime, digits, period, code);
+	case OTP_HASH_SHA512:	return computeTOTPCode(key->sha512, unixTime, digits, period, code);
+	default:				return computeTOTPCode(key->sha1, unixTime, digits, period, code);
+	}
+}
+
+// Same rules as TOTPGenerator::parseCode(), without building a std::string
+static bool parseCode(const char *code, size_t size, int digits, uint32_t &value)
+{
+	if (size != static_cast<size_t>(digits))
+		return false;
+
+	value = 0;
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (code[i] < '0' || code[i] > '9')
+			return false;
+		value = value * 10 + (code[i] - '0');
+	}
+	return true;
+}
+
+// Prepare the secret for the requested hash function only
+static int newKey(const uint8_t *secret, size_t size, ftotp_algorithm algorithm, ftotp_key **key)
+{
+	ftotp_key *prepared = new (std::nothrow) ftotp_key;
+	if (!prepared)
+		return FTOTP_ERR_NO_MEMORY;
+
+	prepared->algorithm = static_cast<HashAlgorithm>(algorithm);
+	switch (prepared->algorithm)
+	{
+	case OTP_HASH_SHA256:	prepared->sha256.prepare(secret, size); break;
+	case OTP_HASH_SHA512:	prepared->sha512.prepare(secret, size); break;
+	default:				prepared->sha1.prepare(secret, size); break;
+	}
+	*key = prepared;
+	return FTOTP_OK;
+}
+
+static int newKeyFromText(const char *encoded, size_t size, ftotp_algorithm algorithm, ftotp_key **key)
+{
+	TOTPGenerator	TOTPGenerator(false);
+	uint8_t			keyFormat = TOTPGenerator.isValidHexOrBase32(encoded, size);
+
+	if (!keyFormat)
+		return FTOTP_ERR_INVALID_KEY;
+	// The decoded secret only lives in the SecureArena until it's keyed
+	ArenaScope	scope;
+	size_t		capacity = TOTPGenerator::decodedKeyCapacity(size);
+	uint8_t		*secret = scope.allocate(capacity);
+	size_t		secretSize = TOTPGenerator.DecodeKeyInto(encoded, size, secret, capacity, keyFormat);
+	return newKey(secret, secretSize, algorithm, key);
+}
+
+extern "C" {
+
+int ftotp_abi_version(void)
+{
+	return FTOTP_ABI_VERSION;
+}
+
+const char *ftotp_strerror(int status)
+{
+	switch (status)
+	{
+	case FTOTP_OK:						return "Success";
+	case FTOTP_MISMATCH:				return "The code doesn't match";
+	case FTOTP_ERR_INVALID_ARGUMENT:	return "Invalid argument";
+	case FTOTP_ERR_INVALID_KEY:			return "Key must be in Base32 or Hex format";
+	case FTOTP_ERR_INVALID_CODE:		return "Invalid code format";
+	case FTOTP_ERR_BUFFER_TOO_SMALL:	return "Output buffer too small";
+	case FTOTP_ERR_NOT_FOUND:			return "No key is stored under this account label";
+	case FTOTP_ERR_STORE:				return "Failed to read the key store";
+	case FTOTP_ERR_NO_MEMORY:			return "Out of memory";
+	case FTOTP_ERR_INTERNAL:			return "Internal error";
+	default:							return "Unknown status";
+	}
+}
+
+int ftotp_key_new(const char *encoded, size_t size, ftotp_algorithm algorithm, ftotp_key **key)
+{
+	if (!encoded || !key || !isValidAlgorithm(algorithm))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+	*key = nullptr;
+
+	try
+	{
+		return newKeyFromText(encoded, size, algorithm, key);
+	}
+	catch (std::bad_alloc &)
+	{
+		return FTOTP_ERR_NO_MEMORY;
+	}
+	catch (std::invalid_argument &)
+	{
+		return FTOTP_ERR_INVALID_KEY;
+	}
+	catch (...)
+	{
+		return FTOTP_ERR_INTERNAL;
+	}
+}
+
+int ftotp_key_new_raw(const uint8_t *secret, size_t size, ftotp_algorithm algorithm, ftotp_key **key)
+{
+	if (!secret || !key || !isValidAlgorithm(algorithm))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+	*key = nullptr;
+	if (size == 0)
+		return FTOTP_ERR_INVALID_KEY;
+
+	try
+	{
+		return newKey(secret, size, algorithm, key);
+	}
+	catch (std::bad_alloc &)
+	{
+		return FTOTP_ERR_NO_MEMORY;
+	}
+	catch (...)
+	{
+		return FTOTP_ERR_INTERNAL;
+	}
+}
+
+int ftotp_key_from_store(const char *store_path, const char *label, ftotp_algorithm algorithm, ftotp_key **key)
+{
+	if (!store_path || !label || !key || !isValidAlgorithm(algorithm))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+	*key = nullptr;
+
+	try
+	{
+		// The key text is decrypted into the SecureArena, and wiped when the scope ends
+		ArenaScope		scope;
+		size_t			size;
+		const uint8_t	*plain;
+
+		try
+		{
+			KeyStore store(store_path);
+			plain = store.findKey(label, scope, size);
+			if (!plain)
+				return FTOTP_ERR_NOT_FOUND;
+		}
+		catch (std::bad_alloc &)
+		{
+			return FTOTP_ERR_NO_MEMORY;
+		}
+		catch (...)
+		{
+			return FTOTP_ERR_STORE;
+		}
+		return newKeyFromText(reinterpret_cast<const char *>(plain), size, algorithm, key);
+	}
+	catch (std::bad_alloc &)
+	{
+		return FTOTP_ERR_NO_MEMORY;
+	}
+	catch (std::invalid_argument &)
+	{
+		return FTOTP_ERR_INVALID_KEY;
+	}
+	catch (...)
+	{
+		return FTOTP_ERR_INTERNAL;
+	}
+}
+
+void ftotp_key_free(ftotp_key *key)
+{
+	delete key;
+}
+
+int ftotp_generate(
+	const ftotp_key *key, int64_t unix_time, int digits, uint64_t period,
+	char *out, size_t out_size)
+{
+	uint32_t	code;
+
+	if (!key || !out || unix_time < 0 || !isValidConfig(digits, period))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+	if (out_size <= static_cast<size_t>(digits))
+		return FTOTP_ERR_BUFFER_TOO_SMALL;
+	if (!codeAt(key, unix_time, digits, period, code))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+
+	writeTOTPCode(code, digits, out);
+	out[digits] = '\0';
+	return FTOTP_OK;
+}
+
+/*
+ * Same search as TOTPGenerator::verifyTOTP(): the time steps are tested
+ * from the most likely to the least likely one, T, T-1, T+1, ...
+ */
+int ftotp_verify(
+	const ftotp_key *key, const char *code, size_t code_size,
+	int64_t unix_time, int digits, uint64_t period, int window, int *offset)
+{
+	uint32_t	submitted;
+	uint32_t	expected;
+
+	if (!key || !code || unix_time < 0 || !isValidWindow(window) || !isValidConfig(digits, period))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+	if (!parseCode(code, code_size, digits, submitted))
+		return FTOTP_ERR_INVALID_CODE;
+
+	for (int i = 0; i <= 2 * window; ++i)
+	{
+		int		candidate = windowOffset(i);
+		int64_t	time = unix_time + candidate * static_cast<int64_t>(period);
+
+		// Don't wrap around before the Unix epoch
+		if (time < 0)
+			continue;
+		if (codeAt(key, time, digits, period, expected) && expected == submitted)
+		{
+			if (offset)
+				*offset = candidate;
+			return FTOTP_OK;
+		}
+	}
+	return FTOTP_MISMATCH;
+}
+
+/*
+ * The HMAC-SHA1 items of a chunk with a well-formed code go through
+ * verifyTOTPBatch(), once per time step of the window, and only the ones
+ * not matched yet are checked at the next step. Any other item (other
+ * hash function, null key, malformed code) is given to ftotp_verify().
+ */
+int ftotp_verify_batch(
+	const ftotp_key *const *keys, const char *codes, size_t count,
+	int64_t unix_time, int digits, uint64_t period, int window,
+	int8_t *results, size_t *matched)
+{
+	const PreparedKey	*chunkKeys[FTOTP_BATCH_CHUNK];
+	uint64_t			counters[FTOTP_BATCH_CHUNK];
+	char				chunkCodes[FTOTP_BATCH_CHUNK * FTOTP_MAX_DIGITS];
+	size_t				items[FTOTP_BATCH_CHUNK];
+	uint8_t				batchResults[FTOTP_BATCH_CHUNK];
+	size_t				valid = 0;
+
+	if (matched)
+		*matched = 0;
+	if ((count && (!keys || !codes || !results)) || unix_time < 0 || !isValidWindow(window)
+		|| !isValidConfig(digits, period))
+		return FTOTP_ERR_INVALID_ARGUMENT;
+
+	for (size_t base = 0; base < count; base += FTOTP_BATCH_CHUNK)
+	{
+		size_t	end = std::min<size_t>(count, base + FTOTP_BATCH_CHUNK);
+		size_t	pending = 0;
+		uint32_t	submitted;
+
+		for (size_t i = base; i < end; ++i)
+		{
+			const char *code = codes + i * digits;
+
+			if (keys[i] && keys[i]->algorithm == OTP_HASH_SHA1 && parseCode(code, digits, digits, submitted))
+			{
+				chunkKeys[pending] = &keys[i]->sha1;
+				memcpy(chunkCodes + pending * digits, code, digits);
+				items[pending++] = i;
+				continue;
+			}
+			results[i] = static_cast<int8_t>(ftotp_verify(
+				keys[i], code, digits, unix_time, digits, period, window, nullptr));
+			valid += (results[i] == FTOTP_OK);
+		}
+
+		for (int i = 0; i <= 2 * window && pending > 0; ++i)
+		{
+			int64_t	time = unix_time + windowOffset(i) * static_cast<int64_t>(period);
+
+			// Don't wrap around before the Unix epoch
+			if (time < 0)
+				continue;
+			std::fill(counters, counters + pending, static_cast<uint64_t>(time) / period);
+			if (verifyTOTPBatch(chunkKeys, counters, chunkCodes, pending, batchResults, digits) == 0)
+				continue;
+
+			// Keep the items not matched yet at the front
+			size_t left = 0;
+			for (size_t j = 0; j < pending; ++j)
+			{
+				if (batchResults[j] == OTP_BATCH_MATCH)
+				{
+					results[items[j]] = FTOTP_OK;
+					++valid;
+					continue;
+				}
+				chunkKeys[left] = chunkKeys[j];
+				memmove(chunkCodes + left * digits, chunkCodes + j * digits, digits);
+				items[left++] = items[j];
+			}
+			pending = left;
+		}
+		for (size_t j = 0; j < pending; ++j)
+			results[items[j]] = FTOTP_MISMATCH;
+	}
+	if (matched)
+		*matched = valid;
+	return FTOTP_OK;
+}
+
+}
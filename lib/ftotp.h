@@ -0,0 +1,129 @@
+#ifndef FTOTP_H
+# define FTOTP_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+ * libftotp: the ft_otp core behind a stable C ABI
+ *
+ * The library is meant to be linked in-process by authentication
+ * servers, instead of running ./ft_otp once per request:
+ *  - a key is decoded and prepared once (ftotp_key_new), then reused for
+ *    every code, which only costs the two hash compressions of the HMAC;
+ *  - every output goes into a buffer owned by the caller;
+ *  - no C++ exception crosses the ABI, every function returns an
+ *    ftotp_status (FTOTP_OK on success).
+ *
+ * A prepared key is immutable, so it may be shared by several threads.
+ * Only the symbols declared here are exported by libftotp.so.
+ */
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+# if defined(__GNUC__)
+#  define FTOTP_API	__attribute__((visibility("default")))
+# else
+#  define FTOTP_API
+# endif
+
+// Incremented when the ABI changes in an incompatible way (soname)
+# define FTOTP_ABI_VERSION	1
+
+typedef enum ftotp_status
+{
+	FTOTP_OK					= 0,
+	FTOTP_MISMATCH				= 1,	// The code is valid but doesn't match
+	FTOTP_ERR_INVALID_ARGUMENT	= -1,	// Null pointer, bad digits, period or algorithm
+	FTOTP_ERR_INVALID_KEY		= -2,	// Not a Hex or Base32 key of 64 characters at least
+	FTOTP_ERR_INVALID_CODE		= -3,	// Not exactly 'digits' decimal digits
+	FTOTP_ERR_BUFFER_TOO_SMALL	= -4,
+	FTOTP_ERR_NOT_FOUND			= -5,	// No such account in the key store
+	FTOTP_ERR_STORE				= -6,	// Key store missing, corrupted or not decryptable
+	FTOTP_ERR_NO_MEMORY			= -7,
+	FTOTP_ERR_INTERNAL			= -8
+}	ftotp_status;
+
+// Same values as the ft_otp -a option (RFC 6238 hash functions)
+typedef enum ftotp_algorithm
+{
+	FTOTP_SHA1		= 0,
+	FTOTP_SHA256	= 1,
+	FTOTP_SHA512	= 2
+}	ftotp_algorithm;
+
+enum
+{
+	FTOTP_DEFAULT_DIGITS	= 6,
+	FTOTP_DEFAULT_PERIOD	= 30,
+	FTOTP_MAX_DIGITS		= 9,
+	FTOTP_MAX_WINDOW		= 10,	// Time steps accepted on each side of T, at most
+	FTOTP_CODE_BUFFER		= 10	// Longest code and its terminating '\0'
+};
+
+// A decoded secret with its precomputed HMAC state, opaque to the caller
+typedef struct ftotp_key	ftotp_key;
+
+// FTOTP_ABI_VERSION of the loaded library
+FTOTP_API int			ftotp_abi_version(void);
+// Static description of a status, never null
+FTOTP_API const char	*ftotp_strerror(int status);
+
+/*
+ * Prepared keys
+ *
+ * ftotp_key_new() takes the secret as text, Hex or Base32 (RFC 4648),
+ * like the key files of ft_otp -g. ftotp_key_new_raw() takes the already
+ * decoded secret bytes. The key must be released with ftotp_key_free().
+ */
+FTOTP_API int	ftotp_key_new(
+	const char *encoded, size_t size, ftotp_algorithm algorithm, ftotp_key **key);
+FTOTP_API int	ftotp_key_new_raw(
+	const uint8_t *secret, size_t size, ftotp_algorithm algorithm, ftotp_key **key);
+// Load and prepare the key of an account from an ft_otp key store (ft_otp -g -l)
+FTOTP_API int	ftotp_key_from_store(
+	const char *store_path, const char *label, ftotp_algorithm algorithm, ftotp_key **key);
+FTOTP_API void	ftotp_key_free(ftotp_key *key);
+
+/*
+ * Code generation and verification
+ *
+ * 'unix_time' is given by the caller (usually time(NULL)), so a whole
+ * batch is checked against the same instant. 'digits' goes from 1 to 9.
+ */
+
+// Write the NUL-terminated code of 'key' into 'out' (FTOTP_CODE_BUFFER bytes are always enough)
+FTOTP_API int	ftotp_generate(
+	const ftotp_key *key, int64_t unix_time, int digits, uint64_t period,
+	char *out, size_t out_size);
+
+/*
+ * Check 'code' against the time steps T, T-1, T+1, ... T-window, T+window.
+ * Returns FTOTP_OK and sets '*offset' (may be null) to the matched time
+ * step offset, or FTOTP_MISMATCH. A 'window' above FTOTP_MAX_WINDOW is
+ * an FTOTP_ERR_INVALID_ARGUMENT.
+ */
+FTOTP_API int	ftotp_verify(
+	const ftotp_key *key, const char *code, size_t code_size,
+	int64_t unix_time, int digits, uint64_t period, int window, int *offset);
+
+/*
+ * Verify 'count' codes in one call. Code 'i' is the fixed-width slot
+ * codes[i * digits .. i * digits + digits - 1] (not NUL-terminated) and
+ * is checked against keys[i]. results[i] is set to the status of ftotp_verify
+ * for that item, so a bad item doesn't stop the batch. The HMAC-SHA1 keys
+ * are verified together by the multi-buffer engine, a time step at a time.
+ * Returns FTOTP_OK and sets '*matched' (may be null) to the number of valid codes.
+ */
+FTOTP_API int	ftotp_verify_batch(
+	const ftotp_key *const *keys, const char *codes, size_t count,
+	int64_t unix_time, int digits, uint64_t period, int window,
+	int8_t *results, size_t *matched);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
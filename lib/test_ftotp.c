@@ -0,0 +1,254 @@
+/*
+ * Tests of the libftotp C ABI, linked against libftotp.a
+ *
+ * Usage: ./test_ftotp <key store> <key file>
+ * The key store has an account 'alice' saved from the key file (see the
+ * 'test' rule of the Makefile), so both must give the same codes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ftotp.h"
+#include "../core/ascii_format.hpp"
+
+#define TEST_DIGITS	8
+#define TEST_PERIOD	30
+
+static int	failures = 0;
+
+static void check(int passed, const char *name)
+{
+	if (passed)
+		printf(FMT_DONE " %s\n", name);
+	else
+	{
+		printf(FMT_ERROR " %s\n", name);
+		++failures;
+	}
+}
+
+static void checkStatus(int status, int expected, const char *name)
+{
+	if (status == expected)
+		printf(FMT_DONE " %s\n", name);
+	else
+	{
+		printf(FMT_ERROR " %s: %s (%d), expected %s (%d)\n", name,
+			ftotp_strerror(status), status, ftotp_strerror(expected), expected);
+		++failures;
+	}
+}
+
+/*
+ * RFC 6238 Appendix B: the seed is "1234567890" repeated to the size of
+ * the hash output (20, 32 and 64 bytes), the codes have 8 digits.
+ */
+static const struct
+{
+	int64_t		time;
+	const char	*codes[3];	// SHA1, SHA256, SHA512
+}	rfc6238[] = {
+	{59,			{"94287082", "46119246", "90693936"}},
+	{1111111109,	{"07081804", "68084774", "25091201"}},
+	{1111111111,	{"14050471", "67062674", "99943326"}},
+	{1234567890,	{"89005924", "91819424", "93441116"}},
+	{2000000000,	{"69279037", "90698825", "38618901"}},
+	{20000000000,	{"65353130", "77737706", "47863826"}}
+};
+
+static void testVectors(ftotp_key *keys[3])
+{
+	static const char	*names[3] = {"SHA1", "SHA256", "SHA512"};
+	char				code[FTOTP_CODE_BUFFER];
+	char				name[64];
+
+	for (size_t i = 0; i < sizeof(rfc6238) / sizeof(*rfc6238); ++i)
+		for (int algorithm = 0; algorithm < 3; ++algorithm)
+		{
+			int status = ftotp_generate(keys[algorithm], rfc6238[i].time, TEST_DIGITS, TEST_PERIOD,
+				code, sizeof(code));
+
+			snprintf(name, sizeof(name), "RFC 6238 %s at %lld", names[algorithm],
+				(long long)rfc6238[i].time);
+			check(status == FTOTP_OK && strcmp(code, rfc6238[i].codes[algorithm]) == 0, name);
+		}
+}
+
+static void testKeys(void)
+{
+	ftotp_key	*key = NULL;
+
+	checkStatus(ftotp_key_new("ABCDEF", 6, FTOTP_SHA1, &key), FTOTP_ERR_INVALID_KEY,
+		"ftotp_key_new rejects a short key");
+	check(key == NULL, "ftotp_key_new leaves no key on error");
+	checkStatus(ftotp_key_new(NULL, 0, FTOTP_SHA1, &key), FTOTP_ERR_INVALID_ARGUMENT,
+		"ftotp_key_new rejects a null key");
+	checkStatus(ftotp_key_new_raw((const uint8_t *)"1", 1, (ftotp_algorithm)3, &key),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_key_new_raw rejects an unknown algorithm");
+	checkStatus(ftotp_key_new_raw((const uint8_t *)"1", 0, FTOTP_SHA1, &key), FTOTP_ERR_INVALID_KEY,
+		"ftotp_key_new_raw rejects an empty secret");
+}
+
+static void testGenerate(const ftotp_key *key)
+{
+	char	code[FTOTP_CODE_BUFFER];
+
+	checkStatus(ftotp_generate(NULL, 59, TEST_DIGITS, TEST_PERIOD, code, sizeof(code)),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_generate rejects a null key");
+	checkStatus(ftotp_generate(key, -1, TEST_DIGITS, TEST_PERIOD, code, sizeof(code)),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_generate rejects a time before the epoch");
+	checkStatus(ftotp_generate(key, 59, 0, TEST_PERIOD, code, sizeof(code)),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_generate rejects 0 digits");
+	checkStatus(ftotp_generate(key, 59, FTOTP_MAX_DIGITS + 1, TEST_PERIOD, code, sizeof(code)),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_generate rejects 10 digits");
+	checkStatus(ftotp_generate(key, 59, TEST_DIGITS, 0, code, sizeof(code)),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_generate rejects a period of 0");
+	checkStatus(ftotp_generate(key, 59, TEST_DIGITS, TEST_PERIOD, code, TEST_DIGITS),
+		FTOTP_ERR_BUFFER_TOO_SMALL, "ftotp_generate needs room for the '\\0'");
+}
+
+static void testVerify(const ftotp_key *key)
+{
+	int	offset = 42;
+
+	checkStatus(ftotp_verify(key, "14050471", 8, 1111111111, TEST_DIGITS, TEST_PERIOD, 1, &offset),
+		FTOTP_OK, "ftotp_verify accepts the current code");
+	check(offset == 0, "ftotp_verify gives the offset 0 for the current code");
+	checkStatus(ftotp_verify(key, "07081804", 8, 1111111111, TEST_DIGITS, TEST_PERIOD, 1, &offset),
+		FTOTP_OK, "ftotp_verify accepts the previous code in the window");
+	check(offset == -1, "ftotp_verify gives the offset -1 for the previous code");
+	checkStatus(ftotp_verify(key, "07081804", 8, 1111111111, TEST_DIGITS, TEST_PERIOD, 0, NULL),
+		FTOTP_MISMATCH, "ftotp_verify rejects the previous code without a window");
+	checkStatus(ftotp_verify(key, "1405047a", 8, 1111111111, TEST_DIGITS, TEST_PERIOD, 1, NULL),
+		FTOTP_ERR_INVALID_CODE, "ftotp_verify rejects a code with a letter");
+	checkStatus(ftotp_verify(key, "1405047", 7, 1111111111, TEST_DIGITS, TEST_PERIOD, 1, NULL),
+		FTOTP_ERR_INVALID_CODE, "ftotp_verify rejects a code of the wrong size");
+	checkStatus(ftotp_verify(key, "14050471", 8, 1111111111, TEST_DIGITS, TEST_PERIOD,
+		FTOTP_MAX_WINDOW + 1, NULL), FTOTP_ERR_INVALID_ARGUMENT, "ftotp_verify rejects a window of 11");
+	checkStatus(ftotp_verify(NULL, "14050471", 8, 1111111111, TEST_DIGITS, TEST_PERIOD, 1, NULL),
+		FTOTP_ERR_INVALID_ARGUMENT, "ftotp_verify rejects a null key");
+}
+
+/*
+ * The SHA1 items with a well-formed code take the multi-buffer path of
+ * ftotp_verify_batch(), every other item is given to ftotp_verify(): both
+ * must give the same status as ftotp_verify() alone.
+ */
+static void testBatch(ftotp_key *keys[3])
+{
+	const ftotp_key	*items[6] = {keys[0], keys[0], keys[1], NULL, keys[0], keys[0]};
+	const char		*codes = "14050471" "00000000" "67062674" "14050471" "1405047a" "07081804";
+	const int8_t	expected[6] = {FTOTP_OK, FTOTP_MISMATCH, FTOTP_OK, FTOTP_ERR_INVALID_ARGUMENT,
+		FTOTP_ERR_INVALID_CODE, FTOTP_OK};
+	int8_t			results[70];
+	size_t			matched = 42;
+	int				same = 1;
+
+	checkStatus(ftotp_verify_batch(items, codes, 6, 1111111111, TEST_DIGITS, TEST_PERIOD, 1,
+		results, &matched), FTOTP_OK, "ftotp_verify_batch checks a mixed batch");
+	check(memcmp(results, expected, sizeof(expected)) == 0,
+		"ftotp_verify_batch gives the status of each item, from both paths");
+	check(matched == 3, "ftotp_verify_batch counts the valid codes");
+
+	// More items than a chunk of the fast path, every other one is a mismatch
+	const ftotp_key	*many[70];
+	char			manyCodes[70 * TEST_DIGITS];
+
+	for (size_t i = 0; i < 70; ++i)
+	{
+		many[i] = keys[0];
+		memcpy(manyCodes + i * TEST_DIGITS, (i % 2) ? "00000000" : "07081804", TEST_DIGITS);
+	}
+	checkStatus(ftotp_verify_batch(many, manyCodes, 70, 1111111111, TEST_DIGITS,
+		TEST_PERIOD, 1, results, &matched), FTOTP_OK, "ftotp_verify_batch checks 70 SHA1 items");
+	for (size_t i = 0; i < 70; ++i)
+		same = same && results[i] == ftotp_verify(many[i], manyCodes + i * TEST_DIGITS, TEST_DIGITS,
+			1111111111, TEST_DIGITS, TEST_PERIOD, 1, NULL);
+	check(same && matched == 35, "ftotp_verify_batch agrees with ftotp_verify across chunks");
+
+	checkStatus(ftotp_verify_batch(NULL, codes, 1, 1111111111, TEST_DIGITS, TEST_PERIOD, 1,
+		results, &matched), FTOTP_ERR_INVALID_ARGUMENT, "ftotp_verify_batch rejects null keys");
+	check(matched == 0, "ftotp_verify_batch counts no code on error");
+	checkStatus(ftotp_verify_batch(items, codes, 1, 1111111111, TEST_DIGITS, TEST_PERIOD,
+		FTOTP_MAX_WINDOW + 1, results, NULL), FTOTP_ERR_INVALID_ARGUMENT,
+		"ftotp_verify_batch rejects a window of 11");
+	checkStatus(ftotp_verify_batch(NULL, NULL, 0, 1111111111, TEST_DIGITS, TEST_PERIOD, 1, NULL, NULL),
+		FTOTP_OK, "ftotp_verify_batch accepts an empty batch");
+}
+
+static void testStore(const char *storePath, const char *keyPath)
+{
+	ftotp_key	*stored = NULL;
+	ftotp_key	*fromFile = NULL;
+	char		text[1024];
+	char		storedCode[FTOTP_CODE_BUFFER];
+	char		fileCode[FTOTP_CODE_BUFFER];
+	size_t		size = 0;
+	FILE		*file = fopen(keyPath, "r");
+
+	if (file)
+	{
+		size = fread(text, 1, sizeof(text), file);
+		fclose(file);
+	}
+	checkStatus(ftotp_key_new(text, size, FTOTP_SHA1, &fromFile), FTOTP_OK, "ftotp_key_new reads the key file");
+
+	checkStatus(ftotp_key_from_store(storePath, "alice", FTOTP_SHA1, &stored), FTOTP_OK,
+		"ftotp_key_from_store loads a stored account");
+	check(stored && fromFile
+		&& ftotp_generate(stored, 1111111111, TEST_DIGITS, TEST_PERIOD, storedCode, sizeof(storedCode)) == FTOTP_OK
+		&& ftotp_generate(fromFile, 1111111111, TEST_DIGITS, TEST_PERIOD, fileCode, sizeof(fileCode)) == FTOTP_OK
+		&& strcmp(storedCode, fileCode) == 0, "The stored key gives the codes of the key file");
+	ftotp_key_free(stored);
+	ftotp_key_free(fromFile);
+
+	stored = NULL;
+	checkStatus(ftotp_key_from_store(storePath, "carol", FTOTP_SHA1, &stored), FTOTP_ERR_NOT_FOUND,
+		"ftotp_key_from_store reports a missing account");
+	checkStatus(ftotp_key_from_store(storePath, "", FTOTP_SHA1, &stored), FTOTP_ERR_STORE,
+		"ftotp_key_from_store rejects an invalid label");
+	checkStatus(ftotp_key_from_store("missing.store", "alice", FTOTP_SHA1, &stored), FTOTP_ERR_STORE,
+		"ftotp_key_from_store reports a missing key store");
+	checkStatus(ftotp_key_from_store(keyPath, "alice", FTOTP_SHA1, &stored), FTOTP_ERR_STORE,
+		"ftotp_key_from_store rejects a file which isn't a key store");
+	checkStatus(ftotp_key_from_store(NULL, "alice", FTOTP_SHA1, &stored), FTOTP_ERR_INVALID_ARGUMENT,
+		"ftotp_key_from_store rejects a null path");
+	check(stored == NULL, "ftotp_key_from_store leaves no key on error");
+}
+
+int main(int argc, char **argv)
+{
+	ftotp_key	*keys[3] = {NULL, NULL, NULL};
+
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <key store> <key file>\n", argv[0]);
+		return 2;
+	}
+	check(ftotp_abi_version() == FTOTP_ABI_VERSION, "ftotp_abi_version matches ftotp.h");
+
+	checkStatus(ftotp_key_new_raw((const uint8_t *)"12345678901234567890", 20, FTOTP_SHA1, &keys[0]),
+		FTOTP_OK, "ftotp_key_new_raw prepares the SHA1 seed");
+	// The SHA256 seed as Hex text, to go through the decoder too
+	checkStatus(ftotp_key_new("3132333435363738393031323334353637383930313233343536373839303132", 64,
+		FTOTP_SHA256, &keys[1]), FTOTP_OK, "ftotp_key_new prepares the SHA256 seed");
+	checkStatus(ftotp_key_new_raw((const uint8_t *)"1234567890123456789012345678901234567890"
+		"123456789012345678901234", 64, FTOTP_SHA512, &keys[2]), FTOTP_OK,
+		"ftotp_key_new_raw prepares the SHA512 seed");
+	if (keys[0] && keys[1] && keys[2])
+	{
+		testVectors(keys);
+		testGenerate(keys[0]);
+		testVerify(keys[0]);
+		testBatch(keys);
+	}
+	testKeys();
+	testStore(argv[1], argv[2]);
+
+	for (int i = 0; i < 3; ++i)
+		ftotp_key_free(keys[i]);
+	if (failures)
+		printf(FMT_ERROR " %d test(s) failed.\n", failures);
+	return failures != 0;
+}